@@ -449,10 +449,10 @@ void AlarmCalendar::updateKAEvents(AlarmResource* resource, KCal::CalendarLocal*
 	{
 		KAEvent* event = events[i];
 		mEventMap.remove(event->id());
+		mTriggers.remove(event);
 		delete event;
 	}
 	events.clear();
-	mEarliestAlarm[resource] = 0;
 	if (!cal)
 		return;
 
@@ -474,6 +474,7 @@ void AlarmCalendar::updateKAEvents(AlarmResource* resource, KCal::CalendarLocal*
 		event->setResource(resource);
 		events += event;
 		mEventMap[kcalevent->uid()] = event;
+		updateTrigger(event, resource);
 
 		// Set any command execution error flags for the alarm.
 		// These are stored in the KAlarm config file, not the alarm
@@ -483,8 +484,7 @@ void AlarmCalendar::updateKAEvents(AlarmResource* resource, KCal::CalendarLocal*
 			event->setCommandError(cmdErr);
 	}
 
-	// Now scan the list of alarms to find the earliest one to trigger
-	findEarliestAlarm(resource);
+	emit earliestAlarmChanged();
 	checkForDisabledAlarms();
 }
 
@@ -502,11 +502,11 @@ void AlarmCalendar::removeKAEvents(AlarmResource* resource, bool closing)
 		{
 			KAEvent* event = events[i];
 			mEventMap.remove(event->id());
+			mTriggers.remove(event);
 			delete event;
 		}
 		mResourceMap.erase(rit);
 	}
-	mEarliestAlarm.remove(resource);
 	// Emit signal only if we're not in the process of closing the calendar
 	if (!closing  &&  mOpen)
 	{
@@ -929,10 +929,12 @@ bool AlarmCalendar::addEvent(KAEvent* event, QWidget* promptParent, bool useEven
 		if (remove)
 		{
 			// Adding to mCalendar failed, so undo AlarmCalendar::addEvent()
+			bool wasEarliest = (earliestAlarm() == event);
 			mEventMap.remove(event->id());
 			mResourceMap[resource].removeAll(event);
-			if (mEarliestAlarm[resource] == event)
-				findEarliestAlarm(resource);
+			mTriggers.remove(event);
+			if (wasEarliest)
+				emit earliestAlarmChanged();
 		}
 		*event = oldEvent;
 		delete kcalEvent;
@@ -978,23 +980,9 @@ void AlarmCalendar::addNewEvent(AlarmResource* resource, KAEvent* event)
 {
 	mResourceMap[resource] += event;
 	mEventMap[event->id()] = event;
-	if (resource  &&  resource->alarmType() == AlarmResource::ACTIVE
-	&&  event->category() == KCalEvent::ACTIVE)
-	{
-		// Update the earliest alarm to trigger
-		KDateTime dt = event->nextTrigger(KAEvent::ALL_TRIGGER).effectiveKDateTime();
-		if (dt.isValid())
-		{
-			EarliestMap::ConstIterator eit = mEarliestAlarm.constFind(resource);
-			KAEvent* earliest = (eit != mEarliestAlarm.constEnd()) ? eit.value() : 0;
-			if (!earliest
-			||  dt < earliest->nextTrigger(KAEvent::ALL_TRIGGER))
-			{
-				mEarliestAlarm[resource] = event;
-				emit earliestAlarmChanged();
-			}
-		}
-	}
+	updateTrigger(event, resource);
+	if (earliestAlarm() == event)
+		emit earliestAlarmChanged();
 }
 
 /******************************************************************************
@@ -1065,7 +1053,8 @@ KAEvent* AlarmCalendar::updateEvent(const KAEvent* evnt)
 			bool oldEnabled = kaevnt->enabled();
 			if (kaevnt != evnt)
 				*kaevnt = *evnt;   // update the event instance in our lists, keeping the same pointer
-			findEarliestAlarm(AlarmResources::instance()->resource(kcalEvent));
+			updateTrigger(kaevnt, AlarmResources::instance()->resource(kcalEvent));
+			emit earliestAlarmChanged();
 			if (mCalType == RESOURCES  &&  evnt->category() == KCalEvent::ACTIVE)
 				checkForDisabledAlarms(oldEnabled, evnt->enabled());
 			return kaevnt;
@@ -1113,24 +1102,14 @@ KCalEvent::Status AlarmCalendar::deleteEventInternal(const QString& eventID)
 	if (it != mEventMap.end())
 	{
 		KAEvent* ev = it.value();
+		bool wasEarliest = (earliestAlarm() == ev);
 		mEventMap.erase(it);
 		resource = AlarmResources::instance()->resource(kcalEvent);
 		mResourceMap[resource].removeAll(ev);
+		mTriggers.remove(ev);
 		delete ev;
-		if (mEarliestAlarm[resource] == ev)
-			findEarliestAlarm(resource);
-	}
-	else
-	{
-		for (EarliestMap::Iterator eit = mEarliestAlarm.begin();  eit != mEarliestAlarm.end();  ++eit)
-		{
-			KAEvent* event = eit.value();
-			if (event  &&  event->id() == eventID)
-			{
-				findEarliestAlarm(eit.key());
-				break;
-			}
-		}
+		if (wasEarliest)
+			emit earliestAlarmChanged();
 	}
 	KCalEvent::Status status = KCalEvent::EMPTY;
 	if (kcalEvent)
@@ -1276,6 +1255,7 @@ Event::List AlarmCalendar::kcalEvents(AlarmResource* resource, KCalEvent::Status
 /******************************************************************************
 * Return all events which have alarms falling within the specified time range.
 * 'type' is the OR'ed desired event types.
+* Active alarms are looked up by their next trigger time in the trigger queue.
 */
 KAEvent::List AlarmCalendar::events(const KDateTime& from, const KDateTime& to, KCalEvent::Status type)
 {
@@ -1283,6 +1263,8 @@ KAEvent::List AlarmCalendar::events(const KDateTime& from, const KDateTime& to,
 	KAEvent::List evnts;
 	if (!mCalendar)
 		return evnts;
+	if (type == KCalEvent::ACTIVE  &&  mCalType == RESOURCES)
+		return mTriggers.events(from, to);
 	KDateTime dt;
 	AlarmResources* resources = AlarmResources::instance();
 	KAEvent::List allEvents = events(type);
@@ -1448,60 +1430,27 @@ KAEvent::List AlarmCalendar::atLoginAlarms() const
 }
 
 /******************************************************************************
-* Find and note the active alarm with the earliest trigger time for a resource.
+* Update the next trigger time of an event in the trigger queue. Only active
+* alarms in active alarm resources are queued.
 */
-void AlarmCalendar::findEarliestAlarm(AlarmResource* resource)
+void AlarmCalendar::updateTrigger(KAEvent* event, AlarmResource* resource)
 {
-	EarliestMap::Iterator eit = mEarliestAlarm.find(resource);
-	if (eit != mEarliestAlarm.end())
-		eit.value() = 0;
-	if (!mCalendar  ||  mCalType != RESOURCES
-	||  !resource  ||  resource->alarmType() != AlarmResource::ACTIVE)
-		return;
-	ResourceMap::ConstIterator rit = mResourceMap.constFind(resource);
-	if (rit == mResourceMap.constEnd())
-		return;
-	const KAEvent::List& events = rit.value();
-	KAEvent* earliest = 0;
-	KDateTime earliestTime;
-	for (int i = 0, end = events.count();  i < end;  ++i)
-	{
-		KAEvent* event = events[i];
-		if (event->category() != KCalEvent::ACTIVE
-		||  mPendingAlarms.contains(event->id()))
-			continue;
-		KDateTime dt = event->nextTrigger(KAEvent::ALL_TRIGGER).effectiveKDateTime();
-		if (dt.isValid()  &&  (!earliest || dt < earliestTime))
-		{
-			earliestTime = dt;
-			earliest = event;
-		}
-	}
-	mEarliestAlarm[resource] = earliest;
-	emit earliestAlarmChanged();
+	KDateTime dt;
+	if (mCalType == RESOURCES
+	&&  resource  &&  resource->alarmType() == AlarmResource::ACTIVE
+	&&  event->category() == KCalEvent::ACTIVE)
+		dt = event->nextTrigger(KAEvent::ALL_TRIGGER).effectiveKDateTime();
+	mTriggers.set(event, dt);    // an invalid time removes it from the queue
 }
 
 /******************************************************************************
-* Return the active alarm with the earliest trigger time.
+* Return the active alarm with the earliest trigger time, disregarding alarms
+* which are pending.
 * Reply = 0 if none.
 */
 KAEvent* AlarmCalendar::earliestAlarm() const
 {
-	KAEvent* earliest = 0;
-	KDateTime earliestTime;
-	for (EarliestMap::ConstIterator eit = mEarliestAlarm.constBegin();  eit != mEarliestAlarm.constEnd();  ++eit)
-	{
-		KAEvent* event = eit.value();
-		if (!event)
-			continue;
-		KDateTime dt = event->nextTrigger(KAEvent::ALL_TRIGGER).effectiveKDateTime();
-		if (dt.isValid()  &&  (!earliest || dt < earliestTime))
-		{
-			earliestTime = dt;
-			earliest = event;
-		}
-	}
-	return earliest;
+	return mTriggers.earliest(mPendingAlarms);
 }
 
 /******************************************************************************
@@ -1525,25 +1474,34 @@ void AlarmCalendar::setAlarmPending(KAEvent* event, bool pending)
 			return;
 		mPendingAlarms.removeAll(id);
 	}
-	// Now update the earliest alarm to trigger for its resource
-	findEarliestAlarm(AlarmResources::instance()->resourceForIncidence(id));
+	// Pending alarms are ignored by earliestAlarm()
+	emit earliestAlarmChanged();
 }
 
 /******************************************************************************
 * Called when the user changes the start-of-day time.
-* Adjust the start times of all date-only alarms' recurrences.
+* Adjust the start times of all date-only alarms' recurrences, and their
+* trigger times.
 */
 void AlarmCalendar::adjustStartOfDay()
 {
 	if (!mCalendar)
 		return;
+	bool adjusted = false;
 	for (ResourceMap::ConstIterator rit = mResourceMap.constBegin();  rit != mResourceMap.constEnd();  ++rit)
 	{
 		const KAEvent::List events = rit.value();
 		for (int i = 0, end = events.count();  i < end;  ++i)
 		{
-			if (events[i]->startDateTime().isDateOnly()  &&  events[i]->recurs())
-				events[i]->adjustRecurrenceStartOfDay();
+			if (events[i]->startDateTime().isDateOnly())
+			{
+				if (events[i]->recurs())
+					events[i]->adjustRecurrenceStartOfDay();
+				updateTrigger(events[i], rit.key());
+				adjusted = true;
+			}
 		}
 	}
+	if (adjusted)
+		emit earliestAlarmChanged();
 }
@@ -25,6 +25,7 @@
 #include <kurl.h>
 #include "alarmresources.h"
 #include "kaevent.h"
+#include "triggerqueue.h"
 
 namespace KCal {
   class Calendar;
@@ -108,7 +109,6 @@ class AlarmCalendar : public QObject
 		enum CalType { RESOURCES, LOCAL_ICAL, LOCAL_VCAL };
 		typedef QMap<AlarmResource*, KAEvent::List> ResourceMap;  // resource = null for display calendar
 		typedef QMap<QString, KAEvent*> KAEventMap;  // indexed by event UID
-		typedef QMap<AlarmResource*, KAEvent*> EarliestMap;
 
 		AlarmCalendar();
 		AlarmCalendar(const QString& file, KCalEvent::Status);
@@ -120,7 +120,7 @@ class AlarmCalendar : public QObject
 		void                  updateKAEvents(AlarmResource*, KCal::CalendarLocal*);
 		static void           updateResourceKAEvents(AlarmResource*, KCal::CalendarLocal*);
 		void                  removeKAEvents(AlarmResource*, bool closing = false);
-		void                  findEarliestAlarm(AlarmResource*);
+		void                  updateTrigger(KAEvent*, AlarmResource*);
 		void                  checkForDisabledAlarms();
 		void                  checkForDisabledAlarms(bool oldEnabled, bool newEnabled);
 
@@ -130,7 +130,7 @@ class AlarmCalendar : public QObject
 		KCal::Calendar*       mCalendar;           // AlarmResources or CalendarLocal
 		ResourceMap           mResourceMap;
 		KAEventMap            mEventMap;           // lookup of all events by UID
-		EarliestMap           mEarliestAlarm;      // alarm with earliest trigger time, by resource
+		TriggerQueue          mTriggers;           // next trigger times of the active alarms
 		QList<QString>        mPendingAlarms;      // IDs of alarms which are currently being processed after triggering
 		KUrl                  mUrl;                // URL of current calendar file
 		KUrl                  mICalUrl;            // URL of iCalendar file
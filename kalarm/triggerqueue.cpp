@@ -0,0 +1,184 @@
+/*
+ *  triggerqueue.cpp  -  priority queue of alarm trigger times
+ *  Program:  kalarm
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "kalarm.h"
+#include "triggerqueue.h"
+
+
+/******************************************************************************
+* Set the trigger time of an event, adding it to the queue if necessary.
+* If the trigger time is invalid, the event is removed from the queue.
+*/
+void TriggerQueue::set(KAEvent* event, const KDateTime& trigger)
+{
+	if (!trigger.isValid())
+	{
+		remove(event);
+		return;
+	}
+	QHash<KAEvent*, int>::ConstIterator it = mIndex.constFind(event);
+	if (it == mIndex.constEnd())
+	{
+		Entry entry;
+		entry.trigger = trigger;
+		entry.event   = event;
+		mHeap.append(entry);
+		mIndex[event] = mHeap.count() - 1;
+		moveUp(mHeap.count() - 1);
+		return;
+	}
+	int index = it.value();
+	bool earlier = trigger < mHeap[index].trigger;
+	mHeap[index].trigger = trigger;
+	if (earlier)
+		moveUp(index);
+	else
+		moveDown(index);
+}
+
+/******************************************************************************
+* Remove an event from the queue, if it is in it.
+*/
+void TriggerQueue::remove(KAEvent* event)
+{
+	QHash<KAEvent*, int>::Iterator it = mIndex.find(event);
+	if (it == mIndex.end())
+		return;
+	int index = it.value();
+	mIndex.erase(it);
+	Entry last = mHeap.last();
+	mHeap.pop_back();
+	if (index == mHeap.count())
+		return;    // it was the last entry
+	// Put the last entry into the vacated position, and restore the heap order
+	bool earlier = last.trigger < mHeap[index].trigger;
+	place(index, last);
+	if (earlier)
+		moveUp(index);
+	else
+		moveDown(index);
+}
+
+void TriggerQueue::clear()
+{
+	mHeap.clear();
+	mIndex.clear();
+}
+
+/******************************************************************************
+* Return the event with the earliest trigger time, disregarding events whose
+* IDs are in 'ignoreIds'.
+* Reply = 0 if none.
+*/
+KAEvent* TriggerQueue::earliest(const QList<QString>& ignoreIds) const
+{
+	if (mHeap.isEmpty())
+		return 0;
+	if (ignoreIds.isEmpty())
+		return mHeap[0].event;
+	int earliest = -1;
+	findEarliest(0, ignoreIds, earliest);
+	return (earliest >= 0) ? mHeap[earliest].event : 0;
+}
+
+/******************************************************************************
+* Return all events whose trigger time is within the specified time range.
+*/
+KAEvent::List TriggerQueue::events(const KDateTime& from, const KDateTime& to) const
+{
+	KAEvent::List list;
+	findEvents(0, from, to, list);
+	return list;
+}
+
+/******************************************************************************
+* Search the subtree at 'index' for an event earlier than 'earliest' which is
+* not ignored. A subtree whose root is later than the best found is skipped.
+*/
+void TriggerQueue::findEarliest(int index, const QList<QString>& ignoreIds, int& earliest) const
+{
+	if (index >= mHeap.count())
+		return;
+	const Entry& entry = mHeap[index];
+	if (earliest >= 0  &&  !(entry.trigger < mHeap[earliest].trigger))
+		return;
+	if (!ignoreIds.contains(entry.event->id()))
+	{
+		earliest = index;
+		return;    // nothing below is earlier
+	}
+	findEarliest(2 * index + 1, ignoreIds, earliest);
+	findEarliest(2 * index + 2, ignoreIds, earliest);
+}
+
+/******************************************************************************
+* Collect the events in the subtree at 'index' which trigger within the time
+* range. A subtree whose root is later than the range is skipped.
+*/
+void TriggerQueue::findEvents(int index, const KDateTime& from, const KDateTime& to, KAEvent::List& list) const
+{
+	if (index >= mHeap.count())
+		return;
+	const Entry& entry = mHeap[index];
+	if (to < entry.trigger)
+		return;
+	if (!(entry.trigger < from))
+		list += entry.event;
+	findEvents(2 * index + 1, from, to, list);
+	findEvents(2 * index + 2, from, to, list);
+}
+
+void TriggerQueue::moveUp(int index)
+{
+	Entry entry = mHeap[index];
+	while (index > 0)
+	{
+		int parent = (index - 1) / 2;
+		if (!(entry.trigger < mHeap[parent].trigger))
+			break;
+		place(index, mHeap[parent]);
+		index = parent;
+	}
+	place(index, entry);
+}
+
+void TriggerQueue::moveDown(int index)
+{
+	Entry entry = mHeap[index];
+	int count = mHeap.count();
+	for ( ; ; )
+	{
+		int child = 2 * index + 1;
+		if (child >= count)
+			break;
+		if (child + 1 < count  &&  mHeap[child + 1].trigger < mHeap[child].trigger)
+			++child;
+		if (!(mHeap[child].trigger < entry.trigger))
+			break;
+		place(index, mHeap[child]);
+		index = child;
+	}
+	place(index, entry);
+}
+
+void TriggerQueue::place(int index, const Entry& entry)
+{
+	mHeap[index] = entry;
+	mIndex[entry.event] = index;
+}
@@ -0,0 +1,64 @@
+/*
+ *  triggerqueue.h  -  priority queue of alarm trigger times
+ *  Program:  kalarm
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef TRIGGERQUEUE_H
+#define TRIGGERQUEUE_H
+
+#include "kaevent.h"
+
+#include <kdatetime.h>
+#include <QHash>
+#include <QList>
+#include <QVector>
+
+
+/** Holds the next trigger times of a set of alarms in a binary min-heap,
+ *  together with the position of each alarm in the heap, so that the earliest
+ *  alarm is found at once and an alarm whose trigger time changes is moved
+ *  without searching for it.
+ *  The trigger times are those given to set(): the owner must call set() or
+ *  remove() whenever an alarm's trigger time changes.
+ */
+class TriggerQueue
+{
+	public:
+		void          set(KAEvent*, const KDateTime& trigger);
+		void          remove(KAEvent*);
+		void          clear();
+		bool          isEmpty() const              { return mHeap.isEmpty(); }
+		KAEvent*      earliest(const QList<QString>& ignoreIds = QList<QString>()) const;
+		KAEvent::List events(const KDateTime& from, const KDateTime& to) const;
+
+	private:
+		struct Entry
+		{
+			KDateTime trigger;
+			KAEvent*  event;
+		};
+		void          moveUp(int index);
+		void          moveDown(int index);
+		void          place(int index, const Entry&);
+		void          findEarliest(int index, const QList<QString>& ignoreIds, int& earliest) const;
+		void          findEvents(int index, const KDateTime& from, const KDateTime& to, KAEvent::List&) const;
+
+		QVector<Entry>        mHeap;
+		QHash<KAEvent*, int>  mIndex;    // position of each event in mHeap
+};
+
+#endif // TRIGGERQUEUE_H
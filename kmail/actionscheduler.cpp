@@ -49,6 +49,8 @@ using KMail::AccountManager;
 
 #include <QTimer>
 
+#include <mimelib/message.h>
+
 using namespace KMail;
 
 
@@ -78,6 +80,14 @@ ActionScheduler::ActionScheduler(KMFilterMgr::FilterSet set,
   mAccount = false;
   lastCommand = 0;
   lastJob = 0;
+  mBatchCount = 0;
+  mPendingFetches = 0;
+  mFetchedCount = mFilteredCount = mTransferredCount = 0;
+  mFetchMs = mFilterMs = mTransferMs = 0;
+  {
+    KConfigGroup group( KMKernel::config(), "General" );
+    mBatchSize = qMax( 1, group.readEntry( "action-scheduler-batch-size", 1 ) );
+  }
   finishTimer = new QTimer( this );
   finishTimer->setSingleShot( true );
   connect( finishTimer, SIGNAL(timeout()), this, SLOT(finish()));
@@ -158,6 +168,11 @@ void ActionScheduler::setIgnoreFilterSet( bool ignore )
   mIgnoreFilterSet = ignore;
 }
 
+void ActionScheduler::setBatchSize( int size )
+{
+  mBatchSize = qMax( 1, size );
+}
+
 void ActionScheduler::setDefaultDestinationFolder( KMFolder *destFolder )
 {
   mDestFolder = destFolder;
@@ -410,6 +425,11 @@ void ActionScheduler::finish()
 
 void ActionScheduler::fetchMessage()
 {
+  if ( isBatching() ) {
+    fetchBatch();
+    return;
+  }
+
   QList<quint32>::Iterator mFetchMessageIt = mFetchSerNums.begin();
   while (mFetchMessageIt != mFetchSerNums.end()) {
     if (!MessageProperty::transferInProgress(*mFetchMessageIt))
@@ -473,7 +493,15 @@ void ActionScheduler::messageFetched( KMMessage *msg )
       return;
   }
 
+  if ( !copyToSourceFolder( msg, mFetchUnget ) )
+    fetchMessageTimer->start( 0 );
+}
+
+bool ActionScheduler::copyToSourceFolder( KMMessage *msg, bool unGet )
+{
+  bool copied = true;
   mFetchSerNums.removeAll( msg->getMsgSerNum() );
+  ++mFetchedCount;
 
   // Note: This may not be necessary. What about when it's time to
   //       delete the original message?
@@ -491,11 +519,95 @@ void ActionScheduler::messageFetched( KMMessage *msg )
   } else {
     // msg was already filtered (by another instance of KMail)
     emit filtered( msg->getMsgSerNum() );
-    fetchMessageTimer->start( 0 );
+    copied = false;
   }
-  if (mFetchUnget && msg->parent())
+  if (unGet && msg->parent())
     msg->parent()->unGetMsg( msg->parent()->find( msg ));
-  return;
+  return copied;
+}
+
+void ActionScheduler::fetchBatch()
+{
+  if ( mPendingFetches > 0 )
+    return; // the current batch is still being fetched
+
+  // Don't fetch too far ahead of the filtering: finish() fetches again
+  // once the filtered messages are gone from the source folder
+  if ( mSerNums.count() >= 2 * mBatchSize && mResult == ResultOk )
+    return;
+
+  QList<quint32> serNums;
+  QList<quint32>::ConstIterator it;
+  for ( it = mFetchSerNums.constBegin();
+        it != mFetchSerNums.constEnd() && serNums.count() < mBatchSize; ++it ) {
+    if ( !MessageProperty::transferInProgress( *it ) )
+      serNums.append( *it );
+  }
+
+  // See fetchMessage()
+  if ( serNums.isEmpty() && !mFetchSerNums.isEmpty() ) {
+    mResult = ResultError;
+  }
+  if ( serNums.isEmpty() || mResult != ResultOk ) {
+    mFetchExecuting = false;
+    if ( !mSrcFolder->count() )
+      mSrcFolder->expunge();
+    finishTimer->start( 0 );
+    return;
+  }
+
+  mFetchTime.start();
+  for ( it = serNums.constBegin(); it != serNums.constEnd(); ++it ) {
+    KMMsgBase *msgBase = messageBase( *it );
+    if ( !msgBase || mResult != ResultOk ) {
+      mFetchExecuting = false;
+      return;
+    }
+    if ( msgBase->isMessage() )
+      mFetchUngetSerNums.insert( *it );
+    KMMessage *msg = message( *it );
+    if ( mResult != ResultOk ) {
+      mFetchExecuting = false;
+      return;
+    }
+
+    if ( msg && msg->isComplete() ) {
+      copyToSourceFolder( msg, mFetchUngetSerNums.remove( *it ) );
+    } else if ( msg ) {
+      // All the messages of the batch are downloaded at the same time
+      FolderJob *job = msg->parent()->createJob( msg );
+      connect( job, SIGNAL(messageRetrieved( KMMessage* )),
+               SLOT(batchMessageFetched( KMMessage* )) );
+      mFetchJobs.append( job );
+      ++mPendingFetches;
+      job->start();
+    } else {
+      mFetchExecuting = false;
+      mResult = ResultError;
+      finishTimer->start( 0 );
+      return;
+    }
+  }
+  if ( mPendingFetches > 0 ) {
+    fetchTimeOutTime = QTime::currentTime();
+    fetchTimeOutTimer->start( 60 * 1000 );
+  } else {
+    mFetchMs += mFetchTime.elapsed();
+    fetchMessageTimer->start( 0 );
+  }
+}
+
+void ActionScheduler::batchMessageFetched( KMMessage *msg )
+{
+  if ( msg )
+    copyToSourceFolder( msg, mFetchUngetSerNums.remove( msg->getMsgSerNum() ) );
+  if ( --mPendingFetches > 0 )
+    return;
+
+  mFetchMs += mFetchTime.elapsed();
+  fetchTimeOutTimer->stop();
+  mFetchJobs.clear();
+  fetchMessageTimer->start( 0 );
 }
 
 void ActionScheduler::msgAdded( KMFolder*, quint32 serNum )
@@ -545,6 +657,13 @@ void ActionScheduler::processMessage()
     ++mMessageIt;
   }
 
+  if ( mBatchCount > 0 && ( mMessageIt == mSerNums.end() || mResult != ResultOk ) ) {
+    // Nothing more to filter for now: carry out the moves and copies
+    // of the messages filtered so far
+    flushBatch();
+    return;
+  }
+
   if (mMessageIt == mSerNums.end() && !mSerNums.isEmpty()) {
     mExecuting = false;
     processMessageTimer->start( 600 );
@@ -565,6 +684,12 @@ void ActionScheduler::processMessage()
     return;
   }
 
+  if ( isBatching() ) {
+    if ( mBatchCount == 0 )
+      mBatchTime.start();
+    mMessageTime.start();
+  }
+
   MessageProperty::setFiltering( *mMessageIt, true );
   MessageProperty::setFilterHandler( *mMessageIt, this );
   MessageProperty::setFilterFolder( *mMessageIt, mDestFolder );
@@ -621,10 +746,26 @@ void ActionScheduler::messageRetrieved(KMMessage* msg)
 
 void ActionScheduler::filterMessage()
 {
-  if (mFilterIt == mFilters.end()) {
-    moveMessage();
-    return;
+  // In batches the filters that don't match are skipped without going
+  // through the event loop
+  while ( mFilterIt != mFilters.end() ) {
+    if ( filterMatches() ) {
+      mFilterActionIt = (*mFilterIt)->actions()->begin();
+      mFilterAction = (*mFilterActionIt);
+      actionMessage();
+      return;
+    }
+    ++mFilterIt;
+    if ( !isBatching() ) {
+      filterMessageTimer->start( 0 );
+      return;
+    }
   }
+  moveMessage();
+}
+
+bool ActionScheduler::filterMatches()
+{
   if ( mIgnoreFilterSet ||
       ((((mSet & KMFilterMgr::Outbound) && (*mFilterIt)->applyOnOutbound()) ||
       ((mSet & KMFilterMgr::Inbound) && (*mFilterIt)->applyOnInbound() &&
@@ -643,14 +784,10 @@ void ActionScheduler::filterMessage()
         FilterLog::instance()->add( i18n( "<b>Filter rules have matched.</b>" ),
                                     FilterLog::patternResult );
       }
-      mFilterActionIt = (*mFilterIt)->actions()->begin();
-      mFilterAction = (*mFilterActionIt);
-      actionMessage();
-      return;
+      return true;
     }
   }
-  ++mFilterIt;
-  filterMessageTimer->start( 0 );
+  return false;
 }
 
 void ActionScheduler::actionMessage(KMFilterAction::ReturnCode res)
@@ -680,7 +817,10 @@ void ActionScheduler::actionMessage(KMFilterAction::ReturnCode res)
       mFilterIt = mFilters.end();
     else
       ++mFilterIt;
-    filterMessageTimer->start( 0 );
+    if ( isBatching() )
+      filterMessage();
+    else
+      filterMessageTimer->start( 0 );
   }
 }
 
@@ -736,6 +876,11 @@ void ActionScheduler::moveMessage()
   if ( msg && folder && folder->storage() && dynamic_cast<KMFolderImap*>( folder->storage() ) )
     MessageProperty::setKeepSerialNumber( msg->getMsgSerNum(), true );
 
+  if ( isBatching() ) {
+    queueMove( folder, msg );
+    return;
+  }
+
   timeOutTime = QTime::currentTime();
   KMCommand *cmd = new KMMoveCommand( folder, msg );
   connect( cmd, SIGNAL( completed( KMCommand * ) ),
@@ -822,8 +967,210 @@ void ActionScheduler::copyMessageFinished( KMCommand *command )
     actionMessage();
 }
 
+bool ActionScheduler::queueCopy( KMFolder *folder, KMMessage *msg )
+{
+  if ( !isBatching() || !folder )
+    return false;
+
+  // copy the message 1:1, like KMFilterActionCopy::process()
+  batchTransfer( folder ).mCopies.append( new KMMessage( new DwMessage( *msg->asDwMessage() ) ) );
+  return true;
+}
+
+ActionScheduler::BatchTransfer &ActionScheduler::batchTransfer( KMFolder *folder )
+{
+  QList<BatchTransfer>::Iterator it;
+  for ( it = mBatchTransfers.begin(); it != mBatchTransfers.end(); ++it ) {
+    if ( (*it).mFolder == folder )
+      return *it;
+  }
+  BatchTransfer transfer;
+  transfer.mFolder = folder;
+  mBatchTransfers.append( transfer );
+  return mBatchTransfers.last();
+}
+
+void ActionScheduler::queueMove( KMFolder *folder, KMMessage *msg )
+{
+  BatchTransfer &transfer = batchTransfer( folder );
+  transfer.mMoves.append( msg->getMsgSerNum() );
+  transfer.mOriginals.append( mOriginalSerNum );
+
+  ++mBatchCount;
+  ++mFilteredCount;
+  mFilterMs += mMessageTime.elapsed();
+
+  if ( mBatchCount >= mBatchSize ) {
+    flushBatch();
+  } else {
+    mExecutingLock = false;
+    processMessageTimer->start( 0 );
+  }
+}
+
+void ActionScheduler::flushBatch()
+{
+  // mExecutingLock stays set until the moves are done, see finishBatch()
+  mExecutingLock = true;
+  mTransferTime.start();
+
+  QList<BatchTransfer>::ConstIterator it;
+  for ( it = mBatchTransfers.constBegin(); it != mBatchTransfers.constEnd(); ++it ) {
+    KMFolder *folder = (*it).mFolder;
+    if ( !(*it).mCopies.isEmpty() ) {
+      QList<KMMessage*> copies = (*it).mCopies;
+      if ( folder && folder->open( "actionsched" ) == 0 ) {
+        QList<int> indexes;
+        folder->addMessages( copies, indexes );
+        foreach ( int index, indexes ) {
+          if ( index != -1 )
+            folder->unGetMsg( index );
+        }
+        folder->close( "actionsched" );
+        mTransferredCount += copies.count();
+      } else {
+        qDeleteAll( copies );
+      }
+    }
+
+    if ( (*it).mMoves.isEmpty() )
+      continue;
+    QList<KMMsgBase*> msgs;
+    foreach ( quint32 serNum, (*it).mMoves ) {
+      KMFolder *srcFolder = 0;
+      int idx = -1;
+      KMMsgDict::instance()->getLocation( serNum, &srcFolder, &idx );
+      if ( srcFolder == mSrcFolder && idx != -1 )
+        msgs.append( mSrcFolder->getMsgBase( idx ) );
+    }
+    if ( !folder ) {
+      // The destination is gone: keep the originals
+      kWarning() << "The target folder of" << msgs.count()
+                 << "filtered messages has been removed.";
+      foreach ( KMMsgBase *msgBase, msgs )
+        mSrcFolder->removeMsg( mSrcFolder->find( msgBase ) );
+      continue;
+    }
+    if ( msgs.isEmpty() )
+      continue;
+
+    KMCommand *cmd = new KMMoveCommand( folder, msgs );
+    connect( cmd, SIGNAL( completed( KMCommand * ) ),
+             this, SLOT( batchMoveFinished( KMCommand * ) ) );
+    mBatchCommands.insert( cmd, (*it).mOriginals );
+    mTransferredCount += msgs.count();
+    cmd->start();
+  }
+  mBatchTransfers.clear();
+
+  if ( mBatchCommands.isEmpty() ) {
+    finishBatch();
+  } else {
+    // sometimes the move command doesn't complete, see moveMessage()
+    timeOutTime = QTime::currentTime();
+    timeOutTimer->start( 60 * 1000 );
+  }
+}
+
+void ActionScheduler::batchMoveFinished( KMCommand *command )
+{
+  const QList<quint32> originals = mBatchCommands.take( command );
+  if ( command->result() == KMCommand::OK ) {
+    mBatchOriginals += originals;
+  } else {
+    // See moveMessageFinished()
+    kWarning() << "Moving" << originals.count() << "messages from the temporary"
+                  "filter folder to the target folder failed. They will stay unfiltered.";
+  }
+  foreach ( quint32 serNum, originals ) {
+    if ( serNum )
+      emit filtered( serNum );
+  }
+
+  if ( mBatchCommands.isEmpty() ) {
+    timeOutTimer->stop();
+    finishBatch();
+  }
+}
+
+void ActionScheduler::finishBatch()
+{
+  if ( !mSrcFolder->count() )
+    mSrcFolder->expunge();
+
+  // Delete the originals of the moved messages, see moveMessageFinished()
+  QList<KMMsgBase*> originals;
+  foreach ( quint32 serNum, mBatchOriginals ) {
+    KMFolder *folder = 0;
+    int idx = -1;
+    KMMsgDict::instance()->getLocation( serNum, &folder, &idx );
+    if ( folder && idx != -1 ) {
+      tempOpenFolder( folder );
+      originals.append( folder->getMsgBase( idx ) );
+    }
+  }
+  mBatchOriginals.clear();
+
+  mTransferMs += mTransferTime.elapsed();
+  logBatchStatistics();
+  mBatchCount = 0;
+  mExecutingLock = false;
+
+  // The filtering has caught up, fetch the next messages
+  if ( mFetchExecuting && mPendingFetches == 0 && !mFetchSerNums.isEmpty() )
+    fetchMessageTimer->start( 0 );
+
+  if ( !originals.isEmpty() ) {
+    KMCommand *cmd = new KMMoveCommand( 0, originals );
+    connect( cmd, SIGNAL( completed( KMCommand * ) ),
+             this, SLOT( processMessage() ) );
+    cmd->start();
+  } else {
+    processMessageTimer->start( 0 );
+  }
+}
+
+void ActionScheduler::logBatchStatistics()
+{
+  if ( FilterLog::instance()->isLogging() ) {
+    // Messages per second of each stage, over the time spent in it
+    const QString logText = i18n( "<b>Filtered a batch of %1 messages in %2 ms:</b> "
+                                  "fetching %3, filtering %4, moving and copying %5 "
+                                  "messages per second",
+                                  mBatchCount, mBatchTime.elapsed(),
+                                  mFetchedCount * 1000 / qMax( 1, mFetchMs ),
+                                  mFilteredCount * 1000 / qMax( 1, mFilterMs ),
+                                  mTransferredCount * 1000 / qMax( 1, mTransferMs ) );
+    FilterLog::instance()->add( logText, FilterLog::meta );
+  }
+  mFetchedCount = mFilteredCount = mTransferredCount = 0;
+  mFetchMs = mFilterMs = mTransferMs = 0;
+}
+
 void ActionScheduler::timeOut()
 {
+  if ( !mBatchCommands.isEmpty() ) {
+    // Like below, for all the moves of the batch
+    QList<quint32> originals;
+    QHash<KMCommand*, QList<quint32> >::ConstIterator it;
+    for ( it = mBatchCommands.constBegin(); it != mBatchCommands.constEnd(); ++it ) {
+      disconnect( it.key(), SIGNAL( completed( KMCommand * ) ),
+                  this, SLOT( batchMoveFinished( KMCommand * ) ) );
+      originals += it.value();
+    }
+    mBatchCommands.clear();
+    mBatchOriginals.clear();
+    mBatchCount = 0;
+    mExecutingLock = false;
+    mExecuting = false;
+    finishTimer->start( 0 );
+    foreach ( quint32 serNum, originals ) {
+      if ( serNum )
+        execFilters( serNum );
+    }
+    return;
+  }
+
   // Note: This is a good place for a debug statement
   assert( lastCommand );
   // sometimes imap jobs seem to just stall so give up and move on
@@ -839,6 +1186,21 @@ void ActionScheduler::timeOut()
 
 void ActionScheduler::fetchTimeOut()
 {
+  if ( mPendingFetches > 0 ) {
+    // Give up on the messages of the batch that haven't arrived yet
+    foreach ( const QPointer<FolderJob> &job, mFetchJobs ) {
+      if ( !job )
+        continue;
+      disconnect( job, SIGNAL(messageRetrieved( KMMessage* )),
+                  this, SLOT(batchMessageFetched( KMMessage* )) );
+      job->kill();
+    }
+    mFetchJobs.clear();
+    mPendingFetches = 0;
+    fetchMessageTimer->start( 0 );
+    return;
+  }
+
   // Note: This is a good place for a debug statement
   if( !lastJob )
     return;
@@ -868,6 +1230,9 @@ QString ActionScheduler::debug()
     res.append( QString( "mOriginalSerNum %1.\n" ).arg( (*it)->mOriginalSerNum ) );
     res.append( QString( "mSerNums count %1, " ).arg( (*it)->mSerNums.count() ) );
     res.append( QString( "mFetchSerNums count %1.\n" ).arg( (*it)->mFetchSerNums.count() ) );
+    res.append( QString( "mBatchSize %1, " ).arg( (*it)->mBatchSize ) );
+    res.append( QString( "mBatchCount %1, " ).arg( (*it)->mBatchCount ) );
+    res.append( QString( "mPendingFetches %1.\n" ).arg( (*it)->mPendingFetches ) );
     res.append( QString( "mResult " ) );
     if ((*it)->mResult == ResultOk)
       res.append( QString( "ResultOk.\n" ) );
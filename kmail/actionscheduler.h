@@ -37,7 +37,9 @@
 #include "kmfiltermgr.h" // KMFilterMgr::FilterSet
 #include "kmcommands.h"
 
+#include <QHash>
 #include <QList>
+#include <QSet>
 #include <QTime>
 #include <QPointer>
 
@@ -86,6 +88,20 @@ public:
    of messages left to process is empty */
   void setFilterList( QList<KMFilter*> filters );
 
+  /** Set the number of messages that are fetched ahead and filtered
+      before their moves and copies are carried out, together for each
+      destination folder. 1, the default, means one message at a time.
+      The default can be changed with the "action-scheduler-batch-size"
+      entry of the "General" group of the configuration. */
+  void setBatchSize( int size );
+
+  /** Called by the copy filter action: queues a copy of @p msg, as it is
+      now, into @p folder. The copies are added at the end of the batch,
+      together with the other copies into the same folder. Returns false
+      if messages are not filtered in batches: the caller must then copy
+      the message itself. */
+  bool queueCopy( KMFolder *folder, KMMessage *msg );
+
   /** Set the id of the account associated with this scheduler */
   void setAccountId( uint id  ) { mAccountId = id; mAccount = true; }
 
@@ -143,7 +159,31 @@ private slots:
   void timeOut();
   void fetchTimeOut();
 
+  //Batch slots
+  void batchMessageFetched( KMMessage *msg );
+  void batchMoveFinished( KMCommand *command );
+
 private:
+  // The moves and copies into a folder collected during a batch
+  class BatchTransfer
+  {
+  public:
+    QPointer<KMFolder> mFolder;
+    QList<quint32> mMoves;       ///< Messages in the source folder
+    QList<quint32> mOriginals;   ///< The originals of mMoves, 0 if unknown
+    QList<KMMessage*> mCopies;
+  };
+
+  bool filterMatches();
+  bool isBatching() const { return mBatchSize > 1; }
+  bool copyToSourceFolder( KMMessage *msg, bool unGet );
+  void fetchBatch();
+  BatchTransfer &batchTransfer( KMFolder *folder );
+  void queueMove( KMFolder *folder, KMMessage *msg );
+  void flushBatch();
+  void finishBatch();
+  void logBatchStatistics();
+
   static QList<ActionScheduler*> *schedulerList; // for debugging
   static KMFolderMgr *tempFolderMgr;
   static int refCount, count;
@@ -203,6 +243,21 @@ private:
   QTime timeOutTime, fetchTimeOutTime;
   KMCommand *lastCommand;
   QPointer<FolderJob> lastJob;
+
+  // Batch mode, see setBatchSize()
+  int mBatchSize;
+  int mBatchCount;    ///< Messages filtered since the last flushBatch()
+  int mPendingFetches;
+  QList<QPointer<FolderJob> > mFetchJobs;
+  QSet<quint32> mFetchUngetSerNums;
+  QList<BatchTransfer> mBatchTransfers;
+  QHash<KMCommand*, QList<quint32> > mBatchCommands;  ///< The originals moved by each running command
+  QList<quint32> mBatchOriginals;                     ///< Originals to delete at the end of the batch
+
+  // Throughput counters, logged to the FilterLog after each batch
+  QTime mBatchTime, mMessageTime, mFetchTime, mTransferTime;
+  int mFetchedCount, mFilteredCount, mTransferredCount;
+  int mFetchMs, mFilterMs, mTransferMs;
 };
 
 }
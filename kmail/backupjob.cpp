@@ -23,6 +23,7 @@
 #include "kmfoldercachedimap.h"
 #include "kmfolderdir.h"
 #include "folderutil.h"
+#include "parallelgzipdevice.h"
 
 #include "kzip.h"
 #include "ktar.h"
@@ -31,14 +32,20 @@
 #include "qfile.h"
 #include "qfileinfo.h"
 #include "qstringlist.h"
+#include "qdatetime.h"
 
 using namespace KMail;
 
+// Write the messages of local folders for that many milliseconds before
+// giving the event loop a turn
+#define BACKUPJOB_RAW_MSECS 100
+
 BackupJob::BackupJob( QWidget *parent )
   : QObject( parent ),
     mArchiveType( Zip ),
     mRootFolder( 0 ),
     mArchive( 0 ),
+    mArchiveDevice( 0 ),
     mParentWidget( parent ),
     mCurrentFolderOpen( false ),
     mArchivedMessages( 0 ),
@@ -47,6 +54,11 @@ BackupJob::BackupJob( QWidget *parent )
     mAborted( false ),
     mDeleteFoldersAfterCompletion( false ),
     mCurrentFolder( 0 ),
+    mCurrentFolderIsLocal( false ),
+    mMessagePermissions( 0700 ),
+    mMessageCreationTime( 0 ),
+    mMessageModificationTime( 0 ),
+    mMessageAccessTime( 0 ),
     mCurrentMessage( 0 ),
     mCurrentJob( 0 )
 {
@@ -59,6 +71,8 @@ BackupJob::~BackupJob()
     delete mArchive;
     mArchive = 0;
   }
+  delete mArchiveDevice;
+  mArchiveDevice = 0;
 }
 
 void BackupJob::setRootFolder( KMFolder *rootFolder )
@@ -161,7 +175,8 @@ void BackupJob::abort( const QString &errorMessage )
 void BackupJob::finish()
 {
   if ( mArchive->isOpen() ) {
-    if ( !mArchive->close() ) {
+    // Closing the archive also finishes the compression of a .tar.gz file
+    if ( !mArchive->close() || ( mArchiveDevice && mArchiveDevice->hasError() ) ) {
       abort( i18n( "Unable to finalize the archive file." ) );
       return;
     }
@@ -208,19 +223,14 @@ void BackupJob::archiveNextMessage()
     return;
   }
 
-  unsigned long serNum = mPendingMessages.front();
-  mPendingMessages.pop_front();
-
-  KMFolder *folder;
-  mMessageIndex = -1;
-  KMMsgDict::instance()->getLocation( serNum, &folder, &mMessageIndex );
-  if ( mMessageIndex == -1 ) {
-    kWarning() << "Failed to get message location for sernum " << serNum;
-    abort( i18n( "Unable to retrieve a message for folder '%1'.", mCurrentFolder->name() ) );
+  if ( mCurrentFolderIsLocal ) {
+    archiveNextRawMessages();
     return;
   }
 
-  Q_ASSERT( folder == mCurrentFolder );
+  if ( !takeNextMessage() )
+    return;
+
   const KMMsgBase *base = mCurrentFolder->getMsgBase( mMessageIndex );
   mUnget = base && !base->isMessage();
   KMMessage *message = mCurrentFolder->getMsg( mMessageIndex );
@@ -256,6 +266,60 @@ void BackupJob::archiveNextMessage()
   }
 }
 
+unsigned long BackupJob::takeNextMessage()
+{
+  unsigned long serNum = mPendingMessages.front();
+  mPendingMessages.pop_front();
+
+  KMFolder *folder;
+  mMessageIndex = -1;
+  KMMsgDict::instance()->getLocation( serNum, &folder, &mMessageIndex );
+  if ( mMessageIndex == -1 ) {
+    kWarning() << "Failed to get message location for sernum " << serNum;
+    abort( i18n( "Unable to retrieve a message for folder '%1'.", mCurrentFolder->name() ) );
+    return 0;
+  }
+
+  Q_ASSERT( folder == mCurrentFolder );
+  return serNum;
+}
+
+void BackupJob::archiveNextRawMessages()
+{
+  // The messages are written as they are stored, which is what getMsg() would parse
+  QTime timer;
+  timer.start();
+  while ( !mPendingMessages.isEmpty() && timer.elapsed() < BACKUPJOB_RAW_MSECS ) {
+    const unsigned long serNum = takeNextMessage();
+    if ( !serNum )
+      return;
+    const DwString message = mCurrentFolder->getDwString( mMessageIndex );
+    if ( message.size() == 0 && messageReadFailed( mMessageIndex ) ) {
+      kWarning() << "Failed to read message with index " << mMessageIndex;
+      abort( i18n( "Unable to retrieve a message for folder '%1'.", mCurrentFolder->name() ) );
+      return;
+    }
+    if ( !writeMessage( serNum, message.data(), message.size() ) )
+      return;
+  }
+
+  // Use a singleshot timer, or otherwise we risk ending up in a very big recursion
+  QTimer::singleShot( 0, this, SLOT( archiveNextMessage() ) );
+}
+
+bool BackupJob::messageReadFailed( int index ) const
+{
+  // getDwString() gives an empty message both for an empty message and for
+  // one it can't read. Only the latter has something stored.
+  const QString fileName = mCurrentFolder->storage()->rawMessageFile( index );
+  if ( !fileName.isEmpty() ) {
+    const QFileInfo fileInfo( fileName );
+    return !fileInfo.isFile() || fileInfo.size() > 0;
+  }
+  const KMMsgBase *base = mCurrentFolder->getMsgBase( index );
+  return !base || base->msgSize() > 0;
+}
+
 static int fileInfoToUnixPermissions( const QFileInfo &fileInfo )
 {
   int perm = 0;
@@ -271,6 +335,24 @@ static int fileInfoToUnixPermissions( const QFileInfo &fileInfo )
   return perm;
 }
 
+bool BackupJob::writeMessage( unsigned long serNum, const char *data, qint64 size )
+{
+  // IMAP doesn't have filenames
+  const QString fileName = stripRootPath( mCurrentFolder->location() ) +
+                           "/cur/" + QString::number( serNum );
+
+  if ( !mArchive->writeFile( fileName, mMessageUser, mMessageGroup,
+                             data, size, mMessagePermissions,
+                             mMessageAccessTime, mMessageModificationTime, mMessageCreationTime ) ) {
+    abort( i18n( "Failed to write a message into the archive folder '%1'.", mCurrentFolder->name() ) );
+    return false;
+  }
+
+  mArchivedMessages++;
+  mArchivedSize += size;
+  return true;
+}
+
 void BackupJob::processCurrentMessage()
 {
   if ( mAborted )
@@ -281,56 +363,13 @@ void BackupJob::processCurrentMessage()
     const DwString &messageDWString = mCurrentMessage->asDwString();
     const qint64 messageSize = messageDWString.size();
     const char *messageString = mCurrentMessage->asDwString().c_str();
-    QString messageName;
-    QFileInfo fileInfo;
-    if ( messageName.isEmpty() ) {
-      messageName = QString::number( mCurrentMessage->getMsgSerNum() ); // IMAP doesn't have filenames
-      if ( mCurrentMessage->storage() ) {
-        fileInfo.setFile( mCurrentMessage->storage()->location() );
-        // TODO: what permissions etc to take when there is no storage file?
-      }
-    }
-    else {
-      // TODO: What if the message is not in the "cur" directory?
-      fileInfo.setFile( mCurrentFolder->location() + "/cur/" + mCurrentMessage->fileName() );
-      messageName = mCurrentMessage->fileName();
-    }
-
-    const QString fileName = stripRootPath( mCurrentFolder->location() ) +
-                             "/cur/" + messageName;
-
-    QString user;
-    QString group;
-    mode_t permissions = 0700;
-    time_t creationTime = time( 0 );
-    time_t modificationTime = time( 0 );
-    time_t accessTime = time( 0 );
-    if ( !fileInfo.fileName().isEmpty() ) {
-      user = fileInfo.owner();
-      group = fileInfo.group();
-      permissions = fileInfoToUnixPermissions( fileInfo );
-      creationTime = fileInfo.created().toTime_t();
-      modificationTime = fileInfo.lastModified().toTime_t();
-      accessTime = fileInfo.lastRead().toTime_t();
-    }
-    else {
-      kWarning() << "Unable to find file for message " << fileName;
-    }
-
-    if ( !mArchive->writeFile( fileName, user, group,
-                               messageString, messageSize, permissions,
-                               accessTime, modificationTime, creationTime ) ) {
-      abort( i18n( "Failed to write a message into the archive folder '%1'.", mCurrentFolder->name() ) );
+    if ( !writeMessage( mCurrentMessage->getMsgSerNum(), messageString, messageSize ) )
       return;
-    }
 
     if ( mUnget ) {
       Q_ASSERT( mMessageIndex >= 0 );
       mCurrentFolder->unGetMsg( mMessageIndex );
     }
-
-    mArchivedMessages++;
-    mArchivedSize += messageSize;
   }
   else {
     // No message? According to ImapJob::slotGetMessageResult(), that means the message is no
@@ -397,6 +436,30 @@ void BackupJob::archiveNextFolder()
   }
   mCurrentFolderOpen = true;
 
+  const KMFolderType type = mCurrentFolder->folderType();
+  mCurrentFolderIsLocal = ( type == KMFolderTypeMbox || type == KMFolderTypeMaildir ||
+                            type == KMFolderTypeCachedImap );
+
+  // The messages get the owner, permissions and times of the folder file
+  const QFileInfo fileInfo( mCurrentFolder->location() );
+  if ( !fileInfo.fileName().isEmpty() ) {
+    mMessageUser = fileInfo.owner();
+    mMessageGroup = fileInfo.group();
+    mMessagePermissions = fileInfoToUnixPermissions( fileInfo );
+    mMessageCreationTime = fileInfo.created().toTime_t();
+    mMessageModificationTime = fileInfo.lastModified().toTime_t();
+    mMessageAccessTime = fileInfo.lastRead().toTime_t();
+  }
+  else {
+    kWarning() << "Unable to find file for folder " << mCurrentFolder->name();
+    mMessageUser.clear();
+    mMessageGroup.clear();
+    mMessagePermissions = 0700;
+    mMessageCreationTime = time( 0 );
+    mMessageModificationTime = time( 0 );
+    mMessageAccessTime = time( 0 );
+  }
+
   const QString folderName = mCurrentFolder->name();
   bool success = true;
   if ( hasChildren( mCurrentFolder ) ) {
@@ -471,7 +534,9 @@ void BackupJob::start()
       break;
     }
     case TarGz: {
-      mArchive = new KTar( mMailArchivePath.path(), "application/x-gzip" );
+      // KTar writes plain tar data, which is compressed on several threads
+      mArchiveDevice = new ParallelGzipDevice( mMailArchivePath.path() );
+      mArchive = new KTar( mArchiveDevice );
       break;
     }
     case TarBz2: {
@@ -25,6 +25,9 @@
 #include <qobject.h>
 #include "progressmanager.h"
 
+#include <sys/types.h>
+#include <time.h>
+
 
 class KMFolder;
 class KMMessage;
@@ -35,12 +38,16 @@ class QWidget;
 namespace KMail
 {
   class FolderJob;
+  class ParallelGzipDevice;
 
 /**
  * Writes an entire folder structure to an archive file.
  * The archive is structured like a hierarchy of maildir folders. However, every type of folder
  * works as the source, i.e. also online IMAP folders.
  *
+ * The messages of local folders are archived as they are stored, without parsing them, many
+ * in each turn of the event loop. A .tar.gz archive is compressed on several threads.
+ *
  * The job deletes itself after it finished.
  */
 class BackupJob : public QObject
@@ -65,13 +72,17 @@ class BackupJob : public QObject
     void messageRetrieved( KMMessage *message );
     void folderJobFinished( KMail::FolderJob *job );
     void processCurrentMessage();
+    void archiveNextMessage();
     void cancelJob();
 
   private:
 
     void queueFolders( KMFolder *root );
     void archiveNextFolder();
-    void archiveNextMessage();
+    void archiveNextRawMessages();
+    unsigned long takeNextMessage();
+    bool messageReadFailed( int index ) const;
+    bool writeMessage( unsigned long serNum, const char *data, qint64 size );
     QString stripRootPath( const QString &path ) const;
     bool hasChildren( KMFolder *folder ) const;
     void finish();
@@ -82,6 +93,7 @@ class BackupJob : public QObject
     ArchiveType mArchiveType;
     KMFolder *mRootFolder;
     KArchive *mArchive;
+    ParallelGzipDevice *mArchiveDevice; // if the archive doesn't write the file itself
     QWidget *mParentWidget;
     bool mCurrentFolderOpen;
     int mArchivedMessages;
@@ -97,6 +109,16 @@ class BackupJob : public QObject
 
     QList<KMFolder*> mPendingFolders;
     KMFolder *mCurrentFolder;
+    bool mCurrentFolderIsLocal;
+
+    // Owner, permissions and times of the messages of the current folder
+    QString mMessageUser;
+    QString mMessageGroup;
+    mode_t mMessagePermissions;
+    time_t mMessageCreationTime;
+    time_t mMessageModificationTime;
+    time_t mMessageAccessTime;
+
     QList<unsigned long> mPendingMessages;
     KMMessage *mCurrentMessage;
     FolderJob *mCurrentJob;
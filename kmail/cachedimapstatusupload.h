@@ -0,0 +1,47 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef KMAIL_CACHEDIMAPSTATUSUPLOAD_H
+#define KMAIL_CACHEDIMAPSTATUSUPLOAD_H
+
+#include <QList>
+#include <QMap>
+#include <QSet>
+
+namespace KMail {
+
+/**
+ * Decides whose status a disconnected IMAP folder uploads to the server,
+ * kept apart from KMFolderCachedImap so that it does not depend on the
+ * folder classes.
+ */
+namespace CachedImapStatusUpload {
+
+  /** Returns the sorted UIDs of @p changedUids, the messages whose status
+      changed locally, that are in @p uidMap, which maps the UIDs of the
+      messages of the folder to their index. Messages that aren't on the
+      server yet have the UID 0 and are left out, as are the changed
+      messages that have been removed since. */
+  QList<ulong> uidsToUpload( const QSet<ulong> &changedUids,
+                             const QMap<ulong, int> &uidMap );
+
+}
+
+} // namespace KMail
+
+#endif // KMAIL_CACHEDIMAPSTATUSUPLOAD_H
@@ -35,6 +35,7 @@ using KPIM::BroadcastStatus;
 
 #include <kdebug.h>
 #include <kde_file.h>
+#include <kio/global.h>
 #include <klocale.h>
 
 #include <QFile>
@@ -115,6 +116,25 @@ int MboxCompactionJob::executeNow( bool silent )
     //      exit(1); backed out due to broken nfs
   }
 
+  mOpeningFolder = true; // Ignore open-notifications while opening the folder
+  storage->open( "mboxcompact" );
+  mOpeningFolder = false;
+  mFolderOpen = true;
+  mOffset = 0;
+  mCurrentIndex = 0;
+  mTime.start();
+
+  // The messages at the beginning of the file which follow one another stay
+  // where they are. If that is all of them, only what follows is cut off.
+  off_t prefixEnd;
+  if ( mbox->compactedPrefix( prefixEnd ) == mbox->count() ) {
+    kDebug() << "MboxCompactionJob: truncating folder"
+                 << mSrcFolder->location() << "at" << prefixEnd;
+    mOffset = prefixEnd;
+    done( mbox->truncateContents( prefixEnd ) );
+    return mErrorCode;
+  }
+
   const QFileInfo pathInfo( realLocation() );
   // Use /dir/.mailboxname.compacted so that it's hidden, and doesn't show up after restarting kmail
   // (e.g. due to an unfortunate crash while compaction is happening)
@@ -124,17 +144,15 @@ int MboxCompactionJob::executeNow( bool silent )
   mTmpFile = KDE_fopen( QFile::encodeName( mTempName ), "w" );
   umask( old_umask );
   if (!mTmpFile) {
+    const int rc = errno;
     kWarning() <<"Couldn't start compacting" << mSrcFolder->label()
-                   << ":" << strerror( errno )
+                   << ":" << strerror( rc )
                    << "while creating" << mTempName;
-    return errno;
+    mTempName.clear();
+    storage->close( "mboxcompact" );
+    mFolderOpen = false;
+    return rc;
   }
-  mOpeningFolder = true; // Ignore open-notifications while opening the folder
-  storage->open( "mboxcompact" );
-  mOpeningFolder = false;
-  mFolderOpen = true;
-  mOffset = 0;
-  mCurrentIndex = 0;
 
   kDebug() << "MboxCompactionJob: starting to compact folder"
                << mSrcFolder->location() << "into" << mTempName;
@@ -155,7 +173,7 @@ void MboxCompactionJob::slotDoWork()
   int rc = mbox->compact( mCurrentIndex, nbMessages,
                           mTmpFile, mOffset /*in-out*/, bDone /*out*/ );
   if ( !mImmediate )
-    mCurrentIndex += COMPACTIONJOB_NRMESSAGES;
+    mCurrentIndex += nbMessages;
   if ( rc || bDone ) // error, or finished
     done( rc );
 }
@@ -165,34 +183,51 @@ void MboxCompactionJob::done( int rc )
   mTimer.stop();
   mCancellable = false;
   KMFolderMbox *mbox = static_cast<KMFolderMbox *>( mSrcFolder->storage() );
-  if ( !rc ) {
-    rc = fflush( mTmpFile );
-  }
-  if ( !rc ) {
-    rc = fsync( fileno( mTmpFile ) );
+  // There is no temporary file if the folder was only truncated
+  if ( mTmpFile ) {
+    if ( !rc ) {
+      rc = fflush( mTmpFile );
+    }
+    if ( !rc ) {
+      rc = fsync( fileno( mTmpFile ) );
+    }
+    rc |= fclose( mTmpFile );
+    mTmpFile = 0;
   }
-  rc |= fclose( mTmpFile );
   QString str;
   if ( !rc ) {
     bool autoCreate = mbox->autoCreateIndex();
-    QString box( realLocation() );
-    rc = KDE_rename( QFile::encodeName( mTempName ), QFile::encodeName( box ) );
-    if ( rc != 0 )
-      return;
+    if ( !mTempName.isEmpty() ) {
+      QString box( realLocation() );
+      rc = KDE_rename( QFile::encodeName( mTempName ), QFile::encodeName( box ) );
+      if ( rc != 0 )
+        return;
+    }
+    const int elapsed = qMax( 1, mTime.elapsed() );
+    // When the folder was only truncated, its contents stayed in place
+    const KIO::filesize_t copied = mTempName.isEmpty() ? 0 : mOffset;
+    const QString rate = KIO::convertSize( copied * 1000 / elapsed );
+    kDebug() << "Compacted" << mSrcFolder->location() << "to" << mOffset << "bytes in"
+             << elapsed << "ms," << copied << "bytes copied," << rate << "per second";
     mbox->writeIndex();
     mbox->writeConfig();
     mbox->setAutoCreateIndex( false );
     mbox->close( "mboxcompact", true );
     mbox->setAutoCreateIndex( autoCreate );
     mbox->setNeedsCompacting( false );            // We are clean now
-    str = i18n( "Folder \"%1\" successfully compacted", mSrcFolder->label() );
+    if ( copied > 0 )
+      str = i18n( "Folder \"%1\" successfully compacted, %2 copied at %3/s",
+                  mSrcFolder->label(), KIO::convertSize( copied ), rate );
+    else
+      str = i18n( "Folder \"%1\" successfully compacted", mSrcFolder->label() );
     kDebug() << str;
   } else {
     mbox->close( "mboxcompact" );
     str = i18n( "Error occurred while compacting \"%1\". Compaction aborted.", mSrcFolder->label() );
     kDebug() << "Error occurred while compacting" << mbox->location();
     kDebug() << "Compaction aborted.";
-    QFile::remove( mTempName );
+    if ( !mTempName.isEmpty() )
+      QFile::remove( mTempName );
   }
   mErrorCode = rc;
 
@@ -30,6 +30,7 @@
 
 #include "jobscheduler.h"
 #include <QStringList>
+#include <QTime>
 
 namespace KMail {
 
@@ -62,6 +63,7 @@ private:
   FILE *mTmpFile;
   off_t mOffset;
   int mCurrentIndex;
+  QTime mTime;
   bool mFolderOpen;
   bool mSilent;
 };
@@ -13,6 +13,11 @@
 
 #cmakedefine HAVE_MMAP 1
 
+#cmakedefine HAVE_COPY_FILE_RANGE 1
+
+/* Define to 1 if you have the <sys/sendfile.h> header file. */
+#cmakedefine HAVE_SYS_SENDFILE_H 1
+
 #cmakedefine KDEPIM_FOLDEROPEN_PROFILE 1
 
 #cmakedefine INDICATEQT_FOUND 1
@@ -0,0 +1,297 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "filtermatcher.h"
+
+#include "kmfilter.h"
+#include "kmmessage.h"
+
+#include <QStringList>
+
+using namespace KMail;
+
+//-----------------------------------------------------------------------------
+SubstringMatcher::SubstringMatcher()
+  : mNodes( 1 ) // the root
+{
+}
+
+void SubstringMatcher::addPattern( const QString &pattern, int id )
+{
+  Q_ASSERT( !pattern.isEmpty() );
+  int node = 0;
+  const ushort *c = pattern.utf16();
+  for ( int i = 0 ; i < pattern.length() ; ++i ) {
+    int next = mNodes[node].mNext.value( c[i], 0 );
+    if ( next == 0 ) {
+      next = mNodes.count();
+      mNodes.append( Node() );
+      mNodes[node].mNext.insert( c[i], next );
+    }
+    node = next;
+  }
+  mNodes[node].mIds.append( id );
+}
+
+void SubstringMatcher::finish()
+{
+  // Breadth first: the failure link of a node goes to a shorter one
+  QList<int> queue;
+  queue.append( 0 );
+  while ( !queue.isEmpty() ) {
+    const int node = queue.takeFirst();
+    QHash<ushort, int>::const_iterator it;
+    for ( it = mNodes[node].mNext.constBegin() ; it != mNodes[node].mNext.constEnd() ; ++it ) {
+      const int child = it.value();
+      int failure = 0;
+      if ( node != 0 ) {
+        int f = mNodes[node].mFailure;
+        while ( f != 0 && !mNodes[f].mNext.contains( it.key() ) )
+          f = mNodes[f].mFailure;
+        failure = mNodes[f].mNext.value( it.key(), 0 );
+      }
+      mNodes[child].mFailure = failure;
+      mNodes[child].mOutput = mNodes[child].mIds.isEmpty() ? mNodes[failure].mOutput : child;
+      queue.append( child );
+    }
+  }
+}
+
+void SubstringMatcher::match( const QString &text, QVector<bool> &found ) const
+{
+  int node = 0;
+  const ushort *c = text.utf16();
+  for ( int i = 0 ; i < text.length() ; ++i ) {
+    forever {
+      QHash<ushort, int>::const_iterator it = mNodes[node].mNext.constFind( c[i] );
+      if ( it != mNodes[node].mNext.constEnd() ) {
+        node = it.value();
+        break;
+      }
+      if ( node == 0 )
+        break;
+      node = mNodes[node].mFailure;
+    }
+    for ( int out = mNodes[node].mOutput ; out != -1 ; out = mNodes[mNodes[out].mFailure].mOutput ) {
+      foreach ( int id, mNodes[out].mIds )
+        found[id] = true;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+FilterMatcher::Message::Message( const FilterMatcher *matcher, const KMMessage *msg )
+  : mMsg( msg ),
+    mValues( matcher->mFields.count() ),
+    mFieldDone( matcher->mFields.count(), false ),
+    mRuleDone( matcher->mRules.count(), false ),
+    mRuleResult( matcher->mRules.count(), false ),
+    mFound( matcher->mRules.count(), false )
+{
+}
+
+void FilterMatcher::Message::reset()
+{
+  mValues.fill( QString() );
+  mFieldDone.fill( false );
+  mRuleDone.fill( false );
+  mFound.fill( false );
+}
+
+//-----------------------------------------------------------------------------
+FilterMatcher::FilterMatcher( const QList<KMFilter*> &filters )
+{
+  mFilters.reserve( filters.count() );
+  QList<KMFilter*>::const_iterator it;
+  for ( it = filters.constBegin() ; it != filters.constEnd() ; ++it ) {
+    const KMSearchPattern *pattern = (*it)->pattern();
+    Filter filter;
+    filter.mOperator = pattern->op();
+    QList<KMSearchRule*>::const_iterator rit;
+    for ( rit = pattern->constBegin() ; rit != pattern->constEnd() ; ++rit ) {
+      filter.mRules.append( mRules.count() );
+      compileRule( *rit );
+    }
+    mFilters.append( filter );
+  }
+
+  for ( int i = 0 ; i < mFields.count() ; ++i )
+    mFields[i].mContains.finish();
+}
+
+void FilterMatcher::compileRule( const KMSearchRule *rule )
+{
+  const int ruleIdx = mRules.count();
+  Rule r;
+  r.mRule = rule;
+
+  // Pseudo headers ("<message>", "<status>", ...) are left to the rule.
+  // Other fields are always KMSearchRuleStrings, which compare the
+  // decoded values of all the header fields with that name.
+  const QByteArray field = rule->field();
+  if ( !field.isEmpty() && !field.startsWith( '<' ) ) {
+    switch ( rule->function() ) {
+    case KMSearchRule::FuncEquals:
+    case KMSearchRule::FuncNotEqual:
+      r.mKind = Equals;
+      r.mNegated = rule->function() == KMSearchRule::FuncNotEqual;
+      break;
+    case KMSearchRule::FuncContains:
+    case KMSearchRule::FuncContainsNot:
+      r.mKind = Contains;
+      r.mNegated = rule->function() == KMSearchRule::FuncContainsNot;
+      break;
+    case KMSearchRule::FuncRegExp:
+    case KMSearchRule::FuncNotRegExp:
+      r.mKind = RegExp;
+      r.mNegated = rule->function() == KMSearchRule::FuncNotRegExp;
+      break;
+    default:
+      break;
+    }
+  }
+
+  // KMSearchRuleString::matches() doesn't match empty rules, whatever
+  // their function is
+  if ( r.mKind != Other && rule->isEmpty() )
+    r.mKind = Never;
+
+  if ( r.mKind == Equals || r.mKind == Contains || r.mKind == RegExp ) {
+    r.mField = fieldNumber( field );
+    Field &f = mFields[r.mField];
+    if ( r.mKind == Equals ) {
+      f.mEquals[rule->contents().toLower()].append( ruleIdx );
+      f.mEqualsRules.append( ruleIdx );
+    } else if ( r.mKind == Contains ) {
+      // QString::contains( ..., Qt::CaseInsensitive ) compares case
+      // folded characters
+      f.mContains.addPattern( rule->contents().toCaseFolded(), ruleIdx );
+      f.mContainsRules.append( ruleIdx );
+    } else {
+      r.mRegExp = QRegExp( rule->contents(), Qt::CaseInsensitive );
+    }
+  }
+
+  mRules.append( r );
+}
+
+int FilterMatcher::fieldNumber( const QByteArray &name )
+{
+  const QByteArray key = name.toLower();
+  QHash<QByteArray, int>::const_iterator it = mFieldNumbers.constFind( key );
+  if ( it != mFieldNumbers.constEnd() )
+    return it.value();
+
+  Field field;
+  field.mName = name;
+  mFields.append( field );
+  mFieldNumbers.insert( key, mFields.count() - 1 );
+  return mFields.count() - 1;
+}
+
+int FilterMatcher::compiledRuleCount() const
+{
+  int count = 0;
+  QVector<Rule>::const_iterator it;
+  for ( it = mRules.constBegin() ; it != mRules.constEnd() ; ++it )
+    if ( it->mKind == Never || it->mKind == Equals || it->mKind == Contains )
+      ++count;
+  return count;
+}
+
+bool FilterMatcher::matches( int filterIdx, Message &msg ) const
+{
+  // like KMSearchPattern::matches( const KMMessage*, bool )
+  const Filter &filter = mFilters[filterIdx];
+  if ( filter.mRules.isEmpty() )
+    return true;
+
+  QVector<int>::const_iterator it;
+  switch ( filter.mOperator ) {
+  case KMSearchPattern::OpAnd: // all rules must match
+    for ( it = filter.mRules.constBegin() ; it != filter.mRules.constEnd() ; ++it )
+      if ( !ruleMatches( *it, msg ) )
+        return false;
+    return true;
+  case KMSearchPattern::OpOr:  // at least one rule must match
+    for ( it = filter.mRules.constBegin() ; it != filter.mRules.constEnd() ; ++it )
+      if ( ruleMatches( *it, msg ) )
+        return true;
+    // fall through
+  default:
+    return false;
+  }
+}
+
+bool FilterMatcher::ruleMatches( int ruleIdx, Message &msg ) const
+{
+  if ( msg.mRuleDone[ruleIdx] )
+    return msg.mRuleResult[ruleIdx];
+
+  const Rule &rule = mRules[ruleIdx];
+  bool result = false;
+  switch ( rule.mKind ) {
+  case Never:
+    break;
+  case Equals:
+  case Contains:
+    scanField( rule.mField, msg );
+    return msg.mRuleResult[ruleIdx];
+  case RegExp:
+    scanField( rule.mField, msg );
+    result = ( rule.mRegExp.indexIn( msg.mValues[rule.mField] ) >= 0 ) != rule.mNegated;
+    break;
+  case Other:
+    result = rule.mRule->matches( msg.mMsg );
+    break;
+  }
+
+  msg.mRuleDone[ruleIdx] = true;
+  msg.mRuleResult[ruleIdx] = result;
+  return result;
+}
+
+void FilterMatcher::scanField( int fieldIdx, Message &msg ) const
+{
+  if ( msg.mFieldDone[fieldIdx] )
+    return;
+  msg.mFieldDone[fieldIdx] = true;
+
+  const Field &field = mFields[fieldIdx];
+  // like KMSearchRuleString::matches( const KMMessage* )
+  const QString value = msg.mMsg->headerFields( field.mName ).join( " " );
+  msg.mValues[fieldIdx] = value;
+
+  if ( !field.mEqualsRules.isEmpty() ) {
+    foreach ( int ruleIdx, field.mEqualsRules ) {
+      msg.mRuleDone[ruleIdx] = true;
+      msg.mRuleResult[ruleIdx] = mRules[ruleIdx].mNegated;
+    }
+    const QList<int> equal = field.mEquals.value( value.toLower() );
+    foreach ( int ruleIdx, equal )
+      msg.mRuleResult[ruleIdx] = !mRules[ruleIdx].mNegated;
+  }
+
+  if ( !field.mContainsRules.isEmpty() ) {
+    field.mContains.match( value.toCaseFolded(), msg.mFound );
+    foreach ( int ruleIdx, field.mContainsRules ) {
+      msg.mRuleDone[ruleIdx] = true;
+      msg.mRuleResult[ruleIdx] = msg.mFound[ruleIdx] != mRules[ruleIdx].mNegated;
+    }
+  }
+}
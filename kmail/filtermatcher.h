@@ -0,0 +1,175 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef FILTERMATCHER_H
+#define FILTERMATCHER_H
+
+#include "kmsearchpattern.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QRegExp>
+#include <QString>
+#include <QVector>
+
+class KMFilter;
+class KMMessage;
+
+namespace KMail {
+
+/**
+ * A multi-pattern matcher (Aho-Corasick) for the "contains" rules on one
+ * header field. The patterns and the searched texts must be case folded.
+ */
+class SubstringMatcher
+{
+public:
+  SubstringMatcher();
+
+  /** Adds @p pattern, which must not be empty, with the number @p id.
+      The numbers must be unique. */
+  void addPattern( const QString &pattern, int id );
+  /** Computes the failure links. Must be called after the last
+      addPattern() and before the first match(). */
+  void finish();
+
+  bool isEmpty() const { return mNodes.count() <= 1; }
+
+  /** Sets @p found[id] to true for the id of each pattern that @p text
+      contains. */
+  void match( const QString &text, QVector<bool> &found ) const;
+
+private:
+  class Node
+  {
+  public:
+    Node() : mFailure( 0 ), mOutput( -1 ) {}
+
+    QHash<ushort, int> mNext;
+    int mFailure;
+    int mOutput;          ///< The nearest node, this one included, that ends patterns
+    QList<int> mIds;      ///< The patterns that end here
+  };
+
+  QVector<Node> mNodes;
+};
+
+/**
+ * The rules of a list of filters compiled for KMFilterMgr::process(), so
+ * that a message can be tested against all of them without going through
+ * each KMSearchPattern in turn.
+ *
+ * Each header field a rule tests is extracted and decoded once per message.
+ * The "equals" and "not equal" rules on a field are answered with one hash
+ * lookup of its value and the "contains" and "does not contain" rules with
+ * one pass of a SubstringMatcher over it. The regular expressions are only
+ * evaluated when their filter gets to them, and are compiled only once.
+ * The other rules (pseudo headers, addressbook, status, size, ...) are
+ * matched by the KMSearchRule itself.
+ *
+ * The results are exactly those of KMSearchPattern::matches(): the
+ * comparisons are the ones of KMSearchRuleString::matchesInternal(), and
+ * the rules of a pattern are evaluated in the same order, with the same
+ * short cuts. Filter actions may change the message: call
+ * Message::reset() after running them.
+ */
+class FilterMatcher
+{
+public:
+  /** The values extracted from one message and the rules answered so far.
+      Keep it on the stack: process() can be reentered. */
+  class Message
+  {
+  public:
+    Message( const FilterMatcher *matcher, const KMMessage *msg );
+
+    /** Forgets what has been extracted from the message, e.g. because
+        filter actions have changed it. */
+    void reset();
+
+  private:
+    friend class FilterMatcher;
+
+    const KMMessage *mMsg;
+    QVector<QString> mValues;     ///< By field number
+    QVector<bool> mFieldDone;     ///< By field number
+    QVector<bool> mRuleDone;      ///< By rule number
+    QVector<bool> mRuleResult;    ///< By rule number
+    QVector<bool> mFound;         ///< By rule number, see scanField()
+  };
+
+  /** Compiles the patterns of @p filters, which must outlive the matcher
+      and must not be modified while it exists. */
+  explicit FilterMatcher( const QList<KMFilter*> &filters );
+
+  /** Returns true if the pattern of the filter at position @p filterIdx
+      of the list given to the constructor matches the message of @p msg. */
+  bool matches( int filterIdx, Message &msg ) const;
+
+  /** Returns the number of rules that are answered by the lookups, and
+      the number of all the rules. */
+  int compiledRuleCount() const;
+  int ruleCount() const { return mRules.count(); }
+
+private:
+  enum Kind { Never, Equals, Contains, RegExp, Other };
+
+  class Rule
+  {
+  public:
+    Rule() : mKind( Other ), mNegated( false ), mField( -1 ), mRule( 0 ) {}
+
+    Kind mKind;
+    bool mNegated;
+    int mField;               ///< Equals, Contains and RegExp
+    QRegExp mRegExp;          ///< RegExp
+    const KMSearchRule *mRule;
+  };
+
+  class Field
+  {
+  public:
+    QByteArray mName;
+    QHash< QString, QList<int> > mEquals; ///< Lower case contents to rules
+    QList<int> mEqualsRules;
+    QList<int> mContainsRules;
+    SubstringMatcher mContains;           ///< The ids are the rule numbers
+  };
+
+  class Filter
+  {
+  public:
+    KMSearchPattern::Operator mOperator;
+    QVector<int> mRules;
+  };
+
+  void compileRule( const KMSearchRule *rule );
+  int fieldNumber( const QByteArray &name );
+  bool ruleMatches( int ruleIdx, Message &msg ) const;
+  void scanField( int fieldIdx, Message &msg ) const;
+
+  QVector<Filter> mFilters;
+  QVector<Rule> mRules;
+  QVector<Field> mFields;
+  QHash<QByteArray, int> mFieldNumbers;   ///< By lower case name
+};
+
+} // namespace KMail
+
+#endif // FILTERMATCHER_H
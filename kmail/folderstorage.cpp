@@ -45,6 +45,7 @@
 #include "listjob.h"
 using KMail::ListJob;
 #include "kmsearchpattern.h"
+#include "searchexecutor.h"
 #include "globalsettings.h"
 
 #include <kde_file.h>
@@ -83,6 +84,10 @@ FolderStorage::FolderStorage( KMFolder *folder, const char *aName )
   mNoContent = false;
   mNoChildren = false;
   mRDict = 0;
+  mCurrentSearchedMsg = 0;
+  mSearchPattern = 0;
+  mSearchPlan = 0;
+  mSearchExecutor = 0;
   mDirtyTimer = new QTimer( this );
   connect( mDirtyTimer, SIGNAL( timeout() ), this, SLOT( updateIndex() ) );
 
@@ -99,6 +104,8 @@ FolderStorage::~FolderStorage()
   qDeleteAll( mJobList );
   mJobList.clear();
   KMMsgDict::deleteRentry(mRDict);
+  delete mSearchExecutor;
+  delete mSearchPlan;
 }
 
 
@@ -661,6 +668,7 @@ int FolderStorage::moveMsg( QList<KMMessage*> msglist, int *aIndex_ret )
 int FolderStorage::rename( const QString &newName, KMFolderDir *newParent )
 {
   QString oldLoc, oldIndexLoc, oldSortedLoc, oldIdsLoc, newLoc, newIndexLoc, newSortedLoc, newIdsLoc;
+  QString oldThreadingLoc, newThreadingLoc;
   QString oldSubDirLoc, newSubDirLoc;
   QString oldName;
   int rc = 0;
@@ -671,6 +679,7 @@ int FolderStorage::rename( const QString &newName, KMFolderDir *newParent )
   oldLoc = location();
   oldIndexLoc = indexLocation();
   oldSortedLoc = sortedLocation();
+  oldThreadingLoc = threadingLocation();
   oldSubDirLoc = folder()->subdirLocation();
   oldIdsLoc =  KMMsgDict::instance()->getFolderIdsLocation( *this );
   QString oldConfigString = folder()->configGroupName();
@@ -687,6 +696,7 @@ int FolderStorage::rename( const QString &newName, KMFolderDir *newParent )
   newLoc = location();
   newIndexLoc = indexLocation();
   newSortedLoc = sortedLocation();
+  newThreadingLoc = threadingLocation();
   newSubDirLoc = folder()->subdirLocation();
   newIdsLoc = KMMsgDict::instance()->getFolderIdsLocation( *this );
 
@@ -714,6 +724,10 @@ int FolderStorage::rename( const QString &newName, KMFolderDir *newParent )
         // sometimes doesn't exist (in case of empty folder, for example).
         //return 1;
       }
+      // The threading cache is rebuilt when the folder is shown
+      if ( KDE_rename( QFile::encodeName( oldThreadingLoc ),
+                       QFile::encodeName( newThreadingLoc ) ) != 0 )
+        QFile::remove( oldThreadingLoc );
     }
 
     // rename/move serial number file
@@ -790,6 +804,7 @@ void FolderStorage::remove()
     mExportsSernums = false;  // do not writeFolderIds after removal
   }
   unlink( QFile::encodeName( sortedLocation() ) );
+  unlink( QFile::encodeName( threadingLocation() ) );
   unlink( QFile::encodeName( indexLocation() ) );
 
   int rc = removeContents();
@@ -1030,6 +1045,7 @@ void FolderStorage::invalidateFolder()
 {
   if ( !mExportsSernums ) return;
   unlink(QFile::encodeName( sortedLocation()) );
+  unlink(QFile::encodeName( threadingLocation()) );
   unlink(QFile::encodeName( idsLocation()) );
   fillMessageDict();
   KMMsgDict::mutableInstance()->writeFolderIds( *this );
@@ -1052,14 +1068,14 @@ int FolderStorage::touchFolderIdsFile()
 }
 
 //-----------------------------------------------------------------------------
-int FolderStorage::appendToFolderIdsFile( int idx )
+int FolderStorage::appendToFolderIdsFile( int idx, int number )
 {
   if ( !mExportsSernums ) return 0;
   int ret = 0;
-  if ( count() == 1 ) {
+  if ( count() == number ) {
     ret = KMMsgDict::mutableInstance()->writeFolderIds( *this );
   } else {
-    ret = KMMsgDict::mutableInstance()->appendToFolderIds( *this, idx );
+    ret = KMMsgDict::mutableInstance()->appendToFolderIds( *this, idx, number );
   }
   return ret;
 }
@@ -1171,8 +1187,36 @@ void FolderStorage::search( const KMSearchPattern* pattern )
 {
   mSearchPattern = pattern;
   mCurrentSearchedMsg = 0;
-  if ( pattern )
+  // The executor uses the plan
+  delete mSearchExecutor;
+  mSearchExecutor = 0;
+  delete mSearchPlan;
+  mSearchPlan = pattern ? new KMSearchPlan( pattern ) : 0;
+  if ( !pattern )
+    return;
+
+  mSearchPlan->useFullTextIndex( kmkernel->fullTextIndex() );
+  if ( mSearchPlan->canMatchRaw() ) {
+    // Match the raw text of the messages in worker threads
+    mSearchExecutor = new KMail::SearchExecutor( folder(), mSearchPlan, this );
+    connect( mSearchExecutor, SIGNAL( result( const QList<quint32>&, bool ) ),
+             this, SLOT( slotSearchExecutorResult( const QList<quint32>&, bool ) ) );
+    mSearchExecutor->start();
+  } else {
     slotProcessNextSearchBatch();
+  }
+}
+
+void FolderStorage::slotSearchExecutorResult( const QList<quint32> &serNums, bool complete )
+{
+  if ( !mSearchPattern )
+    return;
+  const KMSearchPattern *pattern = mSearchPattern;
+  if ( complete ) {
+    mSearchExecutor->deleteLater();
+    mSearchExecutor = 0;
+  }
+  emit searchResult( folder(), serNums, pattern, complete );
 }
 
 void FolderStorage::slotProcessNextSearchBatch()
@@ -1180,15 +1224,14 @@ void FolderStorage::slotProcessNextSearchBatch()
   if ( !mSearchPattern )
     return;
   QList<quint32> matchingSerNums;
-  const int end = qMin( mCurrentSearchedMsg + 10, count() );
-  for ( int i = mCurrentSearchedMsg; i < end; ++i )
-  {
-    quint32 serNum = KMMsgDict::instance()->getMsgSerNum( folder(), i );
-    if ( mSearchPattern->matches( serNum ) )
-      matchingSerNums.append( serNum );
-  }
-  mCurrentSearchedMsg = end;
-  bool complete = ( end >= count() );
+  // Messages answered from the folder index or from the full text index
+  // are cheap: check a lot of them at once. Load only a few messages
+  // per batch to keep the event loop responsive.
+  const int last = qMin( mCurrentSearchedMsg + 10000, count() ) - 1;
+  if ( last >= mCurrentSearchedMsg )
+    mCurrentSearchedMsg = mSearchPlan->matches( folder(), mCurrentSearchedMsg, last,
+                                                matchingSerNums, 10 );
+  bool complete = ( mCurrentSearchedMsg >= count() );
   emit searchResult( folder(), matchingSerNums, mSearchPattern, complete );
   if ( !complete )
     QTimer::singleShot( 0, this, SLOT(slotProcessNextSearchBatch()) );
@@ -1218,6 +1261,46 @@ int FolderStorage::addMessages( QList<KMMessage*>& msgList, QList<int>& index_re
   return ret;
 }
 
+//-----------------------------------------------------------------------------
+int FolderStorage::appendMessages( const QList<KMMessage*> &msgList, QList<int> &index_return )
+{
+  quiet( true );
+  int rc = 0;
+  QList<int> indexes;
+  QList<KMMessage*> empty;
+  bool canTakeBack = true;
+  foreach ( KMMessage *msg, msgList ) {
+    // addMsg() ignores messages without data, without taking them over
+    if ( msg->asDwString().size() == 0 ) {
+      empty << msg;
+      indexes << -1;
+      continue;
+    }
+    int index = -1;
+    rc = addMsg( msg, &index );
+    if ( rc != 0 )
+      break;
+    // Online IMAP folders own the message now, but don't know its index
+    if ( index < 0 )
+      canTakeBack = false;
+    indexes << index;
+  }
+
+  if ( rc != 0 && canTakeBack ) {
+    // Take out what was added, starting at the end so that the indices stay valid
+    for ( int i = indexes.count() - 1; i >= 0; --i ) {
+      if ( indexes[i] >= 0 )
+        take( indexes[i] );
+    }
+  }
+  else {
+    qDeleteAll( empty );
+    index_return << indexes;
+  }
+  quiet( false );
+  return rc;
+}
+
 //-----------------------------------------------------------------------------
 bool FolderStorage::isMoveable() const
 {
@@ -1263,6 +1346,11 @@ QString FolderStorage::sortedLocation() const
   return location( "sorted" );
 }
 
+QString FolderStorage::threadingLocation() const
+{
+  return location( "threading" );
+}
+
 bool FolderStorage::canDeleteMessages() const
 {
   return !isReadOnly();
@@ -59,9 +59,11 @@ class KMMsgDict; // for the rDict manipulations
 class KMMsgDictREntry;
 class QTimer;
 class KMSearchPattern;
+class KMSearchPlan;
 
 namespace KMail {
    class AttachmentStrategy;
+   class SearchExecutor;
 }
 using KMail::AttachmentStrategy;
 
@@ -110,6 +112,9 @@ public:
   /** Returns full path to 'sorted' file */
   virtual QString sortedLocation() const;
 
+  /** Returns full path to the file caching the threading of the message list */
+  virtual QString threadingLocation() const;
+
   /** Returns, if the folder can't contain mails, but only subfolder */
   virtual bool noContent() const { return mNoContent; }
 
@@ -159,6 +164,13 @@ public:
   /** Read a message and returns a DwString */
   virtual DwString getDwString(int idx) = 0;
 
+  /** Returns the name of the file that holds exactly the message at
+      index @p idx, as getDwString() would return it except for the line
+      breaks, if there is such a file. It can then be read without going
+      through the folder, e.g. from another thread. Returns an empty string
+      if getDwString() has to be used. */
+  virtual QString rawMessageFile( int idx ) const { Q_UNUSED( idx ); return QString(); }
+
   /**
    * Removes and deletes all jobs associated with the particular message
    */
@@ -214,6 +226,29 @@ public:
    */
   virtual int addMessages( QList<KMMessage*>&, QList<int>& index_return );
 
+  /**
+   * Appends the given messages, which must not belong to any folder, to the
+   * end of the folder as one transaction: either all of them are added, or
+   * none is and the folder is left as it was. Returns zero on success and an
+   * errno error code on failure.
+   *
+   * One entry per message taken over by the folder is appended to
+   * @p index_return: the first index_return.count() messages of @p msgList
+   * belong to the folder afterwards, the others stay with the caller. On
+   * success that is all of them. An entry is the index of the message, or
+   * -1 if the folder doesn't know it yet, as for online IMAP folders which
+   * upload the message first, or if the message had no data and was deleted.
+   *
+   * msgAdded(KMFolder*, quint32) is emitted for every message, but the folder
+   * only announces the change once, as if it had been quiet().
+   *
+   * This implementation adds one message after the other. On failure it
+   * takes the added ones out again if all their indices are known, and
+   * otherwise leaves them in the folder. Local folders reimplement it to
+   * write the messages and their index entries in one go.
+   */
+  virtual int appendMessages( const QList<KMMessage*> &msgList, QList<int> &index_return );
+
   /** Called by derived classes implementation of addMsg.
       Emits msgAdded signals */
   void emitMsgAddedSignals(int idx);
@@ -545,6 +580,9 @@ protected slots:
   /** Process the next search batch */
   void slotProcessNextSearchBatch();
 
+  /** Forwards the results of mSearchExecutor */
+  void slotSearchExecutorResult( const QList<quint32> &serNums, bool complete );
+
 protected:
 
   /**
@@ -584,8 +622,9 @@ friend class KMMsgDict;
   /** Touches the message serial number file. */
   int touchFolderIdsFile();
 
-  /** Append message to end of message serial number file. */
-  int appendToFolderIdsFile( int idx = -1 );
+  /** Append message, or @p number messages starting at @p idx, to end of
+      message serial number file. */
+  int appendToFolderIdsFile( int idx = -1, int number = 1 );
 
   /** Sets the reverse-dictionary for this folder. const, because the mRDict
    * is mutable, since it is not part of the (conceptually) const-relevant state
@@ -677,6 +716,8 @@ friend class KMMsgDict;
 
   int mCurrentSearchedMsg;
   const KMSearchPattern* mSearchPattern;
+  KMSearchPlan* mSearchPlan;
+  KMail::SearchExecutor* mSearchExecutor;
 };
 
 #endif // FOLDERSTORAGE_H
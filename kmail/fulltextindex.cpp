@@ -0,0 +1,1189 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "fulltextindex.h"
+#include "fulltextindexbody.h"
+#include "fulltextindexjob.h"
+#include "kmfolder.h"
+#include "kmfoldermgr.h"
+#include "kmkernel.h"
+#include "kmmessage.h"
+#include "kmmsgdict.h"
+#include "jobscheduler.h"
+
+#include <kdebug.h>
+#include <ksavefile.h>
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QDir>
+#include <QMap>
+#include <QPair>
+#include <QPointer>
+#include <QtAlgorithms>
+#include <QtConcurrentRun>
+#include <QtEndian>
+
+#include <mimelib/field.h>
+#include <mimelib/headers.h>
+#include <mimelib/message.h>
+#include <mimelib/string.h>
+
+#include <algorithm>
+#include <string.h>
+#include <unistd.h>
+
+using namespace KMail;
+
+// A segment file is made of
+//   the header:   "KMFT", version, doc count, term count, postings size, text size
+//   the docs:     serial number and fingerprint of each indexed message, sorted
+//   the postings: for each term the sorted serial numbers of the messages
+//                 that contain it, as varint encoded differences
+//   the terms:    for each term the offset of its text, the number of messages
+//                 that contain it and the offset of its postings
+//   the text:     the UTF-8 text of the terms, sorted, each followed by a NUL
+// All numbers are 32 bit little endian.
+static const char gSegmentMagic[4] = { 'K', 'M', 'F', 'T' };
+static const quint32 gSegmentVersion = 3;
+static const int gHeaderSize = 24;
+static const int gDocSize = 8;
+static const int gTermSize = 12;
+// The offsets are 32 bit and a segment is mapped as a whole
+static const qint64 gMaxSegmentSize = 0x7fffffff;
+
+// Merge the smallest segments once there are more than that
+static const int gMaxSegments = 8;
+static const int gMergedSegments = 4;
+// Write a segment once that many messages have been indexed
+static const int gFlushDocCount = 2000;
+// or when no message has been indexed for that long (ms)
+static const int gFlushInterval = 60 * 1000;
+// Load at most that many new messages every gQueueInterval ms
+static const int gQueueBatchSize = 10;
+static const int gQueueInterval = 100;
+static const int gMaxCachedSearches = 32;
+
+// Indexed for the messages whose body is only indexed in part, see
+// FullTextIndexBody. No word of a searched text contains the control char.
+static const char gPartialBodyTerm[] = "\001partialbody";
+
+typedef QPair<quint32, quint32> FullTextIndexDoc; // serial number, fingerprint
+
+static inline quint32 readLE32( const uchar *p )
+{
+  return qFromLittleEndian<quint32>( p );
+}
+
+static inline void appendLE32( QByteArray &a, quint32 v )
+{
+  uchar buf[4];
+  qToLittleEndian<quint32>( v, buf );
+  a.append( reinterpret_cast<const char *>( buf ), 4 );
+}
+
+//-----------------------------------------------------------------------------
+// Splitting texts into words
+
+// Calls add( word ) for each maximal run of letters and digits of
+// text, case folded char by char like QString::contains() does it
+template <typename Add>
+static void splitWords( const QChar *text, int length, Add &add )
+{
+  QString word;
+  for ( int i = 0 ; i < length ; ++i ) {
+    const QChar c = text[i].toCaseFolded();
+    if ( c.isLetterOrNumber() ) {
+      word += c;
+    } else if ( !word.isEmpty() ) {
+      add( word );
+      word.clear();
+    }
+  }
+  if ( !word.isEmpty() )
+    add( word );
+}
+
+// Collects the terms to index: any text of at most
+// FullTextIndex::MaxQueryTermLength chars is in one of the chunks
+class AddTerms
+{
+public:
+  explicit AddTerms( QSet<QString> &terms ) : mTerms( terms ) {}
+
+  void operator()( const QString &word )
+  {
+    if ( word.length() <= FullTextIndex::MaxTermLength ) {
+      mTerms.insert( word );
+      return;
+    }
+    for ( int pos = 0 ; pos + FullTextIndex::MaxTermLength < word.length() ;
+          pos += FullTextIndex::MaxQueryTermLength )
+      mTerms.insert( word.mid( pos, FullTextIndex::MaxTermLength ) );
+    mTerms.insert( word.right( FullTextIndex::MaxTermLength ) );
+  }
+
+private:
+  QSet<QString> &mTerms;
+};
+
+// Collects the terms to search: longer words are looked up by their
+// beginning and their end, which both have to be in one of the chunks
+class AddQueryTerms
+{
+public:
+  explicit AddQueryTerms( QSet<QString> &terms ) : mTerms( terms ) {}
+
+  void operator()( const QString &word )
+  {
+    if ( word.length() <= FullTextIndex::MaxQueryTermLength ) {
+      mTerms.insert( word );
+    } else {
+      mTerms.insert( word.left( FullTextIndex::MaxQueryTermLength ) );
+      mTerms.insert( word.right( FullTextIndex::MaxQueryTermLength ) );
+    }
+  }
+
+private:
+  QSet<QString> &mTerms;
+};
+
+static void addTerms( const QString &text, QSet<QString> &terms )
+{
+  AddTerms add( terms );
+  splitWords( text.unicode(), text.length(), add );
+}
+
+// Collects the terms of all the texts KMSearchRuleString matches a "contains"
+// rule against, except for the "<message>" pseudo header. Returns false if
+// only the text parts of the body have been collected.
+static bool addMessageTerms( const KMMessage *msg, QSet<QString> &terms )
+{
+  // "<any header>" (this also assembles the header)
+  addTerms( msg->headerAsString(), terms );
+
+  // The header fields, decoded like KMMessage::headerField() and like
+  // KMSearchRuleString::matches() does it for the unparsed message
+  const QByteArray charset = msg->charset();
+  for ( DwField *field = msg->headers().FirstField() ; field ; field = field->Next() ) {
+    const DwString &value = field->FieldBodyStr();
+    const QByteArray codedValue( value.data(), value.length() );
+    addTerms( KMMsgBase::decodeRFC2047String( codedValue, charset ), terms );
+    addTerms( KMMsgBase::decodeRFC2047String( codedValue ), terms );
+  }
+  // "<recipients>" uses the IDN decoded Cc addresses too
+  addTerms( msg->cc(), terms );
+
+  // "<body>", unless it has attachments or encoded parts: their lines
+  // would fill the index with random words
+  DwMessage &dwMsg = *msg->getTopLevelPart();
+  if ( FullTextIndexBody::isPlainText( dwMsg ) ) {
+    addTerms( msg->bodyToUnicode(), terms );
+    return true;
+  }
+  addTerms( FullTextIndexBody::textParts( dwMsg, msg->codec() ), terms );
+  return false;
+}
+
+// Returns the sorted terms to look up for text
+static QStringList queryTerms( const QString &text )
+{
+  QSet<QString> terms;
+  AddQueryTerms add( terms );
+  splitWords( text.unicode(), text.length(), add );
+  QStringList result = terms.toList();
+  result.sort();
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+
+namespace KMail {
+
+/**
+ * A mmap()ed segment file, see the description of the format above.
+ * Segments are never changed: they can be read from any thread.
+ */
+class FullTextIndexSegment
+{
+public:
+  /** Returns 0 if the file can't be mapped or is broken. */
+  static FullTextIndexSegment *open( const QString &fileName );
+  ~FullTextIndexSegment();
+
+  QString fileName() const { return mFile.fileName(); }
+  qint64 size() const { return mFile.size(); }
+
+  quint32 docCount() const { return mDocCount; }
+  FullTextIndexDoc doc( quint32 idx ) const
+  {
+    const uchar *p = mDocs + idx * gDocSize;
+    return FullTextIndexDoc( readLE32( p ), readLE32( p + 4 ) );
+  }
+
+  /** Returns true if there is a message with this serial number. */
+  bool contains( quint32 serNum ) const;
+  /** Returns true if there is a message with this serial number and fingerprint. */
+  bool contains( quint32 serNum, quint32 fingerprint ) const;
+
+  quint32 termCount() const { return mTermCount; }
+  /** Returns the text of the term, which refers to the mapped file. */
+  QByteArray term( quint32 idx ) const;
+  /** Appends the serial numbers of the messages that contain the term. */
+  void appendPostings( quint32 idx, QVector<quint32> &serNums ) const;
+
+  /** Adds the serial numbers of the messages that contain a term
+      that contains @p word to @p serNums. */
+  void findWord( const QByteArray &word, QSet<quint32> &serNums ) const;
+
+private:
+  explicit FullTextIndexSegment( const QString &fileName ) : mFile( fileName ), mData( 0 ) {}
+
+  quint32 lowerBound( quint32 serNum ) const;
+  quint32 termTextOffset( quint32 idx ) const
+    { return readLE32( mTerms + idx * gTermSize ); }
+
+  QFile mFile;
+  uchar *mData;
+  quint32 mDocCount;
+  quint32 mTermCount;
+  quint32 mPostingsSize;
+  quint32 mTextSize;
+  const uchar *mDocs;
+  const uchar *mPostings;
+  const uchar *mTerms;
+  const char *mText;
+};
+
+/**
+ * Writes a segment file. The terms must be added in sorted order.
+ * The file is written under a temporary name and renamed by finish().
+ */
+class FullTextIndexSegmentWriter
+{
+public:
+  explicit FullTextIndexSegmentWriter( const QString &fileName );
+  ~FullTextIndexSegmentWriter();
+
+  bool begin( const QVector<FullTextIndexDoc> &docs );
+  bool addTerm( const QByteArray &term, const QVector<quint32> &serNums );
+  bool finish();
+
+private:
+  bool writeBuffer();
+  /** Returns the size of the segment file if it was finished now. */
+  qint64 size() const;
+
+  QString mFileName;
+  QFile mFile;
+  QByteArray mBuffer;     // pending postings
+  QByteArray mTermTable;
+  QByteArray mText;
+  quint32 mDocCount;
+  quint32 mTermCount;
+  quint32 mPostingsSize;
+  bool mFinished;
+};
+
+} // namespace KMail
+
+FullTextIndexSegment *FullTextIndexSegment::open( const QString &fileName )
+{
+  FullTextIndexSegment *segment = new FullTextIndexSegment( fileName );
+  QFile &f = segment->mFile;
+  const qint64 size = f.size();
+  if ( !f.open( QIODevice::ReadOnly ) || size < gHeaderSize || size > gMaxSegmentSize ||
+       !( segment->mData = f.map( 0, size ) ) ) {
+    delete segment;
+    return 0;
+  }
+
+  const uchar *p = segment->mData;
+  segment->mDocCount = readLE32( p + 8 );
+  segment->mTermCount = readLE32( p + 12 );
+  segment->mPostingsSize = readLE32( p + 16 );
+  segment->mTextSize = readLE32( p + 20 );
+  const quint64 postingsStart = gHeaderSize + quint64( segment->mDocCount ) * gDocSize;
+  const quint64 termsStart = postingsStart + segment->mPostingsSize;
+  const quint64 textStart = termsStart + quint64( segment->mTermCount ) * gTermSize;
+  if ( memcmp( p, gSegmentMagic, 4 ) != 0 || readLE32( p + 4 ) != gSegmentVersion ||
+       textStart + segment->mTextSize != quint64( size ) ||
+       ( segment->mTextSize > 0 && p[size - 1] != '\0' ) ) {
+    delete segment;
+    return 0;
+  }
+  segment->mDocs = p + gHeaderSize;
+  segment->mPostings = p + postingsStart;
+  segment->mTerms = p + termsStart;
+  segment->mText = reinterpret_cast<const char *>( p + textStart );
+  return segment;
+}
+
+FullTextIndexSegment::~FullTextIndexSegment()
+{
+  if ( mFile.isOpen() && mData )
+    mFile.unmap( mData );
+}
+
+quint32 FullTextIndexSegment::lowerBound( quint32 serNum ) const
+{
+  quint32 lo = 0, hi = mDocCount;
+  while ( lo < hi ) {
+    const quint32 mid = lo + ( hi - lo ) / 2;
+    if ( readLE32( mDocs + mid * gDocSize ) < serNum )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+bool FullTextIndexSegment::contains( quint32 serNum ) const
+{
+  const quint32 idx = lowerBound( serNum );
+  return idx < mDocCount && doc( idx ).first == serNum;
+}
+
+bool FullTextIndexSegment::contains( quint32 serNum, quint32 fingerprint ) const
+{
+  for ( quint32 idx = lowerBound( serNum ) ; idx < mDocCount ; ++idx ) {
+    const FullTextIndexDoc d = doc( idx );
+    if ( d.first != serNum )
+      break;
+    if ( d.second == fingerprint )
+      return true;
+  }
+  return false;
+}
+
+QByteArray FullTextIndexSegment::term( quint32 idx ) const
+{
+  const quint32 start = termTextOffset( idx );
+  const quint32 end = ( idx + 1 < mTermCount ) ? termTextOffset( idx + 1 ) : mTextSize;
+  if ( start >= end || end > mTextSize )
+    return QByteArray();
+  return QByteArray::fromRawData( mText + start, end - start - 1 ); // without the NUL
+}
+
+void FullTextIndexSegment::appendPostings( quint32 idx, QVector<quint32> &serNums ) const
+{
+  const uchar *entry = mTerms + idx * gTermSize;
+  quint32 count = readLE32( entry + 4 );
+  const quint32 offset = readLE32( entry + 8 );
+  if ( offset >= mPostingsSize )
+    return;
+  const uchar *p = mPostings + offset;
+  const uchar *end = mPostings + mPostingsSize;
+  quint32 serNum = 0;
+  for ( ; count > 0 && p < end ; --count ) {
+    quint32 delta = 0;
+    int shift = 0;
+    uchar b;
+    do {
+      b = *p++;
+      delta |= quint32( b & 0x7f ) << shift;
+      shift += 7;
+    } while ( ( b & 0x80 ) && p < end && shift < 35 );
+    serNum += delta;
+    serNums.append( serNum );
+  }
+}
+
+void FullTextIndexSegment::findWord( const QByteArray &word, QSet<quint32> &serNums ) const
+{
+  if ( mTermCount == 0 || word.isEmpty() )
+    return;
+
+  // One pass over the text of all the terms. The terms are separated by
+  // NULs, which the words never contain, so that a match is always
+  // inside of a term.
+  const QByteArray text = QByteArray::fromRawData( mText, mTextSize );
+  QVector<quint32> postings;
+  int pos = 0;
+  while ( ( pos = text.indexOf( word, pos ) ) >= 0 ) {
+    // the last term that starts at or before the match
+    quint32 lo = 0, hi = mTermCount;
+    while ( hi - lo > 1 ) {
+      const quint32 mid = lo + ( hi - lo ) / 2;
+      if ( termTextOffset( mid ) <= quint32( pos ) )
+        lo = mid;
+      else
+        hi = mid;
+    }
+    postings.clear();
+    appendPostings( lo, postings );
+    for ( QVector<quint32>::const_iterator it = postings.constBegin() ; it != postings.constEnd() ; ++it )
+      serNums.insert( *it );
+
+    // continue with the next term
+    const int next = ( lo + 1 < mTermCount ) ? int( termTextOffset( lo + 1 ) ) : int( mTextSize );
+    pos = qMax( next, pos + 1 );
+  }
+}
+
+//-----------------------------------------------------------------------------
+
+FullTextIndexSegmentWriter::FullTextIndexSegmentWriter( const QString &fileName )
+  : mFileName( fileName ), mFile( fileName + ".tmp" ),
+    mDocCount( 0 ), mTermCount( 0 ), mPostingsSize( 0 ), mFinished( false )
+{
+}
+
+FullTextIndexSegmentWriter::~FullTextIndexSegmentWriter()
+{
+  if ( !mFinished ) {
+    mFile.close();
+    mFile.remove();
+  }
+}
+
+bool FullTextIndexSegmentWriter::begin( const QVector<FullTextIndexDoc> &docs )
+{
+  if ( !mFile.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    return false;
+
+  // The header is written by finish()
+  QByteArray data( gHeaderSize, '\0' );
+  data.reserve( gHeaderSize + docs.count() * gDocSize );
+  for ( QVector<FullTextIndexDoc>::const_iterator it = docs.constBegin() ; it != docs.constEnd() ; ++it ) {
+    appendLE32( data, it->first );
+    appendLE32( data, it->second );
+  }
+  mDocCount = docs.count();
+  return size() <= gMaxSegmentSize && mFile.write( data ) == data.size();
+}
+
+bool FullTextIndexSegmentWriter::addTerm( const QByteArray &term, const QVector<quint32> &serNums )
+{
+  appendLE32( mTermTable, mText.size() );
+  appendLE32( mTermTable, serNums.count() );
+  appendLE32( mTermTable, mPostingsSize + mBuffer.size() );
+  mText += term;
+  mText += '\0';
+  ++mTermCount;
+
+  quint32 previous = 0;
+  for ( QVector<quint32>::const_iterator it = serNums.constBegin() ; it != serNums.constEnd() ; ++it ) {
+    quint32 delta = *it - previous;
+    previous = *it;
+    while ( delta >= 0x80 ) {
+      mBuffer += char( ( delta & 0x7f ) | 0x80 );
+      delta >>= 7;
+    }
+    mBuffer += char( delta );
+  }
+
+  // Refuse to write a segment that can't be opened
+  if ( size() > gMaxSegmentSize )
+    return false;
+  if ( mBuffer.size() >= 64 * 1024 )
+    return writeBuffer();
+  return true;
+}
+
+qint64 FullTextIndexSegmentWriter::size() const
+{
+  return gHeaderSize + qint64( mDocCount ) * gDocSize + mPostingsSize + mBuffer.size() +
+         mTermTable.size() + mText.size();
+}
+
+bool FullTextIndexSegmentWriter::writeBuffer()
+{
+  if ( mFile.write( mBuffer ) != mBuffer.size() )
+    return false;
+  mPostingsSize += mBuffer.size();
+  mBuffer.clear();
+  return true;
+}
+
+bool FullTextIndexSegmentWriter::finish()
+{
+  if ( !writeBuffer() ||
+       mFile.write( mTermTable ) != mTermTable.size() ||
+       mFile.write( mText ) != mText.size() )
+    return false;
+
+  QByteArray header( gSegmentMagic, 4 );
+  appendLE32( header, gSegmentVersion );
+  appendLE32( header, mDocCount );
+  appendLE32( header, mTermCount );
+  appendLE32( header, mPostingsSize );
+  appendLE32( header, mText.size() );
+  if ( !mFile.seek( 0 ) || mFile.write( header ) != header.size() || !mFile.flush() ||
+       fsync( mFile.handle() ) != 0 )
+    return false;
+  mFile.close();
+
+  if ( !mFile.rename( mFileName ) )
+    return false;
+  mFinished = true;
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+
+static bool segmentLessThan( const QSharedPointer<FullTextIndexSegment> &s1,
+                             const QSharedPointer<FullTextIndexSegment> &s2 )
+{
+  return s1->docCount() < s2->docCount();
+}
+
+// Runs in a worker thread: merges the segments into a new segment file,
+// leaving out the messages that have tombstones
+static FullTextIndex::MergeResult mergeSegments( const QList< QSharedPointer<FullTextIndexSegment> > &segments,
+                                                 const QSet<quint32> &tombstones,
+                                                 const QString &fileName )
+{
+  FullTextIndex::MergeResult result;
+  result.mFileName = fileName;
+
+  QVector<FullTextIndexDoc> docs;
+  QSet<quint32> dropped;
+  for ( int i = 0 ; i < segments.count() ; ++i ) {
+    const FullTextIndexSegment *segment = segments.at( i ).data();
+    for ( quint32 idx = 0 ; idx < segment->docCount() ; ++idx ) {
+      const FullTextIndexDoc doc = segment->doc( idx );
+      if ( tombstones.contains( doc.first ) )
+        dropped.insert( doc.first );
+      else
+        docs.append( doc );
+    }
+  }
+  qSort( docs );
+  docs.erase( std::unique( docs.begin(), docs.end() ), docs.end() );
+
+  FullTextIndexSegmentWriter writer( fileName );
+  if ( !writer.begin( docs ) )
+    return result;
+
+  // All the term lists are sorted: merge them
+  QVector<quint32> cursors( segments.count(), 0 );
+  QVector<quint32> serNums;
+  forever {
+    QByteArray smallest;
+    bool found = false;
+    for ( int i = 0 ; i < segments.count() ; ++i ) {
+      if ( cursors[i] >= segments.at( i )->termCount() )
+        continue;
+      const QByteArray term = segments.at( i )->term( cursors[i] );
+      if ( !found || term < smallest ) {
+        smallest = term;
+        found = true;
+      }
+    }
+    if ( !found )
+      break;
+
+    serNums.clear();
+    for ( int i = 0 ; i < segments.count() ; ++i ) {
+      if ( cursors[i] < segments.at( i )->termCount() &&
+           segments.at( i )->term( cursors[i] ) == smallest ) {
+        segments.at( i )->appendPostings( cursors[i], serNums );
+        ++cursors[i];
+      }
+    }
+    qSort( serNums );
+    serNums.erase( std::unique( serNums.begin(), serNums.end() ), serNums.end() );
+    if ( !dropped.isEmpty() ) {
+      QVector<quint32>::iterator end = serNums.begin();
+      for ( QVector<quint32>::const_iterator it = serNums.constBegin() ; it != serNums.constEnd() ; ++it )
+        if ( !dropped.contains( *it ) )
+          *end++ = *it;
+      serNums.erase( end, serNums.end() );
+    }
+    if ( !serNums.isEmpty() && !writer.addTerm( smallest, serNums ) )
+      return result;
+  }
+
+  result.mOk = writer.finish();
+  result.mDropped = dropped.toList();
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+
+bool FullTextIndex::Hits::isIndexed( quint32 serNum, quint32 fingerprint ) const
+{
+  if ( mPendingDocs.contains( serNum, fingerprint ) )
+    return true;
+  QList< QSharedPointer<FullTextIndexSegment> >::const_iterator it;
+  for ( it = mSegments.constBegin() ; it != mSegments.constEnd() ; ++it )
+    if ( (*it)->contains( serNum, fingerprint ) )
+      return true;
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+
+FullTextIndex::FullTextIndex( const QString &directory, QObject *parent )
+  : QObject( parent ),
+    mDirectory( directory.endsWith( QLatin1Char( '/' ) ) ? directory : directory + QLatin1Char( '/' ) ),
+    mNextSegmentNumber( 1 ), mDirty( false ), mClosing( false )
+{
+  load();
+
+  mQueueTimer.setSingleShot( true );
+  mQueueTimer.setInterval( gQueueInterval );
+  connect( &mQueueTimer, SIGNAL( timeout() ), this, SLOT( slotProcessQueue() ) );
+  mFlushTimer.setSingleShot( true );
+  mFlushTimer.setInterval( gFlushInterval );
+  connect( &mFlushTimer, SIGNAL( timeout() ), this, SLOT( flush() ) );
+  connect( &mMergeWatcher, SIGNAL( finished() ), this, SLOT( slotMergeFinished() ) );
+
+  // Search folders and online IMAP folders aren't indexed
+  KMFolderMgr *mgrs[] = { kmkernel->folderMgr(), kmkernel->dimapFolderMgr() };
+  for ( unsigned int i = 0 ; i < sizeof mgrs / sizeof *mgrs ; ++i ) {
+    connect( mgrs[i], SIGNAL( msgAdded( KMFolder*, quint32 ) ),
+             this, SLOT( slotMsgAdded( KMFolder*, quint32 ) ) );
+    connect( mgrs[i], SIGNAL( msgRemoved( KMFolder*, quint32 ) ),
+             this, SLOT( slotMsgRemoved( KMFolder*, quint32 ) ) );
+    connect( mgrs[i], SIGNAL( folderInvalidated( KMFolder* ) ),
+             this, SLOT( slotFolderInvalidated( KMFolder* ) ) );
+  }
+}
+
+FullTextIndex::~FullTextIndex()
+{
+  mClosing = true;
+
+  // The worker uses the merged segments: it can't be abandoned
+  if ( !mMergedSegments.isEmpty() ) {
+    mMergeWatcher.waitForFinished();
+    slotMergeFinished();
+  }
+
+  // The folders of the messages that haven't been indexed yet aren't complete
+  for ( QList<quint32>::const_iterator it = mQueue.constBegin() ; it != mQueue.constEnd() ; ++it ) {
+    KMFolder *folder = 0;
+    int idx = -1;
+    KMMsgDict::instance()->getLocation( *it, &folder, &idx );
+    if ( folder )
+      mCompleteFolders.remove( folder->idString() );
+  }
+  mQueue.clear();
+
+  flush();
+  writeCompleteFolders();
+  if ( mPendingDocs.isEmpty() )
+    QFile::remove( mDirectory + "dirty" );
+}
+
+QString FullTextIndex::segmentFileName( int number ) const
+{
+  return mDirectory + QString::number( number ) + ".seg";
+}
+
+void FullTextIndex::load()
+{
+  QDir dir( mDirectory );
+  if ( !dir.exists() && !dir.mkpath( mDirectory ) )
+    kWarning() << "Can't create the full text index directory" << mDirectory;
+
+  // Left over by an interrupted flush or merge
+  foreach ( const QString &name, dir.entryList( QStringList() << "*.tmp", QDir::Files ) )
+    dir.remove( name );
+
+  bool lostSegments = false;
+  foreach ( const QString &name, dir.entryList( QStringList() << "*.seg", QDir::Files ) ) {
+    bool ok;
+    const int number = name.section( '.', 0, 0 ).toInt( &ok );
+    if ( !ok )
+      continue;
+    mNextSegmentNumber = qMax( mNextSegmentNumber, number + 1 );
+    if ( !addSegment( mDirectory + name ) )
+      lostSegments = true;
+  }
+
+  QFile tombstones( mDirectory + "tombstones" );
+  if ( tombstones.open( QIODevice::ReadOnly ) ) {
+    QDataStream s( &tombstones );
+    while ( !s.atEnd() ) {
+      quint32 serNum;
+      quint8 removed;
+      s >> serNum >> removed;
+      if ( s.status() != QDataStream::Ok )
+        break;
+      if ( removed )
+        mTombstones.insert( serNum );
+      else
+        mTombstones.remove( serNum );
+    }
+  }
+  // Rewrite the tombstones, so that the file doesn't grow forever
+  writeTombstones();
+
+  // After a crash, or when segments of an older version were dropped, the
+  // complete folders may be missing messages: check them all
+  if ( lostSegments || QFile::exists( mDirectory + "dirty" ) ) {
+    QFile::remove( mDirectory + "dirty" );
+    writeCompleteFolders();
+  } else {
+    QFile folders( mDirectory + "folders" );
+    if ( folders.open( QIODevice::ReadOnly ) ) {
+      QDataStream s( &folders );
+      QStringList ids;
+      s >> ids;
+      if ( s.status() == QDataStream::Ok )
+        mCompleteFolders = ids.toSet();
+    }
+  }
+}
+
+bool FullTextIndex::addSegment( const QString &fileName )
+{
+  FullTextIndexSegment *segment = FullTextIndexSegment::open( fileName );
+  if ( !segment ) {
+    kWarning() << "Removing the broken full text index segment" << fileName;
+    QFile::remove( fileName );
+    return false;
+  }
+  mSegments.append( QSharedPointer<FullTextIndexSegment>( segment ) );
+  segmentsChanged();
+  return true;
+}
+
+void FullTextIndex::segmentsChanged()
+{
+  mSegmentHitsCache.clear();
+}
+
+void FullTextIndex::markDirty()
+{
+  if ( mDirty )
+    return;
+  QFile marker( mDirectory + "dirty" );
+  marker.open( QIODevice::WriteOnly );
+  mDirty = true;
+}
+
+void FullTextIndex::writeTombstone( quint32 serNum, bool removed )
+{
+  if ( !mTombstoneFile.isOpen() )
+    return;
+  QDataStream s( &mTombstoneFile );
+  s << serNum << quint8( removed ? 1 : 0 );
+  mTombstoneFile.flush();
+}
+
+void FullTextIndex::writeTombstones()
+{
+  mTombstoneFile.close();
+  mTombstoneFile.setFileName( mDirectory + "tombstones" );
+  if ( !mTombstoneFile.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) {
+    kWarning() << "Can't write" << mTombstoneFile.fileName() << ":" << mTombstoneFile.errorString();
+    return;
+  }
+  for ( QSet<quint32>::const_iterator it = mTombstones.constBegin() ; it != mTombstones.constEnd() ; ++it )
+    writeTombstone( *it, true );
+}
+
+void FullTextIndex::writeCompleteFolders()
+{
+  KSaveFile f( mDirectory + "folders" );
+  if ( !f.open() ) {
+    kWarning() << "Can't write" << f.fileName() << ":" << f.errorString();
+    return;
+  }
+  QDataStream s( &f );
+  s << QStringList( mCompleteFolders.toList() );
+  if ( s.status() != QDataStream::Ok )
+    f.abort();
+  else
+    f.finalize();
+}
+
+bool FullTextIndex::isIndexable( const KMFolder *folder )
+{
+  if ( !folder || folder->isDir() )
+    return false;
+  switch ( folder->folderType() ) {
+  case KMFolderTypeMbox:
+  case KMFolderTypeMaildir:
+  case KMFolderTypeCachedImap:
+    return true;
+  default: // imap, search
+    return false;
+  }
+}
+
+quint32 FullTextIndex::fingerprint( const KMMsgBase *msgBase )
+{
+  return quint32( msgBase->msgSize() ) ^ ( quint32( msgBase->date() ) * 2654435761U );
+}
+
+bool FullTextIndex::isInSegments( quint32 serNum ) const
+{
+  QList< QSharedPointer<FullTextIndexSegment> >::const_iterator it;
+  for ( it = mSegments.constBegin() ; it != mSegments.constEnd() ; ++it )
+    if ( (*it)->contains( serNum ) )
+      return true;
+  return false;
+}
+
+bool FullTextIndex::isIndexed( quint32 serNum, quint32 fingerprint ) const
+{
+  if ( mPendingDocs.contains( serNum, fingerprint ) )
+    return true;
+  QList< QSharedPointer<FullTextIndexSegment> >::const_iterator it;
+  for ( it = mSegments.constBegin() ; it != mSegments.constEnd() ; ++it )
+    if ( (*it)->contains( serNum, fingerprint ) )
+      return true;
+  return false;
+}
+
+bool FullTextIndex::isFolderComplete( const KMFolder *folder ) const
+{
+  return mCompleteFolders.contains( folder->idString() );
+}
+
+void FullTextIndex::setFolderComplete( const KMFolder *folder )
+{
+  mCompleteFolders.insert( folder->idString() );
+}
+
+//-----------------------------------------------------------------------------
+
+QSet<quint32> FullTextIndex::segmentHits( const QStringList &terms ) const
+{
+  QSet<quint32> result;
+  for ( int i = 0 ; i < terms.count() ; ++i ) {
+    const QByteArray word = terms.at( i ).toUtf8();
+    QSet<quint32> wordHits;
+    QList< QSharedPointer<FullTextIndexSegment> >::const_iterator it;
+    for ( it = mSegments.constBegin() ; it != mSegments.constEnd() ; ++it )
+      (*it)->findWord( word, wordHits );
+    if ( i == 0 )
+      result = wordHits;
+    else
+      result.intersect( wordHits );
+    if ( result.isEmpty() )
+      break;
+  }
+  return result;
+}
+
+QSet<quint32> FullTextIndex::pendingHits( const QStringList &terms ) const
+{
+  QSet<quint32> result;
+  for ( int i = 0 ; i < terms.count() ; ++i ) {
+    const QString &word = terms.at( i );
+    QSet<quint32> wordHits;
+    QHash< QString, QVector<quint32> >::const_iterator it;
+    for ( it = mPendingTerms.constBegin() ; it != mPendingTerms.constEnd() ; ++it ) {
+      if ( it.key().contains( word ) ) {
+        for ( QVector<quint32>::const_iterator sit = it->constBegin() ; sit != it->constEnd() ; ++sit )
+          wordHits.insert( *sit );
+      }
+    }
+    if ( i == 0 )
+      result = wordHits;
+    else
+      result.intersect( wordHits );
+    if ( result.isEmpty() )
+      break;
+  }
+  return result;
+}
+
+QSet<quint32> FullTextIndex::cachedHits( const QStringList &terms ) const
+{
+  // A search folder asks once for each folder
+  const QString key = terms.join( " " );
+  QHash< QString, QSet<quint32> >::const_iterator it = mSegmentHitsCache.constFind( key );
+  if ( it == mSegmentHitsCache.constEnd() ) {
+    if ( mSegmentHitsCache.count() >= gMaxCachedSearches )
+      mSegmentHitsCache.clear();
+    it = mSegmentHitsCache.insert( key, segmentHits( terms ) );
+  }
+  QSet<quint32> result = *it;
+
+  it = mPendingHitsCache.constFind( key );
+  if ( it == mPendingHitsCache.constEnd() ) {
+    if ( mPendingHitsCache.count() >= gMaxCachedSearches )
+      mPendingHitsCache.clear();
+    it = mPendingHitsCache.insert( key, pendingHits( terms ) );
+  }
+  result.unite( *it );
+  return result;
+}
+
+FullTextIndex::Hits FullTextIndex::search( const QString &text, bool inBody ) const
+{
+  Hits hits;
+  const QStringList terms = queryTerms( text );
+  if ( terms.isEmpty() )
+    return hits; // nothing to look up: any message may match
+
+  hits.mSerNums = cachedHits( terms );
+  // The bodies that are indexed in part may contain anything
+  if ( inBody )
+    hits.mSerNums.unite( cachedHits( QStringList() << QString::fromLatin1( gPartialBodyTerm ) ) );
+
+  hits.mSegments = mSegments;
+  hits.mPendingDocs = mPendingDocs;
+  hits.mValid = true;
+  return hits;
+}
+
+//-----------------------------------------------------------------------------
+
+bool FullTextIndex::indexMessage( KMFolder *folder, int idx )
+{
+  KMMsgBase *msgBase = folder->getMsgBase( idx );
+  if ( !msgBase )
+    return false;
+  const quint32 serNum = msgBase->getMsgSerNum();
+  const quint32 fp = fingerprint( msgBase );
+  if ( serNum == 0 || isIndexed( serNum, fp ) )
+    return false;
+
+  const bool unGet = !msgBase->isMessage();
+  KMMessage *msg = folder->getMsg( idx );
+  if ( !msg )
+    return true;
+  if ( msg->isComplete() )
+    addMessage( serNum, fp, msg );
+  else
+    mCompleteFolders.remove( folder->idString() );
+  if ( unGet )
+    folder->unGetMsg( idx );
+  return true;
+}
+
+void FullTextIndex::addMessage( quint32 serNum, quint32 fingerprint, const KMMessage *msg )
+{
+  QSet<QString> terms;
+  if ( !addMessageTerms( msg, terms ) )
+    terms.insert( QString::fromLatin1( gPartialBodyTerm ) );
+
+  markDirty();
+  for ( QSet<QString>::const_iterator it = terms.constBegin() ; it != terms.constEnd() ; ++it )
+    mPendingTerms[*it].append( serNum );
+  mPendingDocs.insert( serNum, fingerprint );
+  mPendingHitsCache.clear();
+
+  if ( mPendingDocs.count() >= gFlushDocCount )
+    flush();
+  else
+    mFlushTimer.start();
+}
+
+void FullTextIndex::flush()
+{
+  mFlushTimer.stop();
+  if ( mPendingDocs.isEmpty() )
+    return;
+
+  QVector<FullTextIndexDoc> docs;
+  docs.reserve( mPendingDocs.count() );
+  for ( QMultiHash<quint32, quint32>::const_iterator it = mPendingDocs.constBegin() ;
+        it != mPendingDocs.constEnd() ; ++it )
+    docs.append( FullTextIndexDoc( it.key(), it.value() ) );
+  qSort( docs );
+  docs.erase( std::unique( docs.begin(), docs.end() ), docs.end() );
+
+  // The segment terms are sorted by their UTF-8 text
+  QMap< QByteArray, QVector<quint32> > terms;
+  for ( QHash< QString, QVector<quint32> >::const_iterator it = mPendingTerms.constBegin() ;
+        it != mPendingTerms.constEnd() ; ++it ) {
+    QVector<quint32> serNums = *it;
+    qSort( serNums );
+    serNums.erase( std::unique( serNums.begin(), serNums.end() ), serNums.end() );
+    terms.insert( it.key().toUtf8(), serNums );
+  }
+
+  const QString fileName = segmentFileName( mNextSegmentNumber++ );
+  bool ok;
+  {
+    FullTextIndexSegmentWriter writer( fileName );
+    ok = writer.begin( docs );
+    QMap< QByteArray, QVector<quint32> >::const_iterator it;
+    for ( it = terms.constBegin() ; ok && it != terms.constEnd() ; ++it )
+      ok = writer.addTerm( it.key(), *it );
+    if ( ok )
+      ok = writer.finish();
+  }
+  if ( !ok ) {
+    // Keep the messages, the next flush will try again
+    kWarning() << "Can't write the full text index segment" << fileName;
+    return;
+  }
+
+  mPendingTerms.clear();
+  mPendingDocs.clear();
+  mPendingHitsCache.clear();
+  addSegment( fileName );
+
+  writeCompleteFolders();
+  if ( mQueue.isEmpty() ) {
+    QFile::remove( mDirectory + "dirty" );
+    mDirty = false;
+  }
+
+  startMerge();
+}
+
+void FullTextIndex::startMerge()
+{
+  if ( mClosing || !mMergedSegments.isEmpty() || mSegments.count() <= gMaxSegments )
+    return;
+
+  // Merging the smallest segments rewrites each message a logarithmic
+  // number of times
+  QList< QSharedPointer<FullTextIndexSegment> > segments = mSegments;
+  qSort( segments.begin(), segments.end(), segmentLessThan );
+  segments = segments.mid( 0, gMergedSegments );
+
+  // The merged segment is about as large as the smallest ones together:
+  // once that is too large for a segment, the index stays as it is
+  qint64 size = 0;
+  QList< QSharedPointer<FullTextIndexSegment> >::const_iterator it;
+  for ( it = segments.constBegin() ; it != segments.constEnd() ; ++it )
+    size += (*it)->size();
+  if ( size > gMaxSegmentSize )
+    return;
+  mMergedSegments = segments;
+
+  const QString fileName = segmentFileName( mNextSegmentNumber++ );
+  mMergeWatcher.setFuture( QtConcurrent::run( mergeSegments, mMergedSegments, mTombstones, fileName ) );
+}
+
+void FullTextIndex::slotMergeFinished()
+{
+  if ( mMergedSegments.isEmpty() )
+    return; // already handled by the destructor
+
+  const MergeResult result = mMergeWatcher.result();
+  if ( !result.mOk ) {
+    kWarning() << "Can't merge the full text index segments into" << result.mFileName;
+    mMergedSegments.clear();
+    return;
+  }
+
+  // The old segments are only removed once the merged one can be used
+  FullTextIndexSegment *merged = FullTextIndexSegment::open( result.mFileName );
+  if ( !merged ) {
+    kWarning() << "Removing the broken merged full text index segment" << result.mFileName;
+    QFile::remove( result.mFileName );
+    mMergedSegments.clear();
+    return;
+  }
+
+  // Searches in progress still refer to the old segments:
+  // they are unmapped once the last of them has finished
+  QList< QSharedPointer<FullTextIndexSegment> >::const_iterator it;
+  for ( it = mMergedSegments.constBegin() ; it != mMergedSegments.constEnd() ; ++it ) {
+    mSegments.removeAll( *it );
+    QFile::remove( (*it)->fileName() );
+  }
+  mMergedSegments.clear();
+  mSegments.append( QSharedPointer<FullTextIndexSegment>( merged ) );
+  segmentsChanged();
+
+  bool tombstonesChanged = false;
+  for ( QList<quint32>::const_iterator sit = result.mDropped.constBegin() ;
+        sit != result.mDropped.constEnd() ; ++sit ) {
+    if ( !mTombstones.contains( *sit ) ) {
+      // added again while the merge was running
+      mQueue.append( *sit );
+    } else if ( !isInSegments( *sit ) && !mPendingDocs.contains( *sit ) ) {
+      mTombstones.remove( *sit );
+      tombstonesChanged = true;
+    }
+  }
+  if ( tombstonesChanged )
+    writeTombstones();
+  if ( !mQueue.isEmpty() && !mClosing )
+    mQueueTimer.start();
+
+  startMerge();
+}
+
+//-----------------------------------------------------------------------------
+
+void FullTextIndex::slotMsgAdded( KMFolder *folder, quint32 serNum )
+{
+  if ( !isIndexable( folder ) )
+    return;
+  // A moved message keeps its serial number
+  if ( mTombstones.remove( serNum ) )
+    writeTombstone( serNum, false );
+  markDirty();
+  mQueue.append( serNum );
+  if ( !mQueueTimer.isActive() )
+    mQueueTimer.start();
+}
+
+void FullTextIndex::slotMsgRemoved( KMFolder *folder, quint32 serNum )
+{
+  Q_UNUSED( folder );
+  if ( mTombstones.contains( serNum ) )
+    return;
+  if ( mPendingDocs.contains( serNum ) || isInSegments( serNum ) ) {
+    mTombstones.insert( serNum );
+    writeTombstone( serNum, true );
+  }
+}
+
+void FullTextIndex::slotFolderInvalidated( KMFolder *folder )
+{
+  // The messages got new serial numbers
+  mCompleteFolders.remove( folder->idString() );
+  if ( isIndexable( folder ) )
+    kmkernel->jobScheduler()->registerTask( new ScheduledFullTextIndexTask( folder, false ) );
+}
+
+void FullTextIndex::slotProcessQueue()
+{
+  int loaded = 0;
+  while ( !mQueue.isEmpty() && loaded < gQueueBatchSize ) {
+    const quint32 serNum = mQueue.takeFirst();
+    KMFolder *folder = 0;
+    int idx = -1;
+    KMMsgDict::instance()->getLocation( serNum, &folder, &idx );
+    if ( !folder || idx < 0 || !isIndexable( folder ) )
+      continue; // removed or moved away meanwhile
+    KMFolderOpener openFolder( folder, "fulltextindex" );
+    if ( openFolder.openResult() != 0 ) {
+      mCompleteFolders.remove( folder->idString() );
+      continue;
+    }
+    if ( indexMessage( folder, idx ) )
+      ++loaded;
+  }
+  if ( !mQueue.isEmpty() )
+    mQueueTimer.start();
+}
+
+void FullTextIndex::scheduleIncompleteFolders()
+{
+  KMFolderMgr *mgrs[] = { kmkernel->folderMgr(), kmkernel->dimapFolderMgr() };
+  for ( unsigned int i = 0 ; i < sizeof mgrs / sizeof *mgrs ; ++i ) {
+    QStringList names;
+    QList< QPointer<KMFolder> > folders;
+    mgrs[i]->createFolderList( &names, &folders );
+    for ( QList< QPointer<KMFolder> >::const_iterator it = folders.constBegin() ;
+          it != folders.constEnd() ; ++it ) {
+      KMFolder *folder = *it;
+      if ( isIndexable( folder ) && !isFolderComplete( folder ) )
+        kmkernel->jobScheduler()->registerTask( new ScheduledFullTextIndexTask( folder, false ) );
+    }
+  }
+}
+
+#include "fulltextindex.moc"
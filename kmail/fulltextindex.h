@@ -0,0 +1,220 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef FULLTEXTINDEX_H
+#define FULLTEXTINDEX_H
+
+#include <QFile>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+
+class KMFolder;
+class KMMessage;
+class KMMsgBase;
+
+namespace KMail {
+
+class FullTextIndexSegment;
+
+/**
+ * An on-disk inverted index of the words of the messages of all local and
+ * disconnected IMAP folders, keyed by message serial number. Searches use
+ * it to skip the messages that can't match a "contains" rule instead of
+ * loading and decoding every message.
+ *
+ * The indexed words are the maximal runs of letters and digits of the raw
+ * header, of each header field decoded like KMMessage::headerField() and
+ * KMSearchRuleString do it, and of KMMessage::bodyToUnicode(). Of messages
+ * with attachments or encoded parts only the decoded text parts are indexed,
+ * see FullTextIndexBody: they may contain any text in their body. The
+ * words are case folded like QString::contains( ..., Qt::CaseInsensitive )
+ * compares them, so that a message that contains a text contains all the
+ * words of the text.
+ * search() only says which messages may contain a text: the matches must
+ * still be confirmed against the real message.
+ *
+ * The index is made of immutable segment files, which are mmap()ed, and of
+ * the messages indexed since the last flush(), which are kept in memory.
+ * Segments are merged in a worker thread once there are too many of them.
+ * A message is identified by its serial number and a fingerprint of its
+ * index entry (see fingerprint()), as the serial numbers of deleted
+ * messages can be reused by later sessions.
+ *
+ * New messages are indexed shortly after KMFolderMgr::msgAdded(). The
+ * messages that were already there are indexed by a FullTextIndexJob per
+ * folder, see scheduleIncompleteFolders().
+ */
+class FullTextIndex : public QObject
+{
+  Q_OBJECT
+public:
+  enum {
+    /** Longer words are indexed as overlapping chunks of this length. */
+    MaxTermLength = 40,
+    /** The length of the words of searched texts is limited to this, so
+        that they are always found in one of the chunks. */
+    MaxQueryTermLength = MaxTermLength / 2
+  };
+
+  /**
+   * The messages that may contain a searched text, as returned by search().
+   * It also remembers which messages were indexed at the time of the
+   * search: a message that wasn't may contain anything.
+   */
+  class Hits
+  {
+  public:
+    Hits() : mValid( false ) {}
+
+    /** Returns false if the text can't be searched in the index,
+        e.g. because it has no words. */
+    bool isValid() const { return mValid; }
+
+    /** Returns true if the message with the specified serial number and
+        fingerprint was indexed when the hits were computed. */
+    bool isIndexed( quint32 serNum, quint32 fingerprint ) const;
+
+    /** Returns true if the indexed message with the specified serial
+        number may contain the text. */
+    bool contains( quint32 serNum ) const { return mSerNums.contains( serNum ); }
+
+  private:
+    friend class FullTextIndex;
+
+    QList< QSharedPointer<FullTextIndexSegment> > mSegments;
+    QMultiHash<quint32, quint32> mPendingDocs;
+    QSet<quint32> mSerNums;
+    bool mValid;
+  };
+
+  /** The result of a merge of segments, which runs in a worker thread. */
+  class MergeResult
+  {
+  public:
+    MergeResult() : mOk( false ) {}
+
+    bool mOk;
+    QString mFileName;
+    QList<quint32> mDropped;  ///< The serial numbers left out because of tombstones
+  };
+
+  /** Opens the index in @p directory, creating it if needed. */
+  explicit FullTextIndex( const QString &directory, QObject *parent = 0 );
+  /** Flushes the index, see flush(). */
+  ~FullTextIndex();
+
+  /** Returns true if the messages of @p folder can be indexed: they must be
+      local, and loading them must not involve a server. */
+  static bool isIndexable( const KMFolder *folder );
+
+  /** Returns the value that tells the message of @p msgBase apart from
+      earlier messages with the same serial number. */
+  static quint32 fingerprint( const KMMsgBase *msgBase );
+
+  /** Returns the messages that may contain @p text, case insensitively.
+      If @p inBody is true, the text is searched in the body, which only
+      some of the messages have been indexed for. */
+  Hits search( const QString &text, bool inBody = false ) const;
+
+  /** Returns true if the message with the specified serial number and
+      fingerprint has been indexed. */
+  bool isIndexed( quint32 serNum, quint32 fingerprint ) const;
+
+  /** Indexes the message at index @p idx of @p folder, which must be open,
+      unless it has been indexed already. Returns true if the message
+      had to be loaded. */
+  bool indexMessage( KMFolder *folder, int idx );
+
+  /** Returns true if all the messages of @p folder have been indexed. */
+  bool isFolderComplete( const KMFolder *folder ) const;
+  /** Called by the FullTextIndexJob of @p folder once it has indexed all
+      the messages of the folder. */
+  void setFolderComplete( const KMFolder *folder );
+
+  /** Registers a FullTextIndexJob with the JobScheduler for each
+      indexable folder that isn't complete. */
+  void scheduleIncompleteFolders();
+
+public slots:
+  /** Writes the messages indexed since the last flush to a new segment. */
+  void flush();
+
+private slots:
+  void slotMsgAdded( KMFolder *folder, quint32 serNum );
+  void slotMsgRemoved( KMFolder *folder, quint32 serNum );
+  void slotFolderInvalidated( KMFolder *folder );
+  void slotProcessQueue();
+  void slotMergeFinished();
+
+private:
+  void load();
+  void markDirty();
+  void addMessage( quint32 serNum, quint32 fingerprint, const KMMessage *msg );
+  bool addSegment( const QString &fileName );
+  void segmentsChanged();
+  void startMerge();
+  bool isInSegments( quint32 serNum ) const;
+  void writeTombstone( quint32 serNum, bool removed );
+  void writeTombstones();
+  void writeCompleteFolders();
+  QSet<quint32> segmentHits( const QStringList &terms ) const;
+  QSet<quint32> pendingHits( const QStringList &terms ) const;
+  QSet<quint32> cachedHits( const QStringList &terms ) const;
+  QString segmentFileName( int number ) const;
+
+  QString mDirectory;
+  QList< QSharedPointer<FullTextIndexSegment> > mSegments;
+  int mNextSegmentNumber;
+
+  // The messages indexed since the last flush
+  QHash< QString, QVector<quint32> > mPendingTerms;
+  QMultiHash<quint32, quint32> mPendingDocs;
+
+  // Serial numbers of removed messages, dropped when their segment is merged
+  QSet<quint32> mTombstones;
+  QFile mTombstoneFile;
+
+  QSet<QString> mCompleteFolders;
+
+  // New messages, indexed by slotProcessQueue()
+  QList<quint32> mQueue;
+  QTimer mQueueTimer;
+  QTimer mFlushTimer;
+
+  QFutureWatcher<MergeResult> mMergeWatcher;
+  QList< QSharedPointer<FullTextIndexSegment> > mMergedSegments;
+
+  bool mDirty;    ///< The "dirty" file exists: messages may be lost if we crash
+  bool mClosing;
+
+  // search() results by search terms
+  mutable QHash< QString, QSet<quint32> > mSegmentHitsCache;
+  mutable QHash< QString, QSet<quint32> > mPendingHitsCache;
+};
+
+} // namespace KMail
+
+#endif // FULLTEXTINDEX_H
@@ -0,0 +1,136 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "fulltextindexbody.h"
+
+#include <kcharsets.h>
+#include <kglobal.h>
+
+#include <QTextCodec>
+
+#include <mimelib/body.h>
+#include <mimelib/bodypart.h>
+#include <mimelib/entity.h>
+#include <mimelib/enum.h>
+#include <mimelib/headers.h>
+#include <mimelib/mechansm.h>
+#include <mimelib/mediatyp.h>
+#include <mimelib/param.h>
+#include <mimelib/utility.h>
+
+using namespace KMail;
+
+static int entityType( DwEntity &entity )
+{
+  DwHeaders &headers = entity.Headers();
+  // Parts without a Content-Type are text
+  return headers.HasContentType() ? headers.ContentType().Type() : int( DwMime::kTypeText );
+}
+
+static int entityCte( DwEntity &entity )
+{
+  DwHeaders &headers = entity.Headers();
+  return headers.HasContentTransferEncoding() ?
+         headers.ContentTransferEncoding().AsEnum() : int( DwMime::kCteNull );
+}
+
+static bool isEncoded( int cte )
+{
+  return cte == DwMime::kCteBase64 || cte == DwMime::kCteQuotedPrintable;
+}
+
+static bool partsArePlainText( DwBodyPart *part )
+{
+  if ( !part )
+    return false; // a multipart without parts: the body is unknown text
+  for ( ; part ; part = part->Next() ) {
+    const int type = entityType( *part );
+    if ( type == DwMime::kTypeMultipart ) {
+      if ( !partsArePlainText( part->Body().FirstBodyPart() ) )
+        return false;
+    } else if ( type != DwMime::kTypeText || isEncoded( entityCte( *part ) ) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool FullTextIndexBody::isPlainText( DwEntity &entity )
+{
+  const int type = entityType( entity );
+  if ( type == DwMime::kTypeMultipart )
+    return partsArePlainText( entity.Body().FirstBodyPart() );
+  return type == DwMime::kTypeText;
+}
+
+static const QTextCodec *entityCodec( DwEntity &entity, const QTextCodec *defaultCodec )
+{
+  DwHeaders &headers = entity.Headers();
+  if ( !headers.HasContentType() )
+    return defaultCodec;
+  for ( DwParameter *param = headers.ContentType().FirstParameter() ; param ; param = param->Next() ) {
+    if ( qstricmp( param->Attribute().c_str(), "charset" ) == 0 ) {
+      bool ok = false;
+      const QTextCodec *codec =
+        KGlobal::charsets()->codecForName( QString::fromLatin1( param->Value().c_str() ), ok );
+      return ok && codec ? codec : defaultCodec;
+    }
+  }
+  return defaultCodec;
+}
+
+static QString entityText( DwEntity &entity, const QTextCodec *defaultCodec )
+{
+  const DwString &raw = entity.Body().AsString();
+  DwString decoded;
+  switch ( entityCte( entity ) ) {
+  case DwMime::kCteBase64:
+    DwDecodeBase64( raw, decoded );
+    break;
+  case DwMime::kCteQuotedPrintable:
+    DwDecodeQuotedPrintable( raw, decoded );
+    break;
+  default:
+    decoded = raw;
+  }
+  return entityCodec( entity, defaultCodec )->toUnicode( decoded.data(), decoded.length() );
+}
+
+static void appendTextParts( DwBodyPart *part, const QTextCodec *defaultCodec, QString &text )
+{
+  for ( ; part ; part = part->Next() ) {
+    const int type = entityType( *part );
+    if ( type == DwMime::kTypeMultipart ) {
+      appendTextParts( part->Body().FirstBodyPart(), defaultCodec, text );
+    } else if ( type == DwMime::kTypeText ) {
+      text += entityText( *part, defaultCodec );
+      text += QLatin1Char( '\n' );
+    }
+  }
+}
+
+QString FullTextIndexBody::textParts( DwEntity &entity, const QTextCodec *defaultCodec )
+{
+  const int type = entityType( entity );
+  if ( type == DwMime::kTypeText )
+    return entityText( entity, defaultCodec );
+  QString text;
+  if ( type == DwMime::kTypeMultipart )
+    appendTextParts( entity.Body().FirstBodyPart(), defaultCodec, text );
+  return text;
+}
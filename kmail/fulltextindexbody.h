@@ -0,0 +1,55 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef KMAIL_FULLTEXTINDEXBODY_H
+#define KMAIL_FULLTEXTINDEXBODY_H
+
+#include <QString>
+
+class DwEntity;
+class QTextCodec;
+
+namespace KMail {
+
+/**
+ * Decides which part of the body of a message the FullTextIndex indexes.
+ *
+ * A "<body>" rule matches against KMMessage::bodyToUnicode(), which only
+ * decodes the transfer encoding of the message itself. Indexing all of it
+ * would add the random words of every line of a base64 encoded attachment.
+ * So the whole body is only indexed if it is plain text; otherwise only the
+ * decoded text parts are, and the index can't decide "<body>" rules for
+ * the message.
+ */
+namespace FullTextIndexBody {
+
+  /** Returns true if bodyToUnicode() of the message @p entity is just
+      text: all of its parts are text parts that are neither base64 nor
+      quoted-printable encoded. A message that is no multipart only needs
+      to be text. */
+  bool isPlainText( DwEntity &entity );
+
+  /** Returns the decoded text of the text parts of @p entity, each of them
+      converted from its charset, or by @p defaultCodec if it has none. */
+  QString textParts( DwEntity &entity, const QTextCodec *defaultCodec );
+
+}
+
+} // namespace KMail
+
+#endif // KMAIL_FULLTEXTINDEXBODY_H
@@ -0,0 +1,107 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "fulltextindexjob.h"
+#include "fulltextindex.h"
+#include "folderstorage.h"
+#include "kmfolder.h"
+#include "kmkernel.h"
+
+#include <kdebug.h>
+
+using namespace KMail;
+
+// Load at most this number of messages in each slotDoWork call (the ones
+// that are indexed already are only looked up)
+#define FULLTEXTINDEXJOB_NRMESSAGES 20
+// And wait this number of milliseconds before calling it again
+#define FULLTEXTINDEXJOB_TIMERINTERVAL 100
+
+FullTextIndexJob::FullTextIndexJob( KMFolder* folder, bool immediate )
+ : ScheduledJob( folder, immediate ), mTimer( this ),
+   mCurrentIndex( 0 ), mFolderOpen( false )
+{
+}
+
+FullTextIndexJob::~FullTextIndexJob()
+{
+}
+
+void FullTextIndexJob::kill()
+{
+  Q_ASSERT( mCancellable );
+  // We must close the folder if we opened it and got interrupted
+  if ( mFolderOpen && mSrcFolder && mSrcFolder->storage() ) {
+    mSrcFolder->storage()->close( "fulltextindex" );
+  }
+
+  FolderJob::kill();
+}
+
+void FullTextIndexJob::execute()
+{
+  kDebug() << "Indexing" << mSrcFolder->idString();
+
+  mOpeningFolder = true; // Ignore open-notifications while opening the folder
+  mSrcFolder->storage()->open( "fulltextindex" );
+  mOpeningFolder = false;
+  mFolderOpen = true;
+  mCurrentIndex = 0;
+
+  connect( &mTimer, SIGNAL( timeout() ), SLOT( slotDoWork() ) );
+  mTimer.start( FULLTEXTINDEXJOB_TIMERINTERVAL );
+  slotDoWork();
+}
+
+void FullTextIndexJob::slotDoWork()
+{
+  // No need to worry about mSrcFolder==0 here. The FolderStorage deletes the jobs on destruction.
+  FullTextIndex *index = kmkernel->fullTextIndex();
+  const int count = mSrcFolder->storage()->count();
+  int loaded = 0;
+  while ( mCurrentIndex < count && loaded < FULLTEXTINDEXJOB_NRMESSAGES ) {
+    if ( index->indexMessage( mSrcFolder, mCurrentIndex ) )
+      ++loaded;
+    ++mCurrentIndex;
+  }
+  if ( mCurrentIndex >= count )
+    done();
+}
+
+void FullTextIndexJob::done()
+{
+  mTimer.stop();
+  mCancellable = false;
+  kmkernel->fullTextIndex()->setFolderComplete( mSrcFolder );
+  kDebug() << "Indexed" << mSrcFolder->idString();
+
+  mSrcFolder->storage()->close( "fulltextindex" );
+  mFolderOpen = false;
+  deleteLater();
+}
+
+ScheduledJob *ScheduledFullTextIndexTask::run()
+{
+  if ( !folder() || !kmkernel->fullTextIndex() ||
+       !FullTextIndex::isIndexable( folder() ) ||
+       kmkernel->fullTextIndex()->isFolderComplete( folder() ) )
+    return 0;
+  return new FullTextIndexJob( folder(), isImmediate() );
+}
+
+#include "fulltextindexjob.moc"
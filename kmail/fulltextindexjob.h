@@ -0,0 +1,68 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef FULLTEXTINDEXJOB_H
+#define FULLTEXTINDEXJOB_H
+
+#include "jobscheduler.h"
+
+#include <QTimer>
+
+namespace KMail {
+
+/**
+ * A job that runs in the background and adds the messages of a folder
+ * that haven't been indexed yet to the FullTextIndex.
+ */
+class FullTextIndexJob : public ScheduledJob
+{
+  Q_OBJECT
+public:
+  /// @p folder should be a folder for which FullTextIndex::isIndexable() is true.
+  FullTextIndexJob( KMFolder* folder, bool immediate );
+  virtual ~FullTextIndexJob();
+
+  virtual void execute();
+  virtual void kill();
+
+private slots:
+  void slotDoWork();
+
+private:
+  void done();
+
+private:
+  QTimer mTimer;
+  int mCurrentIndex;
+  bool mFolderOpen;
+};
+
+/// A scheduled "index the messages of this folder" task.
+class ScheduledFullTextIndexTask : public ScheduledTask
+{
+public:
+  ScheduledFullTextIndexTask( KMFolder* folder, bool immediate )
+    : ScheduledTask( folder, immediate ) {}
+  virtual ~ScheduledFullTextIndexTask() {}
+  virtual ScheduledJob* run();
+  virtual int taskTypeId() const { return 3; }
+};
+
+} // namespace
+
+#endif /* FULLTEXTINDEXJOB_H */
@@ -36,6 +36,7 @@
 
 #include <QByteArray>
 #include "progressmanager.h"
+#include "imapdigestparser.h"
 
 class AccountManager;
 class KMFolder;
@@ -160,6 +161,7 @@ namespace KMail {
       QString curNamespace;
       QByteArray data;
       QByteArray cdata;
+      ImapDigestParser digestParser;  ///< For the listing of the messages of a folder
       QStringList items;
       KMFolder *parent, *current;
       QList<KMMessage*> msgList;
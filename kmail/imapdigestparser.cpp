@@ -0,0 +1,109 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "imapdigestparser.h"
+
+using namespace KMail;
+
+static const char gBoundary[] = "\r\n--IMAPDIGEST";
+static const int gBoundaryLength = sizeof( gBoundary ) - 1;
+// The boundary and the line break after it
+static const int gBoundaryLineLength = gBoundaryLength + 2;
+
+ImapDigestParser::ImapDigestParser()
+  : mPos( 0 ), mScanFrom( 0 ), mPreambleTaken( false )
+{
+}
+
+void ImapDigestParser::feed( const QByteArray &data )
+{
+  if ( data.isEmpty() )
+    return;
+
+  // Drop what has been parsed: usually an incomplete message is left
+  if ( mPos > 0 ) {
+    mBuffer.remove( 0, mPos );
+    mScanFrom -= mPos;
+    mPos = 0;
+  }
+  mBuffer += data;
+}
+
+int ImapDigestParser::findBoundary( int from )
+{
+  from = qMax( from, mScanFrom );
+  const int pos = mBuffer.indexOf( gBoundary, from );
+  if ( pos < 0 ) {
+    // The start of a boundary may have arrived already
+    mScanFrom = qMax( from, mBuffer.size() - gBoundaryLength + 1 );
+  } else {
+    mScanFrom = pos + 1;
+  }
+  return pos;
+}
+
+bool ImapDigestParser::takePreamble( QByteArray &preamble )
+{
+  if ( mPreambleTaken )
+    return false;
+
+  const int pos = findBoundary( 0 );
+  if ( pos < 0 )
+    return false;
+
+  preamble = mBuffer.left( pos );
+  mPos = pos;
+  mPreambleTaken = true;
+  return true;
+}
+
+bool ImapDigestParser::nextEntry( QByteArray &header )
+{
+  if ( !mPreambleTaken )
+    return false;
+
+  const int pos = findBoundary( mPos + 1 );
+  if ( pos < 0 )
+    return false;
+
+  if ( pos - mPos > gBoundaryLineLength )
+    header = mBuffer.mid( mPos + gBoundaryLineLength, pos - mPos - gBoundaryLineLength );
+  else
+    header.clear();
+  mPos = pos;
+  return true;
+}
+
+QByteArray ImapDigestParser::headerValue( const QByteArray &header, const char *name )
+{
+  const int nameLength = qstrlen( name );
+  const char *data = header.constData();
+  int lineStart = 0;
+  while ( lineStart < header.size() ) {
+    int lineEnd = header.indexOf( '\n', lineStart );
+    if ( lineEnd < 0 )
+      lineEnd = header.size();
+    if ( lineEnd - lineStart > nameLength && data[lineStart + nameLength] == ':' &&
+         qstrnicmp( data + lineStart, name, nameLength ) == 0 ) {
+      const int valueStart = lineStart + nameLength + 1;
+      return header.mid( valueStart, lineEnd - valueStart ).trimmed();
+    }
+    lineStart = lineEnd + 1;
+  }
+  return QByteArray();
+}
@@ -0,0 +1,74 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef IMAPDIGESTPARSER_H
+#define IMAPDIGESTPARSER_H
+
+#include <QByteArray>
+
+namespace KMail {
+
+/**
+ * Splits the folder listing that the IMAP kioslave sends to
+ * KMFolderImap::slotGetMessagesData() and
+ * KMFolderCachedImap::slotGetMessagesData() as it arrives.
+ *
+ * The listing is a preamble with information about the folder
+ * (X-uidValidity, X-Access, X-Count, ...) followed by the headers of the
+ * messages, each of them after a "\r\n--IMAPDIGEST\r\n" boundary. A message
+ * is complete once the boundary after it has arrived.
+ *
+ * Each byte is searched only once for the boundaries, whatever the size of
+ * the data that is fed, and the parsed data is dropped on the next feed(),
+ * so that only the incomplete message is kept between two of them.
+ */
+class ImapDigestParser
+{
+public:
+  ImapDigestParser();
+
+  /** Appends @p data, the next part of the listing. */
+  void feed( const QByteArray &data );
+
+  /** Sets @p preamble to the part of the listing before the first
+      boundary and returns true, once, as soon as it is complete. */
+  bool takePreamble( QByteArray &preamble );
+
+  /** Sets @p header to the header of the next complete message and returns
+      true, or returns false if there is none yet. The header is empty if
+      the server sent nothing between two boundaries, like older UW IMAP
+      servers do. The preamble must have been taken first. */
+  bool nextEntry( QByteArray &header );
+
+  /** Returns the value of the field @p name, without the leading and
+      trailing white space, of the header or preamble @p header, or an
+      empty value if it has no such field. */
+  static QByteArray headerValue( const QByteArray &header, const char *name );
+
+private:
+  int findBoundary( int from );
+
+  QByteArray mBuffer;
+  int mPos;           ///< The start of the unparsed data, at a boundary once the preamble was taken
+  int mScanFrom;      ///< Where to resume searching for the next boundary
+  bool mPreambleTaken;
+};
+
+} // namespace KMail
+
+#endif // IMAPDIGESTPARSER_H
@@ -37,6 +37,9 @@
 
 using namespace KMail;
 
+// Number of messages added to a folder in one go
+#define IMPORTJOB_BATCH_SIZE 200
+
 ImportJob::ImportJob( QWidget *parentWidget )
   : QObject( parentWidget ),
     mArchive( 0 ),
@@ -186,25 +189,42 @@ void ImportJob::importNextMessage()
       mProgressItem->setStatus( i18n( "Importing folder %1", mCurrentFolder->name() ) );
   }
 
-  const KArchiveFile *file = messages.files.first();
-  Q_ASSERT( file );
-  messages.files.removeFirst();
+  // Add a batch of messages in one go, so that the folder writes their data
+  // and index entries at once
+  QList<KMMessage*> newMessages;
+  QList<const KArchiveFile*> files;
+  while ( !messages.files.isEmpty() && newMessages.count() < IMPORTJOB_BATCH_SIZE ) {
+    const KArchiveFile *file = messages.files.takeFirst();
+    Q_ASSERT( file );
+    KMMessage *newMessage = new KMMessage();
+    newMessage->fromString( file->data(), true /* setStatus */ );
+    newMessages << newMessage;
+    files << file;
+  }
 
-  KMMessage *newMessage = new KMMessage();
-  newMessage->fromString( file->data(), true /* setStatus */ );
-  int retIndex;
-  if ( mCurrentFolder->addMsg( newMessage, &retIndex ) != 0 ) {
+  QList<int> indexes;
+  if ( mCurrentFolder->appendMessages( newMessages, indexes ) != 0 ) {
+    // Only the messages the folder didn't take over are ours to delete
+    for ( int i = indexes.count(); i < newMessages.count(); ++i )
+      delete newMessages[i];
     abort( i18n( "Failed to add a message to the folder '%1'.", mCurrentFolder->name() ) );
     return;
   }
-  else {
-    mNumberOfImportedMessages++;
+
+  // All messages belong to the folder now
+  mNumberOfImportedMessages += newMessages.count();
+  for ( int i = 0; i < newMessages.count(); ++i ) {
+    // Without an index, the folder may already have deleted the message,
+    // e.g. after uploading it or because it had no data
+    if ( indexes[i] < 0 )
+      continue;
+    KMMessage *newMessage = newMessages[i];
     if ( mCurrentFolder->folderType() == KMFolderTypeMaildir ||
          mCurrentFolder->folderType() == KMFolderTypeCachedImap ) {
       const QString messageFile = mCurrentFolder->location() + "/cur/" + newMessage->fileName();
       // TODO: what if the file is not in the "cur" subdirectory?
       if ( QFile::exists( messageFile ) ) {
-        chmod( messageFile.toLatin1(), file->permissions() );
+        chmod( messageFile.toLatin1(), files[i]->permissions() );
         // TODO: changing user/group he requires a bit more work, requires converting the strings
         //       to uid_t and gid_t
         //getpwnam()
@@ -216,7 +236,10 @@ void ImportJob::importNextMessage()
     }
     // TODO: Else?
     kDebug() << "Added message with subject " /*<< newMessage->subject()*/ // < this causes a pure virtual method to be called...
-             << " to folder " << mCurrentFolder->name() << " at index " << retIndex;
+             << " to folder " << mCurrentFolder->name() << " at index " << indexes[i];
+
+    // Keep only the index entry in memory, not the whole message
+    mCurrentFolder->unGetMsg( indexes[i] );
   }
   QTimer::singleShot( 0, this, SLOT( importNextMessage() ) );
 }
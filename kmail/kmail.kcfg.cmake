@@ -280,6 +280,11 @@
       <entry name="MsgDictSizeHint" type="Int" hidden="true">
         <default>9973</default>
       </entry>
+      <entry name="StringPartCacheSize" type="Int" hidden="true">
+        <whatsthis>The amount of memory in KiB used for caching the subjects, senders and receivers of messages read from folder indexes.</whatsthis>
+        <default>8192</default>
+        <min>0</min>
+      </entry>
       <entry name="PreviousNewFeaturesMD5" type="String" hidden="true">
         <whatsthis>This value is used to decide whether the KMail Introduction should be displayed.</whatsthis>
         <default></default>
@@ -3,112 +3,209 @@
 
 
 #include "kmdict.h"
-#include "kmglobal.h"
-#include <kdebug.h>
+
+#include <QtGlobal>
 
 #include <string.h>
+
+// The table grows when it is more than MAX_LOAD_NUM/MAX_LOAD_DEN full
+#define MAX_LOAD_NUM 3
+#define MAX_LOAD_DEN 4
+#define MIN_SIZE 16
+
 //-----------------------------------------------------------------------------
 
 KMDict::KMDict( int size )
+  : mSlots( 0 )
 {
-  init( ( int ) KMail::nextPrime( size ) );
-  //kDebug() << mSize;
+  int slots = MIN_SIZE;
+  while ( slots < ( 1 << 30 ) &&
+          (qint64)slots * MAX_LOAD_NUM < (qint64)size * MAX_LOAD_DEN )
+    slots *= 2;
+  init( slots );
 }
 
 //-----------------------------------------------------------------------------
 
 KMDict::~KMDict()
 {
-  clear();
+  delete [] mSlots;
 }
 
 //-----------------------------------------------------------------------------
 
 void KMDict::init(int size)
 {
+  delete [] mSlots;
   mSize = size;
-  mVecs = new KMDictItem *[mSize];
-  memset(mVecs, 0, mSize * sizeof(KMDictItem *));
+  mBits = 0;
+  while ( ( 1 << mBits ) < mSize )
+    mBits++;
+  mCount = 0;
+  mSlots = new Slot[mSize];
+  memset(mSlots, 0, mSize * sizeof(Slot));
 }
 
 //-----------------------------------------------------------------------------
 
 void KMDict::clear()
 {
-  if (!mVecs)
-    return;
-  for (int i = 0; i < mSize; i++) {
-    KMDictItem *item = mVecs[i];
-    while (item) {
-      KMDictItem *nextItem = item->next;
-      delete item;
-      item = nextItem;
-    }
+  memset(mSlots, 0, mSize * sizeof(Slot));
+  mCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int KMDict::homeSlot( unsigned long key ) const
+{
+  // Fibonacci hashing: serial numbers are mostly consecutive, this spreads
+  // them over the whole table
+  return (int)( ( (quint64)key * Q_UINT64_C( 0x9E3779B97F4A7C15 ) ) >> ( 64 - mBits ) );
+}
+
+//-----------------------------------------------------------------------------
+
+int KMDict::findSlot( unsigned long key ) const
+{
+  if ( key == 0 )
+    return -1;
+  const int mask = mSize - 1;
+  for ( int i = homeSlot( key ); mSlots[i].key; i = ( i + 1 ) & mask ) {
+    if ( mSlots[i].key == key )
+      return i;
   }
-  delete [] mVecs;
-  mVecs = 0;
+  return -1;
 }
 
 //-----------------------------------------------------------------------------
 
-void KMDict::replace( long key, KMDictItem *item )
+void KMDict::rehash( int size )
 {
-  insert( key, item );
-  removeFollowing( item, key );           // remove other items with same key
+  Slot *oldSlots = mSlots;
+  const int oldSize = mSize;
+  mSlots = 0;
+  init( size );
+
+  const int mask = mSize - 1;
+  for ( int j = 0; j < oldSize; j++ ) {
+    if ( !oldSlots[j].key )
+      continue;
+    int i = homeSlot( oldSlots[j].key );
+    while ( mSlots[i].key )
+      i = ( i + 1 ) & mask;
+    mSlots[i] = oldSlots[j];
+    mCount++;
+  }
+  delete [] oldSlots;
 }
 
 //-----------------------------------------------------------------------------
 
+void KMDict::replace( unsigned long key, const KMFolder *folder, int index )
+{
+  if ( key == 0 )
+    return;
+  if ( (qint64)( mCount + 1 ) * MAX_LOAD_DEN > (qint64)mSize * MAX_LOAD_NUM )
+    rehash( mSize * 2 );
+
+  const int mask = mSize - 1;
+  int i = homeSlot( key );
+  while ( mSlots[i].key && mSlots[i].key != key )
+    i = ( i + 1 ) & mask;
+  if ( !mSlots[i].key ) {
+    mSlots[i].key = key;
+    mCount++;
+  }
+  mSlots[i].folder = folder;
+  mSlots[i].index = index;
+}
 
-void KMDict::insert( long key, KMDictItem *item )
+//-----------------------------------------------------------------------------
+
+void KMDict::reserve( int count )
 {
-  item->key = key;
-  int idx = (unsigned long)key % mSize; // insert in
-  item->next = mVecs[idx];              // appropriate
-  mVecs[idx] = item;                    // column
+  int size = mSize;
+  while ( size < ( 1 << 30 ) &&
+          (qint64)size * MAX_LOAD_NUM < (qint64)count * MAX_LOAD_DEN )
+    size *= 2;
+  if ( size != mSize )
+    rehash( size );
 }
 
 //-----------------------------------------------------------------------------
 
-void KMDict::remove(long key)
+bool KMDict::insert( const unsigned long *keys, int count, const KMFolder *folder )
 {
-  int idx = (unsigned long)key % mSize;
-  KMDictItem *item = mVecs[idx];
-
-  if (item) {
-    if (item->key == key) {             // if first in the column
-      mVecs[idx] = item->next;
-      delete item;
-    } else
-      removeFollowing(item, key);       // if deep in the column
+  reserve( mCount + count );
+
+  const int mask = mSize - 1;
+  for ( int j = 0; j < count; j++ ) {
+    const unsigned long key = keys[j];
+    if ( key == 0 )
+      continue;
+    int i = homeSlot( key );
+    while ( mSlots[i].key && mSlots[i].key != key )
+      i = ( i + 1 ) & mask;
+    if ( mSlots[i].key ) {
+      // Take back what was inserted so far
+      for ( int k = 0; k < j; k++ )
+        remove( keys[k] );
+      return false;
+    }
+    mSlots[i].key = key;
+    mSlots[i].folder = folder;
+    mSlots[i].index = j;
+    mCount++;
   }
+  return true;
 }
 
 //-----------------------------------------------------------------------------
 
-void KMDict::removeFollowing(KMDictItem *item, long key)
+void KMDict::remove( unsigned long key )
 {
-  while (item) {
-    KMDictItem *itemNext = item->next;
-    if (itemNext && itemNext->key == key) {
-      KMDictItem *itemNextNext = itemNext->next;
-      delete itemNext;
-      item->next = itemNextNext;
-    } else
-      item = itemNext;
+  int i = findSlot( key );
+  if ( i < 0 )
+    return;
+
+  // Move back the following items which would not be found any more with
+  // the slot emptied, so that no markers of removed items are needed
+  const int mask = mSize - 1;
+  for ( int j = ( i + 1 ) & mask; mSlots[j].key; j = ( j + 1 ) & mask ) {
+    const int home = homeSlot( mSlots[j].key );
+    const bool stays = ( i <= j ) ? ( i < home && home <= j )
+                                  : ( i < home || home <= j );
+    if ( !stays ) {
+      mSlots[i] = mSlots[j];
+      i = j;
+    }
   }
+  mSlots[i].key = 0;
+  mSlots[i].folder = 0;
+  mSlots[i].index = 0;
+  mCount--;
 }
 
 //-----------------------------------------------------------------------------
 
-KMDictItem *KMDict::find(long key)
+bool KMDict::find( unsigned long key, const KMFolder **folder, int *index ) const
 {
-  int idx = (unsigned long)key % mSize;
-  KMDictItem *item = mVecs[idx];
-  while (item) {
-    if (item->key == key)
-      break;
-    item = item->next;
+  const int i = findSlot( key );
+  if ( i < 0 ) {
+    *folder = 0;
+    *index = -1;
+    return false;
   }
-  return item;
+  *folder = mSlots[i].folder;
+  *index = mSlots[i].index;
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void KMDict::setIndex( unsigned long key, int index )
+{
+  const int i = findSlot( key );
+  if ( i >= 0 )
+    mSlots[i].index = index;
 }
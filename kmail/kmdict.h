@@ -5,21 +5,18 @@
 #ifndef __KMDICT
 #define __KMDICT
 
-/**
- * @short Class representing items in a KMDict
- */
-class KMDictItem
-{
-public:
-  long key;
-  KMDictItem *next;
-};
+class KMFolder;
 
 /**
  * @short KMDict implements a lightweight dictionary with serial numbers as keys.
  *
- * KMDict is a leightweight dictionary used exclusively by KMMsgDict. It uses
- * serial numbers as keys.
+ * KMDict is a leightweight dictionary used exclusively by KMMsgDict. It maps
+ * message serial numbers to the folder and index of the message.
+ *
+ * The entries are kept in a single array, using open addressing with linear
+ * probing, so that a lookup usually touches one cache line and no entry
+ * is allocated on its own. The array doubles in size whenever it becomes
+ * three quarters full. Serial number 0 is never used and marks empty slots.
  *
  * @author  Ronen Tzur <rtzur@shani.net>
  */
@@ -27,8 +24,8 @@ class KMDict
 {
   friend class MessageDictTester;
 public:
-  /** Creates a hash table with @p size columns. */
-  KMDict(int size = 17);
+  /** Creates a hash table for about @p size entries. */
+  explicit KMDict(int size = 17);
 
   /** Destroys the hash table object. */
   ~KMDict();
@@ -36,33 +33,67 @@ public:
   /** Clears the hash table, removing all items. */
   void clear();
 
-  /** Returns the size of the hash table. */
-  int size() { return mSize; }
+  /** Returns the number of slots of the hash table. */
+  int size() const { return mSize; }
+
+  /** Returns the number of items in the hash table. */
+  int count() const { return mCount; }
+
+  /** Inserts an item, replacing an old one with the same key. */
+  void replace(unsigned long key, const KMFolder *folder, int index);
 
-  /** Inserts an item, replacing old ones with the same key. */
-  void replace(long key, KMDictItem *item);
+  /** Inserts the items @p keys[i] -> (@p folder, i) for all i < @p count,
+      skipping keys which are 0. Returns false, and inserts nothing, if one
+      of the keys is already in the hash table or appears twice. */
+  bool insert(const unsigned long *keys, int count, const KMFolder *folder);
 
-  /** Inserts an item without replacing ones with the same key. */
-  void insert(long key, KMDictItem *item);
+  /** Makes room for @p count items without growing again. */
+  void reserve(int count);
 
   /** Removes an item. */
-  void remove(long key);
+  void remove(unsigned long key);
 
-  /** Find an item by key.  Returns pointer to it, or 0 if not found. */
-  KMDictItem *find(long key);
+  /** Returns whether there is an item with the given key. */
+  bool contains(unsigned long key) const { return findSlot(key) >= 0; }
+
+  /** Finds an item by key. Returns false, and sets @p folder to 0 and
+      @p index to -1, if there is none. */
+  bool find(unsigned long key, const KMFolder **folder, int *index) const;
+
+  /** Changes the index of the item with the given key, if there is one. */
+  void setIndex(unsigned long key, int index);
 
 private:
-  /** Removes all items _following_ @p item with key @p key. */
-  void removeFollowing(KMDictItem *item, long key);
+  struct Slot
+  {
+    unsigned long key;
+    const KMFolder *folder;
+    int index;
+  };
+
+  /** Returns the slot holding @p key, or -1. */
+  int findSlot(unsigned long key) const;
+
+  /** Returns the slot at which the search for @p key starts. */
+  int homeSlot(unsigned long key) const;
 
-  /** Initializes the hash table to @p size columns. */
+  /** Initializes the hash table to @p size slots, a power of two. */
   void init(int size);
 
-  /** The size of the hash. */
+  /** Moves the items into a hash table of @p size slots. */
+  void rehash(int size);
+
+  /** The number of slots, a power of two. */
   int mSize;
 
-  /** The buckets. */
-  KMDictItem **mVecs;
+  /** log2(mSize) */
+  int mBits;
+
+  /** The number of items. */
+  int mCount;
+
+  /** The slots. */
+  Slot *mSlots;
 };
 
 #endif /* __KMDICT */
@@ -1529,6 +1529,11 @@ KMFilterAction::ReturnCode KMFilterActionCopy::process( KMMessage *msg ) const
 void KMFilterActionCopy::processAsync( KMMessage *msg ) const
 {
   ActionScheduler *handler = MessageProperty::filterHandler( msg );
+  if ( handler && handler->queueCopy( mFolder, msg ) ) {
+    // copied together with the other messages of the batch
+    handler->actionMessage();
+    return;
+  }
 
   KMCommand *cmd = new KMCopyCommand( mFolder, msg );
   QObject::connect( cmd, SIGNAL( completed( KMCommand * ) ),
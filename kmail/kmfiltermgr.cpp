@@ -7,6 +7,8 @@
 // other kmail headers
 #include "filterlog.h"
 using KMail::FilterLog;
+#include "filtermatcher.h"
+using KMail::FilterMatcher;
 #include "kmfilterdlg.h"
 #include "kmfolderindex.h"
 #include "filterimporterexporter.h"
@@ -32,6 +34,7 @@ using KMail::MessageProperty;
 //-----------------------------------------------------------------------------
 KMFilterMgr::KMFilterMgr( bool popFilter )
   : mEditDialog( 0 ),
+    mMatcher( 0 ),
     bPopFilter( popFilter ),
     mShowLater( false ),
     mDirtyBufferedFolderTarget( true ),
@@ -57,6 +60,8 @@ KMFilterMgr::~KMFilterMgr()
 void KMFilterMgr::clear()
 {
   mDirtyBufferedFolderTarget = true;
+  delete mMatcher;
+  mMatcher = 0;
   qDeleteAll( mFilters );
   mFilters.clear();
 }
@@ -231,8 +236,16 @@ int KMFilterMgr::process( KMMessage * msg, FilterSet set,
 
   if (!beginFiltering( msg ))
     return 1;
+
+  // The filter log wants to see every rule being evaluated
+  const bool logging = FilterLog::instance()->isLogging();
+  if ( !mMatcher )
+    mMatcher = new FilterMatcher( mFilters );
+  FilterMatcher::Message matcherMsg( mMatcher, msg );
+
+  int filterIdx = 0;
   for ( QList<KMFilter*>::const_iterator it = mFilters.constBegin();
-        !stopIt && it != mFilters.constEnd() ; ++it ) {
+        !stopIt && it != mFilters.constEnd() ; ++it, ++filterIdx ) {
 
     if ( ( ( (set&Inbound) && (*it)->applyOnInbound() ) &&
          ( !account ||
@@ -242,12 +255,14 @@ int KMFilterMgr::process( KMMessage * msg, FilterSet set,
          ( (set&Explicit) && (*it)->applyOnExplicit() ) ) {
         // filter is applicable
 
-      if ( isMatching( msg, (*it) ) ) {
+      if ( logging ? isMatching( msg, (*it) ) : mMatcher->matches( filterIdx, matcherMsg ) ) {
         // filter matches
         atLeastOneRuleMatched = true;
         // execute actions:
         if ( (*it)->execActions(msg, stopIt) == KMFilter::CriticalError )
           return 2;
+        // they may have changed the message
+        matcherMsg.reset();
       }
     }
   }
@@ -449,6 +464,8 @@ void KMFilterMgr::appendFilters( const QList<KMFilter*> &filters,
                                  bool replaceIfNameExists )
 {
   mDirtyBufferedFolderTarget = true;
+  delete mMatcher;
+  mMatcher = 0;
   beginUpdate();
   if ( replaceIfNameExists ) {
     QList<KMFilter*>::const_iterator it1 = filters.constBegin();
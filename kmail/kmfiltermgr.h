@@ -25,6 +25,9 @@
 
 class KMFilter;
 class KMFilterDlg;
+namespace KMail {
+  class FilterMatcher;
+}
 
 class KMFilterMgr: public QObject
 {
@@ -186,6 +189,8 @@ private:
   QPointer<KMFilterDlg> mEditDialog;
   QVector<KMFolder *> mOpenFolders;
   QList<KMFilter *> mFilters;
+  /** The patterns of mFilters compiled for process(), built when needed */
+  KMail::FilterMatcher *mMatcher;
   bool bPopFilter;
   bool mShowLater;
   bool mDirtyBufferedFolderTarget;
@@ -299,6 +299,11 @@ QString KMFolder::sortedLocation() const
   return mStorage ? mStorage->sortedLocation() : QString();
 }
 
+QString KMFolder::threadingLocation() const
+{
+  return mStorage ? mStorage->threadingLocation() : QString();
+}
+
 QString KMFolder::idsLocation() const
 {
   return mStorage ? mStorage->idsLocation() : QString();
@@ -458,6 +463,11 @@ int KMFolder::addMessages( QList<KMMessage*>& list, QList<int>& index_return )
   return mStorage->addMessages( list, index_return );
 }
 
+int KMFolder::appendMessages( const QList<KMMessage*>& list, QList<int>& index_return )
+{
+  return mStorage->appendMessages( list, index_return );
+}
+
 void KMFolder::emitMsgAddedSignals( int idx )
 {
   mStorage->emitMsgAddedSignals( idx );
@@ -163,6 +163,9 @@ public:
   /** Returns full path to 'sorted' file */
   virtual QString sortedLocation() const;
 
+  /** Returns full path to the file caching the threading of the message list */
+  virtual QString threadingLocation() const;
+
   /** Returns full path to sub directory file */
   QString subdirLocation() const;
 
@@ -269,6 +272,10 @@ public:
    */
   int addMessages(QList<KMMessage*>&, QList<int>& index_return);
 
+  /** Appends messages which don't belong to any folder yet as one
+      transaction. See FolderStorage::appendMessages(). */
+  int appendMessages(const QList<KMMessage*>& list, QList<int>& index_return);
+
   /** Called by derived classes implementation of addMsg.
       Emits msgAdded signals */
   void emitMsgAddedSignals(int idx);
@@ -57,6 +57,7 @@ using KMail::ListJob;
 #include "quotajobs.h"
 #include "groupwareadaptor.h"
 #include "autoqpointer.h"
+#include "cachedimapstatusupload.h"
 using namespace KMail;
 
 #include <kio/jobuidelegate.h>
@@ -572,6 +573,11 @@ int KMFolderCachedImap::addMsg( KMMessage *msg, int *index_return )
   return rc;
 }
 
+int KMFolderCachedImap::appendMessages( const QList<KMMessage*> &msgList, QList<int> &index_return )
+{
+  return KMFolderMaildir::appendMessagesInternal( msgList, index_return, true /*stripUID*/ );
+}
+
 void KMFolderCachedImap::rememberDeletion( int idx )
 {
   KMMsgBase *msg = getMsgBase( idx );
@@ -1456,6 +1462,34 @@ void KMFolderCachedImap::slotPutProgress( unsigned long done, unsigned long tota
   }
 }
 
+QList<KMMsgBase*> KMFolderCachedImap::messagesWithLocallyChangedStatus()
+{
+  QList<KMMsgBase*> msgs;
+  if ( mStatusChangedLocally ) {
+    // Set by older versions: upload the status of all the messages
+    for ( int i = 0; i < count(); ++i ) {
+      KMMsgBase *msg = getMsgBase( i );
+      if ( msg && msg->UID() != 0 ) { // not a new message
+        msgs.append( msg );
+      }
+    }
+    return msgs;
+  }
+
+  if ( uidMapDirty ) {
+    reloadUidMap();
+  }
+  const QList<ulong> uids =
+    KMail::CachedImapStatusUpload::uidsToUpload( mUIDsOfLocallyChangedStatuses, uidMap );
+  foreach ( const ulong uid, uids ) {
+    KMMsgBase *msg = findByUID( uid );
+    if ( msg ) {
+      msgs.append( msg );
+    }
+  }
+  return msgs;
+}
+
 /* Upload message flags to server */
 void KMFolderCachedImap::uploadFlags()
 {
@@ -1466,17 +1500,7 @@ void KMFolderCachedImap::uploadFlags()
     // FIXME DUPLICATED FROM KMFOLDERIMAP
     QMap< QString, QStringList > groups;
     //open(); //already done
-    for ( int i = 0; i < count(); ++i ) {
-      KMMsgBase *msg = getMsgBase( i );
-      if ( !msg || msg->UID() == 0 ) {
-        // Either not a valid message or not one that is on the server yet
-        continue;
-      }
-      if ( !mUIDsOfLocallyChangedStatuses.contains( msg->UID() ) && !mStatusChangedLocally ) {
-        // This message has not had its status changed locally
-        continue;
-      }
-
+    foreach ( KMMsgBase *msg, messagesWithLocallyChangedStatus() ) {
       QString flags = KMFolderImap::statusToFlags( msg->status(), mPermanentFlags );
       // Collect uids for each typem of flags.
       QString uid;
@@ -1513,17 +1537,7 @@ void KMFolderCachedImap::uploadSeenFlags()
     newState( mProgress, i18n("Uploading status of messages to server"));
 
     QList<ulong> seenUids, unseenUids;
-    for( int i = 0; i < count(); ++i ) {
-      KMMsgBase* msg = getMsgBase( i );
-      if( !msg || msg->UID() == 0 )
-        // Either not a valid message or not one that is on the server yet
-        continue;
-
-      if ( !mUIDsOfLocallyChangedStatuses.contains( msg->UID() ) && !mStatusChangedLocally ) {
-        // This message has not had its status changed locally
-        continue;
-      }
-
+    foreach ( KMMsgBase *msg, messagesWithLocallyChangedStatus() ) {
       if ( msg->status().isOld() || msg->status().isRead() )
         seenUids.append( msg->UID() );
       else
@@ -1800,15 +1814,13 @@ void KMFolderCachedImap::slotGetMessagesData( KIO::Job  *job, const QByteArray
     serverSyncInternal(); /* HACK^W Fix: we should at least try to keep going */
     return;
   }
-  (*it).cdata += data;
-  int pos = (*it).cdata.indexOf("\r\n--IMAPDIGEST");
-  if ( pos > 0 ) {
-    int a = (*it).cdata.indexOf("\r\nX-uidValidity:");
-    if (a != -1) {
-      int b = (*it).cdata.indexOf("\r\n", a + 17);
-      setUidValidity((*it).cdata.mid(a + 17, b - a - 17));
-    }
-    a = (*it).cdata.indexOf("\r\nX-Access:");
+  KMail::ImapDigestParser &parser = (*it).digestParser;
+  parser.feed( data );
+  QByteArray preamble;
+  if ( parser.takePreamble( preamble ) && !preamble.isEmpty() ) {
+    const QByteArray uidValidity = KMail::ImapDigestParser::headerValue( preamble, "X-uidValidity" );
+    if ( !uidValidity.isEmpty() )
+      setUidValidity( uidValidity );
 
     /*
      * Only trust X-Access (i.e. the imap select info) if we don't know
@@ -1818,42 +1830,28 @@ void KMFolderCachedImap::slotGetMessagesData( KIO::Job  *job, const QByteArray
      * We don't need two (potentially conflicting) sources for the
      * readonly setting, in any case.
      */
-    if ( a != -1 && mUserRights == -1 ) {
-      int b = (*it).cdata.indexOf( "\r\n", a + 12 );
-      const QString access = (*it).cdata.mid( a + 12, b - a - 12 );
+    const QByteArray access = KMail::ImapDigestParser::headerValue( preamble, "X-Access" );
+    if ( !access.isEmpty() && mUserRights == -1 ) {
       setReadOnly( access == "Read only" );
     }
-    (*it).cdata.remove( 0, pos );
     mFoundAnIMAPDigest = true;
   }
-  pos = (*it).cdata.indexOf( "\r\n--IMAPDIGEST", 1 );
 
   // Start with something largish when rebuilding the cache
   if ( uidsOnServer.size() == 0 ) {
     uidsOnServer.reserve( KMail::nextPrime( 2000 ) );
   }
 
-  while ( pos >= 0 ) {
-      /*
-    KMMessage msg;
-    msg.fromString((*it).cdata.mid(16, pos - 16));
-    const int flags = msg.headerField("X-Flags").toInt();
-    const ulong size = msg.headerField("X-Length").toULong();
-    const ulong uid = msg.UID();
-       */
-    // The below is optimized for speed, not prettiness. The commented out chunk
-    // above was the solution copied from kmfolderimap, and it's 15-20% slower.
-    const QByteArray& entry( (*it).cdata );
-    const int indexOfUID = entry.indexOf("X-UID", 16);
-    const int startOfUIDValue = indexOfUID  + 7;
-    const int indexOfLength = entry.indexOf("X-Length", startOfUIDValue ); // we know length comes after UID
-    const int startOfLengthValue = indexOfLength + 10;
-    const int indexOfFlags = entry.indexOf("X-Flags", startOfLengthValue ); // we know flags comes last
-    const int startOfFlagsValue = indexOfFlags + 9;
-
-    const int flags = entry.mid( startOfFlagsValue, entry.indexOf( '\r', startOfFlagsValue ) - startOfFlagsValue ).toInt();
-    const ulong size = entry.mid( startOfLengthValue, entry.indexOf( '\r', startOfLengthValue ) - startOfLengthValue ).toULong();
-    const ulong uid = entry.mid( startOfUIDValue, entry.indexOf( '\r', startOfUIDValue ) - startOfUIDValue ).toULong();
+  QByteArray entry;
+  while ( parser.nextEntry( entry ) ) {
+    (*it).done++;
+    // nothing between the boundaries, older UWs do that
+    if ( entry.isEmpty() )
+      continue;
+
+    const int flags = KMail::ImapDigestParser::headerValue( entry, "X-Flags" ).toInt();
+    const ulong size = KMail::ImapDigestParser::headerValue( entry, "X-Length" ).toULong();
+    const ulong uid = KMail::ImapDigestParser::headerValue( entry, "X-UID" ).toULong();
 
     const bool deleted = ( flags & 8 );
 
@@ -1935,9 +1933,6 @@ void KMFolderCachedImap::slotGetMessagesData( KIO::Job  *job, const QByteArray
         }
       }
     }
-    (*it).cdata.remove( 0, pos );
-    (*it).done++;
-    pos = (*it).cdata.indexOf( "\r\n--IMAPDIGEST", 1 );
   }
 }
 
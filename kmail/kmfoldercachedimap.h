@@ -248,6 +248,9 @@ class KMFolderCachedImap : public KMFolderMaildir
     /** Reimplemented from KMFolderMaildir */
     virtual int addMsg( KMMessage *msg, int *index_return = 0 );
 
+    /** Reimplemented from KMFolderMaildir, strips the UIDs like addMsg() */
+    virtual int appendMessages( const QList<KMMessage*> &msgList, QList<int> &index_return );
+
 
     /**
       Adds a message without clearing it's X-UID field.
@@ -288,6 +291,12 @@ class KMFolderCachedImap : public KMFolderMaildir
       return result;
     }
 
+    virtual int updateIndexFromContents() {
+      const int result = KMFolderMaildir::updateIndexFromContents();
+      reloadUidMap();
+      return result;
+    }
+
     int createIndexFromContentsRecursive();
 
     /**
@@ -441,6 +450,8 @@ class KMFolderCachedImap : public KMFolderMaildir
     void listMessages();
 
     void uploadNewMessages();
+    /** The messages whose status has to be uploaded to the server. */
+    QList<KMMsgBase*> messagesWithLocallyChangedStatus();
     void uploadFlags();
     void uploadSeenFlags();
     void createNewFolders();
@@ -1577,31 +1577,23 @@ void KMFolderImap::slotGetMessagesData( KIO::Job *job, const QByteArray &data )
   if ( it == account()->jobsEnd() ) {
     return;
   }
-  (*it).cdata += data;
-  int pos = (*it).cdata.indexOf( "\r\n--IMAPDIGEST" );
-  if ( pos == -1 ) {
-    // if we do not find the pattern in the complete string we will not find
-    // it in a substring.
-    return;
-  }
-  if (pos > 0) {
-    int p = (*it).cdata.indexOf( "\r\nX-uidValidity:" );
-    if ( p != -1 ) {
-      setUidValidity(
-        (*it).cdata.mid( p+17, (*it).cdata.indexOf( "\r\n", p+1 ) - p - 17 ) );
+  KMail::ImapDigestParser &parser = (*it).digestParser;
+  parser.feed( data );
+  QByteArray preamble;
+  if ( parser.takePreamble( preamble ) && !preamble.isEmpty() ) {
+    const QByteArray uidValidity = KMail::ImapDigestParser::headerValue( preamble, "X-uidValidity" );
+    if ( !uidValidity.isEmpty() ) {
+      setUidValidity( uidValidity );
     }
-    int c = (*it).cdata.indexOf( "\r\nX-Count:" );
-    if ( c != -1 ) {
+    const QByteArray xCount = KMail::ImapDigestParser::headerValue( preamble, "X-Count" );
+    if ( !xCount.isEmpty() ) {
       bool ok;
-      int exists =
-        (*it).cdata.mid(
-          c+10, (*it).cdata.indexOf( "\r\n", c+1 ) - c - 10 ).toInt( &ok );
+      int exists = xCount.toInt( &ok );
       if ( ok && exists < count() ) {
         kDebug() << "Server has less messages (" << exists
                      << ") than folder (" << count() << "), so reload";
         open( "getMessage" );
         reallyGetFolder( QString() );
-        (*it).cdata.remove( 0, pos );
         return;
       } else if ( ok ) {
         int delta = exists - count();
@@ -1610,102 +1602,130 @@ void KMFolderImap::slotGetMessagesData( KIO::Job *job, const QByteArray &data )
         }
       }
     }
-    (*it).cdata.remove( 0, pos );
   }
-  pos = (*it).cdata.indexOf( "\r\n--IMAPDIGEST", 1 );
-  int flags;
-  while (pos >= 0) {
+  // Collect the new messages of this part of the listing, to add them in one go
+  QByteArray entry;
+  QList<KMMessage*> newMsgs;
+  QList<int> newFlags;
+  QList<bool> newInCache;
+  while ( parser.nextEntry( entry ) ) {
+    (*it).done++;
+    // nothing between the boundaries, older UWs do that
+    if ( entry.isEmpty() )
+      continue;
     KMMessage *msg = new KMMessage;
     msg->setComplete( false );
     msg->setReadyToShow( false );
-    // nothing between the boundaries, older UWs do that
-    if ( pos != 14 ) {
-      msg->fromString( (*it).cdata.mid(16, pos - 16) );
-      flags = msg->headerField( "X-Flags" ).toInt();
-      ulong uid = msg->UID();
-      KMMsgMetaData *md =  0;
-      if ( mUidMetaDataMap.contains( uid ) ) {
-        md =  mUidMetaDataMap[uid];
-      }
-      ulong serNum = 0;
-      bool serialNumberInCache = false;
-      if ( md ) {
-        serNum = md->serNum();
-        serialNumberInCache = true;
-      }
-      bool ok = true;
-      if ( uid <= lastUid() && serNum > 0 ) {
-        // the UID is already known so no need to create it
-        ok = false;
-      }
-      // deleted flag
-      if ( flags & 8 )
-        ok = false;
-      if ( !ok ) {
-        delete msg;
-        msg = 0;
-      } else {
-        if ( serNum > 0 ) {
-          // assign the sernum from the cache
-          msg->setMsgSerNum( serNum );
-        }
-        // Transfer the status, if it is cached.
-        if ( md ) {
-          msg->setStatus( md->messageStatus() );
-        } else if ( !account()->hasCapability("uidplus") ) {
-          // see if we have cached the msgIdMD5 and get the status +
-          // serial number from there
-          QString id = msg->msgIdMD5();
-          if ( mMetaDataMap.contains( id ) ) {
-            md =  mMetaDataMap[id];
-            msg->setStatus( md->messageStatus() );
-            if ( md->serNum() != 0 && serNum == 0 ) {
-              msg->setMsgSerNum( md->serNum() );
-              serialNumberInCache = true;
-            }
-            delete mMetaDataMap.take( id );
-          }
-        }
-        KMFolderMbox::addMsg(msg, 0);
-        // Merge with the flags from the server.
-        flagsToStatus((KMMsgBase*)msg, flags, true, mUploadAllFlags ? 31 : mPermanentFlags);
-        // set the correct size
-        msg->setMsgSizeServer( msg->headerField("X-Length").toUInt() );
-        msg->setUID(uid);
-        if ( msg->getMsgSerNum() > 0 ) {
-          saveMsgMetaData( msg );
-        }
-        // Filter messages that have arrived in the inbox folder
-        if ( folder()->isSystemFolder() && imapPath() == "/INBOX/"
-            && kmkernel->filterMgr()->atLeastOneIncomingFilterAppliesTo( account()->id() ) ) {
-
-          // If the message was already in one of the maps (mMetaDataMap or
-          // mUidMetaDataMap, depending on whether UIDPLUS is supported by the
-          // server), don't filter this message, since it means that the message
-          // was likely uploaded by ourselves.
-          //
-          // This fixes a bug when an already filtered message was filtered again,
-          // because after uploading the filtered message, KMail thought that message
-          // was new and filtered it again.
-          if ( !serialNumberInCache ) {
-            account()->execFilters( msg->getMsgSerNum() );
-          }
+    msg->fromString( entry );
+    const int flags = msg->headerField( "X-Flags" ).toInt();
+    ulong uid = msg->UID();
+    KMMsgMetaData *md =  0;
+    if ( mUidMetaDataMap.contains( uid ) ) {
+      md =  mUidMetaDataMap[uid];
+    }
+    ulong serNum = 0;
+    bool serialNumberInCache = false;
+    if ( md ) {
+      serNum = md->serNum();
+      serialNumberInCache = true;
+    }
+    bool ok = true;
+    if ( uid <= lastUid() && serNum > 0 ) {
+      // the UID is already known so no need to create it
+      ok = false;
+    }
+    // deleted flag
+    if ( flags & 8 )
+      ok = false;
+    if ( !ok ) {
+      delete msg;
+      continue;
+    }
+    if ( serNum > 0 ) {
+      // assign the sernum from the cache
+      msg->setMsgSerNum( serNum );
+    }
+    // Transfer the status, if it is cached.
+    if ( md ) {
+      msg->setStatus( md->messageStatus() );
+    } else if ( !account()->hasCapability("uidplus") ) {
+      // see if we have cached the msgIdMD5 and get the status +
+      // serial number from there
+      QString id = msg->msgIdMD5();
+      if ( mMetaDataMap.contains( id ) ) {
+        md =  mMetaDataMap[id];
+        msg->setStatus( md->messageStatus() );
+        if ( md->serNum() != 0 && serNum == 0 ) {
+          msg->setMsgSerNum( md->serNum() );
+          serialNumberInCache = true;
         }
+        delete mMetaDataMap.take( id );
+      }
+    }
+    newMsgs << msg;
+    newFlags << flags;
+    newInCache << serialNumberInCache;
+  }
+  if ( newMsgs.isEmpty() ) {
+    return;
+  }
 
-        if ( count() > 1 ) {
-          unGetMsg(count() - 1);
-        }
-        mLastUid = uid;
-        if ( mMailCheckProgressItem ) {
-          mMailCheckProgressItem->incCompletedItems();
-          mMailCheckProgressItem->updateProgress();
-        }
+  // Write the messages and their index entries at once, instead of flushing
+  // the folder file and the index for every message. This must not upload
+  // them, which addMsg() of this class would do.
+  QList<int> indexes;
+  if ( KMFolderMbox::appendMessagesInternal( newMsgs, indexes ) != 0 ) {
+    kWarning() << "Could not add" << newMsgs.count() - indexes.count()
+               << "messages to folder" << label();
+  }
+  const bool filterNew = folder()->isSystemFolder() && imapPath() == "/INBOX/"
+      && kmkernel->filterMgr()->atLeastOneIncomingFilterAppliesTo( account()->id() );
+  for ( int i = 0; i < indexes.count(); ++i ) {
+    // The folder deleted the messages without data
+    if ( indexes[i] < 0 ) {
+      continue;
+    }
+    KMMessage *msg = newMsgs[i];
+    const ulong uid = msg->UID();
+    // Merge with the flags from the server.
+    flagsToStatus((KMMsgBase*)msg, newFlags[i], true, mUploadAllFlags ? 31 : mPermanentFlags);
+    // set the correct size
+    msg->setMsgSizeServer( msg->headerField("X-Length").toUInt() );
+    msg->setUID(uid);
+    if ( msg->getMsgSerNum() > 0 ) {
+      saveMsgMetaData( msg );
+    }
+    // Filter messages that have arrived in the inbox folder
+    if ( filterNew ) {
+      // If the message was already in one of the maps (mMetaDataMap or
+      // mUidMetaDataMap, depending on whether UIDPLUS is supported by the
+      // server), don't filter this message, since it means that the message
+      // was likely uploaded by ourselves.
+      //
+      // This fixes a bug when an already filtered message was filtered again,
+      // because after uploading the filtered message, KMail thought that message
+      // was new and filtered it again.
+      if ( !newInCache[i] ) {
+        account()->execFilters( msg->getMsgSerNum() );
       }
     }
-    (*it).cdata.remove(0, pos);
-    (*it).done++;
-    pos = (*it).cdata.indexOf("\r\n--IMAPDIGEST", 1);
-  } // while
+
+    if ( count() > 1 ) {
+      unGetMsg( indexes[i] );
+    }
+    mLastUid = uid;
+    if ( mMailCheckProgressItem ) {
+      mMailCheckProgressItem->incCompletedItems();
+    }
+  }
+  if ( mMailCheckProgressItem ) {
+    mMailCheckProgressItem->updateProgress();
+  }
+  // The messages the folder did not take are listed again next time, as
+  // mLastUid stays before them
+  for ( int i = indexes.count(); i < newMsgs.count(); ++i ) {
+    delete newMsgs[i];
+  }
 }
 
 //-------------------------------------------------------------
@@ -17,6 +17,7 @@
 */
 
 #include "kmfolderindex_common.cpp"
+#include "stringpartcache.h"
 
 #ifdef HAVE_MMAP
 #include <sys/mman.h>
@@ -52,6 +53,7 @@ KMFolderIndex::KMFolderIndex(KMFolder* folder, const char* name)
     mIndexStreamPtrLength = 0;
     mIndexSwapByteOrder = false;
     mIndexSizeOfLong = sizeof(long);
+    mIndexVersion = INDEX_VERSION;
     mIndexId = 0;
     mHeaderOffset   = 0;
 }
@@ -59,6 +61,7 @@ KMFolderIndex::KMFolderIndex(KMFolder* folder, const char* name)
 
 KMFolderIndex::~KMFolderIndex()
 {
+  KMail::StringPartCache::instance()->invalidate( this );
 }
 
 int KMFolderIndex::updateIndex( bool aboutToClose )
@@ -183,6 +186,7 @@ int KMFolderIndex::writeIndex( bool createEmptyIndex )
   if ( KDE_rename(QFile::encodeName(tempName), QFile::encodeName(indexName)) != 0 )
     return errno;
   mHeaderOffset = nho;
+  mIndexVersion = INDEX_VERSION;
 
 #ifndef Q_WS_WIN
   if (mIndexStream) {
@@ -231,23 +235,43 @@ bool KMFolderIndex::readIndex()
   mHeaderOffset = KDE_ftell(mIndexStream);
 
   clearIndex();
-  while (!feof(mIndexStream))
+  off_t mappedOffset = mHeaderOffset;
+  for (;;)
   {
     mi = 0;
     if(version >= 1505) {
-      if(!fread(&len, sizeof(len), 1, mIndexStream))
-        break;
-
-      if (mIndexSwapByteOrder)
-        len = kmail_swap_32(len);
-
-      off_t offs = KDE_ftell(mIndexStream);
-      if(KDE_fseek(mIndexStream, len, SEEK_CUR))
-        break;
+      off_t offs;
+      if (mIndexStreamPtr) {
+        // Walk the mmap()ed index instead of issuing an fread()/fseek()
+        // pair for every single entry.
+        if (mappedOffset + (off_t)sizeof(len) > (off_t)mIndexStreamPtrLength)
+          break;
+        memcpy(&len, mIndexStreamPtr + mappedOffset, sizeof(len));
+        if (mIndexSwapByteOrder)
+          len = kmail_swap_32(len);
+        offs = mappedOffset + sizeof(len);
+        if (len < 0 || offs + len > (off_t)mIndexStreamPtrLength)
+          break;
+        mappedOffset = offs + len;
+      } else {
+        if (feof(mIndexStream))
+          break;
+        if(!fread(&len, sizeof(len), 1, mIndexStream))
+          break;
+
+        if (mIndexSwapByteOrder)
+          len = kmail_swap_32(len);
+
+        offs = KDE_ftell(mIndexStream);
+        if(KDE_fseek(mIndexStream, len, SEEK_CUR))
+          break;
+      }
       mi = new KMMsgInfo(folder(), offs, len);
     }
     else
     {
+      if (feof(mIndexStream))
+        break;
       QByteArray line( MAX_LINE, '\0' );
       fgets(line.data(), MAX_LINE, mIndexStream);
       if (feof(mIndexStream)) break;
@@ -286,8 +310,11 @@ bool KMFolderIndex::readIndex()
     }
     mMsgList.append(mi, false);
   }
-  if( version < 1505)
+  if( version < INDEX_VERSION )
   {
+    // Convert the index to the current format; the entries read above
+    // are still decoded from the old file while it is being rewritten.
+    kDebug() << "Converting index file" << indexLocation() << "from version" << version;
     mConvertToUtf8 = false;
     setDirty( true );
     writeIndex();
@@ -319,16 +346,13 @@ bool KMFolderIndex::readIndexHeader(int *gv)
   if(gv)
       *gv = indexVersion;
   if (indexVersion < 1505 ) {
+      mIndexVersion = indexVersion;
       if(indexVersion == 1503) {
         kDebug() << "Converting old index file" << indexLocation() << "to utf-8";
         mConvertToUtf8 = true;
       }
       return true;
   } else if (indexVersion == 1505) {
-  } else if (indexVersion < INDEX_VERSION) {
-      kDebug() << "Index file" << indexLocation() << "is out of date. Re-creating it.";
-      createIndexFromContents();
-      return false;
   } else if(indexVersion > INDEX_VERSION) {
       QApplication::setOverrideCursor( QCursor( Qt::ArrowCursor ) );
       int r = KMessageBox::questionYesNo(0,
@@ -343,7 +367,7 @@ bool KMFolderIndex::readIndexHeader(int *gv)
       return false;
   }
   else {
-      // Header
+      // Header, identical for all versions since 1506
       quint32 byteOrder = 0;
       quint32 sizeOfLong = sizeof(long); // default
 
@@ -386,6 +410,7 @@ bool KMFolderIndex::readIndexHeader(int *gv)
       }
 
   }
+  mIndexVersion = indexVersion;
   return true;
 }
 
@@ -415,6 +440,10 @@ bool KMFolderIndex::updateIndexStreamPtr(bool just_close)
 
   mIndexSwapByteOrder = false;
 #ifdef HAVE_MMAP
+  // The index is remapped after it has been rewritten, so the cached
+  // entries may now lie at different offsets.
+  KMail::StringPartCache::instance()->invalidate( this );
+
   if ( just_close ) {
     bool munmapResult = true;
     if( mIndexStreamPtr )
@@ -517,19 +546,20 @@ bool KMFolderIndex::recreateIndex()
 int KMFolderIndex::writeMessages( KMMsgBase* msg, bool flush, FILE* indexStream )
 {
   const uint high = mMsgList.high();
+  QByteArray buffer;
   for ( uint i = 0; i < high || msg; i++ )
   {
     KMMsgBase* msgBase = msg ? msg : mMsgList.at(i);
     if ( !msgBase )
       continue;
-    int len;
-    const uchar *buffer = msgBase->asIndexString( len );
+    msgBase->asIndexString( buffer );
+    int len = buffer.size();
     if ( fwrite( &len, sizeof( len ), 1, indexStream ) != 1 )
       return 1;
     off_t offset = KDE_ftell( indexStream );
     msgBase->setIndexOffset( offset );
     msgBase->setIndexLength( len );
-    if ( fwrite( buffer, len, 1, indexStream ) != 1 ) {
+    if ( fwrite( buffer.constData(), len, 1, indexStream ) != 1 ) {
       kDebug() << "Whoa!";
       return 1;
     }
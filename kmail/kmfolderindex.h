@@ -57,6 +57,11 @@ public:
                      IndexTooOld
   };
 
+  /** First index version whose entries have a fixed layout: numeric parts
+      in fixed-width columns followed by a string heap. Entries of older
+      index files are lists of type/length/data records. */
+  enum { FixedLayoutIndexVersion = 1507 };
+
   /** Usually a parent is given. But in some cases there is no
     fitting parent object available. Then the name of the folder
     is used as the absolute path to the folder file. */
@@ -108,6 +113,10 @@ public:
   int  indexSizeOfLong() { return mIndexSizeOfLong; }
 #endif // !KMAIL_SQLITE_INDEX
 
+  /** Version of the currently opened index file or database. Indexes older
+      than FixedLayoutIndexVersion are converted by readIndex(). */
+  int indexVersion() const { return mIndexVersion; }
+
   virtual int writeIndex( bool createEmptyIndex = false );
 
   bool recreateIndex();
@@ -144,6 +153,17 @@ protected:
   */
   virtual IndexStatus indexStatus() = 0;
 
+  /** Returns true if an index that is older than the contents can be
+      brought up to date with updateIndexFromContents() rather than being
+      recreated by createIndexFromContents(). */
+  virtual bool canUpdateIndexFromContents() const { return false; }
+
+  /** Adds, removes and updates the entries of the index that has just been
+      read by readIndex() to match the contents. Serial numbers and status
+      flags of unchanged messages are kept. Returns 0 on success and an
+      errno value on failure. */
+  virtual int updateIndexFromContents() { return createIndexFromContents(); }
+
     /** Inserts messages into the message dictionary by iterating over the
      * message list. The messages will get new serial numbers. This is only
      * used on newly appeared folders, where there is no .ids file yet, or
@@ -159,6 +179,22 @@ protected:
    Allows to specify index stream to use. */
   int writeMessages( KMMsgBase* msg, bool flush, FILE* indexStream );
 
+  /** Writes the index entries of the messages from @p first to the end of
+      the folder, which have just been appended, in one go and appends them
+      to the serial number file. Returns 0 on success and an errno value on
+      failure, in which case the index file is left as it was before. */
+  int appendIndexEntries( int first );
+
+  /** Takes the messages from @p first to the end of the folder out again
+      after appending them failed, restoring the serial numbers @p serNums
+      the messages had before, and writes the serial number file anew. */
+  void takeAppendedMessages( int first, const QList<unsigned long> &serNums );
+
+  /** Counts the messages from @p first to the end of the folder, which have
+      been appended successfully, and announces them with one change
+      notification. */
+  void finishAppendedMessages( int first );
+
   /** Opens index stream (or database) without creating it.
    If @a checkIfIndexTooOld is true, message "The index of folder .. seems
    to be out of date" is displayed.
@@ -213,6 +249,7 @@ protected:
   int mIndexSizeOfLong; // Index file was written with longs of this size
 #endif
 
+  int mIndexVersion; // Index was written with this index version
   int mIndexId;
 };
 
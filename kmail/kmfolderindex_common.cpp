@@ -31,9 +31,11 @@
 #include <QDateTime>
 
 #include <unistd.h>
+#include <string.h>
 
-// Current version of the table of contents (index) files
-#define INDEX_VERSION 1506
+// Current version of the table of contents (index) files,
+// see KMFolderIndex::FixedLayoutIndexVersion
+#define INDEX_VERSION 1507
 
 #ifndef MAX_LINE
 #define MAX_LINE 4096
@@ -55,6 +57,7 @@
 #include <kmessagebox.h>
 #include <klocale.h>
 #include "kmmsgdict.h"
+#include "kmkernel.h"
 #include "kcursorsaver.h"
 
 // We define functions as kmail_swap_NN so that we don't get compile errors
@@ -84,7 +87,14 @@ int KMFolderIndex::openInternal( OpenInternalOptions options )
   }
   else {
     bool shouldCreateIndexFromContents = false;
+    bool shouldUpdateIndexFromContents = false;
     KMFolderIndex::IndexStatus index_status = indexStatus();
+    if ( KMFolderIndex::IndexTooOld == index_status && canUpdateIndexFromContents() ) {
+      // No need to bother the user, the status flags are not lost when
+      // the index is just updated.
+      shouldUpdateIndexFromContents = true;
+      index_status = KMFolderIndex::IndexOk;
+    }
     if ( KMFolderIndex::IndexOk != index_status ) // test if contents file has changed
     {
       if ( ( options & CheckIfIndexTooOld ) && KMFolderIndex::IndexTooOld == index_status ) {
@@ -151,7 +161,12 @@ int KMFolderIndex::openInternal( OpenInternalOptions options )
       rc = createIndexFromContents();
     else {
       rc = readIndex() ? 0 : 1;
-      if ( rc != 0 && ( options & CreateIndexFromContentsWhenReadIndexFailed ) )
+      if ( rc == 0 && shouldUpdateIndexFromContents ) {
+        emit statusMsg( i18n("Folder `%1' changed; updating index.", objectName()) );
+        rc = updateIndexFromContents();
+      }
+      if ( rc != 0 && ( shouldUpdateIndexFromContents ||
+                        ( options & CreateIndexFromContentsWhenReadIndexFailed ) ) )
         rc = createIndexFromContents();
     }
   } // !folder()->path().isEmpty()
@@ -219,3 +234,92 @@ void KMFolderIndex::addToSerialCache() const
     }
   }
 }
+
+int KMFolderIndex::appendIndexEntries( int first )
+{
+  const int high = mMsgList.high();
+#ifndef KMAIL_SQLITE_INDEX
+  assert( mIndexStream != 0 );
+  clearerr( mIndexStream );
+  KDE_fseek( mIndexStream, 0, SEEK_END );
+  const off_t revert = KDE_ftell( mIndexStream );
+#endif
+
+  int error = 0;
+  for ( int idx = first; idx < high && !error; ++idx ) {
+    KMMsgBase *mb = mMsgList.at( idx );
+#ifdef KMAIL_SQLITE_INDEX
+    // reset the db id, in case we have one, we are about to change folders
+    // and can't reuse it there
+    mb->setDbId( 0 );
+    mb->setDirty( true );
+#endif
+    error = writeMessages( mb, false /*flush*/ );
+  }
+#ifndef KMAIL_SQLITE_INDEX
+  if ( !error ) {
+    fflush( mIndexStream );
+    error = ferror( mIndexStream );
+  }
+#endif
+
+  if ( !error && mExportsSernums && high > first )
+    error = appendToFolderIdsFile( first, high - first );
+
+  if ( error ) {
+    kWarning() << "Could not append to the index of folder" << label() << ":" << strerror( errno );
+#ifndef KMAIL_SQLITE_INDEX
+    if ( KDE_ftell( mIndexStream ) > revert ) {
+      kWarning() << "Undoing changes";
+      truncate( QFile::encodeName( indexLocation() ), revert );
+    }
+    clearerr( mIndexStream );
+#endif
+  }
+  return error;
+}
+
+void KMFolderIndex::takeAppendedMessages( int first, const QList<unsigned long> &serNums )
+{
+  // From the end, so that no other message has to move
+  for ( int idx = mMsgList.high() - 1; idx >= first; --idx ) {
+    KMMsgBase *mb = mMsgList.take( idx );
+    if ( !mb )
+      continue;
+    mb->setParent( 0 );
+    if ( idx - first < serNums.count() )
+      KMail::MessageProperty::setSerialCache( mb, serNums[idx - first] );
+  }
+
+  // The serial number file may already have been rewritten or appended to
+  // for the messages. Write it anew, or remove it so that it is regenerated
+  // from the index when the folder is opened next.
+  if ( mExportsSernums && KMMsgDict::mutableInstance()->writeFolderIds( *this ) != 0 ) {
+    kWarning() << "Removing the outdated serial number file of folder" << label();
+    QFile::remove( idsLocation() );
+  }
+}
+
+void KMFolderIndex::finishAppendedMessages( int first )
+{
+  const int high = mMsgList.high();
+  for ( int idx = first; idx < high; ++idx ) {
+    const KMMsgBase *mb = mMsgList.at( idx );
+    if ( mb->status().isUnread() || mb->status().isNew() ||
+         folder() == kmkernel->outboxFolder() ) {
+      if ( mUnreadMsgs == -1 )
+        mUnreadMsgs = 1;
+      else
+        ++mUnreadMsgs;
+    }
+    ++mTotalMsgs;
+  }
+  mCachedSize = -1;
+
+  // While quiet, the folder emits changed() and numUnreadMsgsChanged() once
+  // at the end instead of msgAdded(int) for every message
+  quiet( true );
+  for ( int idx = first; idx < high; ++idx )
+    emitMsgAddedSignals( idx );
+  quiet( false );
+}
@@ -89,6 +89,7 @@ KMFolderIndex::KMFolderIndex(KMFolder* folder, const char* name)
 //    mIndexStreamPtrLength = 0;
 //    mIndexSwapByteOrder = false;
 //    mIndexSizeOfLong = sizeof(long);
+    mIndexVersion = INDEX_VERSION;
     mIndexId = 0;
 //    mHeaderOffset   = 0;
 }
@@ -185,6 +186,7 @@ int KMFolderIndex::writeIndex( bool createEmptyIndex )
 
 //  if ( !updateIndexStreamPtr() )
 //    return 1;
+  mIndexVersion = INDEX_VERSION;
   if ( 0 != writeFolderIdsFile() )
     return 1;
 
@@ -274,6 +276,29 @@ bool KMFolderIndex::readIndex()
   if ( ok )
     ok = deleteIndexRows( rowsToDelete );
 
+  if ( ok && version < KMFolderIndex::FixedLayoutIndexVersion ) {
+    // The rows use the type/length tagged layout: encode every entry in the
+    // current layout and store the converted rows
+    kDebug() << "Converting index database" << indexLocation() << "from version" << version;
+    QList<QByteArray> converted;
+    for ( int i = 0; i < mMsgList.count(); ++i ) {
+      QByteArray buffer;
+      mMsgList.at( i )->asIndexString( buffer );
+      converted.append( buffer );
+    }
+    mIndexVersion = INDEX_VERSION;
+    for ( int i = 0; i < mMsgList.count(); ++i ) {
+      KMMsgBase *mb = mMsgList.at( i );
+      char* data = (char*)malloc( converted[i].size() );
+      memcpy( data, converted[i].constData(), converted[i].size() );
+      free( const_cast<char*>( mb->data() ) );
+      mb->setData( data );
+      mb->setIndexLength( converted[i].size() );
+    }
+    const QString sql( QLatin1String("PRAGMA user_version = ") + QString::number( INDEX_VERSION ) );
+    ok = writeMessages( 0/*all*/, OverwriteMessages ) == 0 && executeQuery( mIndexDb, sql );
+  }
+
   return ok;
 }
 
@@ -364,7 +389,11 @@ bool KMFolderIndex::readIndexHeader(int *gv)
 
   if(gv)
       *gv = indexVersion;
-  if (indexVersion < INDEX_VERSION) {
+  if (indexVersion >= 1505 && indexVersion < KMFolderIndex::FixedLayoutIndexVersion) {
+      // Rows in the type/length tagged layout, readIndex() converts them
+      mIndexVersion = indexVersion;
+      return true;
+  } else if (indexVersion < INDEX_VERSION) {
       kDebug() << "Index file" << indexLocation() << "is out of date. Re-creating it.";
       createIndexFromContents();
       return false;
@@ -383,6 +412,7 @@ bool KMFolderIndex::readIndexHeader(int *gv)
       return false;
   }
   // indexVersion == INDEX_VERSION
+  mIndexVersion = indexVersion;
 
   // Header
 /*  quint32 byteOrder = 0;
@@ -576,6 +606,7 @@ int KMFolderIndex::writeMessages( KMMsgBase* msg, WriteMessagesMode mode )
   }
 
   sqlite3_stmt *pStmt = pInsertStmt; // current statement to use
+  QByteArray buffer; // bound with SQLITE_STATIC, must outlive the statement step
   for (unsigned int i=0; result == SQLITE_OK && i<high; i++) // when result != SQLITE_OK, this loop ends
   {
     KMMsgBase* msgBase = msg ? msg : mMsgList.at(i);
@@ -601,9 +632,8 @@ int KMFolderIndex::writeMessages( KMMsgBase* msg, WriteMessagesMode mode )
     }
 
     const int dataColumnNumber = updating ? 2 : 1;
-    int len;
-    const uchar *buffer = msgBase->asIndexString(len);
-    result = sqlite3_bind_blob(pStmt, dataColumnNumber, buffer, len, SQLITE_STATIC);
+    msgBase->asIndexString( buffer );
+    result = sqlite3_bind_blob(pStmt, dataColumnNumber, buffer.constData(), buffer.size(), SQLITE_STATIC);
     if ( result != SQLITE_OK ) {
       kWarning() << "sqlite3_bind_blob() error " << errorMessage( result, mIndexDb );
       break;
@@ -5,9 +5,11 @@
 #include "kmfoldermaildir.h"
 
 #include <QDir>
+#include <QHash>
 #include <QRegExp>
 #include <QByteArray>
 #include <QFileInfo>
+#include <QVector>
 
 #include <kpimutils/kfileio.h>
 #include "kmfoldermgr.h"
@@ -506,6 +508,151 @@ if( fileD1.open( QIODevice::WriteOnly ) ) {
   return 0;
 }
 
+//-------------------------------------------------------------
+int KMFolderMaildir::appendMessages( const QList<KMMessage*> &msgList, QList<int> &index_return )
+{
+  return appendMessagesInternal( msgList, index_return );
+}
+
+//-------------------------------------------------------------
+int KMFolderMaildir::appendMessagesInternal( const QList<KMMessage*> &msgList,
+                                             QList<int> &index_return, bool stripUid )
+{
+  // Messages still in another folder have to be taken out of it one by one
+  foreach ( KMMessage *msg, msgList ) {
+    if ( msg->parent() )
+      return FolderStorage::appendMessages( msgList, index_return );
+  }
+
+  KMFolderOpener openThis( folder(), "maildirappend" );
+  if ( openThis.openResult() ) {
+    kDebug() << openThis.openResult() << "of folder:" << label();
+    return openThis.openResult();
+  }
+
+  // Write all message files first; an empty file name marks a message
+  // without data
+  QStringList fileNames;
+  QStringList files;
+  QVector<int> sizes;
+  int error = 0;
+  foreach ( KMMessage *msg, msgList ) {
+    msg->setStatusFields();
+    if ( msg->headerField( "Content-Type" ).isEmpty() )  // This might be added by
+      msg->removeHeaderField( "Content-Type" );          // the line above
+
+    const QString uidHeader = msg->headerField( "X-UID", KMMessage::NoEncoding );
+    if ( !uidHeader.isEmpty() && stripUid )
+      msg->removeHeaderField( "X-UID" );
+
+    const QByteArray msgText = msg->asString();
+
+    if ( !uidHeader.isEmpty() && stripUid )
+      msg->setHeaderField( "X-UID", uidHeader, KMMessage::Unstructured, false, KMMessage::NoEncoding );
+
+    if ( msgText.isEmpty() ) {
+      kDebug() << "Message added to folder `" << objectName() <<"' contains no data. Ignoring it.";
+      fileNames << QString();
+      sizes << 0;
+      continue;
+    }
+
+    // make sure the filename has the correct extension
+    QString filename = constructValidFileName( msg->fileName(), msg->messageStatus() );
+    const QString tmp_file = location() + "/tmp/" + filename;
+    if ( !KPIMUtils::kByteArrayToFile( msgText, tmp_file, false, false, false ) ) {
+      error = errno ? errno : EIO;
+      QFile::remove( tmp_file );
+      break;
+    }
+
+    const QString new_loc = moveInternal( tmp_file, location() + "/cur/" + filename,
+                                          filename, msg->messageStatus() );
+    if ( new_loc.isEmpty() ) {
+      error = errno ? errno : EIO;
+      QFile::remove( tmp_file );
+      break;
+    }
+    files << new_loc;
+    fileNames << filename;
+    sizes << msgText.length();
+  }
+
+  if ( error ) {
+    kDebug() << "Error: Could not add messages to folder:" << strerror( error );
+    foreach ( const QString &file, files )
+      QFile::remove( file );
+    return error;
+  }
+
+  const int first = mMsgList.high();
+  QList<unsigned long> serNums;
+  QList<ulong> uids;
+  QStringList oldFileNames;
+  QList<int> indexes;
+  for ( int i = 0; i < msgList.count(); ++i ) {
+    if ( fileNames[i].isEmpty() ) {
+      indexes << -1;
+      continue;
+    }
+    KMMessage *msg = msgList[i];
+
+    // just to be sure it does not end up in the index
+    uids << msg->UID();
+    if ( stripUid ) msg->setUID( 0 );
+
+    oldFileNames << msg->fileName();
+    if ( fileNames[i] != msg->fileName() )
+      msg->setFileName( fileNames[i] );
+
+    if ( msg->attachmentState() == KMMsgAttachmentUnknown &&
+         msg->readyToShow() )
+      msg->updateAttachmentState();
+
+    serNums << msg->getMsgSerNum();
+    msg->setParent( folder() );
+    msg->setMsgSize( sizes[i] );
+    const int idx = mMsgList.append( &msg->toMsgBase(), mExportsSernums );
+    const unsigned long msgSerNum = msg->getMsgSerNum();
+    if ( msgSerNum <= 0 )
+      msg->setMsgSerNum();
+    else
+      replaceMsgSerNum( msgSerNum, &msg->toMsgBase(), idx );
+    indexes << idx;
+  }
+
+  if ( mAutoCreateIndex ) {
+    error = appendIndexEntries( first );
+    if ( error ) {
+      kDebug() << "Error: Could not add messages to folder (No space left on device?)";
+      int j = 0;
+      for ( int i = 0; i < msgList.count(); ++i ) {
+        if ( fileNames[i].isEmpty() )
+          continue;
+        msgList[i]->setUID( uids[j] );
+        if ( msgList[i]->fileName() != oldFileNames[j] )
+          msgList[i]->setFileName( oldFileNames[j] );
+        j++;
+      }
+      takeAppendedMessages( first, serNums );
+      foreach ( const QString &file, files )
+        QFile::remove( file );
+      return error;
+    }
+  }
+
+  finishAppendedMessages( first );
+  needsCompact = true;
+
+  // The folder owns all messages now, including those without data
+  for ( int i = 0; i < msgList.count(); ++i ) {
+    if ( fileNames[i].isEmpty() )
+      delete msgList[i];
+  }
+  index_return << indexes;
+  return 0;
+}
+
 KMMessage* KMFolderMaildir::readMsg(int idx)
 {
   KMMsgInfo* mi = (KMMsgInfo*)mMsgList[idx];
@@ -545,15 +692,23 @@ DwString KMFolderMaildir::getDwString(int idx)
   return DwString();
 }
 
+QString KMFolderMaildir::rawMessageFile( int idx ) const
+{
+  const KMMsgInfo* mi = static_cast<const KMMsgInfo*>( mMsgList.at( idx ) );
+  if ( !mi || mi->fileName().isEmpty() )
+    return QString();
+  return location() + "/cur/" + mi->fileName();
+}
+
 
-void KMFolderMaildir::readFileHeaderIntern( const QString& dir,
-                                            const QString& file,
-                                            MessageStatus& status )
+KMMsgInfo *KMFolderMaildir::readFileHeaderIntern( const QString& dir,
+                                                  const QString& file,
+                                                  MessageStatus& status )
 {
   // we keep our current directory to restore it later
   const QString current = QDir::currentPath();
   if ( current.isEmpty() ) {
-    return;
+    return 0;
   }
 
   QDir::setCurrent( dir );
@@ -584,9 +739,10 @@ void KMFolderMaildir::readFileHeaderIntern( const QString& dir,
     kWarning() << "The file '" << QFile::encodeName(dir) << "/" << file
                << "' could not be opened for reading the message."
                << "Please check ownership and permissions.";
-    return;
+    return 0;
   }
 
+  KMMsgInfo *mi = 0;
   char line[MAX_LINE];
   bool atEof    = false;
   bool inHeader = true;
@@ -696,7 +852,7 @@ void KMFolderMaildir::readFileHeaderIntern( const QString& dir,
         }
       }
 
-      KMMsgInfo *mi = new KMMsgInfo(folder());
+      mi = new KMMsgInfo(folder());
       mi->init( subjStr.trimmed(),
                 fromStr.trimmed(),
                 toStr.trimmed(),
@@ -714,7 +870,6 @@ void KMFolderMaildir::readFileHeaderIntern( const QString& dir,
       if ( !uidStr.isEmpty() )
          mi->setUID( uidStr.toULong() );
       mi->setDirty(false);
-      mMsgList.append( mi, mExportsSernums );
 
       // if this is a New file and is in 'new', we move it to 'cur'
       if ( status.isNew() )
@@ -798,6 +953,7 @@ void KMFolderMaildir::readFileHeaderIntern( const QString& dir,
   }
 
   QDir::setCurrent( current );
+  return mi;
 }
 
 int KMFolderMaildir::createIndexFromContents()
@@ -837,14 +993,18 @@ int KMFolderMaildir::createIndexFromContents()
   foreach( const QFileInfo& fi, curDir.entryInfoList() )
   {
     MessageStatus st = MessageStatus::statusRead();
-    readFileHeaderIntern( curDir.path(), fi.fileName(), st );
+    KMMsgInfo *mi = readFileHeaderIntern( curDir.path(), fi.fileName(), st );
+    if ( mi )
+      mMsgList.append( mi, mExportsSernums );
   }
 
   // then, we look for all the 'new' files
   foreach( const QFileInfo& fi, newDir.entryInfoList() )
   {
     MessageStatus st = MessageStatus::statusNew();
-    readFileHeaderIntern( newDir.path(), fi.fileName(), st );
+    KMMsgInfo *mi = readFileHeaderIntern( newDir.path(), fi.fileName(), st );
+    if ( mi )
+      mMsgList.append( mi, mExportsSernums );
   }
 
   if ( autoCreateIndex() ) {
@@ -871,6 +1031,136 @@ int KMFolderMaildir::createIndexFromContents()
   return 0;
 }
 
+//-----------------------------------------------------------------------------
+// Returns the name of a message file without the maildir info (flags).
+static QString fileNameWithoutInfo( const QString &file )
+{
+  const int i = file.lastIndexOf( GlobalSettings::maildirFilenameSeparator() + QLatin1String( "2," ) );
+  return i < 0 ? file : file.left( i );
+}
+
+int KMFolderMaildir::updateIndexFromContents()
+{
+  kDebug() << "Updating index for" << location();
+
+  QDir newDir( location() + "/new" );
+  QDir curDir( location() + "/cur" );
+  if ( !newDir.exists() || !curDir.exists() ) {
+    kDebug() << "Directory" << location() << "/new or /cur doesn't exist";
+    return 1;
+  }
+  newDir.setFilter( QDir::Files | QDir::NoDotAndDotDot );
+  curDir.setFilter( QDir::Files | QDir::NoDotAndDotDot );
+
+  // Message files are never modified in place by well-behaved programs, so
+  // a file is considered unchanged if its name (apart from the flags) and
+  // size match the index entry and it is not newer than the index itself.
+  const QDateTime indexModified =
+    QFileInfo( indexLocation() ).lastModified().addSecs( 5 );
+
+  QHash<QString, int> entries;
+  entries.reserve( mMsgList.high() );
+  for ( int idx = 0; idx < mMsgList.high(); idx++ ) {
+    const KMMsgBase *msg = mMsgList.at( idx );
+    if ( msg )
+      entries.insert( fileNameWithoutInfo( msg->fileName() ), idx );
+  }
+
+  QVector<bool> found( mMsgList.high(), false );
+  QList<KMMsgInfo*> added;
+  int updated = 0;
+
+  foreach( const QFileInfo& fi, curDir.entryInfoList() )
+  {
+    const QString file = fi.fileName();
+    QHash<QString, int>::const_iterator it = entries.constFind( fileNameWithoutInfo( file ) );
+    if ( it == entries.constEnd() || found[*it] ) {
+      MessageStatus st = MessageStatus::statusRead();
+      KMMsgInfo *mi = readFileHeaderIntern( curDir.path(), file, st );
+      if ( mi )
+        added.append( mi );
+      continue;
+    }
+
+    const int idx = *it;
+    KMMsgBase *msg = mMsgList.at( idx );
+    if ( msg->msgSize() == (size_t)fi.size() && fi.lastModified() <= indexModified ) {
+      found[idx] = true;
+      if ( msg->fileName() != file ) {
+        // Only the flags were changed by some other program. Keep
+        // everything else, including flags that only live in the index.
+        MessageStatus &status = msg->status();
+        const int i = file.lastIndexOf( GlobalSettings::maildirFilenameSeparator() + QLatin1String( "2," ) );
+        const QString flags = i < 0 ? QString() : file.mid( i );
+        if ( flags.contains( 'S' ) ) {
+          if ( status.isNew() || status.isUnread() )
+            status.setRead();
+        } else {
+          status.setUnread();
+        }
+        if ( flags.contains( 'R' ) )
+          status.setReplied();
+        msg->setFileName( file );
+        msg->setDirty( true );
+        updated++;
+      }
+      continue;
+    }
+
+    // The file has been changed: read it again, but keep it at the same
+    // position so that it keeps its serial number.
+    MessageStatus st = MessageStatus::statusRead();
+    KMMsgInfo *mi = readFileHeaderIntern( curDir.path(), file, st );
+    if ( mi ) {
+      found[idx] = true;
+      mMsgList.set( idx, mi );
+      updated++;
+    }
+  }
+
+  foreach( const QFileInfo& fi, newDir.entryInfoList() )
+  {
+    MessageStatus st = MessageStatus::statusNew();
+    KMMsgInfo *mi = readFileHeaderIntern( newDir.path(), fi.fileName(), st );
+    if ( mi )
+      added.append( mi );
+  }
+
+  // Messages whose file is gone
+  QList<int> removed;
+  QList<KMMsgBase*> removedMsgs;
+  for ( int idx = 0; idx < found.count(); idx++ ) {
+    if ( !found[idx] && mMsgList.at( idx ) ) {
+      removed.append( idx );
+      removedMsgs.append( mMsgList.at( idx ) );
+    }
+  }
+  mMsgList.remove( removed );
+  qDeleteAll( removedMsgs );
+
+  foreach( KMMsgInfo *mi, added )
+    mMsgList.append( mi, mExportsSernums );
+
+  kDebug() << location() << ":" << added.count() << "added,"
+           << removed.count() << "removed," << updated << "updated";
+
+  mUnreadMsgs = 0;
+  for ( int idx = 0; idx < mMsgList.high(); idx++ ) {
+    const KMMsgBase *msg = mMsgList.at( idx );
+    if ( msg && ( msg->status().isNew() || msg->status().isUnread() ||
+                  folder() == kmkernel->outboxFolder() ) )
+      mUnreadMsgs++;
+  }
+  mTotalMsgs = mMsgList.count();
+
+  // Always write the index, this also makes it newer than the directories.
+  setDirty( true );
+  const int rc = writeIndex();
+  if ( rc == 0 && ( !added.isEmpty() || !removed.isEmpty() ) )
+    emit changed();
+  return rc;
+}
+
 KMFolderIndex::IndexStatus KMFolderMaildir::indexStatus()
 {
   QFileInfo new_info(location() + "/new");
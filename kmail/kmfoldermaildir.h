@@ -35,6 +35,8 @@ public:
   /** Read a message and return it as a string */
   virtual DwString getDwString(int idx);
 
+  virtual QString rawMessageFile( int idx ) const;
+
   /** Detach message from this folder. Usable to call addMsg() afterwards.
     Loads the message if it is not loaded up to now. */
   virtual KMMessage* take(int idx);
@@ -47,6 +49,11 @@ public:
     takes ownership of the message (deleting it in the destructor).*/
   virtual int addMsg(KMMessage* msg, int* index_return = 0);
 
+  /** Writes one file per message, then appends all index entries in one
+    go. The files are removed again on failure.
+    See FolderStorage::appendMessages(). */
+  virtual int appendMessages( const QList<KMMessage*> &msgList, QList<int> &index_return );
+
   /** Remove (first occurrence of) given message from the folder. */
   virtual void removeMsg(int i, bool imapQuiet = false);
 
@@ -138,12 +145,28 @@ protected:
    * into the KMMoveCommand, where it can safely happen at a much higher level. */
   int addMsgInternal( KMMessage* msg, int* index_return = 0, bool stripUid=false );
 
+  /** Internal helper called by appendMessages(). @p stripUid has the same
+    meaning as for addMsgInternal(). */
+  int appendMessagesInternal( const QList<KMMessage*> &msgList, QList<int> &index_return,
+                              bool stripUid = false );
+
+  /** Maildir folders can reconcile an outdated index with the directory
+      entries instead of reading the headers of every message again. */
+  virtual bool canUpdateIndexFromContents() const { return true; }
+
+  /** Compares the directory entries with the index and only reads the
+      headers of new or changed message files. */
+  virtual int updateIndexFromContents();
+
 private slots:
   void slotDirSizeJobResult( KJob* job );
 
 private:
-  void readFileHeaderIntern( const QString& dir, const QString& file,
-                             MessageStatus& status);
+  /** Reads the index relevant headers of @p file in @p dir and returns
+      a new index entry for it, or 0 if the file can't be read. New
+      messages are moved from 'new' to 'cur'. */
+  KMMsgInfo *readFileHeaderIntern( const QString& dir, const QString& file,
+                                   MessageStatus& status );
   QString moveInternal( const QString& oldLoc, const QString& newLoc,
                         KMMsgInfo* mi);
   QString moveInternal( const QString& oldLoc, const QString& newLoc,
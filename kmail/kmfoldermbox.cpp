@@ -22,7 +22,7 @@
 #include <config-kmail.h>
 #include <QFileInfo>
 #include <QList>
-#include <QRegExp>
+#include <QVector>
 #include <QByteArray>
 
 #include "folderstorage.h"
@@ -33,6 +33,7 @@
 #include "kcursorsaver.h"
 #include "jobscheduler.h"
 #include "compactionjob.h"
+#include "mboxindexer.h"
 #include "util.h"
 
 #include <kde_file.h>
@@ -59,6 +60,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 #include "broadcaststatus.h"
 using KPIM::BroadcastStatus;
 
@@ -69,12 +76,6 @@ using KPIM::BroadcastStatus;
 #define INIT_MSGS 8
 #endif
 
-// Regular expression to find the line that separates messages in a mail
-// folder:
-#define MSG_SEPERATOR_START "From "
-#define MSG_SEPERATOR_START_LEN (sizeof(MSG_SEPERATOR_START) - 1)
-#define MSG_SEPERATOR_REGEX "^From .*[0-9][0-9]:[0-9][0-9]"
-
 #ifdef KMAIL_SQLITE_INDEX
 #include <sqlite3.h>
 #endif
@@ -84,6 +85,7 @@ KMFolderMbox::KMFolderMbox(KMFolder* folder, const char* name)
   : KMFolderIndex(folder, name)
 {
   mStream         = 0;
+  mMappedRegion   = 0;
   mFilesLocked    = false;
   mReadOnly       = false;
   mLockType       = lock_none;
@@ -294,6 +296,7 @@ void KMFolderMbox::reallyDoClose()
     if ( mStream ) {
       unlock();
     }
+    unmapContents();
     mMsgList.clear( true );
 
     if ( mStream ) {
@@ -618,245 +621,126 @@ KMFolderIndex::IndexStatus KMFolderMbox::indexStatus()
 
 
 //-----------------------------------------------------------------------------
-int KMFolderMbox::createIndexFromContents()
+bool KMFolderMbox::createIndexFromMappedContents()
 {
-  char line[MAX_LINE];
-  char status[8], xstatus[8];
-  QByteArray subjStr, dateStr, fromStr, toStr, xmarkStr, *lastStr=0;
-  QByteArray replyToIdStr, replyToAuxIdStr, referencesStr, msgIdStr;
-  QByteArray sizeServerStr, uidStr;
-  QByteArray contentTypeStr, charset;
-  bool atEof = false;
-  bool inHeader = true;
-  KMMsgInfo* mi;
-  QString msgStr;
-  QRegExp regexp(MSG_SEPERATOR_REGEX);
-  int i, num, numStatus;
-  short needStatus;
+#ifdef HAVE_MMAP
+  KDE_struct_stat stat_buf;
+  if ( KDE_fstat( fileno( mStream ), &stat_buf ) == -1 || stat_buf.st_size <= 0 )
+    return false;
+  const size_t length = stat_buf.st_size;
+  void *data = mmap( 0, length, PROT_READ, MAP_SHARED, fileno( mStream ), 0 );
+  if ( data == MAP_FAILED )
+    return false;
+
+  {
+    MboxIndexer indexer( static_cast<const char *>( data ), length );
+    indexer.findMessages();
+    indexer.start();
+
+    // Collect the chunks in file order while the later ones are still
+    // being parsed.
+    for ( int chunk = 0; chunk < indexer.chunkCount(); ++chunk ) {
+      const QVector<MboxMessageHeaders> &headers = indexer.waitForChunk( chunk );
+      const int first = indexer.firstMessageOfChunk( chunk );
+      for ( int i = 0; i < headers.count(); ++i ) {
+        KMMsgInfo *mi = headers[i].createMsgInfo( folder(), indexer.offset( first + i ),
+                                                  indexer.size( first + i ) );
+        mMsgList.append( mi, mExportsSernums );
+      }
+      emit statusMsg( i18np( "Creating index file: one message done",
+                             "Creating index file: %1 messages done",
+                             first + headers.count() ) );
+    }
+  }
 
+  munmap( data, length );
+  return true;
+#else
+  return false;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+bool KMFolderMbox::mapContents( size_t length )
+{
+#ifdef HAVE_MMAP
+  if ( mMappedRegion && mMappedRegion->Size() >= length )
+    return true;
+  KDE_struct_stat stat_buf;
+  if ( KDE_fstat( fileno( mStream ), &stat_buf ) == -1 || (size_t)stat_buf.st_size < length )
+    return false;
+  // The file has only grown since it was mapped, so the messages pointing
+  // into the old mapping stay valid; it is unmapped once they are gone.
+  if ( mMappedRegion )
+    mMappedRegion->Release();
+  mMappedRegion = DwStringRegion::Map( fileno( mStream ), stat_buf.st_size );
+  return mMappedRegion != 0;
+#else
+  Q_UNUSED( length );
+  return false;
+#endif
+}
+
+void KMFolderMbox::unmapContents()
+{
+  if ( !mMappedRegion )
+    return;
+  mMappedRegion->Detach();
+  mMappedRegion->Release();
+  mMappedRegion = 0;
+}
+
+//-----------------------------------------------------------------------------
+int KMFolderMbox::createIndexFromContents()
+{
   assert(mStream != 0);
   rewind(mStream);
 
   mMsgList.clear();
 
-  num     = -1;
-  numStatus= 11;
-  off_t offs = 0;
-  size_t size = 0;
-  dateStr = "";
-  fromStr = "";
-  toStr = "";
-  subjStr = "";
-  *status = '\0';
-  *xstatus = '\0';
-  xmarkStr = "";
-  replyToIdStr = "";
-  replyToAuxIdStr = "";
-  referencesStr = "";
-  msgIdStr = "";
-  needStatus = 3;
-  size_t sizeServer = 0;
-  ulong uid = 0;
-
-
-  while (!atEof)
-  {
-    off_t pos = KDE_ftell(mStream);
-    if (!fgets(line, MAX_LINE, mStream)) atEof = true;
-
-    if (atEof ||
-        (memcmp(line, MSG_SEPERATOR_START, MSG_SEPERATOR_START_LEN)==0 &&
-         regexp.indexIn(line) >= 0))
+  if ( !createIndexFromMappedContents() ) {
+    char line[MAX_LINE];
+    bool atEof = false;
+    bool inHeader = true;
+    MboxMessageHeaders headers;
+    QString msgStr;
+    int num = -1;
+    int numStatus = 11;
+    off_t offs = 0;
+    size_t size = 0;
+
+    while (!atEof)
     {
-      size = pos - offs;
-      pos = KDE_ftell(mStream);
+      off_t pos = KDE_ftell(mStream);
+      if (!fgets(line, MAX_LINE, mStream)) atEof = true;
 
-      if (num >= 0)
+      if (atEof || MboxIndexer::isSeparatorLine(line, strlen(line)))
       {
-        if (numStatus <= 0)
-        {
-          msgStr = i18np("Creating index file: one message done", "Creating index file: %1 messages done", num);
-          emit statusMsg(msgStr);
-          numStatus = 10;
-        }
+        size = pos - offs;
 
-        if (size > 0)
+        if (num >= 0)
         {
-          msgIdStr = msgIdStr.trimmed();
-          if( !msgIdStr.isEmpty() ) {
-            int rightAngle;
-            rightAngle = msgIdStr.indexOf( '>' );
-            if( rightAngle != -1 )
-              msgIdStr.truncate( rightAngle + 1 );
-          }
-
-          replyToIdStr = replyToIdStr.trimmed();
-          if( !replyToIdStr.isEmpty() ) {
-            int rightAngle;
-            rightAngle = replyToIdStr.indexOf( '>' );
-            if( rightAngle != -1 )
-              replyToIdStr.truncate( rightAngle + 1 );
-          }
-
-          referencesStr = referencesStr.trimmed();
-          if( !referencesStr.isEmpty() ) {
-            int leftAngle, rightAngle;
-            leftAngle = referencesStr.lastIndexOf( '<' );
-            if( ( leftAngle != -1 )
-                && ( replyToIdStr.isEmpty() || ( replyToIdStr[0] != '<' ) ) ) {
-              // use the last reference, instead of missing In-Reply-To
-              replyToIdStr = referencesStr.mid( leftAngle );
-            }
-
-            // find second last reference
-            leftAngle = referencesStr.lastIndexOf( '<', leftAngle - 1 );
-            if( leftAngle != -1 )
-              referencesStr = referencesStr.mid( leftAngle );
-            rightAngle = referencesStr.lastIndexOf( '>' );
-            if( rightAngle != -1 )
-              referencesStr.truncate( rightAngle + 1 );
-
-            // Store the second to last reference in the replyToAuxIdStr
-            // It is a good candidate for threading the message below if the
-            // message In-Reply-To points to is not kept in this folder,
-            // but e.g. in an Outbox
-            replyToAuxIdStr = referencesStr;
-            rightAngle = referencesStr.indexOf( '>' );
-            if( rightAngle != -1 )
-              replyToAuxIdStr.truncate( rightAngle + 1 );
-          }
-
-          contentTypeStr = contentTypeStr.trimmed();
-          charset = "";
-          if ( !contentTypeStr.isEmpty() ) {
-            int cidx = contentTypeStr.indexOf( "charset=" );
-            if ( cidx != -1 ) {
-              charset = contentTypeStr.mid( cidx + 8 );
-              if ( !charset.isEmpty() && ( charset[0] == '"' ) ) {
-                charset = charset.mid( 1 );
-              }
-              cidx = 0;
-              while ( cidx < charset.length() ) {
-                if ( charset[cidx] == '"' ||
-                     ( !isalnum(charset[cidx]) &&
-                       charset[cidx] != '-' && charset[cidx] != '_' ) ) {
-                  break;
-                }
-                ++cidx;
-              }
-              charset.truncate( cidx );
-            }
+          if (numStatus <= 0)
+          {
+            msgStr = i18np("Creating index file: one message done", "Creating index file: %1 messages done", num);
+            emit statusMsg(msgStr);
+            numStatus = 10;
           }
 
-          mi = new KMMsgInfo(folder());
-          mi->init( subjStr.trimmed(),
-                    fromStr.trimmed(),
-                    toStr.trimmed(),
-                    0, MessageStatus::statusNew(),
-                    xmarkStr.trimmed(),
-                    replyToIdStr, replyToAuxIdStr, msgIdStr,
-                    KMMsgEncryptionStateUnknown, KMMsgSignatureStateUnknown,
-                    KMMsgMDNStateUnknown, charset, offs, size, sizeServer, uid );
-          mi->setStatus(status, xstatus);
-          mi->setDate( dateStr.trimmed().constData() );
-          mi->setDirty(false);
-          mMsgList.append(mi, mExportsSernums );
-
-          *status = '\0';
-          *xstatus = '\0';
-          needStatus = 3;
-          xmarkStr = "";
-          replyToIdStr = "";
-          replyToAuxIdStr = "";
-          referencesStr = "";
-          msgIdStr = "";
-          dateStr = "";
-          fromStr = "";
-          subjStr = "";
-          sizeServer = 0;
-          uid = 0;
+          if (size > 0)
+            mMsgList.append(headers.createMsgInfo(folder(), offs, size), mExportsSernums);
+          else num--,numStatus++;
         }
-        else num--,numStatus++;
-      }
 
-      offs = KDE_ftell(mStream);
-      num++;
-      numStatus--;
-      inHeader = true;
-      continue;
-    }
-    // Is this a long header line?
-    if (inHeader && (line[0]=='\t' || line[0]==' '))
-    {
-      i = 0;
-      while (line [i]=='\t' || line [i]==' ') i++;
-      if (line [i] < ' ' && line [i]>0) inHeader = false;
-      else if (lastStr) *lastStr += line + i;
-    }
-    else if ( inHeader && line[0] == '=' &&
-        ( ( line[1] == '0' && line[2] == '9' ) ||
-          ( line[1] == '2' && line[2] == '0' ) ) )
-    {
-        // bug 86302 - workaround for malformed wrapped encoded-words
-        if (lastStr)
-          *lastStr += line + 3;
-    }
-    else lastStr = 0;
-
-    if (inHeader && (line [0]=='\n' || line [0]=='\r'))
-      inHeader = false;
-    if (!inHeader) continue;
-
-    /* -sanders Make all messages read when auto-recreating index */
-    /* Reverted, as it breaks reading the sent mail status, for example.
-       -till */
-    if ( ( needStatus & 1) && strncasecmp( line, "Status:", 7 ) == 0 )  {
-      for ( i=0; i<4 && line[i+8] > ' '; ++i ) {
-        status[i] = line[i+8];
+        headers = MboxMessageHeaders();
+        offs = KDE_ftell(mStream);
+        num++;
+        numStatus--;
+        inHeader = true;
+        continue;
       }
-      status[i] = '\0';
-      needStatus &= ~1;
-    } else if ( ( needStatus & 2 ) &&
-                strncasecmp( line, "X-Status:", 9 ) == 0 ) {
-      for ( i=0; i<4 && line[i+10] > ' '; ++i ) {
-        xstatus[i] = line[i+10];
-      }
-      xstatus[i] = '\0';
-      needStatus &= ~2;
-    } else if ( strncasecmp( line, "X-KMail-Mark:", 13 ) == 0 ) {
-        xmarkStr = QByteArray( line + 13 );
-    } else if ( strncasecmp( line, "In-Reply-To:", 12 ) == 0 ) {
-      replyToIdStr = QByteArray( line + 12 );
-      lastStr = &replyToIdStr;
-    } else if ( strncasecmp( line, "References:", 11 ) == 0 ) {
-      referencesStr = QByteArray( line + 11 );
-      lastStr = &referencesStr;
-    } else if ( strncasecmp( line, "Message-Id:", 11 ) == 0 ) {
-      msgIdStr = QByteArray( line + 11 );
-      lastStr = &msgIdStr;
-    } else if ( strncasecmp( line, "Date:", 5 ) == 0 ) {
-      dateStr = QByteArray( line + 5 );
-      lastStr = &dateStr;
-    } else if ( strncasecmp( line, "From:", 5 ) == 0 ) {
-      fromStr = QByteArray( line + 5 );
-      lastStr = &fromStr;
-    } else if ( strncasecmp( line, "To:", 3 ) == 0 ) {
-      toStr = QByteArray( line + 3 );
-      lastStr = &toStr;
-    } else if ( strncasecmp( line, "Subject:", 8 ) == 0 ) {
-      subjStr = QByteArray( line + 8 );
-      lastStr = &subjStr;
-    } else if ( strncasecmp( line, "X-Length:", 9 ) == 0 ) {
-      sizeServerStr = QByteArray( line + 9 );
-      sizeServer = sizeServerStr.toULong();
-      lastStr = &sizeServerStr;
-    } else if ( strncasecmp( line, "X-UID:", 6 ) == 0 ) {
-      uidStr = QByteArray( line + 6 );
-      uid = uidStr.toULong();
-      lastStr = &uidStr;
-    } else if ( strncasecmp( line, "Content-Type:", 13 ) == 0 ) {
-      contentTypeStr = QByteArray( line + 13 );
-      lastStr = &contentTypeStr;
+      if (inHeader)
+        inHeader = headers.parseLine(line);
     }
   }
 
@@ -976,6 +860,23 @@ QByteArray KMFolderMbox::escapeFrom( const DwString & str ) {
 
 #undef STRDIM
 
+//-----------------------------------------------------------------------------
+// returns true if unescapeFrom() would change str
+static bool containsEscapedFrom( const char* str, size_t strLen ) {
+  const char * const e = str + strLen;
+  const char * s = str;
+  while ( ( s = static_cast<const char*>( memchr( s, '\n', e - s ) ) ) ) {
+    ++s;
+    if ( s == e || *s != '>' )
+      continue;
+    while ( s < e && *s == '>' )
+      ++s;
+    if ( e - s >= (int)STRDIM("From ") && qstrncmp( s, "From ", STRDIM("From ") ) == 0 )
+      return true;
+  }
+  return false;
+}
+
 //-----------------------------------------------------------------------------
 DwString KMFolderMbox::getDwString(int idx)
 {
@@ -985,6 +886,16 @@ DwString KMFolderMbox::getDwString(int idx)
   assert(mStream != 0);
 
   size_t msgSize = mi->msgSize();
+
+  // Messages that need neither unescaping nor line break conversion are
+  // not copied, the DwString points into the mapped folder file.
+  const off_t offset = mi->folderOffset();
+  if ( msgSize > 0 && mapContents( offset + msgSize ) ) {
+    const char * const text = mMappedRegion->Data() + offset;
+    if ( !memchr( text, '\r', msgSize ) && !containsEscapedFrom( text, msgSize ) )
+      return DwString( mMappedRegion, offset, msgSize );
+  }
+
   char* msgText = new char[ msgSize + 1 ];
 
   KDE_fseek(mStream, mi->folderOffset(), SEEK_SET);
@@ -1229,92 +1140,317 @@ if( fileD1.open( QIODevice::WriteOnly ) ) {
   return 0;
 }
 
+//-----------------------------------------------------------------------------
+int KMFolderMbox::appendMessages( const QList<KMMessage*> &msgList, QList<int> &index_return )
+{
+  // Messages still in another folder have to be taken out of it one by one,
+  // and IMAP folders upload what is added
+  if ( folderType() != KMFolderTypeMbox )
+    return FolderStorage::appendMessages( msgList, index_return );
+  foreach ( KMMessage *msg, msgList ) {
+    if ( msg->parent() )
+      return FolderStorage::appendMessages( msgList, index_return );
+  }
+  return appendMessagesInternal( msgList, index_return );
+}
+
+//-----------------------------------------------------------------------------
+int KMFolderMbox::appendMessagesInternal( const QList<KMMessage*> &msgList, QList<int> &index_return )
+{
+  KMFolderOpener openThis( folder(), "mboxappend" );
+  if ( openThis.openResult() ) {
+    kDebug() << openThis.openResult() << " of folder: " << label();
+    return openThis.openResult();
+  }
+
+  assert( mStream != 0 );
+  clearerr( mStream );
+  KDE_fseek( mStream, 0, SEEK_END );
+  const off_t revert = KDE_ftell( mStream );
+
+  // ensure separating empty line
+  int growth = 0;
+  if ( revert >= 2 ) {
+    char endStr[2];
+    KDE_fseek( mStream, -2, SEEK_END );
+    fread( endStr, 1, 2, mStream );
+    KDE_fseek( mStream, 0, SEEK_END ); // required at least on Windows, Solaris, etc.
+    if ( endStr[0] != '\n' ) {
+      growth = ( endStr[1] != '\n' ) ? 2 : 1;
+      fwrite( "\n\n", 1, growth, mStream );
+    }
+  }
+
+  // Write the messages one after the other and flush once; the offsets
+  // follow from the sizes, an offset of -1 marks a message without data
+  QVector<off_t> offsets( msgList.count() );
+  QVector<size_t> sizes( msgList.count() );
+  off_t offs = revert + growth;
+  for ( int i = 0; i < msgList.count(); ++i ) {
+    KMMessage *msg = msgList[i];
+    // The IMAP folders keep the headers as the server sent them
+    if ( folderType() != KMFolderTypeImap ) {
+      msg->setStatusFields();
+      if ( msg->headerField( "Content-Type" ).isEmpty() )  // This might be added by
+        msg->removeHeaderField( "Content-Type" );          // the line above
+    }
+    const QByteArray msgText = escapeFrom( msg->asDwString() );
+    if ( msgText.isEmpty() ) {
+      kDebug() << "Message added to folder `" << objectName()
+               << "' contains no data. Ignoring it.";
+      offsets[i] = -1;
+      continue;
+    }
+
+    const QByteArray messageSeparator( msg->mboxMessageSeparator() );
+    fwrite( messageSeparator.data(), messageSeparator.length(), 1, mStream );
+    offs += messageSeparator.length();
+    size_t size = msgText.size();
+    fwrite( msgText.data(), size, 1, mStream );
+    if ( msgText[(int)size - 1] != '\n' ) {
+      fwrite( "\n\n", 1, 2, mStream );
+      size += 2;
+    }
+    offsets[i] = offs;
+    sizes[i] = size;
+    offs += size;
+  }
+  fflush( mStream );
+
+  int error = ferror( mStream );
+  if ( error ) {
+    kDebug() << "Error: Could not add messages to folder:" << strerror(errno);
+    truncate( QFile::encodeName( location() ), revert );
+    clearerr( mStream );
+    return error;
+  }
+
+  const int first = mMsgList.high();
+  QList<unsigned long> serNums;
+  QList<int> indexes;
+  for ( int i = 0; i < msgList.count(); ++i ) {
+    if ( offsets[i] < 0 ) {
+      indexes << -1;
+      continue;
+    }
+    KMMessage *msg = msgList[i];
+    if ( msg->attachmentState() == KMMsgAttachmentUnknown &&
+         msg->readyToShow() )
+      msg->updateAttachmentState();
+
+    // store information about the position in the folder file in the message
+    serNums << msg->getMsgSerNum();
+    msg->setParent( folder() );
+    msg->setFolderOffset( offsets[i] );
+    msg->setMsgSize( sizes[i] );
+    const int idx = mMsgList.append( &msg->toMsgBase(), mExportsSernums );
+    if ( msg->getMsgSerNum() <= 0 ) {
+      msg->setMsgSerNum();
+    } else {
+      replaceMsgSerNum( msg->getMsgSerNum(), &msg->toMsgBase(), idx );
+    }
+    indexes << idx;
+  }
+
+  if ( mAutoCreateIndex ) {
+    error = appendIndexEntries( first );
+    if ( error ) {
+      kWarning() << "Error: Could not add messages to folder (No space left on device?)";
+      takeAppendedMessages( first, serNums );
+      truncate( QFile::encodeName( location() ), revert );
+      return error;
+    }
+  }
+
+  // change the length of the previous message to encompass white space added,
+  // unless a deleted message claims space at the end of the file
+  if ( first > 0 && growth > 0 && mMsgList[first - 1] &&
+       (ulong)revert == mMsgList[first - 1]->folderOffset() + mMsgList[first - 1]->msgSize() ) {
+    mMsgList[first - 1]->setMsgSize( mMsgList[first - 1]->msgSize() + growth );
+  }
+
+  finishAppendedMessages( first );
+
+  // The folder owns all messages now, including those without data
+  for ( int i = 0; i < msgList.count(); ++i ) {
+    if ( offsets[i] < 0 )
+      delete msgList[i];
+  }
+  index_return << indexes;
+  return 0;
+}
+
+/**
+ * Copies @p length bytes from @p srcFd at @p srcOffset to @p dstFd at
+ * @p dstOffset, without going through user space where the system can.
+ * Returns zero on success and an errno on failure.
+ */
+static int copyRange( int srcFd, off_t srcOffset, int dstFd, off_t dstOffset, off_t length )
+{
+#ifdef HAVE_COPY_FILE_RANGE
+  while ( length > 0 ) {
+    loff_t in = srcOffset, out = dstOffset;
+    const ssize_t n = copy_file_range( srcFd, &in, dstFd, &out, length, 0 );
+    if ( n < 0 && errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP )
+      return errno;
+    if ( n <= 0 )
+      break; // not for these files, try the next way
+    srcOffset += n;
+    dstOffset += n;
+    length -= n;
+  }
+  if ( length == 0 )
+    return 0;
+#endif
+
+#ifdef HAVE_SYS_SENDFILE_H
+  if ( lseek( dstFd, dstOffset, SEEK_SET ) == -1 )
+    return errno;
+  while ( length > 0 ) {
+    off_t in = srcOffset;
+    const ssize_t n = sendfile( dstFd, srcFd, &in, length );
+    if ( n < 0 && errno != ENOSYS && errno != EINVAL )
+      return errno;
+    if ( n <= 0 )
+      break;
+    srcOffset += n;
+    dstOffset += n;
+    length -= n;
+  }
+  if ( length == 0 )
+    return 0;
+#endif
+
+  QByteArray buffer( qMin( length, (off_t)( 1 << 20 ) ), 0 );
+  while ( length > 0 ) {
+    const ssize_t n = pread( srcFd, buffer.data(), qMin( length, (off_t)buffer.size() ), srcOffset );
+    if ( n < 0 )
+      return errno;
+    if ( n == 0 )
+      return EIO; // the file is shorter than the index says
+    if ( pwrite( dstFd, buffer.constData(), n, dstOffset ) != n )
+      return errno ? errno : EIO;
+    srcOffset += n;
+    dstOffset += n;
+    length -= n;
+  }
+  return 0;
+}
+
+off_t KMFolderMbox::separatorOffset( off_t offset )
+{
+  // The separator is the line right before the message
+  if ( offset <= 0 )
+    return 0;
+#ifdef HAVE_MMAP
+  if ( mapContents( offset ) ) {
+    const char * const data = mMappedRegion->Data();
+    off_t separator_offset = offset - 1;
+    while ( separator_offset > 0 && data[separator_offset - 1] != '\n' )
+      --separator_offset;
+    return separator_offset;
+  }
+#endif
+
+  char buffer[256];
+  off_t end = offset - 1; // the newline ending the separator
+  while ( end > 0 ) {
+    const off_t start = qMax( (off_t)0, end - (off_t)sizeof( buffer ) );
+    if ( pread( fileno( mStream ), buffer, end - start, start ) != end - start )
+      return -1;
+    for ( off_t i = end - start; i > 0; --i ) {
+      if ( buffer[i - 1] == '\n' )
+        return start + i;
+    }
+    end = start;
+  }
+  return 0;
+}
+
 int KMFolderMbox::compact( int startIndex, int nbMessages, FILE *tmpfile,
                            off_t&offs, bool &done )
 {
   int rc = 0;
-  QByteArray mtext;
   int stopIndex = nbMessages == -1
                        ? mMsgList.count()
                        : qMin( mMsgList.count(), startIndex + nbMessages );
   //kDebug() << "KMFolderMbox: compacting from" << startIndex << "to" << stopIndex;
-  for ( int idx = startIndex; idx < stopIndex; ++idx ) {
-    KMMsgInfo* mi = (KMMsgInfo*)mMsgList.at( idx );
-    size_t msize = mi->msgSize();
-    if ( (size_t) mtext.size() < msize + 2 ) {
-      mtext.resize( msize+2 );
-    }
-    off_t folder_offset = mi->folderOffset();
 
-    //now we need to find the separator! grr...
-    for( off_t i = folder_offset-25; true; i -= 20 ) {
-      off_t chunk_offset = i <= 0 ? 0 : i;
-      if ( KDE_fseek( mStream, chunk_offset, SEEK_SET ) == -1 ) {
-        rc = errno;
+  // Messages which follow one another in the folder file are copied as one
+  // range of the file, with their separators and the white space between
+  // them. The range starts at the separator of message rangeIndex.
+  const int srcFd = fileno( mStream );
+  const int dstFd = fileno( tmpfile );
+  int rangeIndex = startIndex;
+  off_t rangeStart = 0;
+  off_t rangeEnd = 0;
+  for ( int idx = startIndex; idx <= stopIndex; ++idx ) {
+    off_t separator_offset = -1;
+    if ( idx < stopIndex ) {
+      const KMMsgBase *mi = mMsgList.at( idx );
+      separator_offset = separatorOffset( mi->folderOffset() );
+      if ( separator_offset < 0 ) {
+        rc = errno ? errno : EIO;
         break;
       }
-      if ( mtext.size() < 20 ) {
-        mtext.resize( 20 );
+      if ( idx == rangeIndex ) {
+        rangeStart = separator_offset;
       }
-      fread( mtext.data(), 20, 1, mStream );
-      if ( i <= 0 ) { //woops we've reached the top of the file, last try..
-        if ( mtext.indexOf( "from " ) ) {
-          if ( (off_t) mtext.size() < folder_offset ) {
-              mtext.resize( folder_offset );
-          }
-          if ( KDE_fseek( mStream, chunk_offset, SEEK_SET) == -1 ||
-               !fread( mtext.data(), folder_offset, 1, mStream ) ||
-               !fwrite( mtext.data(), folder_offset, 1, tmpfile ) ) {
-            rc = errno;
-            break;
-          }
-          offs += folder_offset;
-        } else {
-          rc = 666; // yes.. this is evil
-        }
-        break;
-      } else {
-        int last_crlf = -1;
-        for ( int i2 = 0; i2 < 20; i2++ ) {
-          if ( *(mtext.data()+i2) == '\n' ) {
-            last_crlf = i2;
-          }
-        }
-        if ( last_crlf != -1 ) {
-          int size = folder_offset - ( i + last_crlf + 1 );
-          if ( (int)mtext.size() < size ) {
-              mtext.resize( size );
-          }
-          if ( KDE_fseek( mStream, i + last_crlf+1, SEEK_SET ) == -1 ||
-               !fread( mtext.data(), size, 1, mStream ) ||
-               !fwrite( mtext.data(), size, 1, tmpfile ) ) {
-            rc = errno;
-            break;
-          }
-          offs += size;
-          break;
-        }
+      if ( idx == rangeIndex || separator_offset == rangeEnd ) {
+        rangeEnd = mi->folderOffset() + mi->msgSize();
+        continue;
       }
     }
+    if ( idx == rangeIndex ) {
+      break; // nothing to copy
+    }
+
+    rc = copyRange( srcFd, rangeStart, dstFd, offs, rangeEnd - rangeStart );
     if ( rc ) {
       break;
     }
+    for ( int i = rangeIndex; i < idx; ++i ) {
+      KMMsgBase *mi = mMsgList.at( i );
+      mi->setFolderOffset( offs + mi->folderOffset() - rangeStart );
+    }
+    offs += rangeEnd - rangeStart;
 
-    //now actually write the message
-    if ( KDE_fseek( mStream, folder_offset, SEEK_SET ) == -1 ||
-         !fread( mtext.data(), msize, 1, mStream ) ||
-         !fwrite( mtext.data(), msize, 1, tmpfile ) ) {
-      rc = errno;
-      break;
+    rangeIndex = idx;
+    rangeStart = separator_offset;
+    if ( idx < stopIndex ) {
+      const KMMsgBase *mi = mMsgList.at( idx );
+      rangeEnd = mi->folderOffset() + mi->msgSize();
     }
-    mi->setFolderOffset( offs );
-    offs += msize;
   }
   done = ( !rc && stopIndex == mMsgList.count() ); // finished without errors
   emit compacted();
   return rc;
 }
 
+int KMFolderMbox::compactedPrefix( off_t &end )
+{
+  end = 0;
+  for ( int idx = 0; idx < mMsgList.count(); ++idx ) {
+    const KMMsgBase *mi = mMsgList.at( idx );
+    if ( separatorOffset( mi->folderOffset() ) != end ) {
+      return idx;
+    }
+    end = mi->folderOffset() + mi->msgSize();
+  }
+  return mMsgList.count();
+}
+
+int KMFolderMbox::truncateContents( off_t end )
+{
+  // Nothing that is cut off belongs to a message
+  unmapContents();
+  if ( fflush( mStream ) != 0 || ftruncate( fileno( mStream ), end ) != 0 ||
+       fsync( fileno( mStream ) ) != 0 ) {
+    return errno;
+  }
+  return 0;
+}
+
 //-----------------------------------------------------------------------------
 int KMFolderMbox::compact( bool silent )
 {
@@ -1351,6 +1487,7 @@ void KMFolderMbox::setProcmailLockFileName( const QString &fname )
 //-----------------------------------------------------------------------------
 int KMFolderMbox::removeContents()
 {
+  unmapContents();
   int rc = 0;
   rc = unlink(QFile::encodeName(location()));
   return rc;
@@ -1359,6 +1496,7 @@ int KMFolderMbox::removeContents()
 //-----------------------------------------------------------------------------
 int KMFolderMbox::expungeContents()
 {
+  unmapContents();
   int rc = 0;
   if (truncate(QFile::encodeName(location()), 0))
     rc = errno;
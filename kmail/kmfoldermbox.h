@@ -71,6 +71,11 @@ public:
     takes ownership of the message (deleting it in the destructor).*/
   virtual int addMsg( KMMessage* msg, int* index_return = 0 );
 
+  /** Appends the messages to the folder file with one flush at the end,
+    and their index entries in one go. The file and the index are
+    truncated again on failure. See FolderStorage::appendMessages(). */
+  virtual int appendMessages( const QList<KMMessage*> &msgList, QList<int> &index_return );
+
   /** Open folder for access.
     Does nothing if the folder is already opened. To reopen a folder
     call close() first.
@@ -98,6 +103,16 @@ public:
   int compact( int startIndex, int nbMessages, FILE* tmpFile,
                off_t& offs, bool& done );
 
+  /** Returns the number of messages at the beginning of the folder which
+    compaction leaves where they are, and sets @p end to the offset right
+    behind the last of them. This is only for use from MboxCompactionJob. */
+  int compactedPrefix( off_t& end );
+
+  /** Cuts off the folder file at @p end, when all messages are in the
+    compacted prefix. Returns zero on success and an errno on failure.
+    This is only for use from MboxCompactionJob. */
+  int truncateContents( off_t end );
+
   /** Is the folder read-only? */
   virtual bool isReadOnly() const { return mReadOnly; }
 
@@ -116,6 +131,12 @@ public:
   virtual qint64 doFolderSize() const;
 
 protected:
+  /** Internal helper called by appendMessages(). It writes the messages to
+    the folder file whatever the type of the folder, so that online IMAP
+    folders can add the messages they listed without uploading them. The
+    messages must not belong to any folder. */
+  int appendMessagesInternal( const QList<KMMessage*> &msgList, QList<int> &index_return );
+
   virtual FolderJob* doCreateJob( KMMessage *msg, FolderJob::JobType jt, KMFolder *folder,
                                   const QString &partSpecifier, const AttachmentStrategy *as ) const;
   virtual FolderJob* doCreateJob( QList<KMMessage*>& msgList, const QString& sets,
@@ -129,6 +150,23 @@ protected:
       failure. */
   virtual int createIndexFromContents();
 
+  /** Fills mMsgList from the mmap()ed folder file, parsing the headers
+      on the thread pool. Returns false if the file could not be mapped. */
+  bool createIndexFromMappedContents();
+
+  /** Makes sure that the first @p length bytes of the folder file are
+      mmap()ed into mMappedRegion. Returns false if they cannot be mapped. */
+  bool mapContents( size_t length );
+
+  /** Returns the offset of the separator line of the message at
+      @p offset, or -1 if it cannot be read. */
+  off_t separatorOffset( off_t offset );
+
+  /** Gives the messages still pointing into mMappedRegion a copy of their
+      contents and unmaps the folder file. Must be called before the file
+      is closed or anything but appending is done to it. */
+  void unmapContents();
+
   /** Lock mail folder files. Called by ::open(). Returns 0 on success and
     an errno error code on failure. */
   virtual int lock();
@@ -149,6 +187,7 @@ protected:
 
 private:
   FILE *mStream;
+  DwStringRegion *mMappedRegion; // messages without >From_ and CRLF point into it
   bool mFilesLocked; // true if the files of the folder are locked (writable)
   bool mReadOnly; // true if locking failed
   LockType mLockType;
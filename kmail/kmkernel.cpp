@@ -50,6 +50,8 @@ using KMail::MailServiceImpl;
 #include "mailmanagerimpl.h"
 using KMail::MailManagerImpl;
 #include "jobscheduler.h"
+#include "fulltextindex.h"
+using KMail::FullTextIndex;
 #include "templateparser.h"
 using KMail::TemplateParser;
 #include "mainfolderview.h"
@@ -69,6 +71,7 @@ using KMail::TemplateParser;
 #include <kwallet.h>
 using KWallet::Wallet;
 #include "actionscheduler.h"
+#include "stringpartcache.h"
 
 #include <QByteArray>
 #include <QDir>
@@ -149,6 +152,7 @@ KMKernel::KMKernel (QObject *parent, const char *name) :
   GlobalSettings::self();
 
   mJobScheduler = new JobScheduler( this );
+  mFullTextIndex = 0;
   mICalIface = new KMailICalIfaceImpl();
 
   mXmlGuiInstance = KComponentData();
@@ -1162,6 +1166,26 @@ QString KMKernel::debugScheduler()
   return res;
 }
 
+QString KMKernel::debugStringPartCache()
+{
+  return KMail::StringPartCache::instance()->debug();
+}
+
+qulonglong KMKernel::stringPartCacheHits()
+{
+  return KMail::StringPartCache::instance()->hits();
+}
+
+qulonglong KMKernel::stringPartCacheMisses()
+{
+  return KMail::StringPartCache::instance()->misses();
+}
+
+qulonglong KMKernel::stringPartCacheEvictions()
+{
+  return KMail::StringPartCache::instance()->evictions();
+}
+
 QString KMKernel::debugSernum( quint32 serialNumber )
 {
   QString res;
@@ -1533,6 +1557,8 @@ void KMKernel::init()
   if (lsf)
     the_searchFolderMgr->remove( lsf );
 
+  mFullTextIndex = new FullTextIndex( localDataPath() + "fulltextindex", this );
+
   the_acctMgr       = new AccountManager();
   the_filterMgr     = new KMFilterMgr();
   the_popFilterMgr     = new KMFilterMgr(true);
@@ -1795,6 +1821,10 @@ void KMKernel::cleanup(void)
     folder->close( "kmkernel", true );
   }
 
+  // Writes the messages indexed since the last flush
+  delete mFullTextIndex;
+  mFullTextIndex = 0;
+
   delete the_folderMgr;
   the_folderMgr = 0;
   delete the_imapFolderMgr;
@@ -2399,6 +2429,11 @@ void KMKernel::slotRunBackgroundTasks() // called regularly by timer
     // the_searchFolderMgr: no compaction
   }
 
+  if ( generalGroup.readEntry( "full-text-indexing", true ) ) {
+    if ( mFullTextIndex )
+      mFullTextIndex->scheduleIncompleteFolders();
+  }
+
 #ifdef DEBUG_SCHEDULER // for debugging, see jobscheduler.h
   mBackgroundTasksTimer->start( 60 * 1000 ); // check again in 1 minute
 #else
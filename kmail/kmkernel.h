@@ -42,6 +42,7 @@ namespace KMail {
   class MailManagerImpl;
   class UndoStack;
   class JobScheduler;
+  class FullTextIndex;
   class MessageSender;
   class AccountManager;
   class FolderAdaptor;
@@ -178,6 +179,12 @@ public Q_SLOTS:
 
   Q_SCRIPTABLE QString debugScheduler();
 
+  /** Statistics of the cache of decoded index strings. */
+  Q_SCRIPTABLE QString debugStringPartCache();
+  Q_SCRIPTABLE qulonglong stringPartCacheHits();
+  Q_SCRIPTABLE qulonglong stringPartCacheMisses();
+  Q_SCRIPTABLE qulonglong stringPartCacheEvictions();
+
   /**
    * returns id of composer if more are opened
    */
@@ -330,6 +337,8 @@ public:
   KPIMIdentities::IdentityManager *identityManager();
 
   JobScheduler* jobScheduler() { return mJobScheduler; }
+  /** Returns the full text index of the messages, 0 before init() */
+  KMail::FullTextIndex* fullTextIndex() { return mFullTextIndex; }
 
   QIndicate::Server *indicateServer() { return the_indicateServer; }
 
@@ -516,6 +525,7 @@ private:
   QTimer *mBackgroundTasksTimer;
   KMailICalIfaceImpl* mICalIface;
   JobScheduler* mJobScheduler;
+  KMail::FullTextIndex* mFullTextIndex;
   // temporary mainwin
   KMMainWin *mWin;
   MailServiceImpl *mMailService;
@@ -10,8 +10,10 @@
 #include "kmmsgdict.h"
 #include "kmmessagetag.h"
 #include "messageproperty.h"
+#include "stringpartcache.h"
 #include <QByteArray>
 using KMail::MessageProperty;
+using KMail::StringPartCache;
 
 #include <kdebug.h>
 #include <kde_file.h>
@@ -28,6 +30,10 @@ using KMail::MessageProperty;
 
 #include <QTextCodec>
 #include <QRegExp>
+#include <QApplication>
+#include <QMutex>
+#include <QThread>
+#include <QtConcurrentMap>
 
 #include <ctype.h>
 #include <stdlib.h>
@@ -884,162 +890,349 @@ static void swapEndian( QString &str )
 }
 
 //-----------------------------------------------------------------------------
-static int g_chunk_length = 0, g_chunk_offset=0;
-static uchar *g_chunk = 0;
+// Index entries of index version KMFolderIndex::FixedLayoutIndexVersion and
+// later start with a block of 64 bit numeric columns, followed by a directory
+// of (offset, length) pairs locating each string part in the string heap that
+// makes up the rest of the entry. Numbers and UTF-16 strings are stored in the
+// byte order recorded in the index header, so every part can be read at a
+// known offset without walking the entry.
+// Entries of older index files are a list of (type, length, data) records.
+namespace {
+  enum {
+    IndexLongColumns = 9,
+    IndexStringColumns = 10,
+    IndexStringDirOffset = IndexLongColumns * sizeof(quint64),
+    IndexHeapOffset = IndexStringDirOffset + IndexStringColumns * 2 * sizeof(quint16),
+    IndexMaxStringLength = 256 // in bytes
+  };
+
+  // Column of each KMMsgBase::MsgPartType, -1 if the part has no such column
+  const int s_longColumn[20] = {
+    -1, -1, -1, -1, -1, -1, -1, // MsgNoPart ... MsgXMarkPart
+    0, 1, 2, 3,                 // MsgOffsetPart ... MsgDatePart
+    -1,                         // MsgFilePart
+    4, 5,                       // MsgCryptoStatePart, MsgMDNSentPart
+    -1, -1,                     // MsgReplyToAuxIdMD5Part, MsgStrippedSubjectMD5Part
+    6, 7, 8,                    // MsgStatusPart ... MsgUIDPart
+    -1                          // MsgTagPart
+  };
+  const int s_stringColumn[20] = {
+    -1, 0, 1, 2, 3, 4, 5,       // MsgNoPart ... MsgXMarkPart
+    -1, -1, -1, -1,             // MsgOffsetPart ... MsgDatePart
+    6,                          // MsgFilePart
+    -1, -1,                     // MsgCryptoStatePart, MsgMDNSentPart
+    7, 8,                       // MsgReplyToAuxIdMD5Part, MsgStrippedSubjectMD5Part
+    -1, -1, -1,                 // MsgStatusPart ... MsgUIDPart
+    9                           // MsgTagPart
+  };
+  const KMMsgBase::MsgPartType s_stringColumnPart[IndexStringColumns] = {
+    KMMsgBase::MsgFromPart, KMMsgBase::MsgSubjectPart, KMMsgBase::MsgToPart,
+    KMMsgBase::MsgReplyToIdMD5Part, KMMsgBase::MsgIdMD5Part, KMMsgBase::MsgXMarkPart,
+    KMMsgBase::MsgFilePart, KMMsgBase::MsgReplyToAuxIdMD5Part,
+    KMMsgBase::MsgStrippedSubjectMD5Part, KMMsgBase::MsgTagPart
+  };
+}
 
+//-----------------------------------------------------------------------------
 namespace {
-  template < typename T > void copy_from_stream( T & x ) {
-    if( g_chunk_offset + int(sizeof(T)) > g_chunk_length ) {
-      g_chunk_offset = g_chunk_length;
-      kDebug() << "This should never happen..";
-      x = 0;
-    } else {
-      // the memcpy is optimized out by the compiler for the values
-      // of sizeof(T) that is called with
-      memcpy( &x, g_chunk + g_chunk_offset, sizeof(T) );
-      g_chunk_offset += sizeof(T);
+  // Walks an index entry of the old (type, length, data) format.
+  struct LegacyEntryReader
+  {
+    LegacyEntryReader( const uchar *data, int length )
+      : data( data ), length( length ), offset( 0 ) {}
+
+    template < typename T > void read( T & x ) {
+      if( offset + int(sizeof(T)) > length ) {
+        offset = length;
+        kDebug() << "This should never happen..";
+        x = 0;
+      } else {
+        // the memcpy is optimized out by the compiler for the values
+        // of sizeof(T) that is called with
+        memcpy( &x, data + offset, sizeof(T) );
+        offset += sizeof(T);
+      }
     }
+
+    const uchar *data;
+    int length;
+    int offset;
+  };
+
+  // Serializes the access to the index stream of folders that could not be
+  // mmap()ed, the stream position is shared by all readers.
+  QMutex s_indexStreamMutex;
+
+  // Below this many messages decoding them in parallel is not worth it
+  const int s_minParallelDecodeCount = 256;
+}
+
+#ifndef KMAIL_SQLITE_INDEX
+//-----------------------------------------------------------------------------
+const uchar *KMMsgBase::readIndexEntry( QByteArray &buffer ) const
+{
+  if ( storage()->indexStreamBasePtr() ) {
+    if ( mIndexOffset + mIndexLength > (off_t)storage()->indexStreamLength() ) {
+      // This message has not been indexed yet, data would lie
+      // outside the index data structures so do not touch it.
+      return 0;
+    }
+    return storage()->indexStreamBasePtr() + mIndexOffset;
   }
+
+  QMutexLocker locker( &s_indexStreamMutex );
+  if ( !storage()->mIndexStream )
+    return 0;
+  buffer.resize( mIndexLength );
+  off_t first_off = KDE_ftell(storage()->mIndexStream);
+  KDE_fseek(storage()->mIndexStream, mIndexOffset, SEEK_SET);
+  const bool ok = fread( buffer.data(), mIndexLength, 1, storage()->mIndexStream ) == 1;
+  KDE_fseek(storage()->mIndexStream, first_off, SEEK_SET);
+  return ok ? reinterpret_cast<const uchar *>( buffer.constData() ) : 0;
 }
+#endif
 
 //-----------------------------------------------------------------------------
 QString KMMsgBase::getStringPart(MsgPartType t) const
 {
+#ifndef KMAIL_SQLITE_INDEX
+  if ( usesStringPartCache() ) {
+    StringPartCache *cache = StringPartCache::instance();
+    QString str;
+    if ( cache->find( storage(), mIndexOffset, t, str ) )
+      return str;
+    QString parts[StringPartCache::PartCount];
+    if ( !decodeStringParts( parts ) )
+      return QString();
+    cache->insert( storage(), mIndexOffset, parts );
+    return parts[t];
+  }
+#endif
   if ( !mStringPartCacheBuilt )
     fillStringPartCache();
   return mCachedStringParts[t];
 }
 
+#ifndef KMAIL_SQLITE_INDEX
+//-----------------------------------------------------------------------------
+bool KMMsgBase::usesStringPartCache() const
+{
+  return mParent && storage()->indexStreamBasePtr();
+}
+#endif
+
 //-----------------------------------------------------------------------------
 void KMMsgBase::fillStringPartCache() const
+{
+  if ( decodeStringParts( mCachedStringParts ) )
+    mStringPartCacheBuilt = true;
+}
+
+//-----------------------------------------------------------------------------
+bool KMMsgBase::decodeStringParts( QString *parts ) const
 {
 retry:
 #ifdef KMAIL_SQLITE_INDEX
   bool swapByteOrder = false;
-  g_chunk = (uchar*)mData;
-  g_chunk_length = mIndexLength;
+  const bool fixedLayout =
+    storage()->indexVersion() >= KMFolderIndex::FixedLayoutIndexVersion;
+  const uchar *chunk = (const uchar*)mData;
 #else
-  bool using_mmap = false;
   bool swapByteOrder = storage()->indexSwapByteOrder();
-  if (storage()->indexStreamBasePtr()) {
-    if (g_chunk)
-      free(g_chunk);
-    using_mmap = true;
-    if ( mIndexOffset > (off_t)storage()->indexStreamLength() ) {
-      // This message has not been indexed yet, data would lie
-      // outside the index data structures so do not touch it.
-      return;
-    }
-    g_chunk = storage()->indexStreamBasePtr() + mIndexOffset;
-    g_chunk_length = mIndexLength;
-  } else {
-    if(!storage()->mIndexStream)
-      return;
-    if (g_chunk_length < mIndexLength)
-      g_chunk = (uchar *)realloc(g_chunk, g_chunk_length = mIndexLength);
-    off_t first_off = KDE_ftell(storage()->mIndexStream);
-    KDE_fseek(storage()->mIndexStream, mIndexOffset, SEEK_SET);
-    fread( g_chunk, mIndexLength, 1, storage()->mIndexStream);
-    KDE_fseek(storage()->mIndexStream, first_off, SEEK_SET);
-  }
+  const bool fixedLayout =
+    storage()->indexVersion() >= KMFolderIndex::FixedLayoutIndexVersion;
+  QByteArray buffer;
+  const uchar *chunk = readIndexEntry( buffer );
+  if ( !chunk )
+    return false;
 #endif // !KMAIL_SQLITE_INDEX
 
-  MsgPartType type;
-  quint16 len;
-  for ( g_chunk_offset = 0; g_chunk_offset < mIndexLength; g_chunk_offset += len ) {
-    quint32 tmp;
-    copy_from_stream(tmp);
-    copy_from_stream(len);
-    if (swapByteOrder)
-    {
-       tmp = kmail_swap_32(tmp);
-       len = kmail_swap_16(len);
-    }
-    type = (MsgPartType) tmp;
-    if( g_chunk_offset + len > mIndexLength ) {
+  if ( fixedLayout ) {
+    if ( mIndexLength < IndexHeapOffset )
       kWarning() << "This should never happen..";
-#ifndef KMAIL_SQLITE_INDEX
-      if( using_mmap ) {
-        g_chunk_length = 0;
-        g_chunk = 0;
+    else {
+      const uchar *dir = chunk + IndexStringDirOffset;
+      for ( int column = 0; column < IndexStringColumns; ++column, dir += 2 * sizeof(quint16) ) {
+        quint16 offset, len;
+        memcpy( &offset, dir, sizeof(offset) );
+        memcpy( &len, dir + sizeof(offset), sizeof(len) );
+        if ( swapByteOrder ) {
+          offset = kmail_swap_16( offset );
+          len = kmail_swap_16( len );
+        }
+        if ( !len )
+          continue;
+        if ( offset + len > mIndexLength ) {
+          kWarning() << "This should never happen..";
+          break;
+        }
+        // This works because the QString constructor does a memcpy.
+        // Otherwise we would need to be concerned about the alignment.
+        QString &str = parts[s_stringColumnPart[column]];
+        str = QString( (QChar *)( chunk + offset ), len / 2 );
+        if ( swapByteOrder )
+          swapEndian( str );
       }
-#endif
-      if ( !storage()->recreateIndex() )
-        return;
-      goto retry;
     }
+  } else {
+    MsgPartType type;
+    quint16 len;
+    LegacyEntryReader reader( chunk, mIndexLength );
+    for ( ; reader.offset < mIndexLength; reader.offset += len ) {
+      quint32 tmp;
+      reader.read(tmp);
+      reader.read(len);
+      if (swapByteOrder)
+      {
+         tmp = kmail_swap_32(tmp);
+         len = kmail_swap_16(len);
+      }
+      type = (MsgPartType) tmp;
+      if( reader.offset + len > mIndexLength ) {
+        kWarning() << "This should never happen..";
+        // Rebuilding the index talks to the user, leave that to
+        // the next access from the GUI thread.
+        if ( QThread::currentThread() != qApp->thread() )
+          return false;
+        if ( !storage()->recreateIndex() )
+          return false;
+        goto retry;
+      }
 
-    // Only try to create strings if the part is really a string part, see declaration of
-    // MsgPartType
-    if ( len && ( ( type >= 1 && type <= 6 ) || type == 11 || type == 14 || type == 15 || type == 19 ) ) {
-
-      // This works because the QString constructor does a memcpy.
-      // Otherwise we would need to be concerned about the alignment.
-      mCachedStringParts[type] = QString((QChar *)(g_chunk + g_chunk_offset), len/2);
-
-      // Normally we need to swap the byte order because the QStrings are written
-      // in the style of Qt2 (MSB -> network ordered).
-      // QStrings in Qt3 expect host ordering.
-      // On e.g. Intel host ordering is LSB, on e.g. Sparc it is MSB.
-
-#     if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
-      // Byte order is little endian (swap is true)
-      swapEndian( mCachedStringParts[type] );
-#     else
-      // Byte order is big endian (swap is false)
-#     endif
-    }
-  } //for
+      // Only try to create strings if the part is really a string part, see declaration of
+      // MsgPartType
+      if ( len && ( ( type >= 1 && type <= 6 ) || type == 11 || type == 14 || type == 15 || type == 19 ) ) {
+
+        // This works because the QString constructor does a memcpy.
+        // Otherwise we would need to be concerned about the alignment.
+        parts[type] = QString((QChar *)(chunk + reader.offset), len/2);
+
+        // Normally we need to swap the byte order because the QStrings are written
+        // in the style of Qt2 (MSB -> network ordered).
+        // QStrings in Qt3 expect host ordering.
+        // On e.g. Intel host ordering is LSB, on e.g. Sparc it is MSB.
+
+#       if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        // Byte order is little endian (swap is true)
+        swapEndian( parts[type] );
+#       else
+        // Byte order is big endian (swap is false)
+#       endif
+      }
+    } //for
+  }
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// static
+void KMMsgBase::fillStringPartCacheOf( KMMsgBase *&msg )
+{
 #ifndef KMAIL_SQLITE_INDEX
-  if(using_mmap) {
-      g_chunk_length = 0;
-      g_chunk = 0;
+  if ( msg->usesStringPartCache() ) {
+    StringPartCache *cache = StringPartCache::instance();
+    if ( cache->contains( msg->storage(), msg->mIndexOffset ) )
+      return;
+    QString parts[StringPartCache::PartCount];
+    if ( msg->decodeStringParts( parts ) )
+      cache->insert( msg->storage(), msg->mIndexOffset, parts );
+    return;
   }
 #endif
+  msg->fillStringPartCache();
+}
 
-  mStringPartCacheBuilt = true;
+//-----------------------------------------------------------------------------
+// static
+void KMMsgBase::fillStringPartCaches( const QList<KMMsgBase*> &msgs )
+{
+  // Every message only touches its own cache and reads the index data of its
+  // folder, which is not changed while we block the GUI thread here.
+  QList<KMMsgBase*> todo;
+  foreach ( KMMsgBase *msg, msgs ) {
+    if ( msg && !msg->isMessage() && !msg->mStringPartCacheBuilt && msg->storage() )
+      todo.append( msg );
+  }
+
+  if ( todo.count() < s_minParallelDecodeCount ) {
+    for ( int i = 0; i < todo.count(); ++i )
+      fillStringPartCacheOf( todo[i] );
+    return;
+  }
+  QtConcurrent::blockingMap( todo, &KMMsgBase::fillStringPartCacheOf );
 }
 
 //-----------------------------------------------------------------------------
 off_t KMMsgBase::getLongPart(MsgPartType t) const
 {
+  const int column = ( t >= 0 && t < 20 ) ? s_longColumn[t] : -1;
+  if ( column < 0 )
+    return 0;
+
+#ifdef KMAIL_SQLITE_INDEX
+  //todo reenable
+  const bool swapByteOrder = false;
+#else
+  const bool swapByteOrder = storage()->indexSwapByteOrder();
+#endif
+  const bool fixedLayout =
+    storage()->indexVersion() >= KMFolderIndex::FixedLayoutIndexVersion;
+
+  if ( fixedLayout ) {
+    // The column lies at a fixed offset, so there is no need to look at
+    // anything else of the entry.
+    quint64 value = 0;
+    if ( mIndexLength < IndexHeapOffset ) {
+      kWarning() << "This should never happen..";
+      return 0;
+    }
+#ifdef KMAIL_SQLITE_INDEX
+    memcpy( &value, mData + column * sizeof(value), sizeof(value) );
+#else
+    const off_t offset = mIndexOffset + column * sizeof(value);
+    if ( storage()->indexStreamBasePtr() ) {
+      if ( offset + (off_t)sizeof(value) > (off_t)storage()->indexStreamLength() )
+        return 0;
+      memcpy( &value, storage()->indexStreamBasePtr() + offset, sizeof(value) );
+    } else {
+      QMutexLocker locker( &s_indexStreamMutex );
+      if ( !storage()->mIndexStream )
+        return 0;
+      off_t first_off = KDE_ftell(storage()->mIndexStream);
+      KDE_fseek(storage()->mIndexStream, offset, SEEK_SET);
+      fread( &value, sizeof(value), 1, storage()->mIndexStream);
+      KDE_fseek(storage()->mIndexStream, first_off, SEEK_SET);
+    }
+#endif
+    if ( swapByteOrder )
+      value = kmail_swap_64( value );
+    return value;
+  }
+
 retry:
   off_t ret = 0;
 
 #ifdef KMAIL_SQLITE_INDEX
-  //todo reenable
-  bool swapByteOrder = false;
+  // Rows of databases written before FixedLayoutIndexVersion, until
+  // readIndex() has converted them
   int sizeOfLong = sizeof(long);
-  g_chunk = (uchar*)mData;
-  g_chunk_length = mIndexLength;
+  const uchar *chunk = (const uchar*)mData;
 #else
-  bool using_mmap = false;
-  bool swapByteOrder = storage()->indexSwapByteOrder();
   int sizeOfLong = storage()->indexSizeOfLong();
-  if (storage()->indexStreamBasePtr()) {
-    if (g_chunk)
-      free(g_chunk);
-    using_mmap = true;
-    g_chunk = storage()->indexStreamBasePtr() + mIndexOffset;
-    g_chunk_length = mIndexLength;
-  } else {
-    if (!storage()->mIndexStream)
-      return ret;
-    assert(mIndexLength >= 0);
-    if (g_chunk_length < mIndexLength)
-      g_chunk = (uchar *)realloc(g_chunk, g_chunk_length = mIndexLength);
-    off_t first_off = KDE_ftell(storage()->mIndexStream);
-    KDE_fseek(storage()->mIndexStream, mIndexOffset, SEEK_SET);
-    fread( g_chunk, mIndexLength, 1, storage()->mIndexStream);
-    KDE_fseek(storage()->mIndexStream, first_off, SEEK_SET);
-  }
-#endif // !KMAIL_SQLITE_INDEX
+  assert(mIndexLength >= 0);
+  QByteArray buffer;
+  const uchar *chunk = readIndexEntry( buffer );
+  if ( !chunk )
+    return ret;
+#endif
 
   quint16 len;
-  for ( g_chunk_offset = 0; g_chunk_offset < mIndexLength; g_chunk_offset += len ) {
+  LegacyEntryReader reader( chunk, mIndexLength );
+  for ( ; reader.offset < mIndexLength; reader.offset += len ) {
     quint32 tmp;
-    copy_from_stream(tmp);
-    copy_from_stream(len);
+    reader.read(tmp);
+    reader.read(len);
     if (swapByteOrder)
     {
        tmp = kmail_swap_32(tmp);
@@ -1047,14 +1240,10 @@ retry:
     }
     MsgPartType type = (MsgPartType) tmp;
 
-    if (g_chunk_offset + len > mIndexLength) {
+    if (reader.offset + len > mIndexLength) {
       kDebug() << "This should never happen..";
-#ifndef KMAIL_SQLITE_INDEX
-      if(using_mmap) {
-        g_chunk_length = 0;
-        g_chunk = 0;
-      }
-#endif
+      if ( QThread::currentThread() != qApp->thread() )
+        return 0;
       if (!storage()->recreateIndex())
         return 0;
       goto retry;
@@ -1063,7 +1252,7 @@ retry:
       assert(sizeOfLong == len);
       if (sizeOfLong == sizeof(ret))
       {
-        copy_from_stream(ret);
+        reader.read(ret);
         if (swapByteOrder)
         {
           if (sizeof(ret) == 4)
@@ -1076,7 +1265,7 @@ retry:
       {
          // Long is stored as 4 bytes in index file, sizeof(long) = 8
          quint32 ret_32;
-         copy_from_stream(ret_32);
+         reader.read(ret_32);
          if (swapByteOrder)
             ret_32 = kmail_swap_32(ret_32);
          ret = ret_32;
@@ -1086,8 +1275,8 @@ retry:
          // Long is stored as 8 bytes in index file, sizeof(long) = 4
          quint32 ret_1;
          quint32 ret_2;
-         copy_from_stream(ret_1);
-         copy_from_stream(ret_2);
+         reader.read(ret_1);
+         reader.read(ret_2);
          if (!swapByteOrder)
          {
             // Index file order is the same as the order of this CPU.
@@ -1117,118 +1306,70 @@ retry:
       break;
     }
   } // for
-#ifndef KMAIL_SQLITE_INDEX
-  if(using_mmap) {
-    g_chunk_length = 0;
-    g_chunk = 0;
-  }
-#endif
 
   return ret;
 }
 
-#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
-// We need to use swab to swap bytes to network byte order
-#define memcpy_networkorder(to, from, len)  swab((char *)(from), (char *)(to), len)
-#else
-// We're already in network byte order
-#define memcpy_networkorder(to, from, len)  memcpy(to, from, len)
-#endif
-
-#define STORE_DATA_LEN(type, x, len, network_order) \
-  do { \
-    int len2 = (len > 256) ? 256 : len; \
-    if(csize < (length + (len2 + sizeof(short) + sizeof(MsgPartType)))) \
-      ret = (uchar *)realloc(ret, csize += len2+sizeof(short)+sizeof(MsgPartType)); \
-    quint32 t = (quint32) type; memcpy(ret+length, &t, sizeof(t)); \
-    quint16 l = len2; memcpy(ret+length+sizeof(t), &l, sizeof(l)); \
-    if (network_order) \
-       memcpy_networkorder(ret+length+sizeof(t)+sizeof(l), x, len2); \
-    else \
-       memcpy(ret+length+sizeof(t)+sizeof(l), x, len2); \
-    length += len2+sizeof(t)+sizeof(l); \
-  } while(0)
-
-#define STORE_DATA(type, x) STORE_DATA_LEN(type, &x, sizeof(x), false)
-
 //-----------------------------------------------------------------------------
-const uchar *KMMsgBase::asIndexString(int &length) const
+void KMMsgBase::asIndexString( QByteArray &buffer ) const
 {
-  unsigned int csize = 256;
-  static uchar *ret = 0; //different static buffer here for we may use the other buffer in the functions below
-  if(!ret) {
-    ret = (uchar *)malloc(csize);
+  quint64 longs[IndexLongColumns];
+  longs[s_longColumn[MsgOffsetPart]] = folderOffset();
+  longs[s_longColumn[MsgLegacyStatusPart]] = 0;
+  longs[s_longColumn[MsgSizePart]] = msgSize();
+  longs[s_longColumn[MsgDatePart]] = date();
+  longs[s_longColumn[MsgCryptoStatePart]] = (signatureState() << 16) | encryptionState();
+  longs[s_longColumn[MsgMDNSentPart]] = mdnSentState();
+  longs[s_longColumn[MsgStatusPart]] = (quint32)mStatus.toQInt32();
+  longs[s_longColumn[MsgSizeServerPart]] = msgSizeServer();
+  longs[s_longColumn[MsgUIDPart]] = UID();
+
+  QString strings[IndexStringColumns];
+  strings[s_stringColumn[MsgFromPart]] = fromStrip().trimmed();
+  strings[s_stringColumn[MsgSubjectPart]] = subject().trimmed();
+  strings[s_stringColumn[MsgToPart]] = toStrip().trimmed();
+  strings[s_stringColumn[MsgReplyToIdMD5Part]] = replyToIdMD5().trimmed();
+  strings[s_stringColumn[MsgIdMD5Part]] = msgIdMD5().trimmed();
+  strings[s_stringColumn[MsgXMarkPart]] = xmark().trimmed();
+  strings[s_stringColumn[MsgFilePart]] = fileName().trimmed();
+  strings[s_stringColumn[MsgReplyToAuxIdMD5Part]] = replyToAuxIdMD5().trimmed();
+  strings[s_stringColumn[MsgStrippedSubjectMD5Part]] = strippedSubjectMD5().trimmed();
+  strings[s_stringColumn[MsgTagPart]] = tagString().trimmed();
+
+  quint16 lengths[IndexStringColumns];
+  int length = IndexHeapOffset;
+  for ( int column = 0; column < IndexStringColumns; ++column ) {
+    lengths[column] = qMin( strings[column].length() * 2, (int)IndexMaxStringLength );
+    length += lengths[column];
+  }
+  buffer.resize( length );
+
+  uchar *ret = reinterpret_cast<uchar *>( buffer.data() );
+  memcpy( ret, longs, sizeof(longs) );
+  uchar *dir = ret + IndexStringDirOffset;
+  quint16 offset = IndexHeapOffset;
+  for ( int column = 0; column < IndexStringColumns; ++column, dir += 2 * sizeof(quint16) ) {
+    memcpy( dir, &offset, sizeof(offset) );
+    memcpy( dir + sizeof(offset), &lengths[column], sizeof(quint16) );
+    memcpy( ret + offset, strings[column].unicode(), lengths[column] );
+    offset += lengths[column];
   }
-  length = 0;
-
-  unsigned long tmp;
-  QString tmp_str;
-
-  //these is at the beginning because it is queried quite often
-  tmp_str = msgIdMD5().trimmed();
-  STORE_DATA_LEN(MsgIdMD5Part, tmp_str.unicode(), tmp_str.length() * 2, true);
-  tmp = 0;
-  STORE_DATA(MsgLegacyStatusPart, tmp);
-
-  //these are completely arbitrary order
-  tmp_str = fromStrip().trimmed();
-  STORE_DATA_LEN(MsgFromPart, tmp_str.unicode(), tmp_str.length() * 2, true);
-  tmp_str = tagString().trimmed();
-  STORE_DATA_LEN(MsgTagPart, tmp_str.unicode(), tmp_str.length() * 2, true);
-  tmp_str = subject().trimmed();
-  STORE_DATA_LEN(MsgSubjectPart, tmp_str.unicode(), tmp_str.length() * 2, true);
-  tmp_str = toStrip().trimmed();
-  STORE_DATA_LEN(MsgToPart, tmp_str.unicode(), tmp_str.length() * 2, true);
-  tmp_str = replyToIdMD5().trimmed();
-  STORE_DATA_LEN(MsgReplyToIdMD5Part, tmp_str.unicode(), tmp_str.length() * 2, true);
-  tmp_str = xmark().trimmed();
-  STORE_DATA_LEN(MsgXMarkPart, tmp_str.unicode(), tmp_str.length() * 2, true);
-  tmp_str = fileName().trimmed();
-  STORE_DATA_LEN(MsgFilePart, tmp_str.unicode(), tmp_str.length() * 2, true);
-  tmp = msgSize();
-  STORE_DATA(MsgSizePart, tmp);
-  tmp = folderOffset();
-  STORE_DATA(MsgOffsetPart, tmp);
-  tmp = date();
-  STORE_DATA(MsgDatePart, tmp);
-  tmp = (signatureState() << 16) | encryptionState();
-  STORE_DATA(MsgCryptoStatePart, tmp);
-  tmp = mdnSentState();
-  STORE_DATA(MsgMDNSentPart, tmp);
-
-  tmp_str = replyToAuxIdMD5().trimmed();
-  STORE_DATA_LEN(MsgReplyToAuxIdMD5Part, tmp_str.unicode(), tmp_str.length() * 2, true);
-
-  tmp_str = strippedSubjectMD5().trimmed();
-  STORE_DATA_LEN(MsgStrippedSubjectMD5Part, tmp_str.unicode(), tmp_str.length() * 2, true);
-
-  tmp = mStatus.toQInt32();
-  STORE_DATA(MsgStatusPart, tmp);
-
-  tmp = msgSizeServer();
-  STORE_DATA(MsgSizeServerPart, tmp);
-  tmp = UID();
-  STORE_DATA(MsgUIDPart, tmp);
-
-  return ret;
 }
-#undef STORE_DATA_LEN
-#undef STORE_DATA
 
 #ifndef KMAIL_SQLITE_INDEX
 bool KMMsgBase::syncIndexString() const
 {
   if(!dirty())
     return true;
-  int len;
-  const uchar *buffer = asIndexString(len);
-  if (len != mIndexLength)
+  QByteArray buffer;
+  asIndexString( buffer );
+  if (buffer.size() != mIndexLength)
     return false;
 
   Q_ASSERT(storage()->mIndexStream);
   KDE_fseek(storage()->mIndexStream, mIndexOffset, SEEK_SET);
   assert( mIndexOffset > 0 );
-  if ( fwrite( buffer, len, 1, storage()->mIndexStream) != 1 )
+  if ( fwrite( buffer.constData(), buffer.size(), 1, storage()->mIndexStream) != 1 )
     return false;
   return true;
 }
@@ -1251,6 +1392,8 @@ void KMMsgBase::readConfig()
     sForwardSubjPrefixes << "Fwd:" << "FW:";
   sReplaceForwSubjPrefix =
       composerGroup.readEntry( "replace-forward-prefix", true );
+
+  StringPartCache::instance()->setMaxSize( GlobalSettings::self()->stringPartCacheSize() * 1024 );
 }
 
 //-----------------------------------------------------------------------------
@@ -26,6 +26,7 @@ using KPIM::MessageStatus;
 // for large file support flags
 #include <sys/types.h>
 #include <QString>
+#include <QList>
 #include <time.h>
 
 #ifdef KMAIL_SQLITE_INDEX
@@ -199,8 +200,10 @@ public:
   /** Calculate strippedSubject */
   virtual void initStrippedSubjectMD5() = 0;
 
-  /** Return contents as index string. This string is of indexStringLength() size */
-  const uchar *asIndexString(int &len) const;
+  /** Stores the contents as index entry in @p buffer, which is resized to
+      the length of the entry. Reusing the buffer for several messages avoids
+      reallocating it for every one. */
+  void asIndexString( QByteArray &buffer ) const;
 
   /** Get/set offset in mail folder. */
   virtual off_t folderOffset(void) const = 0;
@@ -402,9 +405,24 @@ protected:
 
   // Those strings returned by getStringPart() are cached in this array, for
   // faster access. This speeds up folder loading by 10%.
+  // Messages of folders with an mmap()ed index use the size limited
+  // KMail::StringPartCache instead.
   mutable QString mCachedStringParts[20];
   mutable bool mStringPartCacheBuilt;
   void fillStringPartCache() const;
+  /** Decodes the string parts of the index entry into the array @p parts
+      of 20 strings. Returns false if the entry could not be read. */
+  bool decodeStringParts( QString *parts ) const;
+  static void fillStringPartCacheOf( KMMsgBase *&msg );
+
+#ifndef KMAIL_SQLITE_INDEX
+  bool usesStringPartCache() const;
+
+  /** Returns the index entry of this message, either pointing into the
+      mmap()ed index or copied into @p buffer. Returns 0 if the entry
+      cannot be read. */
+  const uchar *readIndexEntry( QByteArray &buffer ) const;
+#endif
 
 public:
   enum MsgPartType
@@ -441,6 +459,12 @@ public:
   off_t getLongPart(MsgPartType) const;
   /** access to string msgparts */
   QString getStringPart(MsgPartType) const;
+
+  /** Decodes the string parts of all messages in @p msgs at once, on the
+      threads of QThreadPool::globalInstance() if there are enough of them.
+      Blocks until all of them are done. The folders of the messages must be
+      open and must not be modified by other threads in the meantime. */
+  static void fillStringPartCaches( const QList<KMMsgBase*> &msgs );
 #ifndef KMAIL_SQLITE_INDEX
   /** sync'ing just one KMMsgBase */
   bool syncIndexString() const;
@@ -6,6 +6,7 @@
 #include "kmfolderindex.h"
 #include "kmfolder.h"
 #include "kmdict.h"
+#include "kmmsgdictfile.h"
 #include "globalsettings.h"
 #include "folderstorage.h"
 
@@ -13,62 +14,24 @@
 #include <kde_file.h>
 #include <kglobal.h>
 
+#include <QFile>
 #include <QFileInfo>
 #include <QVector>
 
 #include <stdio.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 
-#include <config-kmail.h>
-
-#ifdef HAVE_BYTESWAP_H
-#include <byteswap.h>
-#endif
-
-// We define functions as kmail_swap_NN so that we don't get compile errors
-// on platforms where bswap_NN happens to be a function instead of a define.
-
-/* Swap bytes in 32 bit value.  */
-#ifdef bswap_32
-#define kmail_swap_32(x) bswap_32(x)
-#else
-#define kmail_swap_32(x) \
-     ((((x) & 0xff000000) >> 24) | (((x) & 0x00ff0000) >>  8) |		      \
-      (((x) & 0x0000ff00) <<  8) | (((x) & 0x000000ff) << 24))
-#endif
-
-
 //-----------------------------------------------------------------------------
 
-// Current version of the .index.ids files
-#define IDS_VERSION 1002
-
-// The asterisk at the end is important
-#define IDS_HEADER "# KMail-Index-IDs V%d\n*"
-
 /**
- * @short an entry in the global message dictionary consisting of a pointer
- * to a folder and the index of a message in the folder.
- */
-class KMMsgDictEntry : public KMDictItem
-{
-public:
-  KMMsgDictEntry(const KMFolder *aFolder, int aIndex)
-  : folder( aFolder ), index( aIndex )
-    {}
-
-  const KMFolder *folder;
-  int index;
-};
-
-/**
- * @short A "reverse entry", consisting of an array of DictEntry pointers.
+ * @short A "reverse entry", consisting of an array of serial numbers.
  *
  * Each folder (storage) holds such an entry. That's useful for looking up the
- * serial number of a message at a certain index in the folder, since that is the
- * key of these entries.
+ * serial number of a message at a certain index in the folder, which is
+ * the key of the message in the dictionary.
  */
 class KMMsgDictREntry
 {
@@ -76,10 +39,11 @@ public:
   KMMsgDictREntry(int size = 0)
   {
     array.resize(size);
-    memset(array.data(), 0, array.size() * sizeof(KMMsgDictEntry *));  // faster than a loop
+    memset(array.data(), 0, array.size() * sizeof(ulong));  // faster than a loop
     fp = 0;
     swapByteOrder = false;
     baseOffset = 0;
+    appendOffset = 0;
   }
 
   ~KMMsgDictREntry()
@@ -89,7 +53,7 @@ public:
       fclose(fp);
   }
 
-  void set(int index, KMMsgDictEntry *entry)
+  void set(int index, ulong msn)
   {
     if (index >= 0) {
       int size = array.size();
@@ -99,23 +63,26 @@ public:
         for (int j = size; j < newsize; j++)
           array[j] = 0;
       }
-      array[index] = entry;
+      array[index] = msn;
     }
   }
 
-  KMMsgDictEntry *get(int index)
+  ulong getMsn(int index)
   {
     if (index >= 0 && index < array.size())
       return array.at(index);
     return 0;
   }
 
-  ulong getMsn(int index)
+  /** Replaces the array by the serial numbers read from an .ids file. */
+  void load(const QVector<ulong> &ids)
   {
-    KMMsgDictEntry *entry = get(index);
-    if (entry)
-      return entry->key;
-    return 0;
+    array = ids;
+  }
+
+  const ulong *data() const
+  {
+    return array.constData();
   }
 
   int getRealSize()
@@ -139,10 +106,13 @@ public:
   FILE *fp;
   bool swapByteOrder;
   off_t baseOffset;
+  /** Where the appended records of the .ids file start, 0 if the file
+      must be written anew before records can be appended. */
+  off_t appendOffset;
 
 private:
 
-  QVector<KMMsgDictEntry *> array;
+  QVector<ulong> array;
 };
 
 
@@ -230,22 +200,19 @@ unsigned long KMMsgDict::insert(unsigned long msgSerNum,
     index = folder->find(msg);
 
   // Should not happen, indicates id file corruption
-  while (dict->find((long)msn)) {
+  while (dict->contains(msn)) {
     msn = getNextMsgSerNum();
     folder->setDirty( true ); // rewrite id file
   }
 
-  // Insert into the dict. Don't use dict->replace() as we _know_
-  // there is no entry with the same msn, we just made sure.
-  KMMsgDictEntry *entry = new KMMsgDictEntry(folder->folder(), index);
-  dict->insert((long)msn, entry);
+  dict->replace(msn, folder->folder(), index);
 
   KMMsgDictREntry *rentry = folder->rDict();
   if (!rentry) {
     rentry = new KMMsgDictREntry();
     folder->setRDict(rentry);
   }
-  rentry->set(index, entry);
+  rentry->set(index, msn);
 
   return msn;
 }
@@ -273,33 +240,32 @@ void KMMsgDict::replace(unsigned long msgSerNum,
     index = folder->find( msg );
 
   remove( msgSerNum );
-  KMMsgDictEntry *entry = new KMMsgDictEntry( folder->folder(), index );
-  dict->insert( (long)msgSerNum, entry );
+  dict->replace( msgSerNum, folder->folder(), index );
 
   KMMsgDictREntry *rentry = folder->rDict();
   if (!rentry) {
     rentry = new KMMsgDictREntry();
     folder->setRDict(rentry);
   }
-  rentry->set(index, entry);
+  rentry->set(index, msgSerNum);
 }
 
 //-----------------------------------------------------------------------------
 
 void KMMsgDict::remove(unsigned long msgSerNum)
 {
-  long key = (long)msgSerNum;
-  KMMsgDictEntry *entry = (KMMsgDictEntry *)dict->find(key);
-  if (!entry)
+  const KMFolder *folder;
+  int index;
+  if (!dict->find(msgSerNum, &folder, &index))
     return;
 
-  if (entry->folder) {
-    KMMsgDictREntry *rentry = entry->folder->storage()->rDict();
-    if (rentry)
-      rentry->set(entry->index, 0);
+  if (folder) {
+    KMMsgDictREntry *rentry = folder->storage()->rDict();
+    if (rentry && rentry->getMsn(index) == msgSerNum)
+      rentry->set(index, 0);
   }
 
-  dict->remove((long)key);
+  dict->remove(msgSerNum);
 }
 
 unsigned long KMMsgDict::remove(const KMMsgBase *msg)
@@ -315,11 +281,11 @@ void KMMsgDict::update(const KMMsgBase *msg, int index, int newIndex)
 {
   KMMsgDictREntry *rentry = msg->parent()->storage()->rDict();
   if (rentry) {
-    KMMsgDictEntry *entry = rentry->get(index);
-    if (entry) {
-      entry->index = newIndex;
+    ulong msn = rentry->getMsn(index);
+    if (msn) {
+      dict->setIndex(msn, newIndex);
       rentry->set(index, 0);
-      rentry->set(newIndex, entry);
+      rentry->set(newIndex, msn);
     }
   }
 }
@@ -329,14 +295,9 @@ void KMMsgDict::update(const KMMsgBase *msg, int index, int newIndex)
 void KMMsgDict::getLocation(unsigned long key,
                             KMFolder **retFolder, int *retIndex) const
 {
-  KMMsgDictEntry *entry = (KMMsgDictEntry *)dict->find((long)key);
-  if (entry) {
-    *retFolder = (KMFolder *)entry->folder;
-    *retIndex = entry->index;
-  } else {
-    *retFolder = 0;
-    *retIndex = -1;
-  }
+  const KMFolder *folder;
+  dict->find(key, &folder, retIndex);
+  *retFolder = (KMFolder *)folder;
 }
 
 void KMMsgDict::getLocation(const KMMsgBase *msg,
@@ -409,88 +370,44 @@ int KMMsgDict::readFolderIds( FolderStorage& storage )
     return -1;
 
   QString filename = getFolderIdsLocation( storage );
-  FILE *fp = KDE_fopen(QFile::encodeName(filename), "r+");
-  if (!fp)
-    return -1;
-
-  int version = 0;
-  fscanf(fp, IDS_HEADER, &version);
-  if (version != IDS_VERSION) {
-    fclose(fp);
-    return -1;
-  }
-
+  QVector<ulong> ids;
   bool swapByteOrder;
-  quint32 byte_order;
-  if (!fread(&byte_order, sizeof(byte_order), 1, fp)) {
-    fclose(fp);
-    return -1;
-  }
-  swapByteOrder = (byte_order == 0x78563412);
-
-  quint32 count;
-  if (!fread(&count, sizeof(count), 1, fp)) {
-    fclose(fp);
-    return -1;
-  }
-  if (swapByteOrder)
-     count = kmail_swap_32(count);
-
-  // quick consistency check to avoid allocating huge amount of memory
-  // due to reading corrupt file (#71549)
-  long pos = KDE_ftell( fp );       // store current position
-  KDE_fseek( fp, 0, SEEK_END );
-  long fileSize = KDE_ftell( fp );  // how large is the file ?
-  KDE_fseek( fp, pos, SEEK_SET );   // back to previous position
-
-  // the file must at least contain what we try to read below
-  if ( (fileSize - pos) < ( long )(count * sizeof(quint32)) ) {
-    fclose(fp);
+  qint64 appendOffset;
+  if ( !KMMsgDictFile::read( filename, ids, &swapByteOrder, &appendOffset ) )
     return -1;
-  }
-
-  KMMsgDictREntry *rentry = new KMMsgDictREntry(count);
-
-  for (unsigned int index = 0; index < count; index++) {
-    quint32 msn;
-
-    bool readOk = fread(&msn, sizeof(msn), 1, fp);
-    if (swapByteOrder)
-       msn = kmail_swap_32(msn);
 
-    if (!readOk || dict->find(msn)) {
-      for (unsigned int i = 0; i < index; i++) {
-        msn = rentry->getMsn(i);
-        dict->remove((long)msn);
-      }
-      delete rentry;
-      fclose(fp);
-      return -1;
-    }
-
-    // We found a serial number that is zero. This is not allowed, and would
-    // later cause problems like in bug 149715.
-    // Therefore, use a fresh serial number instead
-    if ( msn == 0 ) {
+  KMMsgDictREntry *rentry = new KMMsgDictREntry();
+  rentry->swapByteOrder = swapByteOrder;
+  rentry->appendOffset = appendOffset;
+  rentry->load( ids );
+
+  const int size = rentry->getRealSize();
+  ulong highest = 0;
+  for ( int index = 0; index < size; index++ )
+    highest = qMax( highest, rentry->getMsn( index ) );
+  if ( highest >= nextMsgSerNum )
+    nextMsgSerNum = highest + 1;
+
+  // We found a serial number that is zero. This is not allowed, and would
+  // later cause problems like in bug 149715.
+  // Therefore, use a fresh serial number instead
+  for ( int index = 0; index < size; index++ ) {
+    if ( rentry->getMsn( index ) == 0 ) {
       kWarning() << "Found serial number zero at index" << index << "in folder" << filename;
-      msn = getNextMsgSerNum();
-      Q_ASSERT( msn != 0 );
+      rentry->set( index, getNextMsgSerNum() );
     }
+  }
 
-    // Insert into the dict. Don't use dict->replace() as we _know_
-    // there is no entry with the same msn, we just made sure.
-    KMMsgDictEntry *entry = new KMMsgDictEntry( storage.folder(), index);
-    dict->insert((long)msn, entry);
-    if (msn >= nextMsgSerNum)
-      nextMsgSerNum = msn + 1;
-
-    rentry->set(index, entry);
+  // Fails if one of the serial numbers is taken already
+  if ( !dict->insert( rentry->data(), size, storage.folder() ) ) {
+    delete rentry;
+    return -1;
   }
+
   // Remember how many items we put into the dict this time so we can create
   // it with an appropriate size next time.
-  GlobalSettings::setMsgDictSizeHint( GlobalSettings::msgDictSizeHint() + count );
+  GlobalSettings::setMsgDictSizeHint( GlobalSettings::msgDictSizeHint() + size );
 
-  fclose(fp);
   storage.setRDict(rentry);
 
   return 0;
@@ -517,7 +434,7 @@ KMMsgDictREntry *KMMsgDict::openFolderIds( const FolderStorage& storage, bool tr
     {
       int version = 0;
       fscanf(fp, IDS_HEADER, &version);
-      if (version == IDS_VERSION)
+      if (version == IDS_VERSION || version == IDS_VERSION_NO_APPEND)
       {
          quint32 byte_order = 0;
          fread(&byte_order, sizeof(byte_order), 1, fp);
@@ -567,21 +484,22 @@ int KMMsgDict::writeFolderIds( const FolderStorage &storage )
   KDE_fseek( fp, rentry->baseOffset, SEEK_SET );
   // kDebug() << "Dict writing for folder" << storage.label();
   quint32 count = rentry->getRealSize();
-  if (!fwrite(&count, sizeof(count), 1, fp)) {
-    kDebug() << "Dict cannot write count with folder" << storage.label() <<":"
-                  << strerror(errno) << "(" << errno << ")";
-    return -1;
-  }
-
+  QVector<quint32> ids( count + 1 );
+  ids[0] = count;
   for (unsigned int index = 0; index < count; index++) {
     quint32 msn = rentry->getMsn(index);
-    if (!fwrite(&msn, sizeof(msn), 1, fp))
-      return -1;
+    ids[index + 1] = msn;
     if ( msn == 0 ) {
       kWarning() << "Serial number of message at index" << index << "is zero in folder" << storage.label();
     }
   }
 
+  if (fwrite(ids.constData(), sizeof(quint32), count + 1, fp) != count + 1) {
+    kDebug() << "Dict cannot write ids with folder" << storage.label() <<":"
+                  << strerror(errno) << "(" << errno << ")";
+    return -1;
+  }
+
   rentry->sync();
 
   off_t eof = KDE_ftell( fp );
@@ -589,10 +507,11 @@ int KMMsgDict::writeFolderIds( const FolderStorage &storage )
   if ( fclose( rentry->fp ) != 0 ) {
     return -1;
   }
+  rentry->fp = 0;
   if ( truncate( QFile::encodeName( filename ), eof ) != 0 ) {
     return -1;
   }
-  rentry->fp = 0;
+  rentry->appendOffset = eof;
 
   return 0;
 }
@@ -612,54 +531,30 @@ int KMMsgDict::touchFolderIds( const FolderStorage &storage )
 
 //-----------------------------------------------------------------------------
 
-int KMMsgDict::appendToFolderIds( FolderStorage& storage, int index)
+int KMMsgDict::appendToFolderIds( FolderStorage& storage, int index, int count )
 {
-  KMMsgDictREntry *rentry = openFolderIds( storage, false);
-  if (!rentry)
-    return 0;
-  FILE *fp = rentry->fp;
+  KMMsgDictREntry *rentry = storage.rDict();
+  if (!rentry || !rentry->appendOffset)
+    return writeFolderIds( storage );
 
 //  kDebug() << "Dict appending for folder" << storage.label();
 
-  KDE_fseek( fp, rentry->baseOffset, SEEK_SET );
-  quint32 count;
-  if (!fread(&count, sizeof(count), 1, fp)) {
-    kDebug() << "Dict cannot read count for folder" << storage.label() <<":"
-                  << strerror(errno) << "(" << errno << ")";
-    return 0;
-  }
-  if (rentry->swapByteOrder)
-     count = kmail_swap_32(count);
-
-  count++;
-
-  if (rentry->swapByteOrder)
-     count = kmail_swap_32(count);
-  KDE_fseek( fp, rentry->baseOffset, SEEK_SET );
-  if (!fwrite(&count, sizeof(count), 1, fp)) {
-    kDebug() << "Dict cannot write count for folder" << storage.label() <<":"
-                  << strerror(errno) << "(" << errno << ")";
-    return 0;
-  }
-
-  long ofs = (count - 1) * sizeof(ulong);
-  if ( ofs > 0 ) {
-    KDE_fseek( fp, ofs, SEEK_CUR );
+  QVector<ulong> msns( count );
+  for ( int i = 0; i < count; i++ )
+    msns[i] = rentry->getMsn( index + i );
+  switch ( KMMsgDictFile::append( getFolderIdsLocation( storage ), rentry->appendOffset,
+                                  index, msns.constData(), count, rentry->swapByteOrder ) ) {
+  case KMMsgDictFile::Appended:
+    break;
+  case KMMsgDictFile::RewriteNeeded:
+    return writeFolderIds( storage );
+  case KMMsgDictFile::AppendFailed:
+    // A partial record is dropped when the file is read; write it anew
+    // next time
+    rentry->appendOffset = 0;
+    break;
   }
 
-  quint32 msn = rentry->getMsn(index);
-  if (rentry->swapByteOrder)
-     msn = kmail_swap_32(msn);
-  if (!fwrite(&msn, sizeof(msn), 1, fp)) {
-    kDebug() << "Dict cannot write count for folder" << storage.label() <<":"
-                  << strerror(errno) << "(" << errno << ")";
-    return 0;
-  }
-
-  rentry->sync();
-  fclose(rentry->fp);
-  rentry->fp = 0;
-
   return 0;
 }
 
@@ -118,7 +118,8 @@ private:
   /** Returns true if the .folder.index.ids file should not be read. */
   bool isFolderIdsOutdated( const FolderStorage &folder );
 
-  /** Reads the .folder.index.ids file.  Returns 0 on success. */
+  /** Reads the .folder.index.ids file, which is mapped into memory and
+   * added to the dictionary in one go.  Returns 0 on success. */
   int readFolderIds( FolderStorage & );
 
   /** Writes the .folder.index.ids file.  Returns 0 on success. */
@@ -127,9 +128,10 @@ private:
   /** Touches the .folder.index.ids file.  Returns 0 on success. */
   int touchFolderIds( const FolderStorage & );
 
-  /** Appends the message to the .folder.index.ids file.
-   * Returns 0 on success. */
-  int appendToFolderIds( FolderStorage&, int index );
+  /** Appends records of the @p count messages starting at @p index to the
+   * .folder.index.ids file in one write, leaving the rest of the file
+   * alone.  Returns 0 on success. */
+  int appendToFolderIds( FolderStorage&, int index, int count = 1 );
 
   /** Returns true if the folder has a .folder.index.ids file.  */
   bool hasFolderIds( const FolderStorage & );
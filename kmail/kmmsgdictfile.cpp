@@ -0,0 +1,172 @@
+/* kmail message dictionary: the .index.ids files */
+/* Author: Ronen Tzur <rtzur@shani.net> */
+
+#include "kmmsgdictfile.h"
+
+#include <kdebug.h>
+#include <kde_file.h>
+
+#include <QFile>
+#include <QString>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <config-kmail.h>
+
+#ifdef HAVE_BYTESWAP_H
+#include <byteswap.h>
+#endif
+
+// We define functions as kmail_swap_NN so that we don't get compile errors
+// on platforms where bswap_NN happens to be a function instead of a define.
+
+/* Swap bytes in 32 bit value.  */
+#ifdef bswap_32
+#define kmail_swap_32(x) bswap_32(x)
+#else
+#define kmail_swap_32(x) \
+     ((((x) & 0xff000000) >> 24) | (((x) & 0x00ff0000) >>  8) |		      \
+      (((x) & 0x0000ff00) <<  8) | (((x) & 0x000000ff) << 24))
+#endif
+
+/**
+ * Returns the length of the header at the beginning of a mapped .ids file
+ * and sets @p version, or returns 0 if there is no header. This is what
+ * fscanf() with IDS_HEADER reads.
+ */
+static qint64 idsHeaderLength( const uchar *data, qint64 size, int *version )
+{
+  static const char prefix[] = "# KMail-Index-IDs V";
+  const qint64 prefixLength = sizeof( prefix ) - 1;
+  if ( size < prefixLength || memcmp( data, prefix, prefixLength ) != 0 )
+    return 0;
+  qint64 pos = prefixLength;
+  *version = 0;
+  while ( pos < size && pos < prefixLength + 9 && data[pos] >= '0' && data[pos] <= '9' )
+    *version = *version * 10 + ( data[pos++] - '0' );
+  if ( pos + 2 > size || data[pos] != '\n' || data[pos + 1] != '*' )
+    return 0;
+  return pos + 2;
+}
+
+/** Reads a 32 bit value from a mapped file, where it need not be aligned. */
+static inline quint32 readId( const uchar *data )
+{
+  quint32 value;
+  memcpy( &value, data, sizeof( value ) );
+  return value;
+}
+
+/**
+ * Copies @p count serial numbers from a mapped .ids file. The loops are
+ * kept free of branches so that the compiler can vectorize them.
+ */
+static void copyIds( const uchar *data, ulong *ids, quint32 count, bool swapByteOrder )
+{
+  if ( swapByteOrder ) {
+    for ( quint32 i = 0; i < count; i++ )
+      ids[i] = kmail_swap_32( readId( data + i * sizeof( quint32 ) ) );
+  } else {
+    for ( quint32 i = 0; i < count; i++ )
+      ids[i] = readId( data + i * sizeof( quint32 ) );
+  }
+}
+
+bool KMMsgDictFile::read( const QString &fileName, QVector<ulong> &ids,
+                          bool *swapByteOrder, qint64 *appendOffset )
+{
+  QFile file( fileName );
+  if ( !file.open( QIODevice::ReadOnly ) )
+    return false;
+  const qint64 fileSize = file.size();
+  // Unmapped when the file is closed
+  const uchar *data = fileSize > 0 ? file.map( 0, fileSize ) : 0;
+  if ( !data )
+    return false;
+
+  int version = 0;
+  qint64 pos = idsHeaderLength( data, fileSize, &version );
+  if ( !pos || ( version != IDS_VERSION && version != IDS_VERSION_NO_APPEND ) )
+    return false;
+  if ( fileSize - pos < (qint64)( 2 * sizeof( quint32 ) ) )
+    return false;
+
+  const bool swap = ( readId( data + pos ) == 0x78563412 );
+  quint32 count = readId( data + pos + sizeof( quint32 ) );
+  if ( swap )
+     count = kmail_swap_32( count );
+  pos += 2 * sizeof( quint32 );
+
+  // quick consistency check to avoid allocating huge amount of memory
+  // due to reading corrupt file (#71549)
+  if ( (quint64)( fileSize - pos ) < (quint64)count * sizeof( quint32 ) )
+    return false;
+
+  ids.resize( count );
+  copyIds( data + pos, ids.data(), count, swap );
+  pos += count * sizeof( quint32 );
+  *swapByteOrder = swap;
+  *appendOffset = 0;
+
+  // Apply the records of the messages added since
+  if ( version == IDS_VERSION ) {
+    *appendOffset = pos;
+    const qint64 recordSize = 2 * sizeof( quint32 );
+    const quint32 maxIndex = count + ( fileSize - pos ) / recordSize;
+    ids.resize( maxIndex );
+    memset( ids.data() + count, 0, ( maxIndex - count ) * sizeof( ulong ) );
+    for ( ; fileSize - pos >= recordSize; pos += recordSize ) {
+      quint32 index = readId( data + pos );
+      quint32 msn = readId( data + pos + sizeof( quint32 ) );
+      if ( swap ) {
+        index = kmail_swap_32( index );
+        msn = kmail_swap_32( msn );
+      }
+      if ( index >= maxIndex )
+        return false;
+      ids[index] = msn;
+    }
+  }
+  return true;
+}
+
+KMMsgDictFile::AppendResult KMMsgDictFile::append( const QString &fileName, qint64 appendOffset,
+                                                   int index, const ulong *msns, int count,
+                                                   bool swapByteOrder )
+{
+  int fd = KDE_open( QFile::encodeName( fileName ), O_WRONLY | O_APPEND );
+  if ( fd < 0 )
+    return RewriteNeeded;
+
+  // Write the file anew if a record was cut off or there are enough of them
+  const off_t recordSize = 2 * sizeof( quint32 );
+  KDE_struct_stat st;
+  if ( KDE_fstat( fd, &st ) != 0 || st.st_size < appendOffset ||
+       ( st.st_size - appendOffset ) % recordSize != 0 ||
+       ( st.st_size - appendOffset ) / recordSize + count > IDS_MAX_APPENDED ) {
+    ::close( fd );
+    return RewriteNeeded;
+  }
+
+  QVector<quint32> records( 2 * count );
+  for ( int i = 0; i < count; i++ ) {
+    records[2 * i] = index + i;
+    records[2 * i + 1] = msns[i];
+    if ( swapByteOrder ) {
+      records[2 * i] = kmail_swap_32( records[2 * i] );
+      records[2 * i + 1] = kmail_swap_32( records[2 * i + 1] );
+    }
+  }
+  AppendResult result = Appended;
+  const ssize_t size = records.size() * sizeof( quint32 );
+  if ( ::write( fd, records.constData(), size ) != size ) {
+    kDebug() << "Dict cannot append to" << fileName << ":"
+             << strerror( errno ) << "(" << errno << ")";
+    result = AppendFailed;
+  }
+  ::close( fd );
+  return result;
+}
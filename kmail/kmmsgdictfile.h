@@ -0,0 +1,82 @@
+/*
+ * This file is part of KMail, the KDE mail client
+ * Copyright (c)  Ronen Tzur <rtzur@shani.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef __KMMSGDICTFILE
+#define __KMMSGDICTFILE
+
+#include <QVector>
+
+class QString;
+
+// Current version of the .index.ids files
+#define IDS_VERSION 1003
+
+// Files of this version are still read. They never have appended records.
+#define IDS_VERSION_NO_APPEND 1002
+
+// The asterisk at the end is important
+#define IDS_HEADER "# KMail-Index-IDs V%d\n*"
+
+// Messages added since the file was last written completely are appended
+// as (index, serial number) records. After that many, the file is
+// written anew.
+#define IDS_MAX_APPENDED 4096
+
+/**
+ * The on-disk format of the .folder.index.ids files, kept apart from
+ * KMMsgDict so that it does not depend on the folder classes.
+ *
+ * A file consists of IDS_HEADER, a byte order mark, the number of serial
+ * numbers and the serial numbers of the messages in index order. Files of
+ * version IDS_VERSION are followed by (index, serial number) records of
+ * the messages added since the file was written completely.
+ */
+namespace KMMsgDictFile {
+
+  /**
+   * Reads the .ids file @p fileName, which is mapped into memory, into
+   * @p ids with the appended records applied. Sets @p swapByteOrder and
+   * @p appendOffset, which is 0 for files that records cannot be appended
+   * to. Returns false if the file is missing, cut off before the last
+   * serial number or has a record with an index out of range; a cut off
+   * record at the end is dropped.
+   */
+  bool read( const QString &fileName, QVector<unsigned long> &ids,
+             bool *swapByteOrder, qint64 *appendOffset );
+
+  enum AppendResult {
+    Appended,        ///< All records were written
+    RewriteNeeded,   ///< Nothing was written, the file must be written anew
+    AppendFailed     ///< Some records may have been written
+  };
+
+  /**
+   * Appends the records of the @p count serial numbers in @p msns, which
+   * belong to the messages starting at @p index, to the .ids file
+   * @p fileName in one write. Returns RewriteNeeded if the file does not
+   * end in whole records after @p appendOffset or would hold more than
+   * IDS_MAX_APPENDED of them.
+   */
+  AppendResult append( const QString &fileName, qint64 appendOffset,
+                       int index, const unsigned long *msns, int count,
+                       bool swapByteOrder );
+
+}
+
+#endif
@@ -158,6 +158,37 @@ void KMMsgList::remove( int idx )
 }
 
 
+//-----------------------------------------------------------------------------
+void KMMsgList::remove( const QList<int> &indexes )
+{
+  if ( indexes.isEmpty() )
+    return;
+
+  int next = 0; // next entry of indexes
+  int dest = indexes.first();
+  for ( int i = dest; i < mHigh; i++ ) {
+    if ( next < indexes.count() && indexes[next] == i ) {
+      if ( at(i) ) {
+        mCount--;
+        KMMsgDict::mutableInstance()->remove( at(i) );
+      }
+      next++;
+      continue;
+    }
+    if ( at(i) )
+      KMMsgDict::mutableInstance()->update( at(i), i, dest );
+    operator[]( dest ) = at( i );
+    dest++;
+  }
+
+  for ( int i = dest; i < mHigh; i++ )
+    operator[]( i ) = 0;
+  mHigh = dest;
+
+  rethinkHigh();
+}
+
+
 //-----------------------------------------------------------------------------
 KMMsgBase* KMMsgList::take( int idx )
 {
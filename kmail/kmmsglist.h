@@ -22,6 +22,7 @@
 
 #include "kmmsgbase.h"
 
+#include <QList>
 #include <QVector>
 
 /**
@@ -48,6 +49,11 @@ public:
     Also removes from message dictionary. */
   void remove(int idx);
 
+  /** Remove the messages at the given ascending indexes without deleting
+    them. Unlike calling remove() for each of them every remaining message
+    is moved only once. Also updates the message dictionary. */
+  void remove(const QList<int> &indexes);
+
   /** Returns message at given index and removes it from the list.
     Also removes from message dictionary. */
   KMMsgBase* take(int idx);
@@ -40,6 +40,7 @@ using KMail::FilterLog;
 
 #include <mimelib/string.h>
 #include <mimelib/boyermor.h>
+#include <mimelib/utility.h>
 
 #include <assert.h>
 
@@ -192,6 +193,12 @@ bool KMSearchRule::matches( const DwString & aStr, KMMessage & msg,
   return matches( &msg );
 }
 
+bool KMSearchRule::matchesEnvelope( const KMMsgBase * ) const
+{
+  kWarning() << "Rule" << asString() << "can't be matched against the folder index";
+  return false;
+}
+
 const QString KMSearchRule::asString() const
 {
   QString result  = "\"" + mField + "\" <";
@@ -258,6 +265,64 @@ bool KMSearchRuleString::requiresBody() const
   return true;
 }
 
+KMSearchRule::RequiredPart KMSearchRuleString::requiredPart() const
+{
+  // The index has the decoded subject, the tags and the attachment state
+  if ( function() == FuncHasAttachment || function() == FuncHasNoAttachment )
+    return Envelope;
+  if ( qstricmp( field().constData(), "Subject" ) == 0 || field() == "<tag>" )
+    return Envelope;
+  return requiresBody() ? CompleteMessage : Header;
+}
+
+QString KMSearchRuleString::requiredText() const
+{
+  // The full text index has all the words of the message,
+  // but not the raw body that "<message>" matches against
+  if ( function() != FuncContains || field() == "<message>" || field() == "<tag>" )
+    return QString();
+  return contents();
+}
+
+bool KMSearchRuleString::canMatchRaw() const
+{
+  // Only the plain string functions can run on a SearchExecutor thread:
+  // the address book and category functions use KABC::StdAddressBook,
+  // which isn't thread-safe. The other fields need the message to be
+  // parsed and decoded.
+  switch ( function() ) {
+  case FuncContains:
+  case FuncContainsNot:
+  case FuncEquals:
+  case FuncNotEqual:
+  case FuncRegExp:
+  case FuncNotRegExp:
+  case FuncIsGreater:
+  case FuncIsLessOrEqual:
+  case FuncIsLess:
+  case FuncIsGreaterOrEqual:
+    break;
+  default:
+    return false;
+  }
+  return field() == "<message>" || field() == "<any header>";
+}
+
+bool KMSearchRuleString::matchesRaw( const QByteArray & aStr ) const
+{
+  if ( isEmpty() )
+    return false;
+
+  if ( field() == "<message>" )
+    // like KMMessage::asString()
+    return matchesInternal( QString( aStr ) );
+
+  // like KMMessage::headerAsString(), with the line break of the last field
+  size_t headerLen = DwFindHeaderEnd( aStr.constData(), aStr.size() );
+  headerLen = ( headerLen == DwString::npos ) ? aStr.size() : headerLen + 1;
+  return matchesInternal( QString::fromLatin1( aStr.constData(), headerLen ) );
+}
+
 bool KMSearchRuleString::matches( const DwString & aStr, KMMessage & msg,
                        const DwBoyerMoore * aHeaderField, int aHeaderLen ) const
 {
@@ -271,12 +336,7 @@ bool KMSearchRuleString::matches( const DwString & aStr, KMMessage & msg,
   const int headerLen = ( aHeaderLen > -1 ? aHeaderLen : field().length() ) + 2 ; // +1 for ': '
 
   if ( headerField ) {
-    static const DwBoyerMoore lflf( "\n\n" );
-    static const DwBoyerMoore lfcrlf( "\n\r\n" );
-
-    size_t endOfHeader = lflf.FindIn( aStr, 0 );
-    if ( endOfHeader == DwString::npos )
-      endOfHeader = lfcrlf.FindIn( aStr, 0 );
+    const size_t endOfHeader = DwFindHeaderEnd( aStr.data(), aStr.length() );
     const DwString headers = ( endOfHeader == DwString::npos ) ? aStr : aStr.substr( 0, endOfHeader );
     // In case the searched header is at the beginning, we have to prepend
     // a newline - see the comment in KMSearchRuleString constructor
@@ -414,6 +474,51 @@ bool KMSearchRuleString::matches( const KMMessage * msg ) const
   return rc;
 }
 
+bool KMSearchRuleString::matchesEnvelope( const KMMsgBase * msgBase ) const
+{
+  assert( msgBase );
+
+  if ( isEmpty() )
+    return false;
+
+  // these two functions only need the attachment state
+  if ( function() == FuncHasAttachment )
+    return ( msgBase->attachmentState() == KMMsgHasAttachment );
+  if ( function() == FuncHasNoAttachment )
+    return ( ((KMMsgAttachmentState) msgBase->attachmentState()) == KMMsgHasNoAttachment );
+
+  QString msgContents;
+  bool logContents = true;
+
+  if ( field() == "<tag>" ) {
+    if ( msgBase->tagList() ) {
+      foreach ( const QString &label, * msgBase->tagList() ) {
+        const KMMessageTagDescription * tagDesc = kmkernel->msgTagMgr()->find( label );
+        if ( tagDesc )
+          msgContents += tagDesc->name();
+      }
+      logContents = false;
+    }
+  } else {
+    // the only header field kept in the index (see requiredPart())
+    msgContents = msgBase->subject();
+    if ( ( function() == FuncIsInAddressbook ||
+           function() == FuncIsNotInAddressbook ) && msgContents.isEmpty() )
+      return ( function() == FuncIsInAddressbook ) ? false : true;
+  }
+
+  bool rc = matchesInternal( msgContents );
+  if ( FilterLog::instance()->isLogging() ) {
+    QString msg = ( rc ? "<font color=#00FF00>1 = </font>"
+                       : "<font color=#FF0000>0 = </font>" );
+    msg += FilterLog::recode( asString() );
+    if ( logContents )
+      msg += " (<i>" + FilterLog::recode( msgContents ) + "</i>)";
+    FilterLog::instance()->add( msg, FilterLog::ruleResult );
+  }
+  return rc;
+}
+
 // helper, does the actual comparing
 bool KMSearchRuleString::matchesInternal( const QString & msgContents ) const
 {
@@ -541,8 +646,23 @@ bool KMSearchRuleNumerical::isEmpty() const
   return !ok;
 }
 
+KMSearchRule::RequiredPart KMSearchRuleNumerical::requiredPart() const
+{
+  // size and date are both in the index
+  return Envelope;
+}
 
 bool KMSearchRuleNumerical::matches( const KMMessage * msg ) const
+{
+  return matchesValues( msg->msgLength(), msg->date() );
+}
+
+bool KMSearchRuleNumerical::matchesEnvelope( const KMMsgBase * msgBase ) const
+{
+  return matchesValues( msgBase->msgSize(), msgBase->date() );
+}
+
+bool KMSearchRuleNumerical::matchesValues( size_t msgSize, time_t msgDate ) const
 {
 
   QString msgContents;
@@ -550,12 +670,12 @@ bool KMSearchRuleNumerical::matches( const KMMessage * msg ) const
   int numericalValue = 0;
 
   if ( field() == "<size>" ) {
-    numericalMsgContents = int( msg->msgLength() );
+    numericalMsgContents = int( msgSize );
     numericalValue = contents().toInt();
     msgContents.setNum( numericalMsgContents );
   } else if ( field() == "<age in days>" ) {
     QDateTime msgDateTime;
-    msgDateTime.setTime_t( msg->date() );
+    msgDateTime.setTime_t( msgDate );
     numericalMsgContents = msgDateTime.daysTo( QDateTime::currentDateTime() );
     numericalValue = contents().toInt();
     msgContents.setNum( numericalMsgContents );
@@ -673,6 +793,11 @@ bool KMSearchRuleStatus::isEmpty() const
 }
 
 bool KMSearchRuleStatus::matches( const KMMessage * msg ) const
+{
+  return matchesEnvelope( msg );
+}
+
+bool KMSearchRuleStatus::matchesEnvelope( const KMMsgBase * msgBase ) const
 {
 
   bool rc = false;
@@ -680,12 +805,12 @@ bool KMSearchRuleStatus::matches( const KMMessage * msg ) const
   switch ( function() ) {
     case FuncEquals: // fallthrough. So that "<status> 'is' 'read'" works
     case FuncContains:
-      if (msg->messageStatus() & mStatus)
+      if (msgBase->messageStatus() & mStatus)
         rc = true;
       break;
     case FuncNotEqual: // fallthrough. So that "<status> 'is not' 'read'" works
     case FuncContainsNot:
-      if (! (msg->messageStatus() & mStatus) )
+      if (! (msgBase->messageStatus() & mStatus) )
         rc = true;
       break;
     // FIXME what about the remaining funcs, how can they make sense for
@@ -793,21 +918,7 @@ bool KMSearchPattern::matches( quint32 serNum, bool ignoreBody ) const
 
   KMFolderOpener openFolder( folder, "searptr" );
   if ( openFolder.openResult() == 0 ) { // 0 means no error codes
-    KMFolder *f =  openFolder.folder();
-    KMMsgBase *msgBase = f->getMsgBase( idx );
-    if ( msgBase && requiresBody() && !ignoreBody ) {
-      bool unGet = !msgBase->isMessage();
-      KMMessage *msg = f->getMsg( idx );
-      res = false;
-      if ( msg ) {
-        res = matches( msg, ignoreBody );
-        if ( unGet ) {
-          folder->unGetMsg( idx );
-        }
-      }
-    } else {
-      res = matches( f->getDwString( idx ), ignoreBody );
-    }
+    res = KMSearchPlan( this, ignoreBody ).matches( openFolder.folder(), idx );
   }
   return res;
 }
@@ -820,6 +931,15 @@ bool KMSearchPattern::requiresBody() const {
   return false;
 }
 
+KMSearchRule::RequiredPart KMSearchPattern::requiredPart() const
+{
+  KMSearchRule::RequiredPart part = KMSearchRule::Envelope;
+  QList<KMSearchRule*>::const_iterator it;
+  for ( it = begin() ; it != end() ; ++it )
+    part = qMax( part, (*it)->requiredPart() );
+  return part;
+}
+
 void KMSearchPattern::purify() {
   QList<KMSearchRule*>::iterator it = end();
   while ( it != begin() ) {
@@ -949,3 +1069,206 @@ const KMSearchPattern & KMSearchPattern::operator=( const KMSearchPattern & othe
 
   return *this;
 }
+
+
+//==================================================
+//
+// class KMSearchPlan
+//
+//==================================================
+
+KMSearchPlan::KMSearchPlan( const KMSearchPattern * pattern, bool ignoreBody )
+  : mOperator( pattern->op() ),
+    mMatchesAll( pattern->isEmpty() ),
+    mOtherRulesPart( KMSearchRule::Envelope ),
+    mNonRawRulesPart( KMSearchRule::Envelope )
+{
+  QList<KMSearchRule*>::const_iterator it;
+  for ( it = pattern->begin() ; it != pattern->end() ; ++it ) {
+    const KMSearchRule * rule = *it;
+    if ( rule->requiresBody() && ignoreBody )
+      continue;
+    const KMSearchRule::RequiredPart part = rule->requiredPart();
+    if ( part == KMSearchRule::Envelope ) {
+      mEnvelopeRules.append( rule );
+    } else {
+      mOtherRules.append( rule );
+      mOtherRulesPart = qMax( mOtherRulesPart, part );
+      if ( rule->canMatchRaw() )
+        mRawRules.append( rule );
+      else
+        mNonRawRulesPart = qMax( mNonRawRulesPart, part );
+    }
+  }
+}
+
+KMSearchRule::RequiredPart KMSearchPlan::requiredPart() const
+{
+  return mOtherRules.isEmpty() ? KMSearchRule::Envelope : mOtherRulesPart;
+}
+
+KMSearchPlan::Result KMSearchPlan::matchesEnvelope( const KMMsgBase * msgBase ) const
+{
+  if ( mMatchesAll )
+    return Match;
+
+  QList<const KMSearchRule*>::const_iterator it;
+  for ( it = mEnvelopeRules.constBegin() ; it != mEnvelopeRules.constEnd() ; ++it ) {
+    const bool matched = (*it)->matchesEnvelope( msgBase );
+    if ( mOperator == KMSearchPattern::OpAnd && !matched )
+      return NoMatch;
+    if ( mOperator == KMSearchPattern::OpOr && matched )
+      return Match;
+  }
+
+  // the envelope rules don't decide: the other rules do
+  if ( mOtherRules.isEmpty() )
+    return ( mOperator == KMSearchPattern::OpAnd ) ? Match : NoMatch;
+  return Undecided;
+}
+
+bool KMSearchPlan::matchesMessage( KMFolder * folder, int idx, KMMsgBase * msgBase,
+                                   bool skipRawRules ) const
+{
+  // Load only the header if no rule needs more; KMSearchRule::matches()
+  // parses the message anyway if a rule needs it.
+  KMMessage *msg = 0;
+  bool unGet = false;
+  DwString str;
+  KMMessage dwMsg;
+  const KMSearchRule::RequiredPart part = skipRawRules ? mNonRawRulesPart : mOtherRulesPart;
+  if ( part == KMSearchRule::CompleteMessage ) {
+    unGet = !msgBase->isMessage();
+    msg = folder->getMsg( idx );
+    if ( !msg )
+      return false;
+  } else {
+    str = folder->getDwString( idx );
+  }
+
+  bool res = ( mOperator == KMSearchPattern::OpAnd );
+  QList<const KMSearchRule*>::const_iterator it;
+  for ( it = mOtherRules.constBegin() ; it != mOtherRules.constEnd() ; ++it ) {
+    if ( skipRawRules && (*it)->canMatchRaw() )
+      continue;
+    const bool matched = msg ? (*it)->matches( msg ) : (*it)->matches( str, dwMsg );
+    if ( matched != res ) {
+      // first rule that doesn't match (and) or that matches (or)
+      res = matched;
+      break;
+    }
+  }
+
+  if ( msg && unGet )
+    folder->unGetMsg( idx );
+  return res;
+}
+
+void KMSearchPlan::useFullTextIndex( const KMail::FullTextIndex * index )
+{
+  mIndexHits.clear();
+  if ( !index || mOtherRules.isEmpty() )
+    return;
+
+  QList<KMail::FullTextIndex::Hits> hits;
+  QList<const KMSearchRule*>::const_iterator it;
+  for ( it = mOtherRules.constBegin() ; it != mOtherRules.constEnd() ; ++it ) {
+    const QString text = (*it)->requiredText();
+    const KMail::FullTextIndex::Hits ruleHits = text.isEmpty() ? KMail::FullTextIndex::Hits() :
+      index->search( text, (*it)->field() == "<body>" );
+    if ( ruleHits.isValid() )
+      hits.append( ruleHits );
+    else if ( mOperator == KMSearchPattern::OpOr )
+      return; // this rule may match any message
+  }
+  mIndexHits = hits;
+}
+
+KMSearchPlan::Result KMSearchPlan::matchesIndex( const KMMsgBase * msgBase ) const
+{
+  if ( mIndexHits.isEmpty() )
+    return Undecided;
+
+  // All the hits have been computed at the same time
+  const quint32 serNum = msgBase->getMsgSerNum();
+  if ( !mIndexHits.first().isIndexed( serNum, KMail::FullTextIndex::fingerprint( msgBase ) ) )
+    return Undecided;
+
+  QList<KMail::FullTextIndex::Hits>::const_iterator it;
+  for ( it = mIndexHits.constBegin() ; it != mIndexHits.constEnd() ; ++it ) {
+    const bool mayMatch = (*it).contains( serNum );
+    if ( mOperator == KMSearchPattern::OpAnd && !mayMatch )
+      return NoMatch;
+    if ( mOperator == KMSearchPattern::OpOr && mayMatch )
+      return Undecided;
+  }
+  return ( mOperator == KMSearchPattern::OpAnd ) ? Undecided : NoMatch;
+}
+
+KMSearchPlan::Result KMSearchPlan::matchesWithoutLoading( const KMMsgBase * msgBase ) const
+{
+  const Result result = matchesEnvelope( msgBase );
+  if ( result != Undecided )
+    return result;
+  return matchesIndex( msgBase );
+}
+
+KMSearchPlan::Result KMSearchPlan::matchesRaw( const QByteArray & str ) const
+{
+  QList<const KMSearchRule*>::const_iterator it;
+  for ( it = mRawRules.constBegin() ; it != mRawRules.constEnd() ; ++it ) {
+    const bool matched = (*it)->matchesRaw( str );
+    if ( mOperator == KMSearchPattern::OpAnd && !matched )
+      return NoMatch;
+    if ( mOperator == KMSearchPattern::OpOr && matched )
+      return Match;
+  }
+
+  if ( mRawRules.count() == mOtherRules.count() )
+    return ( mOperator == KMSearchPattern::OpAnd ) ? Match : NoMatch;
+  return Undecided;
+}
+
+bool KMSearchPlan::matchesWithoutRawRules( KMFolder * folder, int idx ) const
+{
+  KMMsgBase *msgBase = folder->getMsgBase( idx );
+  if ( !msgBase )
+    return false;
+  return matchesMessage( folder, idx, msgBase, true );
+}
+
+bool KMSearchPlan::matches( KMFolder * folder, int idx ) const
+{
+  KMMsgBase *msgBase = folder->getMsgBase( idx );
+  if ( !msgBase )
+    return false;
+
+  switch ( matchesWithoutLoading( msgBase ) ) {
+  case Match:
+    return true;
+  case NoMatch:
+    return false;
+  default:
+    return matchesMessage( folder, idx, msgBase );
+  }
+}
+
+int KMSearchPlan::matches( KMFolder * folder, int first, int last,
+                           QList<quint32> & serNums, int maxLoaded ) const
+{
+  int loaded = 0;
+  int idx;
+  for ( idx = first ; idx <= last && loaded < maxLoaded ; ++idx ) {
+    KMMsgBase *msgBase = folder->getMsgBase( idx );
+    if ( !msgBase )
+      continue;
+    Result result = matchesWithoutLoading( msgBase );
+    if ( result == Undecided ) {
+      ++loaded;
+      result = matchesMessage( folder, idx, msgBase ) ? Match : NoMatch;
+    }
+    if ( result == Match )
+      serNums.append( KMMsgDict::instance()->getMsgSerNum( folder, idx ) );
+  }
+  return idx;
+}
@@ -27,7 +27,13 @@ using KPIM::MessageStatus;
 #include <QList>
 #include <QString>
 
+#include "fulltextindex.h"
+
+#include <time.h>
+
 class KMMessage;
+class KMMsgBase;
+class KMFolder;
 class KConfigGroup;
 class DwBoyerMoore;
 class DwString;
@@ -113,6 +119,42 @@ public:
       otherwise returns false. */
   virtual bool requiresBody() const { return true; }
 
+  /** The parts of a message a rule needs to be matched, from the
+      cheapest to the most expensive to get. */
+  enum RequiredPart {
+    Envelope = 0,    ///< The data in the folder index (KMMsgBase)
+    Header,          ///< The header of the message
+    CompleteMessage  ///< The complete message
+  };
+
+  /** Returns the part of a message the rule needs to be matched.
+      Rules that return Envelope implement matchesEnvelope(). */
+  virtual RequiredPart requiredPart() const { return CompleteMessage; }
+
+  /** Tries to match the rule against the index data of a message,
+      without loading it. Only valid if requiredPart() is Envelope.
+      @return true if the rule matched, false otherwise.
+  */
+  virtual bool matchesEnvelope( const KMMsgBase * msgBase ) const;
+
+  /** Returns the text that a message has to contain, case insensitively,
+      to match the rule, or a null string if the rule can match messages
+      that don't contain a particular text. Used to look up the candidates
+      in the full text index (see KMail::FullTextIndex). */
+  virtual QString requiredText() const { return QString(); }
+
+  /** Returns true if the rule can be matched with matchesRaw(). */
+  virtual bool canMatchRaw() const { return false; }
+
+  /** Tries to match the rule against the raw text of a message, without
+      parsing it. Unlike the other matches() methods this one is
+      thread-safe: it doesn't log to the FilterLog and doesn't use
+      KMMessage, the kernel or DwString, so that searches can run it in
+      worker threads (see KMail::SearchExecutor). Only valid if
+      canMatchRaw() is true.
+      @return true if the rule matched, false otherwise.
+  */
+  virtual bool matchesRaw( const QByteArray & ) const { return false; }
 
   /** Save the object into a given config group.
       @p aIdx is an identifier that is used to distinguish
@@ -182,8 +224,13 @@ public:
   virtual ~KMSearchRuleString();
   virtual bool isEmpty() const ;
   virtual bool requiresBody() const;
+  virtual RequiredPart requiredPart() const;
 
   virtual bool matches( const KMMessage * msg ) const;
+  virtual bool matchesEnvelope( const KMMsgBase * msgBase ) const;
+  virtual QString requiredText() const;
+  virtual bool canMatchRaw() const;
+  virtual bool matchesRaw( const QByteArray & str ) const;
 
   /** Optimized version tries to match the rule against the given  DwString.
       @return true if the rule matched, false otherwise.
@@ -211,8 +258,10 @@ public:
   explicit KMSearchRuleNumerical( const QByteArray & field=0,
                          Function function=FuncContains, const QString & contents=QString() );
   virtual bool isEmpty() const ;
+  virtual RequiredPart requiredPart() const;
 
   virtual bool matches( const KMMessage * msg ) const;
+  virtual bool matchesEnvelope( const KMMsgBase * msgBase ) const;
 
   // Optimized matching not implemented, will use the unoptimized matching
   // from KMSearchRule
@@ -221,6 +270,10 @@ public:
   /** Helper for the main matches() method. Does the actual comparing. */
   bool matchesInternal( long numericalValue, long numericalMsgContents,
                         const QString & msgContents ) const;
+
+private:
+  /** Matches the size or the date, whichever the rule is about. */
+  bool matchesValues( size_t msgSize, time_t msgDate ) const;
 };
 
 
@@ -289,7 +342,9 @@ public:
    explicit KMSearchRuleStatus( MessageStatus status, Function function=FuncContains );
 
    virtual bool isEmpty() const ;
+   virtual RequiredPart requiredPart() const { return Envelope; }
    virtual bool matches( const KMMessage * msg ) const;
+   virtual bool matchesEnvelope( const KMMsgBase * msgBase ) const;
 
    //Not possible to implement optimized form for status searching
    using KMSearchRule::matches;
@@ -364,6 +419,10 @@ public:
       a message */
   bool requiresBody() const;
 
+  /** Returns the most expensive part of a message that one of the
+      rules needs. See KMSearchRule::requiredPart(). */
+  KMSearchRule::RequiredPart requiredPart() const;
+
   /** Removes all empty rules from the list. You should call this
       method whenever the user had had control of the rules outside of
       this class. (e.g. after editing it with KMSearchPatternEdit).
@@ -426,4 +485,88 @@ private:
   Operator mOperator;
 };
 
+// ------------------------------------------------------------------------
+
+/** A KMSearchPattern prepared for matching many messages. The rules are
+    split by the part of the message they need (see
+    KMSearchRule::requiredPart()), so that the ones that can be answered
+    from the folder index are tried first. A message is only loaded if
+    they don't decide the result, and only its header is loaded if no
+    rule needs more than that.
+
+    The plan refers to the rules of the pattern: it must not outlive it
+    and must be created again if the pattern changes.
+
+    @short A search pattern prepared for matching whole folders.
+*/
+class KMSearchPlan
+{
+public:
+  /** Prepares @p pattern. If @p ignoreBody is true the rules that
+      require the body are left out, as in KMSearchPattern::matches(). */
+  explicit KMSearchPlan( const KMSearchPattern * pattern, bool ignoreBody = false );
+
+  /** Returns the most expensive part of a message that the plan may
+      need to load. Envelope means that no message is ever loaded. */
+  KMSearchRule::RequiredPart requiredPart() const;
+
+  /** Matches the message at index @p idx of @p folder, which must be
+      open. Returns false if there is no such message. */
+  bool matches( KMFolder * folder, int idx ) const;
+
+  /** Matches the messages at the indexes from @p first up to @p last
+      (inclusive) of @p folder, which must be open, and appends the serial
+      numbers of the matching ones to @p serNums. Stops early once
+      @p maxLoaded messages had to be loaded. Returns the index of the
+      first message that hasn't been matched. This is the fast way to
+      search a whole folder. */
+  int matches( KMFolder * folder, int first, int last,
+               QList<quint32> & serNums, int maxLoaded ) const;
+
+  /** Looks up the texts of the "contains" rules in @p index, so that the
+      indexed messages that don't contain them aren't loaded. The messages
+      that contain them are still matched against the rules. */
+  void useFullTextIndex( const KMail::FullTextIndex * index );
+
+  /** The result of matching a message against some of the rules. */
+  enum Result {
+    NoMatch,
+    Match,
+    Undecided  ///< The other rules decide
+  };
+
+  /** Matches the message of @p msgBase against the rules that can be
+      answered from the folder index and from the full text index. */
+  Result matchesWithoutLoading( const KMMsgBase * msgBase ) const;
+
+  /** Returns true if some of the rules that need the message can be
+      matched on its raw text, see KMSearchRule::canMatchRaw(). */
+  bool canMatchRaw() const { return !mRawRules.isEmpty(); }
+
+  /** Matches the raw text @p str of a message for which
+      matchesWithoutLoading() was Undecided against the rules that can be
+      matched on it. Thread-safe, see KMSearchRule::matchesRaw(). */
+  Result matchesRaw( const QByteArray & str ) const;
+
+  /** Matches the message at index @p idx of @p folder, which must be
+      open, against the rules that matchesRaw() leaves out. Only valid if
+      both matchesWithoutLoading() and matchesRaw() were Undecided. */
+  bool matchesWithoutRawRules( KMFolder * folder, int idx ) const;
+
+private:
+  Result matchesEnvelope( const KMMsgBase * msgBase ) const;
+  Result matchesIndex( const KMMsgBase * msgBase ) const;
+  bool matchesMessage( KMFolder * folder, int idx, KMMsgBase * msgBase,
+                       bool skipRawRules = false ) const;
+
+  KMSearchPattern::Operator mOperator;
+  bool mMatchesAll;
+  QList<const KMSearchRule*> mEnvelopeRules;
+  QList<const KMSearchRule*> mOtherRules;
+  KMSearchRule::RequiredPart mOtherRulesPart;
+  QList<const KMSearchRule*> mRawRules;        ///< The ones of mOtherRules that canMatchRaw()
+  KMSearchRule::RequiredPart mNonRawRulesPart;  ///< The part needed by the others
+  QList<KMail::FullTextIndex::Hits> mIndexHits;
+};
+
 #endif /* _kmsearchpattern_h_ */
@@ -0,0 +1,330 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "mboxindexer.h"
+
+#include "kmmsginfo.h"
+
+#include <QtConcurrentRun>
+
+#include <mimelib/utility.h>
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+#ifndef MAX_LINE
+#define MAX_LINE 4096
+#endif
+
+using namespace KMail;
+
+// Number of messages whose headers are parsed by one job of the thread pool
+static const int sChunkSize = 1000;
+
+//-----------------------------------------------------------------------------
+MboxMessageHeaders::MboxMessageHeaders()
+  : mLastStr( 0 ),
+    mNeedStatus( 3 ),
+    mInHeader( true )
+{
+  *mStatus = '\0';
+  *mXStatus = '\0';
+}
+
+//-----------------------------------------------------------------------------
+bool MboxMessageHeaders::parseLine( const char *line )
+{
+  int i;
+
+  // Is this a long header line?
+  if ( mInHeader && ( line[0] == '\t' || line[0] == ' ' ) )
+  {
+    i = 0;
+    while ( line[i] == '\t' || line[i] == ' ' ) i++;
+    if ( line[i] < ' ' && line[i] > 0 ) mInHeader = false;
+    else if ( mLastStr ) this->*mLastStr += line + i;
+  }
+  else if ( mInHeader && line[0] == '=' &&
+            ( ( line[1] == '0' && line[2] == '9' ) ||
+              ( line[1] == '2' && line[2] == '0' ) ) )
+  {
+    // bug 86302 - workaround for malformed wrapped encoded-words
+    if ( mLastStr )
+      this->*mLastStr += line + 3;
+  }
+  else mLastStr = 0;
+
+  if ( mInHeader && ( line[0] == '\n' || line[0] == '\r' ) )
+    mInHeader = false;
+  if ( !mInHeader )
+    return false;
+
+  if ( ( mNeedStatus & 1 ) && strncasecmp( line, "Status:", 7 ) == 0 ) {
+    for ( i = 0; i < 4 && line[i+8] > ' '; ++i ) {
+      mStatus[i] = line[i+8];
+    }
+    mStatus[i] = '\0';
+    mNeedStatus &= ~1;
+  } else if ( ( mNeedStatus & 2 ) &&
+              strncasecmp( line, "X-Status:", 9 ) == 0 ) {
+    for ( i = 0; i < 4 && line[i+10] > ' '; ++i ) {
+      mXStatus[i] = line[i+10];
+    }
+    mXStatus[i] = '\0';
+    mNeedStatus &= ~2;
+  } else if ( strncasecmp( line, "X-KMail-Mark:", 13 ) == 0 ) {
+    mXMark = QByteArray( line + 13 );
+  } else if ( strncasecmp( line, "In-Reply-To:", 12 ) == 0 ) {
+    mReplyToId = QByteArray( line + 12 );
+    mLastStr = &MboxMessageHeaders::mReplyToId;
+  } else if ( strncasecmp( line, "References:", 11 ) == 0 ) {
+    mReferences = QByteArray( line + 11 );
+    mLastStr = &MboxMessageHeaders::mReferences;
+  } else if ( strncasecmp( line, "Message-Id:", 11 ) == 0 ) {
+    mMsgId = QByteArray( line + 11 );
+    mLastStr = &MboxMessageHeaders::mMsgId;
+  } else if ( strncasecmp( line, "Date:", 5 ) == 0 ) {
+    mDate = QByteArray( line + 5 );
+    mLastStr = &MboxMessageHeaders::mDate;
+  } else if ( strncasecmp( line, "From:", 5 ) == 0 ) {
+    mFrom = QByteArray( line + 5 );
+    mLastStr = &MboxMessageHeaders::mFrom;
+  } else if ( strncasecmp( line, "To:", 3 ) == 0 ) {
+    mTo = QByteArray( line + 3 );
+    mLastStr = &MboxMessageHeaders::mTo;
+  } else if ( strncasecmp( line, "Subject:", 8 ) == 0 ) {
+    mSubject = QByteArray( line + 8 );
+    mLastStr = &MboxMessageHeaders::mSubject;
+  } else if ( strncasecmp( line, "X-Length:", 9 ) == 0 ) {
+    mSizeServer = QByteArray( line + 9 );
+    mLastStr = &MboxMessageHeaders::mSizeServer;
+  } else if ( strncasecmp( line, "X-UID:", 6 ) == 0 ) {
+    mUid = QByteArray( line + 6 );
+    mLastStr = &MboxMessageHeaders::mUid;
+  } else if ( strncasecmp( line, "Content-Type:", 13 ) == 0 ) {
+    mContentType = QByteArray( line + 13 );
+    mLastStr = &MboxMessageHeaders::mContentType;
+  }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+KMMsgInfo *MboxMessageHeaders::createMsgInfo( KMFolder *folder, off_t offset,
+                                              size_t size ) const
+{
+  QByteArray msgIdStr = mMsgId.trimmed();
+  if ( !msgIdStr.isEmpty() ) {
+    int rightAngle;
+    rightAngle = msgIdStr.indexOf( '>' );
+    if ( rightAngle != -1 )
+      msgIdStr.truncate( rightAngle + 1 );
+  }
+
+  QByteArray replyToIdStr = mReplyToId.trimmed();
+  if ( !replyToIdStr.isEmpty() ) {
+    int rightAngle;
+    rightAngle = replyToIdStr.indexOf( '>' );
+    if ( rightAngle != -1 )
+      replyToIdStr.truncate( rightAngle + 1 );
+  }
+
+  QByteArray replyToAuxIdStr;
+  QByteArray referencesStr = mReferences.trimmed();
+  if ( !referencesStr.isEmpty() ) {
+    int leftAngle, rightAngle;
+    leftAngle = referencesStr.lastIndexOf( '<' );
+    if ( ( leftAngle != -1 )
+         && ( replyToIdStr.isEmpty() || ( replyToIdStr[0] != '<' ) ) ) {
+      // use the last reference, instead of missing In-Reply-To
+      replyToIdStr = referencesStr.mid( leftAngle );
+    }
+
+    // find second last reference
+    leftAngle = referencesStr.lastIndexOf( '<', leftAngle - 1 );
+    if ( leftAngle != -1 )
+      referencesStr = referencesStr.mid( leftAngle );
+    rightAngle = referencesStr.lastIndexOf( '>' );
+    if ( rightAngle != -1 )
+      referencesStr.truncate( rightAngle + 1 );
+
+    // Store the second to last reference in the replyToAuxIdStr
+    // It is a good candidate for threading the message below if the
+    // message In-Reply-To points to is not kept in this folder,
+    // but e.g. in an Outbox
+    replyToAuxIdStr = referencesStr;
+    rightAngle = referencesStr.indexOf( '>' );
+    if ( rightAngle != -1 )
+      replyToAuxIdStr.truncate( rightAngle + 1 );
+  }
+
+  const QByteArray contentTypeStr = mContentType.trimmed();
+  QByteArray charset;
+  if ( !contentTypeStr.isEmpty() ) {
+    int cidx = contentTypeStr.indexOf( "charset=" );
+    if ( cidx != -1 ) {
+      charset = contentTypeStr.mid( cidx + 8 );
+      if ( !charset.isEmpty() && ( charset[0] == '"' ) ) {
+        charset = charset.mid( 1 );
+      }
+      cidx = 0;
+      while ( cidx < charset.length() ) {
+        if ( charset[cidx] == '"' ||
+             ( !isalnum(charset[cidx]) &&
+               charset[cidx] != '-' && charset[cidx] != '_' ) ) {
+          break;
+        }
+        ++cidx;
+      }
+      charset.truncate( cidx );
+    }
+  }
+
+  KMMsgInfo *mi = new KMMsgInfo( folder );
+  mi->init( mSubject.trimmed(),
+            mFrom.trimmed(),
+            mTo.trimmed(),
+            0, MessageStatus::statusNew(),
+            mXMark.trimmed(),
+            replyToIdStr, replyToAuxIdStr, msgIdStr,
+            KMMsgEncryptionStateUnknown, KMMsgSignatureStateUnknown,
+            KMMsgMDNStateUnknown, charset, offset, size,
+            mSizeServer.toULong(), mUid.toULong() );
+  mi->setStatus( mStatus, mXStatus );
+  mi->setDate( mDate.trimmed().constData() );
+  mi->setDirty( false );
+  return mi;
+}
+
+//-----------------------------------------------------------------------------
+MboxIndexer::MboxIndexer( const char *data, size_t length )
+  : mData( data ),
+    mLength( length )
+{
+}
+
+//-----------------------------------------------------------------------------
+MboxIndexer::~MboxIndexer()
+{
+  // The jobs still refer to mData and the chunks
+  foreach ( Chunk *chunk, mChunks )
+    chunk->future.waitForFinished();
+  qDeleteAll( mChunks );
+}
+
+//-----------------------------------------------------------------------------
+// static
+bool MboxIndexer::isSeparatorLine( const char *line, size_t length )
+{
+  if ( length < 5 || memcmp( line, "From ", 5 ) != 0 )
+    return false;
+
+  // Same as matching the regular expression "^From .*[0-9][0-9]:[0-9][0-9]"
+  for ( size_t i = 5; i + 5 <= length; ++i ) {
+    if ( line[i + 2] == ':' &&
+         line[i] >= '0' && line[i] <= '9' &&
+         line[i + 1] >= '0' && line[i + 1] <= '9' &&
+         line[i + 3] >= '0' && line[i + 3] <= '9' &&
+         line[i + 4] >= '0' && line[i + 4] <= '9' )
+      return true;
+  }
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+int MboxIndexer::findMessages()
+{
+  mOffsets.clear();
+  mSizes.clear();
+
+  // Messages start after their separator line and end right before
+  // the next one. Anything before the first separator is ignored.
+  off_t messageStart = -1;
+  size_t pos = 0;
+  while ( ( pos = DwFindFromLine( mData, mLength, pos ) ) != (size_t)-1 ) {
+    const char *line = mData + pos;
+    const char *lf = static_cast<const char *>( memchr( line, '\n', mLength - pos ) );
+    const size_t lineEnd = lf ? lf - mData + 1 : mLength;
+
+    if ( isSeparatorLine( line, lineEnd - pos ) ) {
+      if ( messageStart >= 0 && (off_t)pos > messageStart ) {
+        mOffsets.append( messageStart );
+        mSizes.append( pos - messageStart );
+      }
+      messageStart = lineEnd;
+    }
+    pos = lineEnd;
+  }
+  if ( messageStart >= 0 && (off_t)mLength > messageStart ) {
+    mOffsets.append( messageStart );
+    mSizes.append( mLength - messageStart );
+  }
+
+  return mOffsets.count();
+}
+
+//-----------------------------------------------------------------------------
+void MboxIndexer::start()
+{
+  // Set up all chunks before starting any job; the jobs only ever touch
+  // their own chunk.
+  for ( int first = 0; first < mOffsets.count(); first += sChunkSize )
+    mChunks.append( new Chunk );
+  for ( int i = 0; i < mChunks.count(); ++i )
+    mChunks[i]->future = QtConcurrent::run( this, &MboxIndexer::parseChunk, i );
+}
+
+//-----------------------------------------------------------------------------
+int MboxIndexer::firstMessageOfChunk( int chunk ) const
+{
+  return chunk * sChunkSize;
+}
+
+//-----------------------------------------------------------------------------
+const QVector<MboxMessageHeaders> &MboxIndexer::waitForChunk( int chunk )
+{
+  mChunks[chunk]->future.waitForFinished();
+  return mChunks[chunk]->headers;
+}
+
+//-----------------------------------------------------------------------------
+void MboxIndexer::parseChunk( int chunk )
+{
+  const int first = firstMessageOfChunk( chunk );
+  const int last = qMin( first + sChunkSize, mOffsets.count() );
+  QVector<MboxMessageHeaders> &headers = mChunks[chunk]->headers;
+  headers.resize( last - first );
+
+  char line[MAX_LINE];
+  for ( int i = first; i < last; ++i ) {
+    MboxMessageHeaders &msgHeaders = headers[i - first];
+    const char *pos = mData + mOffsets[i];
+    const char * const end = pos + mSizes[i];
+    while ( pos < end ) {
+      // Split the lines like fgets( line, MAX_LINE, ... ) would
+      const size_t maxLength = qMin<size_t>( end - pos, MAX_LINE - 1 );
+      const char *lf = static_cast<const char *>( memchr( pos, '\n', maxLength ) );
+      const size_t length = lf ? lf - pos + 1 : maxLength;
+      memcpy( line, pos, length );
+      line[length] = '\0';
+      pos += length;
+      if ( !msgHeaders.parseLine( line ) )
+        break;
+    }
+  }
+}
@@ -0,0 +1,118 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MBOXINDEXER_H
+#define MBOXINDEXER_H
+
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+#include <QFuture>
+
+#include <sys/types.h>
+
+class KMFolder;
+class KMMsgInfo;
+
+namespace KMail {
+
+/**
+ * The index relevant header fields of one message of an mbox file.
+ *
+ * Parsing only touches the members of the object itself, so different
+ * objects can be filled on different threads. The KMMsgInfo is created
+ * afterwards on the GUI thread with createMsgInfo().
+ */
+class MboxMessageHeaders
+{
+public:
+  MboxMessageHeaders();
+
+  /** Parses the next line of the message header, as returned by fgets()
+      (i.e. NUL terminated and including the line break, at most MAX_LINE
+      bytes). Returns false once the end of the header has been reached. */
+  bool parseLine( const char *line );
+
+  /** Creates the index entry for the parsed message, which starts at
+      @p offset in the mbox file and is @p size bytes long. */
+  KMMsgInfo *createMsgInfo( KMFolder *folder, off_t offset, size_t size ) const;
+
+private:
+  QByteArray mSubject, mDate, mFrom, mTo, mXMark;
+  QByteArray mReplyToId, mReferences, mMsgId, mContentType;
+  QByteArray mSizeServer, mUid;
+  QByteArray MboxMessageHeaders::*mLastStr; // header a folded line continues
+  char mStatus[8], mXStatus[8];
+  short mNeedStatus;
+  bool mInHeader;
+};
+
+/**
+ * Builds the index of an mmap()ed mbox file in two phases.
+ *
+ * findMessages() finds the message boundaries in one pass over the whole
+ * file. start() then parses the headers of the messages in chunks on
+ * QThreadPool::globalInstance(). The chunks can be collected in file order
+ * with waitForChunk() while later ones are still being parsed.
+ */
+class MboxIndexer
+{
+public:
+  MboxIndexer( const char *data, size_t length );
+  ~MboxIndexer();
+
+  /** Returns true if @p line of @p length bytes separates two messages. */
+  static bool isSeparatorLine( const char *line, size_t length );
+
+  /** Phase one: finds the messages of the file. Empty messages are
+      skipped. Returns the number of messages found. */
+  int findMessages();
+
+  /** Phase two: parses the headers of all messages found. */
+  void start();
+
+  int chunkCount() const { return mChunks.count(); }
+
+  /** Offset and size of message @p i (in file order). */
+  off_t offset( int i ) const { return mOffsets[i]; }
+  size_t size( int i ) const { return mSizes[i]; }
+
+  /** Index of the first message of @p chunk. */
+  int firstMessageOfChunk( int chunk ) const;
+
+  /** Blocks until @p chunk has been parsed and returns its messages. */
+  const QVector<MboxMessageHeaders> &waitForChunk( int chunk );
+
+private:
+  void parseChunk( int chunk );
+
+  struct Chunk {
+    QVector<MboxMessageHeaders> headers;
+    QFuture<void> future;
+  };
+
+  const char *mData;
+  size_t mLength;
+  QVector<off_t> mOffsets;
+  QVector<size_t> mSizes;
+  QList<Chunk*> mChunks;
+};
+
+}
+
+#endif
@@ -36,6 +36,7 @@
 #include "kmmessagetag.h"
 #include "kmkernel.h"
 #include "kmmsgdict.h"
+#include "stringpartcache.h"
 
 namespace KMail
 {
@@ -407,6 +408,22 @@ void StorageModel::prepareForScan()
     kDebug() << "The folder was closed. Re-opening.";
     mFolder->open( "MessageListView::StorageModel" );
   }
+
+  // The scan reads subject, sender and receiver of every message, decode
+  // them up front on the thread pool. Only as many as the string part cache
+  // holds: the first ones would otherwise be evicted before the scan gets to
+  // them, and be decoded twice. The scan starts with the newest messages,
+  // at the end of the folder; leave room for the others then.
+  KMail::StringPartCache *cache = KMail::StringPartCache::instance();
+  const int entryCost = cache->count() > 0 ? qMax( 1, cache->size() / cache->count() ) : 512;
+  const int count = mFolder->count();
+  int window = cache->maxSize() / entryCost;
+  if ( count > window )
+    window /= 2;
+  QList<KMMsgBase*> msgs;
+  for ( int i = qMax( 0, count - window ); i < count; ++i )
+    msgs.append( mFolder->getMsgBase( i ) );
+  KMMsgBase::fillStringPartCaches( msgs );
 }
 
 bool StorageModel::initializeMessageItem( Core::MessageItem * mi, int row, bool bUseReceiver ) const
@@ -605,6 +622,11 @@ int StorageModel::initialUnreadRowCountGuess() const
   return mFolder->countUnread();
 }
 
+QString StorageModel::threadingCacheFileName() const
+{
+  return mFolder->threadingLocation();
+}
+
 
 void StorageModel::slotFolderClosed()
 {
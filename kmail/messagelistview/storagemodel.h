@@ -136,6 +136,12 @@ public:
    */
   virtual int initialUnreadRowCountGuess() const;
 
+  /**
+   * Returns the ".index.threading" file of the inner KMFolder. KMail removes it
+   * whenever the folder index is rebuilt.
+   */
+  virtual QString threadingCacheFileName() const;
+
   /**
    * This method uses the inner KMFolder to fill in the
    * data for the specified MessageItem from the underlying storage item at
@@ -0,0 +1,197 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "parallelgzipdevice.h"
+
+#include <QThreadPool>
+#include <QtConcurrentRun>
+
+#include <kdebug.h>
+
+#include <string.h>
+#include <zlib.h>
+
+using namespace KMail;
+
+// Uncompressed size of the blocks which are compressed at the same time
+static const int gBlockSize = 512 * 1024;
+
+// The window of deflate: that much of the block before is the dictionary
+static const int gDictionarySize = 32 * 1024;
+
+ParallelGzipDevice::ParallelGzipDevice( const QString &fileName, QObject *parent )
+  : QIODevice( parent ), mFile( fileName ), mCrc( crc32( 0, 0, 0 ) ), mSize( 0 ),
+    mFailed( false )
+{
+}
+
+ParallelGzipDevice::~ParallelGzipDevice()
+{
+  close();
+}
+
+bool ParallelGzipDevice::open( OpenMode mode )
+{
+  if ( mode != QIODevice::WriteOnly || !mFile.open( mode ) ) {
+    setErrorString( mFile.errorString() );
+    return false;
+  }
+
+  // Deflate, no flags, no modification time, no extra flags, Unix
+  static const char header[] = { 0x1f, (char)0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+  if ( mFile.write( header, sizeof( header ) ) != sizeof( header ) ) {
+    setErrorString( mFile.errorString() );
+    mFile.close();
+    return false;
+  }
+
+  mCrc = crc32( 0, 0, 0 );
+  mSize = 0;
+  mFailed = false;
+  return QIODevice::open( mode );
+}
+
+void ParallelGzipDevice::close()
+{
+  if ( !isOpen() )
+    return;
+
+  submitBlock( true );
+  while ( !mPending.isEmpty() )
+    writeBlock();
+
+  char trailer[8];
+  for ( int i = 0; i < 4; ++i ) {
+    trailer[i] = ( mCrc >> ( 8 * i ) ) & 0xff;
+    trailer[4 + i] = ( mSize >> ( 8 * i ) ) & 0xff;
+  }
+  if ( !mFailed && mFile.write( trailer, sizeof( trailer ) ) != sizeof( trailer ) )
+    fail( mFile.errorString() );
+  if ( !mFile.flush() )
+    fail( mFile.errorString() );
+  mFile.close();
+  mDictionary.clear();
+  QIODevice::close();
+}
+
+qint64 ParallelGzipDevice::readData( char *data, qint64 maxSize )
+{
+  Q_UNUSED( data );
+  Q_UNUSED( maxSize );
+  return -1;
+}
+
+qint64 ParallelGzipDevice::writeData( const char *data, qint64 size )
+{
+  if ( mFailed )
+    return -1;
+  qint64 written = 0;
+  while ( written < size ) {
+    const int chunk = qMin( size - written, (qint64)( gBlockSize - mCurrent.size() ) );
+    mCurrent.append( data + written, chunk );
+    written += chunk;
+    if ( mCurrent.size() == gBlockSize )
+      submitBlock( false );
+  }
+  return mFailed ? -1 : written;
+}
+
+void ParallelGzipDevice::submitBlock( bool last )
+{
+  Block *block = new Block;
+  block->input = mCurrent;
+  block->dictionary = mDictionary;
+  block->crc = 0;
+  block->last = last;
+  block->ok = false;
+  mDictionary = mCurrent.right( gDictionarySize );
+  mCurrent.clear();
+  block->future = QtConcurrent::run( &ParallelGzipDevice::compress, block );
+  mPending.append( block );
+
+  // Keep all threads busy, but don't collect more than that in memory
+  while ( mPending.count() > 2 * QThreadPool::globalInstance()->maxThreadCount() )
+    writeBlock();
+}
+
+void ParallelGzipDevice::writeBlock()
+{
+  Block *block = mPending.takeFirst();
+  block->future.waitForFinished();
+  if ( !mFailed ) {
+    if ( !block->ok ) {
+      fail( "Compression failed" );
+    } else if ( mFile.write( block->output ) != block->output.size() ) {
+      fail( mFile.errorString() );
+    } else {
+      mCrc = crc32_combine( mCrc, block->crc, block->input.size() );
+      mSize += block->input.size();
+    }
+  }
+  delete block;
+}
+
+void ParallelGzipDevice::fail( const QString &error )
+{
+  kWarning() << "Writing" << mFile.fileName() << "failed:" << error;
+  setErrorString( error );
+  mFailed = true;
+}
+
+void ParallelGzipDevice::compress( Block *block )
+{
+  const Bytef *input = reinterpret_cast<const Bytef*>( block->input.constData() );
+  block->crc = crc32( crc32( 0, 0, 0 ), input, block->input.size() );
+
+  z_stream stream;
+  memset( &stream, 0, sizeof( stream ) );
+  // Raw deflate data, the gzip header and trailer are written around it
+  if ( deflateInit2( &stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY ) != Z_OK )
+    return;
+  if ( !block->dictionary.isEmpty() &&
+       deflateSetDictionary( &stream,
+                             reinterpret_cast<const Bytef*>( block->dictionary.constData() ),
+                             block->dictionary.size() ) != Z_OK ) {
+    deflateEnd( &stream );
+    return;
+  }
+
+  stream.next_in = const_cast<Bytef*>( input );
+  stream.avail_in = block->input.size();
+  block->output.resize( deflateBound( &stream, block->input.size() ) + 64 );
+  // All but the last block end with an empty stored block, which leaves
+  // the data on a byte boundary without ending the deflate stream
+  const int flush = block->last ? Z_FINISH : Z_SYNC_FLUSH;
+  block->ok = true;
+  forever {
+    if ( block->output.size() - (int)stream.total_out < 64 )
+      block->output.resize( 2 * block->output.size() );
+    stream.next_out = reinterpret_cast<Bytef*>( block->output.data() ) + stream.total_out;
+    stream.avail_out = block->output.size() - stream.total_out;
+    const int rc = deflate( &stream, flush );
+    if ( rc == Z_STREAM_ERROR ) {
+      block->ok = false;
+      break;
+    }
+    if ( block->last ? rc == Z_STREAM_END : stream.avail_out != 0 )
+      break;
+  }
+  block->output.resize( stream.total_out );
+  deflateEnd( &stream );
+}
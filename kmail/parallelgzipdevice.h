@@ -0,0 +1,94 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef PARALLELGZIPDEVICE_H
+#define PARALLELGZIPDEVICE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QFuture>
+#include <QIODevice>
+#include <QList>
+
+namespace KMail {
+
+/**
+ * A write-only device which writes a gzip file, compressing blocks of the
+ * data on QThreadPool::globalInstance() at the same time, the way pigz does.
+ *
+ * Each block is compressed on its own, with the end of the block before as
+ * dictionary, and flushed to a byte boundary. The compressed blocks then
+ * simply follow one another in a single gzip member, which every gzip
+ * reader can read.
+ */
+class ParallelGzipDevice : public QIODevice
+{
+public:
+  explicit ParallelGzipDevice( const QString &fileName, QObject *parent = 0 );
+  ~ParallelGzipDevice();
+
+  /** Opens the file. Only QIODevice::WriteOnly is supported. */
+  virtual bool open( OpenMode mode );
+
+  /** Compresses what is left and finishes the file. */
+  virtual void close();
+
+  virtual bool isSequential() const { return true; }
+
+  /** Returns true if something could not be compressed or written.
+      errorString() tells what. */
+  bool hasError() const { return mFailed; }
+
+protected:
+  virtual qint64 readData( char *data, qint64 maxSize );
+  virtual qint64 writeData( const char *data, qint64 size );
+
+private:
+  struct Block {
+    QByteArray input;
+    QByteArray dictionary;
+    QByteArray output;
+    quint32 crc;
+    bool last;
+    bool ok;
+    QFuture<void> future;
+  };
+
+  static void compress( Block *block );
+
+  /** Starts compressing the collected data, and writes the oldest
+      compressed blocks if too many are waiting. */
+  void submitBlock( bool last );
+
+  /** Waits for the oldest block and writes it to the file. */
+  void writeBlock();
+
+  void fail( const QString &error );
+
+  QFile mFile;
+  QByteArray mCurrent;
+  QByteArray mDictionary;
+  QList<Block*> mPending;
+  quint32 mCrc;
+  quint32 mSize; // modulo 2^32, as the gzip trailer has it
+  bool mFailed;
+};
+
+}
+
+#endif
@@ -0,0 +1,261 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "searchexecutor.h"
+
+#include "folderstorage.h"
+#include "kmfolder.h"
+#include "kmkernel.h"
+#include "kmmsgbase.h"
+#include "kmmsgdict.h"
+#include "kmsearchpattern.h"
+#include "util.h"
+
+#include <kconfiggroup.h>
+#include <kdebug.h>
+#include <kglobal.h>
+
+#include <QByteArray>
+#include <QFile>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVector>
+
+#include <mimelib/string.h>
+
+using namespace KMail;
+
+// The number of messages handed over to a worker at once
+static const int gChunkSize = 100;
+// The messages answered from the indexes are cheap: check a lot of them
+// at once, like FolderStorage::slotProcessNextSearchBatch() does
+static const int gMaxScannedPerStep = 10000;
+// The messages matched on the GUI thread per step
+static const int gMaxLoadedPerStep = 10;
+
+K_GLOBAL_STATIC( QThreadPool, s_searchThreadPool )
+
+namespace KMail {
+
+// The messages a worker matches against the raw rules. They are copied,
+// or read by the worker, as DwStrings can't be shared between threads.
+class SearchChunk
+{
+public:
+  class Entry
+  {
+  public:
+    Entry() : mSerNum( 0 ), mResult( KMSearchPlan::Undecided ) {}
+
+    quint32 mSerNum;
+    QString mFileName;  ///< The file to read the message from, if any
+    QByteArray mText;   ///< The raw message otherwise
+    KMSearchPlan::Result mResult;
+  };
+
+  QVector<Entry> mEntries;
+};
+
+class SearchChunkRunnable : public QRunnable
+{
+public:
+  SearchChunkRunnable( SearchExecutor *executor, SearchChunk *chunk )
+    : mExecutor( executor ), mChunk( chunk ) {}
+
+  virtual void run() { mExecutor->matchChunk( mChunk ); }
+
+private:
+  SearchExecutor *mExecutor;
+  SearchChunk *mChunk;
+};
+
+} // namespace KMail
+
+SearchExecutor::SearchExecutor( KMFolder *folder, const KMSearchPlan *plan, QObject *parent )
+  : QObject( parent ),
+    mFolder( folder ),
+    mPlan( plan ),
+    mCurrentMsg( 0 ),
+    mRunningChunks( 0 ),
+    mCancelled( 0 ),
+    mProcessScheduled( false )
+{
+}
+
+SearchExecutor::~SearchExecutor()
+{
+  // The workers use the plan and the chunks: they can't be abandoned
+  mCancelled = 1;
+  mChunkDone.acquire( mRunningChunks );
+  qDeleteAll( mFinished );
+}
+
+QThreadPool *SearchExecutor::threadPool()
+{
+  if ( !s_searchThreadPool.exists() ) {
+    const KConfigGroup group( KMKernel::config(), "General" );
+    const int threads = group.readEntry( "search-threads", 0 );
+    if ( threads > 0 )
+      s_searchThreadPool->setMaxThreadCount( threads );
+  }
+  return s_searchThreadPool;
+}
+
+void SearchExecutor::start()
+{
+  mProcessScheduled = true;
+  QTimer::singleShot( 0, this, SLOT(slotProcess()) );
+}
+
+bool SearchExecutor::isComplete() const
+{
+  return mCurrentMsg >= mFolder->count() && mRunningChunks == 0 && mUndecided.isEmpty();
+}
+
+void SearchExecutor::slotProcess()
+{
+  mProcessScheduled = false;
+  QList<quint32> serNums;
+
+  // The messages that the raw rules didn't decide need to be loaded:
+  // only a few of them per step to keep the event loop responsive
+  for ( int loaded = 0 ; loaded < gMaxLoadedPerStep && !mUndecided.isEmpty() ; ++loaded ) {
+    const quint32 serNum = mUndecided.takeFirst();
+    KMFolder *folder = 0;
+    int idx = -1;
+    KMMsgDict::instance()->getLocation( serNum, &folder, &idx );
+    if ( folder == mFolder && idx >= 0 && mPlan->matchesWithoutRawRules( mFolder, idx ) )
+      serNums.append( serNum );
+  }
+
+  // Keep all the workers busy
+  const int maxChunks = threadPool()->maxThreadCount();
+  int scanned = 0;
+  while ( mRunningChunks < maxChunks && mCurrentMsg < mFolder->count() &&
+          scanned < gMaxScannedPerStep ) {
+    SearchChunk *chunk = new SearchChunk;
+    for ( ; mCurrentMsg < mFolder->count() && chunk->mEntries.count() < gChunkSize &&
+            scanned < gMaxScannedPerStep ; ++mCurrentMsg, ++scanned ) {
+      KMMsgBase *msgBase = mFolder->getMsgBase( mCurrentMsg );
+      if ( !msgBase )
+        continue;
+      const KMSearchPlan::Result result = mPlan->matchesWithoutLoading( msgBase );
+      if ( result == KMSearchPlan::NoMatch )
+        continue;
+      const quint32 serNum = KMMsgDict::instance()->getMsgSerNum( mFolder, mCurrentMsg );
+      if ( result == KMSearchPlan::Match ) {
+        serNums.append( serNum );
+        continue;
+      }
+
+      SearchChunk::Entry entry;
+      entry.mSerNum = serNum;
+      entry.mFileName = mFolder->storage()->rawMessageFile( mCurrentMsg );
+      if ( entry.mFileName.isEmpty() ) {
+        const DwString str = mFolder->getDwString( mCurrentMsg );
+        entry.mText = QByteArray( str.data(), str.length() );
+      }
+      chunk->mEntries.append( entry );
+    }
+
+    if ( chunk->mEntries.isEmpty() ) {
+      delete chunk;
+      continue;
+    }
+    ++mRunningChunks;
+    threadPool()->start( new SearchChunkRunnable( this, chunk ) );
+  }
+
+  const bool complete = isComplete();
+  if ( !serNums.isEmpty() || complete )
+    emit result( serNums, complete );
+
+  // Otherwise slotChunkFinished() goes on
+  if ( !complete && ( !mUndecided.isEmpty() ||
+                      ( mRunningChunks < maxChunks && mCurrentMsg < mFolder->count() ) ) ) {
+    mProcessScheduled = true;
+    QTimer::singleShot( 0, this, SLOT(slotProcess()) );
+  }
+}
+
+void SearchExecutor::matchChunk( SearchChunk *chunk )
+{
+  // Runs in a worker thread
+
+  QVector<SearchChunk::Entry>::Iterator it;
+  for ( it = chunk->mEntries.begin() ; it != chunk->mEntries.end() && !mCancelled ; ++it ) {
+    QByteArray text = it->mText;
+    if ( !it->mFileName.isEmpty() ) {
+      // like KMFolderMaildir::getDwString(), which gives an empty
+      // message if the file can't be read
+      QFile file( it->mFileName );
+      if ( file.open( QIODevice::ReadOnly ) ) {
+        text = file.readAll();
+        text.truncate( Util::crlf2lf( text.data(), text.size() ) );
+      }
+    }
+    it->mResult = mPlan->matchesRaw( text );
+    it->mText = QByteArray();
+  }
+
+  {
+    QMutexLocker locker( &mFinishedMutex );
+    mFinished.append( chunk );
+  }
+  QMetaObject::invokeMethod( this, "slotChunkFinished", Qt::QueuedConnection );
+  // The executor may be gone from here on
+  mChunkDone.release();
+}
+
+void SearchExecutor::slotChunkFinished()
+{
+  QList<SearchChunk*> chunks;
+  {
+    QMutexLocker locker( &mFinishedMutex );
+    chunks = mFinished;
+    mFinished.clear();
+  }
+  if ( chunks.isEmpty() )
+    return; // taken by an earlier call
+
+  QList<quint32> serNums;
+  QList<SearchChunk*>::const_iterator it;
+  for ( it = chunks.constBegin() ; it != chunks.constEnd() ; ++it ) {
+    mChunkDone.acquire();
+    --mRunningChunks;
+    QVector<SearchChunk::Entry>::const_iterator eit;
+    for ( eit = (*it)->mEntries.constBegin() ; eit != (*it)->mEntries.constEnd() ; ++eit ) {
+      if ( eit->mResult == KMSearchPlan::Match )
+        serNums.append( eit->mSerNum );
+      else if ( eit->mResult == KMSearchPlan::Undecided )
+        mUndecided.append( eit->mSerNum );
+    }
+    delete *it;
+  }
+
+  if ( !serNums.isEmpty() )
+    emit result( serNums, false );
+  if ( !mProcessScheduled ) {
+    mProcessScheduled = true;
+    QTimer::singleShot( 0, this, SLOT(slotProcess()) );
+  }
+}
+
+#include "searchexecutor.moc"
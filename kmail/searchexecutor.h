@@ -0,0 +1,109 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SEARCHEXECUTOR_H
+#define SEARCHEXECUTOR_H
+
+#include <QAtomicInt>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QPointer>
+#include <QSemaphore>
+
+class KMFolder;
+class KMSearchPlan;
+class QThreadPool;
+
+namespace KMail {
+
+class SearchChunk;
+
+/**
+ * Searches a folder for FolderStorage::search() when some of the rules that
+ * need the messages can be matched on their raw text, like "<message>"
+ * contains or regular expression rules (see KMSearchPlan::canMatchRaw()).
+ *
+ * The GUI thread matches the messages against the rules that can be
+ * answered from the indexes and hands the others over to a pool of worker
+ * threads in chunks, together with their raw text or the name of the file
+ * they are in. The workers match them against the raw rules. Whatever
+ * those rules don't decide is matched against the remaining rules on the
+ * GUI thread, a few messages at a time.
+ *
+ * The matching serial numbers are emitted with result() as soon as they
+ * are known. Deleting the executor cancels the search.
+ */
+class SearchExecutor : public QObject
+{
+  Q_OBJECT
+public:
+  /** Prepares the search of @p folder, which must be open, with @p plan,
+      which must outlive the executor. */
+  SearchExecutor( KMFolder *folder, const KMSearchPlan *plan, QObject *parent = 0 );
+  /** Cancels the search. Waits for the workers to give back the chunks
+      they have been handed, which they do without matching the rest of
+      their messages. */
+  ~SearchExecutor();
+
+  /** Starts the search. */
+  void start();
+
+  /** Returns the pool of the worker threads, which is shared by all the
+      searches. Its size is the "search-threads" entry of the "General"
+      group of the configuration, or the number of processors if the
+      entry is 0 (the default). */
+  static QThreadPool *threadPool();
+
+  /** Matches the messages of @p chunk against the raw rules of @p plan.
+      Runs in a worker thread. */
+  void matchChunk( SearchChunk *chunk );
+
+signals:
+  /** Emitted with the serial numbers of matching messages. @p complete
+      is true, once, when the whole folder has been searched. */
+  void result( const QList<quint32> &serNums, bool complete );
+
+private slots:
+  void slotProcess();
+  void slotChunkFinished();
+
+private:
+  void startChunk();
+  bool isComplete() const;
+
+  QPointer<KMFolder> mFolder;
+  const KMSearchPlan *mPlan;
+  int mCurrentMsg;
+  int mRunningChunks;
+
+  // Serial numbers of the messages that the raw rules didn't decide
+  QList<quint32> mUndecided;
+
+  // Chunks that have been matched, handed over by the workers
+  QMutex mFinishedMutex;
+  QList<SearchChunk*> mFinished;
+
+  QSemaphore mChunkDone;   ///< Released by the workers for each chunk
+  QAtomicInt mCancelled;
+  bool mProcessScheduled;
+};
+
+} // namespace KMail
+
+#endif // SEARCHEXECUTOR_H
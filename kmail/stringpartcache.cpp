@@ -0,0 +1,235 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "stringpartcache.h"
+
+#include "globalsettings.h"
+
+#include <KGlobal>
+
+#include <QMutexLocker>
+
+namespace KMail {
+
+K_GLOBAL_STATIC( StringPartCache, s_stringPartCache )
+
+struct StringPartCache::Node
+{
+  Key key;
+  QString parts[PartCount];
+  int cost;
+  Node *prev, *next;             // in least recently used order
+  Node *folderPrev, *folderNext; // of the same folder
+};
+
+uint qHash( const StringPartCache::Key &key )
+{
+  return ::qHash( key.folder ) ^ ::qHash( (quint64)key.offset );
+}
+
+//-----------------------------------------------------------------------------
+StringPartCache::StringPartCache()
+  : mFirst( 0 ), mLast( 0 ), mSize( 0 ),
+    mMaxSize( GlobalSettings::self()->stringPartCacheSize() * 1024 ),
+    mHits( 0 ), mMisses( 0 ), mEvictions( 0 )
+{
+}
+
+StringPartCache::~StringPartCache()
+{
+  qDeleteAll( mNodes );
+}
+
+StringPartCache *StringPartCache::instance()
+{
+  return s_stringPartCache;
+}
+
+//-----------------------------------------------------------------------------
+bool StringPartCache::find( const KMFolderIndex *folder, off_t offset, int part, QString &result )
+{
+  const Key key = { folder, offset };
+  QMutexLocker locker( &mMutex );
+  Node *node = mNodes.value( key );
+  if ( !node ) {
+    ++mMisses;
+    return false;
+  }
+  ++mHits;
+  if ( node != mFirst ) {
+    // move to the front of the list
+    node->prev->next = node->next;
+    if ( node->next )
+      node->next->prev = node->prev;
+    else
+      mLast = node->prev;
+    node->prev = 0;
+    node->next = mFirst;
+    mFirst->prev = node;
+    mFirst = node;
+  }
+  result = node->parts[part];
+  return true;
+}
+
+bool StringPartCache::contains( const KMFolderIndex *folder, off_t offset ) const
+{
+  const Key key = { folder, offset };
+  QMutexLocker locker( &mMutex );
+  return mNodes.contains( key );
+}
+
+//-----------------------------------------------------------------------------
+void StringPartCache::insert( const KMFolderIndex *folder, off_t offset, const QString *parts )
+{
+  const Key key = { folder, offset };
+  int cost = sizeof(Node);
+  for ( int i = 0; i < PartCount; ++i )
+    cost += parts[i].size() * sizeof(QChar);
+
+  QMutexLocker locker( &mMutex );
+  if ( mNodes.contains( key ) ) // decoded by another thread in the meantime
+    return;
+
+  Node *node = new Node;
+  node->key = key;
+  for ( int i = 0; i < PartCount; ++i )
+    node->parts[i] = parts[i];
+  node->cost = cost;
+
+  node->prev = 0;
+  node->next = mFirst;
+  if ( mFirst )
+    mFirst->prev = node;
+  else
+    mLast = node;
+  mFirst = node;
+
+  Node *&folderFirst = mFolderNodes[folder];
+  node->folderPrev = 0;
+  node->folderNext = folderFirst;
+  if ( folderFirst )
+    folderFirst->folderPrev = node;
+  folderFirst = node;
+
+  mNodes.insert( key, node );
+  mSize += cost;
+  evict();
+}
+
+//-----------------------------------------------------------------------------
+void StringPartCache::unlink( Node *node )
+{
+  if ( node->prev )
+    node->prev->next = node->next;
+  else
+    mFirst = node->next;
+  if ( node->next )
+    node->next->prev = node->prev;
+  else
+    mLast = node->prev;
+
+  if ( node->folderNext )
+    node->folderNext->folderPrev = node->folderPrev;
+  if ( node->folderPrev )
+    node->folderPrev->folderNext = node->folderNext;
+  else if ( node->folderNext )
+    mFolderNodes[node->key.folder] = node->folderNext;
+  else
+    mFolderNodes.remove( node->key.folder );
+
+  mNodes.remove( node->key );
+  mSize -= node->cost;
+}
+
+void StringPartCache::evict()
+{
+  while ( mSize > mMaxSize && mLast ) {
+    Node *node = mLast;
+    unlink( node );
+    delete node;
+    ++mEvictions;
+  }
+}
+
+//-----------------------------------------------------------------------------
+void StringPartCache::invalidate( const KMFolderIndex *folder )
+{
+  QMutexLocker locker( &mMutex );
+  Node *node = mFolderNodes.value( folder );
+  while ( node ) {
+    Node *next = node->folderNext;
+    unlink( node );
+    delete node;
+    node = next;
+  }
+}
+
+//-----------------------------------------------------------------------------
+int StringPartCache::maxSize() const
+{
+  QMutexLocker locker( &mMutex );
+  return mMaxSize;
+}
+
+void StringPartCache::setMaxSize( int bytes )
+{
+  QMutexLocker locker( &mMutex );
+  mMaxSize = bytes;
+  evict();
+}
+
+int StringPartCache::size() const
+{
+  QMutexLocker locker( &mMutex );
+  return mSize;
+}
+
+int StringPartCache::count() const
+{
+  QMutexLocker locker( &mMutex );
+  return mNodes.count();
+}
+
+quint64 StringPartCache::hits() const
+{
+  QMutexLocker locker( &mMutex );
+  return mHits;
+}
+
+quint64 StringPartCache::misses() const
+{
+  QMutexLocker locker( &mMutex );
+  return mMisses;
+}
+
+quint64 StringPartCache::evictions() const
+{
+  QMutexLocker locker( &mMutex );
+  return mEvictions;
+}
+
+QString StringPartCache::debug() const
+{
+  QMutexLocker locker( &mMutex );
+  return QString( "entries: %1, size: %2 of %3 bytes, hits: %4, misses: %5, evictions: %6\n" )
+    .arg( mNodes.count() ).arg( mSize ).arg( mMaxSize )
+    .arg( mHits ).arg( mMisses ).arg( mEvictions );
+}
+
+}
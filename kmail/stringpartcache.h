@@ -0,0 +1,104 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef STRINGPARTCACHE_H
+#define STRINGPARTCACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+#include <sys/types.h>
+
+class KMFolderIndex;
+
+namespace KMail {
+
+/**
+ * The decoded string parts (subject, from, ...) of the index entries of
+ * all folders with an mmap()ed index.
+ *
+ * Entries are keyed by folder and index offset and evicted in least
+ * recently used order once the cache holds more than maxSize() bytes.
+ * Decoding an evicted entry again is cheap, as it only has to be copied out
+ * of the mapped index. All members may be called from any thread.
+ */
+class StringPartCache
+{
+  public:
+    enum { PartCount = 20 }; // number of KMMsgBase::MsgPartType values
+
+    StringPartCache();
+    ~StringPartCache();
+
+    static StringPartCache *instance();
+
+    /** Looks up part @p part of the entry at @p offset of the index of
+        @p folder. Returns false if the entry is not cached. */
+    bool find( const KMFolderIndex *folder, off_t offset, int part, QString &result );
+
+    /** Returns true if the entry at @p offset of @p folder is cached,
+        without counting it as an access. */
+    bool contains( const KMFolderIndex *folder, off_t offset ) const;
+
+    /** Caches the PartCount string parts @p parts of the entry at @p offset
+        of the index of @p folder, evicting older entries if needed. */
+    void insert( const KMFolderIndex *folder, off_t offset, const QString *parts );
+
+    /** Drops all entries of @p folder. Must be called whenever the offsets of
+        the index entries of the folder may have changed. */
+    void invalidate( const KMFolderIndex *folder );
+
+    /** The byte budget of the cache. */
+    int maxSize() const;
+    void setMaxSize( int bytes );
+
+    /** Statistics, for debugging and tuning the budget. */
+    int size() const;
+    int count() const;
+    quint64 hits() const;
+    quint64 misses() const;
+    quint64 evictions() const;
+    QString debug() const;
+
+  private:
+    struct Node;
+    struct Key {
+      const KMFolderIndex *folder;
+      off_t offset;
+      bool operator==( const Key &other ) const
+      { return folder == other.folder && offset == other.offset; }
+    };
+    friend uint qHash( const Key &key );
+
+    void unlink( Node *node );
+    void evict();
+
+    mutable QMutex mMutex;
+    QHash<Key, Node*> mNodes;
+    QHash<const KMFolderIndex*, Node*> mFolderNodes;
+    Node *mFirst; // most recently used
+    Node *mLast;  // least recently used
+    int mSize;
+    int mMaxSize;
+    quint64 mHits, mMisses, mEvictions;
+};
+
+}
+
+#endif
@@ -0,0 +1,166 @@
+// Replays the messages of an mbox file through the filters the way
+// KMFilterMgr::process() used to match them, one KMSearchPattern after
+// the other, and through the compiled KMail::FilterMatcher. Checks that
+// both find the same filters for every message and reports the time
+// each of them took.
+//
+// usage: bench_filtermatcher <mbox> [ <kmailrc> ]
+//
+// The filters are read from the kmailrc like KMail does, or made up:
+// 300 filters on List-Id, To, X-Spam-Flag and Subject, like those of
+// someone subscribed to a lot of mailing lists.
+
+#include "filterimporterexporter.h"
+#include "filtermatcher.h"
+#include "kmfilter.h"
+#include "kmmessage.h"
+#include "kmsearchpattern.h"
+
+#include <kcomponentdata.h>
+#include <kconfig.h>
+#include <ksharedconfig.h>
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QList>
+#include <QTime>
+
+#include <iostream>
+
+using KMail::FilterImporterExporter;
+using KMail::FilterMatcher;
+using std::cerr;
+using std::cout;
+using std::endl;
+
+static KMSearchRule * rule( const char * field, KMSearchRule::Function func,
+                            const QString & contents ) {
+  return KMSearchRule::createInstance( field, func, contents );
+}
+
+static QList<KMFilter*> madeUpFilters() {
+  QList<KMFilter*> filters;
+  for ( int i = 0 ; i < 300 ; ++i ) {
+    KMFilter * filter = new KMFilter();
+    KMSearchPattern * pattern = filter->pattern();
+    const QString list = QString( "list-%1.example.org" ).arg( i );
+    switch ( i % 6 ) {
+    case 0:
+    case 1:
+      pattern->append( rule( "List-Id", KMSearchRule::FuncContains, list ) );
+      break;
+    case 2:
+      pattern->append( rule( "To", KMSearchRule::FuncEquals,
+                             QString( "user-%1@example.com" ).arg( i ) ) );
+      break;
+    case 3:
+      pattern->setOp( KMSearchPattern::OpOr );
+      pattern->append( rule( "To", KMSearchRule::FuncContains, list ) );
+      pattern->append( rule( "Cc", KMSearchRule::FuncContains, list ) );
+      break;
+    case 4:
+      pattern->append( rule( "List-Id", KMSearchRule::FuncContains, list ) );
+      pattern->append( rule( "Subject", KMSearchRule::FuncRegExp,
+                             QString( "^\\[list-%1\\]" ).arg( i ) ) );
+      break;
+    default:
+      pattern->append( rule( "<recipients>", KMSearchRule::FuncContains,
+                             QString( "user-%1@" ).arg( i ) ) );
+      break;
+    }
+    filters.append( filter );
+  }
+
+  KMFilter * spam = new KMFilter();
+  spam->pattern()->append( rule( "X-Spam-Flag", KMSearchRule::FuncEquals, "YES" ) );
+  filters.prepend( spam );
+  return filters;
+}
+
+// The messages of an mbox file, without their separator lines
+static QList<QByteArray> readMbox( const QString & fileName ) {
+  QList<QByteArray> messages;
+  QFile file( fileName );
+  if ( !file.open( QIODevice::ReadOnly ) )
+    return messages;
+
+  const QByteArray mbox = file.readAll();
+  int start = mbox.startsWith( "From " ) ? 0 : -1;
+  while ( start >= 0 ) {
+    const int text = mbox.indexOf( '\n', start ) + 1;
+    if ( text == 0 )
+      break;
+    const int next = mbox.indexOf( "\nFrom ", text );
+    messages.append( mbox.mid( text, next < 0 ? -1 : next + 1 - text ) );
+    start = next < 0 ? -1 : next + 1;
+  }
+  return messages;
+}
+
+int main( int argc, char ** argv ) {
+  QCoreApplication app( argc, argv );
+  KComponentData componentData( "bench_filtermatcher" );
+
+  if ( argc < 2 ) {
+    cerr << "usage: bench_filtermatcher <mbox> [ <kmailrc> ]" << endl;
+    return 1;
+  }
+
+  const QList<QByteArray> texts = readMbox( QFile::decodeName( argv[1] ) );
+  if ( texts.isEmpty() ) {
+    cerr << "no messages in " << argv[1] << endl;
+    return 1;
+  }
+  QList<KMMessage*> messages;
+  foreach ( const QByteArray & text, texts ) {
+    KMMessage * msg = new KMMessage;
+    msg->fromString( text );
+    messages.append( msg );
+  }
+
+  const QList<KMFilter*> filters = argc > 2
+    ? FilterImporterExporter::readFiltersFromConfig( KSharedConfig::openConfig( QFile::decodeName( argv[2] ) ), false )
+    : madeUpFilters();
+
+  QTime time;
+  time.start();
+  const FilterMatcher matcher( filters );
+  const int compileTime = time.elapsed();
+  cout << filters.count() << " filters, " << matcher.ruleCount() << " rules, "
+       << matcher.compiledRuleCount() << " of them answered by lookups, compiled in "
+       << compileTime << " ms" << endl;
+
+  // Which filters match, message after message
+  QList<int> patternMatches;
+  time.start();
+  foreach ( const KMMessage * msg, messages ) {
+    for ( int i = 0 ; i < filters.count() ; ++i )
+      if ( filters[i]->pattern()->matches( msg ) )
+        patternMatches.append( i );
+    patternMatches.append( -1 );
+  }
+  const int patternTime = time.elapsed();
+
+  QList<int> matcherMatches;
+  time.start();
+  foreach ( const KMMessage * msg, messages ) {
+    FilterMatcher::Message matcherMsg( &matcher, msg );
+    for ( int i = 0 ; i < filters.count() ; ++i )
+      if ( matcher.matches( i, matcherMsg ) )
+        matcherMatches.append( i );
+    matcherMatches.append( -1 );
+  }
+  const int matcherTime = time.elapsed();
+
+  cout << messages.count() << " messages: patterns " << patternTime << " ms, "
+       << "compiled " << matcherTime << " ms" << endl;
+
+  if ( patternMatches != matcherMatches ) {
+    cerr << "the matched filters differ" << endl;
+    return 1;
+  }
+
+  qDeleteAll( messages );
+  qDeleteAll( filters );
+  return 0;
+}
@@ -0,0 +1,99 @@
+// Feeds the folder listing of a synthetic IMAP folder to the way
+// slotGetMessagesData() used to split it, which removed each message from
+// the front of the buffer and searched the rest again, and to
+// KMail::ImapDigestParser. Checks that both find the same messages and
+// reports the time per message for growing folders: it stays the same
+// with the parser.
+//
+// usage: bench_imapdigest [ <chunk size in kB> ]
+
+#include "imapdigestparser.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QTime>
+
+#include <iostream>
+#include <cstdlib>
+
+using KMail::ImapDigestParser;
+using std::cerr;
+using std::cout;
+using std::endl;
+
+static QByteArray listing( int messages ) {
+  QByteArray data( "X-uidValidity: 1234567890\r\nX-Access: Read/Write\r\nX-Count: " );
+  data += QByteArray::number( messages );
+  data += "\r\nX-Flags: 31\r\n";
+  for ( int i = 1 ; i <= messages ; ++i ) {
+    data += "\r\n--IMAPDIGEST\r\nX-UID: ";
+    data += QByteArray::number( i );
+    data += "\r\nX-Length: ";
+    data += QByteArray::number( 1000 + i % 5000 );
+    data += "\r\nX-Flags: ";
+    data += QByteArray::number( i % 16 );
+  }
+  data += "\r\n--IMAPDIGEST";
+  return data;
+}
+
+// The former KMFolderCachedImap::slotGetMessagesData()
+static void oldParse( QByteArray & cdata, const QByteArray & data, QList<ulong> & uids ) {
+  cdata += data;
+  int pos = cdata.indexOf( "\r\n--IMAPDIGEST" );
+  if ( pos > 0 )
+    cdata.remove( 0, pos );
+  pos = cdata.indexOf( "\r\n--IMAPDIGEST", 1 );
+  while ( pos >= 0 ) {
+    const int indexOfUID = cdata.indexOf( "X-UID", 16 );
+    const int startOfUIDValue = indexOfUID  + 7;
+    uids.append( cdata.mid( startOfUIDValue, cdata.indexOf( '\r', startOfUIDValue ) - startOfUIDValue ).toULong() );
+    cdata.remove( 0, pos );
+    pos = cdata.indexOf( "\r\n--IMAPDIGEST", 1 );
+  }
+}
+
+static void newParse( ImapDigestParser & parser, const QByteArray & data, QList<ulong> & uids ) {
+  parser.feed( data );
+  QByteArray preamble;
+  parser.takePreamble( preamble );
+  QByteArray entry;
+  while ( parser.nextEntry( entry ) )
+    uids.append( ImapDigestParser::headerValue( entry, "X-UID" ).toULong() );
+}
+
+int main( int argc, char ** argv ) {
+  const int chunkSize = ( argc > 1 ? atoi( argv[1] ) : 32 ) * 1024;
+  if ( chunkSize <= 0 ) {
+    cerr << "usage: bench_imapdigest [ <chunk size in kB> ]" << endl;
+    return 1;
+  }
+
+  cout << "messages\told ns/msg\tnew ns/msg" << endl;
+  for ( int messages = 25000 ; messages <= 200000 ; messages *= 2 ) {
+    const QByteArray data = listing( messages );
+
+    QList<ulong> oldUids;
+    QByteArray cdata;
+    QTime time;
+    time.start();
+    for ( int i = 0 ; i < data.size() ; i += chunkSize )
+      oldParse( cdata, data.mid( i, chunkSize ), oldUids );
+    const int oldTime = time.elapsed();
+
+    QList<ulong> newUids;
+    ImapDigestParser parser;
+    time.start();
+    for ( int i = 0 ; i < data.size() ; i += chunkSize )
+      newParse( parser, data.mid( i, chunkSize ), newUids );
+    const int newTime = time.elapsed();
+
+    if ( oldUids != newUids || newUids.count() != messages ) {
+      cerr << "the parsed messages differ" << endl;
+      return 1;
+    }
+    cout << messages << "\t\t" << oldTime * 1000000.0 / messages
+         << "\t\t" << newTime * 1000000.0 / messages << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,155 @@
+// Inserts, looks up and removes the serial numbers of a synthetic message
+// store in the chained hash table KMDict used to be, with one allocated
+// item per message and the number of buckets fixed at creation, and in
+// KMDict. Both are created with the number of entries as size hint, as
+// KMMsgDict does after the first start. Reports the time per operation.
+//
+// usage: bench_kmdict [ <millions of entries> ]
+
+#include "kmdict.h"
+
+#include <QTime>
+
+#include <iostream>
+#include <cstdlib>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+
+// The former KMDict, holding KMMsgDictEntry items
+class OldDict {
+public:
+  struct Item {
+    unsigned long key;
+    Item *next;
+    const KMFolder *folder;
+    int index;
+  };
+
+  explicit OldDict( int size ) : mSize( size | 1 ) {
+    mVecs = new Item *[mSize];
+    for ( int i = 0 ; i < mSize ; ++i )
+      mVecs[i] = 0;
+  }
+
+  ~OldDict() {
+    for ( int i = 0 ; i < mSize ; ++i ) {
+      Item *item = mVecs[i];
+      while ( item ) {
+        Item *next = item->next;
+        delete item;
+        item = next;
+      }
+    }
+    delete [] mVecs;
+  }
+
+  void insert( unsigned long key, const KMFolder *folder, int index ) {
+    Item *item = new Item;
+    item->key = key;
+    item->folder = folder;
+    item->index = index;
+    const int idx = key % mSize;
+    item->next = mVecs[idx];
+    mVecs[idx] = item;
+  }
+
+  Item *find( unsigned long key ) const {
+    for ( Item *item = mVecs[key % mSize] ; item ; item = item->next )
+      if ( item->key == key )
+        return item;
+    return 0;
+  }
+
+  void remove( unsigned long key ) {
+    Item **link = &mVecs[key % mSize];
+    while ( *link && (*link)->key != key )
+      link = &(*link)->next;
+    if ( *link ) {
+      Item *item = *link;
+      *link = item->next;
+      delete item;
+    }
+  }
+
+private:
+  int mSize;
+  Item **mVecs;
+};
+
+static const KMFolder *folder( unsigned long msn ) {
+  // Never dereferenced
+  return reinterpret_cast<const KMFolder *>( quintptr( 0x1000 + ( msn % 100 ) * 16 ) );
+}
+
+// Serial numbers are handed out in order, but folders are loaded one by one,
+// so look them up and remove them in a scattered order
+static unsigned long scattered( int i, int entries ) {
+  return ( quint64( i ) * 7919 ) % entries + 1;
+}
+
+int main( int argc, char ** argv ) {
+  const int maxMillions = argc > 1 ? atoi( argv[1] ) : 10;
+  if ( maxMillions <= 0 ) {
+    cerr << "usage: bench_kmdict [ <millions of entries> ]" << endl;
+    return 1;
+  }
+
+  cout << "entries\t\told insert/find/remove ns\tnew insert/find/remove ns" << endl;
+  for ( int millions = 1 ; millions <= maxMillions ; millions *= 10 ) {
+    const int entries = millions * 1000000;
+    long checkOld = 0, checkNew = 0;
+    QTime time;
+
+    OldDict *oldDict = new OldDict( entries );
+    time.start();
+    for ( int i = 1 ; i <= entries ; ++i )
+      oldDict->insert( i, folder( i ), i );
+    const int oldInsert = time.elapsed();
+    time.start();
+    for ( int i = 0 ; i < entries ; ++i ) {
+      const unsigned long msn = scattered( i, entries );
+      OldDict::Item *item = oldDict->find( msn );
+      if ( item && item->folder == folder( msn ) )
+        checkOld += item->index;
+    }
+    const int oldFind = time.elapsed();
+    time.start();
+    for ( int i = 0 ; i < entries ; ++i )
+      oldDict->remove( scattered( i, entries ) );
+    const int oldRemove = time.elapsed();
+    delete oldDict;
+
+    KMDict *newDict = new KMDict( entries );
+    time.start();
+    for ( int i = 1 ; i <= entries ; ++i )
+      newDict->replace( i, folder( i ), i );
+    const int newInsert = time.elapsed();
+    time.start();
+    for ( int i = 0 ; i < entries ; ++i ) {
+      const unsigned long msn = scattered( i, entries );
+      const KMFolder *f;
+      int index;
+      if ( newDict->find( msn, &f, &index ) && f == folder( msn ) )
+        checkNew += index;
+    }
+    const int newFind = time.elapsed();
+    time.start();
+    for ( int i = 0 ; i < entries ; ++i )
+      newDict->remove( scattered( i, entries ) );
+    const int newRemove = time.elapsed();
+    const int left = newDict->count();
+    delete newDict;
+
+    if ( checkOld != checkNew || left != 0 ) {
+      cerr << "the dictionaries differ" << endl;
+      return 1;
+    }
+    const double scale = 1000000.0 / entries;
+    cout << entries << "\t"
+         << oldInsert * scale << "/" << oldFind * scale << "/" << oldRemove * scale << "\t\t\t"
+         << newInsert * scale << "/" << newFind * scale << "/" << newRemove * scale << endl;
+  }
+  return 0;
+}
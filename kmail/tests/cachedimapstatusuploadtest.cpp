@@ -0,0 +1,71 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "qtest_kde.h"
+#include "cachedimapstatusuploadtest.h"
+#include "cachedimapstatusuploadtest.moc"
+
+#include "cachedimapstatusupload.h"
+
+QTEST_KDEMAIN_CORE( CachedImapStatusUploadTester )
+
+using KMail::CachedImapStatusUpload::uidsToUpload;
+
+// The uid map of a folder with the messages @p first to @p last
+static QMap<ulong, int> folderUids( ulong first, ulong last )
+{
+  QMap<ulong, int> uidMap;
+  for ( ulong uid = first; uid <= last; ++uid ) {
+    uidMap.insert( uid, uidMap.count() );
+  }
+  return uidMap;
+}
+
+void CachedImapStatusUploadTester::test_onlyChangedUids()
+{
+  const QMap<ulong, int> uidMap = folderUids( 1, 10000 );
+  QSet<ulong> changed;
+  changed << 9000 << 17 << 4711;
+
+  QList<ulong> expected;
+  expected << 17 << 4711 << 9000;
+  QCOMPARE( uidsToUpload( changed, uidMap ), expected );
+}
+
+void CachedImapStatusUploadTester::test_newAndRemovedMessages()
+{
+  // A new message, which has no uid yet, is in the map as 0
+  QMap<ulong, int> uidMap = folderUids( 100, 110 );
+  uidMap.insert( 0, uidMap.count() );
+
+  QSet<ulong> changed;
+  changed << 0 << 99 << 105 << 111;
+
+  QList<ulong> expected;
+  expected << 105;
+  QCOMPARE( uidsToUpload( changed, uidMap ), expected );
+}
+
+void CachedImapStatusUploadTester::test_nothingChanged()
+{
+  QVERIFY( uidsToUpload( QSet<ulong>(), folderUids( 1, 100 ) ).isEmpty() );
+
+  QSet<ulong> changed;
+  changed << 5;
+  QVERIFY( uidsToUpload( changed, QMap<ulong, int>() ).isEmpty() );
+}
@@ -0,0 +1,34 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef CACHEDIMAPSTATUSUPLOADTEST_H
+#define CACHEDIMAPSTATUSUPLOADTEST_H
+
+#include <QtCore/QObject>
+
+class CachedImapStatusUploadTester : public QObject
+{
+  Q_OBJECT
+
+private Q_SLOTS:
+  void test_onlyChangedUids();
+  void test_newAndRemovedMessages();
+  void test_nothingChanged();
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "qtest_kde.h"
+#include "fulltextindexbodytest.h"
+#include "fulltextindexbodytest.moc"
+
+#include "fulltextindexbody.h"
+
+#include <mimelib/message.h>
+#include <mimelib/string.h>
+
+#include <QTextCodec>
+
+QTEST_KDEMAIN_CORE( FullTextIndexBodyTester )
+
+using KMail::FullTextIndexBody::isPlainText;
+using KMail::FullTextIndexBody::textParts;
+
+static const QTextCodec *latin1()
+{
+  return QTextCodec::codecForName( "ISO-8859-1" );
+}
+
+// Parses the message @p text, with "\n" line breaks
+static DwMessage *parse( const char *text )
+{
+  DwMessage *msg = new DwMessage( DwString( QByteArray( text ).replace( "\n", "\r\n" ).constData() ) );
+  msg->Parse();
+  return msg;
+}
+
+void FullTextIndexBodyTester::test_plainText()
+{
+  DwMessage *msg = parse(
+    "From: a@example.org\n"
+    "Subject: plain\n"
+    "\n"
+    "Just some text.\n" );
+  QVERIFY( isPlainText( *msg ) );
+  QVERIFY( textParts( *msg, latin1() ).contains( "Just some text." ) );
+  delete msg;
+}
+
+void FullTextIndexBodyTester::test_encodedText()
+{
+  // bodyToUnicode() decodes the transfer encoding of the message itself
+  DwMessage *msg = parse(
+    "From: a@example.org\n"
+    "Content-Type: text/plain; charset=\"utf-8\"\n"
+    "Content-Transfer-Encoding: base64\n"
+    "\n"
+    "R3LDvMOfZSBhdXMgS8O2bG4K\n" );
+  QVERIFY( isPlainText( *msg ) );
+  QVERIFY( textParts( *msg, latin1() ).contains( QString::fromUtf8( "Grüße aus Köln" ) ) );
+  delete msg;
+}
+
+void FullTextIndexBodyTester::test_textParts()
+{
+  DwMessage *msg = parse(
+    "From: a@example.org\n"
+    "Content-Type: multipart/alternative; boundary=\"b\"\n"
+    "\n"
+    "--b\n"
+    "Content-Type: text/plain\n"
+    "\n"
+    "First part.\n"
+    "--b\n"
+    "Content-Type: text/html\n"
+    "Content-Transfer-Encoding: 8bit\n"
+    "\n"
+    "<p>Second part.</p>\n"
+    "--b--\n" );
+  QVERIFY( isPlainText( *msg ) );
+  const QString text = textParts( *msg, latin1() );
+  QVERIFY( text.contains( "First part." ) );
+  QVERIFY( text.contains( "Second part." ) );
+  delete msg;
+}
+
+void FullTextIndexBodyTester::test_attachment()
+{
+  DwMessage *msg = parse(
+    "From: a@example.org\n"
+    "Content-Type: multipart/mixed; boundary=\"b\"\n"
+    "\n"
+    "--b\n"
+    "Content-Type: text/plain; charset=\"utf-8\"\n"
+    "Content-Transfer-Encoding: base64\n"
+    "\n"
+    "U2VlIHRoZSBhdHRhY2hlZCByZXBvcnQuCg==\n"
+    "--b\n"
+    "Content-Type: application/octet-stream; name=\"report.bin\"\n"
+    "Content-Transfer-Encoding: base64\n"
+    "\n"
+    "QmluYXJ5ZGF0YVhZWjEyMw9kYXRhbW9yZWRhdGFIZWxsb1dvcmxkWlpaMTIzNDU2Nzg5MA==\n"
+    "--b--\n" );
+  // "<body>" has the encoded lines, which the index leaves out
+  QVERIFY( !isPlainText( *msg ) );
+  const QString text = textParts( *msg, latin1() );
+  QVERIFY( text.contains( "See the attached report." ) );
+  QVERIFY( !text.contains( "QmluYXJ5ZGF0YVhZWjEyMw9kYXRhbW9yZWRhdGFIZWxsb1dvcmxkWlpaMTIzNDU2Nzg5MA" ) );
+  QVERIFY( !text.contains( "Binarydata" ) );
+  delete msg;
+}
+
+void FullTextIndexBodyTester::test_quotedPrintablePart()
+{
+  // The raw body has the soft line breaks, the decoded part doesn't
+  DwMessage *msg = parse(
+    "From: a@example.org\n"
+    "Content-Type: multipart/mixed; boundary=\"b\"\n"
+    "\n"
+    "--b\n"
+    "Content-Type: text/plain; charset=\"iso-8859-1\"\n"
+    "Content-Transfer-Encoding: quoted-printable\n"
+    "\n"
+    "Sch=F6ne Gr=FC=\n"
+    "=DFe\n"
+    "--b--\n" );
+  QVERIFY( !isPlainText( *msg ) );
+  QVERIFY( textParts( *msg, latin1() ).contains( QString::fromUtf8( "Schöne Grüße" ) ) );
+  delete msg;
+}
@@ -6,62 +6,329 @@
 #include "messagedicttests.h"
 
 #include "kmdict.h"
+#include "kmmsgdictfile.h"
 
 #include <kdebug.h>
+#include <ktempdir.h>
 #include "qtest_kde.h"
 
+#include <QFile>
+#include <QVector>
+
+#include <stdio.h>
+
 QTEST_KDEMAIN_CORE( MessageDictTester )
 
+// Never dereferenced, only compared
+static const KMFolder *fakeFolder( int n )
+{
+  return reinterpret_cast<const KMFolder *>( quintptr( 0x1000 + n * 16 ) );
+}
+
 void MessageDictTester::initTestCase()
 {
     m_dict = new KMDict( 4 ); // will be thrown away in init
+    m_tempDir = new KTempDir();
 }
 
 void MessageDictTester::cleanupTestCase()
 {
     delete m_dict;
+    delete m_tempDir;
 }
 
 void MessageDictTester::test_KMDictCreation()
 {
-    QCOMPARE( m_dict->size(), 31 );
-    m_dict->init( 13 ); // will be created with a 13, no nextPrime()
-    QCOMPARE( m_dict->size(), 13 );
+    QCOMPARE( m_dict->size(), 16 );
+    QCOMPARE( m_dict->count(), 0 );
+    KMDict dict( 1000 ); // room for 1000 entries without growing
+    QCOMPARE( dict.size(), 2048 );
+    m_dict->init( 32 ); // will be created with exactly 32 slots
+    QCOMPARE( m_dict->size(), 32 );
 }
 
 void MessageDictTester::test_KMDictInsert()
 {
-    KMDictItem *item = new KMDictItem();
-    m_dict->insert( 12345, item );
-    KMDictItem *found = m_dict->find( 12345 );
-    QCOMPARE( item, found);
+    m_dict->replace( 12345, fakeFolder( 1 ), 7 );
+    const KMFolder *folder;
+    int index;
+    QVERIFY( m_dict->find( 12345, &folder, &index ) );
+    QCOMPARE( folder, fakeFolder( 1 ) );
+    QCOMPARE( index, 7 );
+    QVERIFY( m_dict->contains( 12345 ) );
+    QCOMPARE( m_dict->count(), 1 );
 }
  
 void MessageDictTester::test_KMDictRemove()
 {
   m_dict->remove( 12345 );
-  KMDictItem *item = m_dict->find( 12345 );
-  QCOMPARE( item, (KMDictItem*)0 );
+  const KMFolder *folder;
+  int index;
+  QVERIFY( !m_dict->find( 12345, &folder, &index ) );
+  QCOMPARE( folder, (const KMFolder*)0 );
+  QCOMPARE( index, -1 );
+  QCOMPARE( m_dict->count(), 0 );
 }
 
 void MessageDictTester::test_KMDictClear()
 {
-  for ( unsigned int i=0; i<11; ++i )
-    m_dict->insert( i, new KMDictItem() );
+  for ( unsigned int i=1; i<12; ++i )
+    m_dict->replace( i, fakeFolder( 1 ), i );
   m_dict->clear();
-  QCOMPARE( m_dict->mVecs, (KMDictItem**)0 );
+  QCOMPARE( m_dict->count(), 0 );
+  for ( unsigned int i=1; i<12; ++i )
+    QVERIFY( !m_dict->contains( i ) );
 }
 
 void MessageDictTester::test_KMDictReplace()
 {
-  m_dict->init( 31 );
-  KMDictItem *oldItem = new KMDictItem();
-  KMDictItem *newItem = new KMDictItem();
-  m_dict->insert( 12345, oldItem );
-  m_dict->replace( 12345, newItem );
-  KMDictItem *found = m_dict->find( 12345 );
-  QCOMPARE( found, newItem );
+  m_dict->init( 32 );
+  m_dict->replace( 12345, fakeFolder( 1 ), 1 );
+  m_dict->replace( 12345, fakeFolder( 2 ), 2 );
+  const KMFolder *folder;
+  int index;
+  QVERIFY( m_dict->find( 12345, &folder, &index ) );
+  QCOMPARE( folder, fakeFolder( 2 ) );
+  QCOMPARE( index, 2 );
+  QCOMPARE( m_dict->count(), 1 );
 }
 
-#include "messagedicttests.moc"
+void MessageDictTester::test_KMDictSetIndex()
+{
+  m_dict->setIndex( 12345, 42 );
+  m_dict->setIndex( 54321, 42 ); // not there, must not be added
+  const KMFolder *folder;
+  int index;
+  QVERIFY( m_dict->find( 12345, &folder, &index ) );
+  QCOMPARE( index, 42 );
+  QVERIFY( !m_dict->contains( 54321 ) );
+  QCOMPARE( m_dict->count(), 1 );
+}
+
+void MessageDictTester::test_KMDictGrow()
+{
+  m_dict->init( 16 );
+  const int count = 10000;
+  for ( int i = 1; i <= count; ++i )
+    m_dict->replace( i, fakeFolder( i % 5 ), i * 3 );
+  QCOMPARE( m_dict->count(), count );
+  QVERIFY( m_dict->size() * 3 >= count * 4 );
+  for ( int i = 1; i <= count; ++i ) {
+    const KMFolder *folder;
+    int index;
+    QVERIFY( m_dict->find( i, &folder, &index ) );
+    QCOMPARE( folder, fakeFolder( i % 5 ) );
+    QCOMPARE( index, i * 3 );
+  }
+  QVERIFY( !m_dict->contains( count + 1 ) );
+}
+
+void MessageDictTester::test_KMDictRemoveMany()
+{
+  // Removing has to keep the remaining entries findable, wherever the
+  // probe sequences run (including around the end of the table)
+  const int count = 10000;
+  for ( int i = 1; i <= count; i += 2 )
+    m_dict->remove( i );
+  QCOMPARE( m_dict->count(), count / 2 );
+  for ( int i = 1; i <= count; ++i ) {
+    const KMFolder *folder;
+    int index;
+    const bool found = m_dict->find( i, &folder, &index );
+    QCOMPARE( found, i % 2 == 0 );
+    if ( found )
+      QCOMPARE( index, i * 3 );
+  }
+  for ( int i = 2; i <= count; i += 2 )
+    m_dict->remove( i );
+  QCOMPARE( m_dict->count(), 0 );
+  m_dict->replace( 1, fakeFolder( 1 ), 1 );
+  QVERIFY( m_dict->contains( 1 ) );
+}
+
+void MessageDictTester::test_KMDictInsertFolder()
+{
+  m_dict->clear();
+  m_dict->replace( 100, fakeFolder( 1 ), 0 );
+  const unsigned long keys[] = { 10, 0, 30, 40 };
+  QVERIFY( m_dict->insert( keys, 4, fakeFolder( 2 ) ) );
+  QCOMPARE( m_dict->count(), 4 );
+  const KMFolder *folder;
+  int index;
+  QVERIFY( m_dict->find( 30, &folder, &index ) );
+  QCOMPARE( folder, fakeFolder( 2 ) );
+  QCOMPARE( index, 2 );
+  QVERIFY( !m_dict->contains( 0 ) );
+
+  // A key which is taken already, or appears twice, inserts nothing
+  const unsigned long taken[] = { 50, 60, 100 };
+  QVERIFY( !m_dict->insert( taken, 3, fakeFolder( 3 ) ) );
+  const unsigned long twice[] = { 70, 80, 70 };
+  QVERIFY( !m_dict->insert( twice, 3, fakeFolder( 3 ) ) );
+  QCOMPARE( m_dict->count(), 4 );
+  QVERIFY( !m_dict->contains( 50 ) );
+  QVERIFY( !m_dict->contains( 70 ) );
+  QVERIFY( m_dict->find( 100, &folder, &index ) );
+  QCOMPARE( folder, fakeFolder( 1 ) );
+}
+
+// Writes an .ids file the way KMMsgDict::writeFolderIds() does
+static bool writeIds( const QString &fileName, int version, const QVector<quint32> &ids )
+{
+  FILE *fp = fopen( QFile::encodeName( fileName ), "w" );
+  if ( !fp )
+    return false;
+  fprintf( fp, IDS_HEADER, version );
+  const quint32 byteOrder = 0x12345678;
+  const quint32 count = ids.size();
+  fwrite( &byteOrder, sizeof( byteOrder ), 1, fp );
+  fwrite( &count, sizeof( count ), 1, fp );
+  fwrite( ids.constData(), sizeof( quint32 ), count, fp );
+  return fclose( fp ) == 0;
+}
+
+static bool appendBytes( const QString &fileName, const QByteArray &bytes )
+{
+  QFile file( fileName );
+  return file.open( QIODevice::WriteOnly | QIODevice::Append ) &&
+         file.write( bytes ) == bytes.size();
+}
+
+// The serial numbers without the unused indices at the end
+static QVector<ulong> realIds( QVector<ulong> ids )
+{
+  while ( !ids.isEmpty() && ids.last() == 0 )
+    ids.pop_back();
+  return ids;
+}
+
+void MessageDictTester::test_IdsFileAppend()
+{
+  const QString fileName = m_tempDir->name() + "append.ids";
+  QVERIFY( writeIds( fileName, IDS_VERSION, QVector<quint32>() << 11 << 12 << 13 ) );
+
+  QVector<ulong> ids;
+  bool swapByteOrder = true;
+  qint64 appendOffset = 0;
+  QVERIFY( KMMsgDictFile::read( fileName, ids, &swapByteOrder, &appendOffset ) );
+  QCOMPARE( realIds( ids ), QVector<ulong>() << 11 << 12 << 13 );
+  QVERIFY( !swapByteOrder );
+  QCOMPARE( appendOffset, QFile( fileName ).size() );
+
+  const ulong added[] = { 14, 15 };
+  QCOMPARE( KMMsgDictFile::append( fileName, appendOffset, 3, added, 2, false ),
+            KMMsgDictFile::Appended );
+  const ulong replaced[] = { 22 };
+  QCOMPARE( KMMsgDictFile::append( fileName, appendOffset, 1, replaced, 1, false ),
+            KMMsgDictFile::Appended );
+
+  qint64 offset = 0;
+  QVERIFY( KMMsgDictFile::read( fileName, ids, &swapByteOrder, &offset ) );
+  QCOMPARE( realIds( ids ), QVector<ulong>() << 11 << 22 << 13 << 14 << 15 );
+  QCOMPARE( offset, appendOffset );
+}
+
+void MessageDictTester::test_IdsFileCutOffRecord()
+{
+  const QString fileName = m_tempDir->name() + "cutoff.ids";
+  QVERIFY( writeIds( fileName, IDS_VERSION, QVector<quint32>() << 11 << 12 ) );
+  const qint64 appendOffset = QFile( fileName ).size();
+  const ulong added[] = { 13 };
+  QCOMPARE( KMMsgDictFile::append( fileName, appendOffset, 2, added, 1, false ),
+            KMMsgDictFile::Appended );
+  // Half of a record, as left behind by a failed write
+  QVERIFY( appendBytes( fileName, QByteArray( "\3\0\0\0", 4 ) ) );
+
+  QVector<ulong> ids;
+  bool swapByteOrder;
+  qint64 offset;
+  QVERIFY( KMMsgDictFile::read( fileName, ids, &swapByteOrder, &offset ) );
+  QCOMPARE( realIds( ids ), QVector<ulong>() << 11 << 12 << 13 );
+
+  // Nothing must be appended after it
+  QCOMPARE( KMMsgDictFile::append( fileName, offset, 3, added, 1, false ),
+            KMMsgDictFile::RewriteNeeded );
+  QCOMPARE( QFile( fileName ).size(), offset + 8 + 4 );
+}
+
+void MessageDictTester::test_IdsFileIndexOutOfRange()
+{
+  const QString fileName = m_tempDir->name() + "range.ids";
+  QVERIFY( writeIds( fileName, IDS_VERSION, QVector<quint32>() << 11 << 12 << 13 ) );
+  const qint64 appendOffset = QFile( fileName ).size();
+  // Three serial numbers and one record allow indices up to 3
+  const ulong added[] = { 14 };
+  QCOMPARE( KMMsgDictFile::append( fileName, appendOffset, 3, added, 1, false ),
+            KMMsgDictFile::Appended );
+
+  QVector<ulong> ids;
+  bool swapByteOrder;
+  qint64 offset;
+  QVERIFY( KMMsgDictFile::read( fileName, ids, &swapByteOrder, &offset ) );
+
+  QCOMPARE( KMMsgDictFile::append( fileName, appendOffset, 100, added, 1, false ),
+            KMMsgDictFile::Appended );
+  QVERIFY( !KMMsgDictFile::read( fileName, ids, &swapByteOrder, &offset ) );
+}
 
+void MessageDictTester::test_IdsFileVersion1002()
+{
+  const QString fileName = m_tempDir->name() + "old.ids";
+  QVERIFY( writeIds( fileName, IDS_VERSION_NO_APPEND, QVector<quint32>() << 11 << 12 << 13 ) );
+
+  QVector<ulong> ids;
+  bool swapByteOrder;
+  qint64 appendOffset = -1;
+  QVERIFY( KMMsgDictFile::read( fileName, ids, &swapByteOrder, &appendOffset ) );
+  QCOMPARE( ids, QVector<ulong>() << 11 << 12 << 13 );
+  // The file has to be written anew before anything is appended
+  QCOMPARE( appendOffset, qint64( 0 ) );
+
+  // Trailing bytes are no records in this version
+  QVERIFY( appendBytes( fileName, QByteArray( 8, '\xff' ) ) );
+  QVERIFY( KMMsgDictFile::read( fileName, ids, &swapByteOrder, &appendOffset ) );
+  QCOMPARE( ids, QVector<ulong>() << 11 << 12 << 13 );
+
+  // A file cut off before the last serial number is not read at all
+  QFile file( fileName );
+  QVERIFY( file.resize( file.size() - 8 - 2 ) );
+  QVERIFY( !KMMsgDictFile::read( fileName, ids, &swapByteOrder, &appendOffset ) );
+}
+
+void MessageDictTester::test_IdsFileRewrite()
+{
+  const QString fileName = m_tempDir->name() + "rewrite.ids";
+  QVERIFY( writeIds( fileName, IDS_VERSION, QVector<quint32>() ) );
+  const qint64 appendOffset = QFile( fileName ).size();
+
+  QVector<ulong> added( IDS_MAX_APPENDED );
+  for ( int i = 0; i < IDS_MAX_APPENDED; ++i )
+    added[i] = i + 1;
+  QCOMPARE( KMMsgDictFile::append( fileName, appendOffset, 0, added.constData(),
+                                   IDS_MAX_APPENDED - 1, false ),
+            KMMsgDictFile::Appended );
+  QCOMPARE( KMMsgDictFile::append( fileName, appendOffset, IDS_MAX_APPENDED - 1,
+                                   added.constData() + IDS_MAX_APPENDED - 1, 1, false ),
+            KMMsgDictFile::Appended );
+
+  // One more is too many, the file stays as it is
+  const qint64 size = QFile( fileName ).size();
+  QCOMPARE( size, appendOffset + IDS_MAX_APPENDED * 8 );
+  const ulong more[] = { IDS_MAX_APPENDED + 1 };
+  QCOMPARE( KMMsgDictFile::append( fileName, appendOffset, IDS_MAX_APPENDED, more, 1, false ),
+            KMMsgDictFile::RewriteNeeded );
+  QCOMPARE( QFile( fileName ).size(), size );
+
+  QVector<ulong> ids;
+  bool swapByteOrder;
+  qint64 offset;
+  QVERIFY( KMMsgDictFile::read( fileName, ids, &swapByteOrder, &offset ) );
+  QCOMPARE( ids, added );
+
+  // Written anew, records can be appended again
+  QVERIFY( writeIds( fileName, IDS_VERSION, QVector<quint32>() << 1 << 2 ) );
+  QCOMPARE( KMMsgDictFile::append( fileName, QFile( fileName ).size(), 2, more, 1, false ),
+            KMMsgDictFile::Appended );
+}
+
+#include "messagedicttests.moc"
@@ -10,6 +10,7 @@
 #include <qobject.h>
 
 class KMDict;
+class KTempDir;
 
 class MessageDictTester : public QObject
 {
@@ -23,8 +24,18 @@ private slots:
     void test_KMDictRemove();
     void test_KMDictClear();
     void test_KMDictReplace();
+    void test_KMDictSetIndex();
+    void test_KMDictGrow();
+    void test_KMDictRemoveMany();
+    void test_KMDictInsertFolder();
+    void test_IdsFileAppend();
+    void test_IdsFileCutOffRecord();
+    void test_IdsFileIndexOutOfRange();
+    void test_IdsFileVersion1002();
+    void test_IdsFileRewrite();
 private:
     KMDict *m_dict;
+    KTempDir *m_tempDir;
 };
 
 #endif
@@ -0,0 +1,179 @@
+/*  -*- mode: C++; c-file-style: "gnu" -*-
+ *
+ *  This file is part of KMail, the KDE mail client.
+ *
+ *  KMail is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  KMail is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "qtest_kde.h"
+#include "parallelgzipdevicetest.h"
+#include "parallelgzipdevicetest.moc"
+
+#include "parallelgzipdevice.h"
+
+#include <karchive.h>
+#include <kfilterdev.h>
+#include <ktar.h>
+#include <ktempdir.h>
+
+#include <QFile>
+
+#include <zlib.h>
+
+QTEST_KDEMAIN_CORE( ParallelGzipDeviceTester )
+
+using KMail::ParallelGzipDevice;
+
+// The size of the blocks ParallelGzipDevice compresses at the same time
+static const int blockSize = 512 * 1024;
+
+// Text that compresses well, but not into nothing
+static QByteArray testData( int size )
+{
+  QByteArray data;
+  data.reserve( size + 64 );
+  for ( quint32 i = 0; data.size() < size; ++i ) {
+    data += "Line " + QByteArray::number( ( i * 2654435761u ) % 100000 ) + " of the test data\n";
+  }
+  data.truncate( size );
+  return data;
+}
+
+// Writes @p data to the gzip file @p fileName in writes of @p chunkSize
+static bool writeGzip( const QString &fileName, const QByteArray &data, int chunkSize )
+{
+  ParallelGzipDevice device( fileName );
+  if ( !device.open( QIODevice::WriteOnly ) )
+    return false;
+  for ( int pos = 0; pos < data.size(); pos += chunkSize ) {
+    const int size = qMin( chunkSize, data.size() - pos );
+    if ( device.write( data.constData() + pos, size ) != size )
+      return false;
+  }
+  device.close();
+  return !device.hasError();
+}
+
+// Reads the gzip file @p fileName with zlib, which checks the CRC and the
+// size in the trailer. Returns false if it doesn't match.
+static bool readWithZlib( const QString &fileName, QByteArray *data )
+{
+  gzFile file = gzopen( QFile::encodeName( fileName ).constData(), "rb" );
+  if ( !file )
+    return false;
+  char buffer[65536];
+  int count;
+  while ( ( count = gzread( file, buffer, sizeof( buffer ) ) ) > 0 ) {
+    data->append( buffer, count );
+  }
+  return gzclose( file ) == Z_OK && count == 0;
+}
+
+static QByteArray readWithFilterDev( const QString &fileName )
+{
+  QIODevice *device = KFilterDev::deviceForFile( fileName, "application/x-gzip" );
+  if ( !device || !device->open( QIODevice::ReadOnly ) ) {
+    delete device;
+    return QByteArray();
+  }
+  const QByteArray data = device->readAll();
+  delete device;
+  return data;
+}
+
+void ParallelGzipDeviceTester::initTestCase()
+{
+  m_tempDir = new KTempDir();
+}
+
+void ParallelGzipDeviceTester::cleanupTestCase()
+{
+  delete m_tempDir;
+}
+
+void ParallelGzipDeviceTester::test_blocks()
+{
+  // Several blocks and a last one that isn't full, written in pieces that
+  // don't fit the blocks, so some of them span two
+  const QString fileName = m_tempDir->name() + "blocks.gz";
+  const QByteArray data = testData( 3 * blockSize + 12345 );
+  QVERIFY( writeGzip( fileName, data, 100003 ) );
+
+  QByteArray zlibData;
+  QVERIFY( readWithZlib( fileName, &zlibData ) );
+  QCOMPARE( zlibData.size(), data.size() );
+  QVERIFY( zlibData == data );
+
+  const QByteArray filterData = readWithFilterDev( fileName );
+  QCOMPARE( filterData.size(), data.size() );
+  QVERIFY( filterData == data );
+}
+
+void ParallelGzipDeviceTester::test_emptyFinalBlock()
+{
+  // All blocks are full, in one write, so closing compresses an empty block
+  const QString fileName = m_tempDir->name() + "fullblocks.gz";
+  const QByteArray data = testData( 2 * blockSize );
+  QVERIFY( writeGzip( fileName, data, data.size() ) );
+
+  QByteArray zlibData;
+  QVERIFY( readWithZlib( fileName, &zlibData ) );
+  QCOMPARE( zlibData.size(), data.size() );
+  QVERIFY( zlibData == data );
+
+  QVERIFY( readWithFilterDev( fileName ) == data );
+}
+
+void ParallelGzipDeviceTester::test_empty()
+{
+  const QString fileName = m_tempDir->name() + "empty.gz";
+  QVERIFY( writeGzip( fileName, QByteArray(), 1 ) );
+
+  QByteArray zlibData;
+  QVERIFY( readWithZlib( fileName, &zlibData ) );
+  QVERIFY( zlibData.isEmpty() );
+}
+
+void ParallelGzipDeviceTester::test_tar()
+{
+  // Written the way BackupJob writes .tar.gz archives
+  const QString fileName = m_tempDir->name() + "archive.tar.gz";
+  const QByteArray big = testData( blockSize + 1000 );
+  const QByteArray small = testData( 4000 );
+  {
+    ParallelGzipDevice device( fileName );
+    KTar tar( &device );
+    QVERIFY( tar.open( QIODevice::WriteOnly ) );
+    QVERIFY( tar.writeFile( "inbox/cur/1", "user", "group", small.constData(), small.size() ) );
+    QVERIFY( tar.writeFile( "inbox/cur/2", "user", "group", big.constData(), big.size() ) );
+    QVERIFY( tar.writeFile( "inbox/cur/3", "user", "group", "", 0 ) );
+    QVERIFY( tar.close() );
+    QVERIFY( !device.hasError() );
+  }
+
+  // and read the way ImportJob reads them
+  KTar tar( fileName );
+  QVERIFY( tar.open( QIODevice::ReadOnly ) );
+  const KArchiveDirectory *dir = tar.directory();
+  const KArchiveEntry *entry = dir->entry( "inbox/cur/1" );
+  QVERIFY( entry && entry->isFile() );
+  QVERIFY( static_cast<const KArchiveFile*>( entry )->data() == small );
+  entry = dir->entry( "inbox/cur/2" );
+  QVERIFY( entry && entry->isFile() );
+  QVERIFY( static_cast<const KArchiveFile*>( entry )->data() == big );
+  entry = dir->entry( "inbox/cur/3" );
+  QVERIFY( entry && entry->isFile() );
+  QCOMPARE( static_cast<const KArchiveFile*>( entry )->size(), (qint64)0 );
+  QVERIFY( tar.close() );
+}
@@ -28,6 +28,7 @@
 #include "knnntpaccount.h"
 #include "headerview.h"
 #include "settings.h"
+#include "utils/hdrcache.h"
 #include "utils/locale.h"
 
 #include <kconfig.h>
@@ -36,12 +37,58 @@
 
 #include <QTextStream>
 #include <QByteArray>
+#include <QBuffer>
 
 
 using namespace KNode::Utilities;
 #define SORT_DEPTH 5
 
 
+/** Sets the headers of @p art which are kept in the static data. */
+static void setStaticData( KNRemoteArticle *art, const StaticEntry &entry )
+{
+  art->messageID()->from7BitString( entry.messageId );
+  art->subject()->from7BitString( entry.subject );
+
+  KMime::Types::Mailbox mbox;
+  mbox.setAddress( entry.fromAddress );
+  if ( !entry.fromName.isEmpty() )
+    mbox.setNameFrom7Bit( entry.fromName );
+  art->from()->addAddress( mbox );
+
+  if ( !entry.references.isEmpty() )
+    art->references()->from7BitString( entry.references );
+
+  art->setId( entry.id );
+  art->lines()->setNumberOfLines( entry.lines );
+  KDateTime dt;
+  dt.setTime_t( entry.timeT );
+  art->date()->setDateTime( dt );
+  art->setArticleNumber( entry.articleNumber );
+
+  const QByteArray &optionalHeaders = entry.optionalHeaders;
+  int start = 0;
+  while ( start < optionalHeaders.size() ) {
+    int end = optionalHeaders.indexOf( '\n', start );
+    if ( end < 0 )
+      end = optionalHeaders.size();
+    const QByteArray line = optionalHeaders.mid( start, end - start );
+    start = end + 1;
+    int pos = line.indexOf( ':' );
+    QByteArray hdrName = line.left( pos );
+    // skip headers we already set above and which we actually never should
+    // find here, but however it still happens... (eg. #101355)
+    if ( hdrName == "Subject" || hdrName == "From" || hdrName == "Date"
+        || hdrName == "Message-ID" || hdrName == "References"
+        || hdrName == "Bytes" || hdrName == "Lines" )
+      continue;
+    QByteArray hdrValue = line.right( line.length() - (pos + 2) );
+    if ( hdrValue.length() > 0 )
+      art->setHeader( new KMime::Headers::Generic( hdrName, art, hdrValue ) );
+  }
+}
+
+
 KNGroup::KNGroup(KNCollection *p)
   : KNArticleCollection(p), n_ewCount(0), l_astFetchCount(0), r_eadCount(0), i_gnoreCount(0),
     f_irstNr(0), l_astNr(0), m_axFetch(0), d_ynDataFormat(1), f_irstNew(-1), l_ocked(false),
@@ -194,19 +241,30 @@ bool KNGroup::loadHdrs()
   }
 
   kDebug(5003) <<"KNGroup::loadHdrs() : loading headers";
-  QByteArray buffer, hdrValue;
+  QByteArray buffer;
   QFile f;
-  int cnt=0, id, lines, fileFormatVersion, artNumber;
-  unsigned int timeT;
+  int cnt=0;
   KNRemoteArticle *art;
 
   QString dir(path());
   if (dir.isNull())
     return false;
 
-  f.setFileName(dir+g_roupname+".static");
-
-  if(f.open(QIODevice::ReadOnly)) {
+  if ( loadHdrCache( dir ) ) {
+    cnt = length();
+  } else {
+    f.setFileName(dir+g_roupname+".static");
+    // the static data of the articles read, for the header cache
+    QByteArray cacheRecords;
+    StaticEntry entry;
+    StaticFileState staticFile;
+    HdrCache::stat( f.fileName(), staticFile );
+
+    if(!f.open(QIODevice::ReadOnly)) {
+      clear();
+      return false;
+    }
+    const qint64 staticEnd = f.size();
 
     if(!resize(c_ount)) {
       f.close();
@@ -226,68 +284,13 @@ bool KNGroup::loadHdrs()
         }
       }
 
-      QList<QByteArray> splits = buffer.split( '\t' );
-      if ( splits.size() < 4 ) {
+      if ( !HdrCache::readStaticEntry( buffer, f, entry ) ) {
         kWarning(5003) <<"Found broken line in static-file: Ignored!";
         continue;
       }
-      QList<QByteArray>::ConstIterator it = splits.constBegin();
 
       art = new KNRemoteArticle( this );
-
-      art->messageID()->from7BitString( *it );
-      ++it;
-
-      art->subject()->from7BitString( *it );
-      ++it;
-
-      KMime::Types::Mailbox mbox;
-      mbox.setAddress( *it );
-      ++it;
-
-      if ( (*it) != "0\n" ) // last item has the line ending
-        mbox.setNameFrom7Bit( (*it).trimmed() );
-      art->from()->addAddress( mbox );
-
-      buffer = f.readLine().trimmed();
-      if ( buffer != "0" )
-        art->references()->from7BitString( buffer );
-
-      buffer = f.readLine();
-      if ( sscanf( buffer, "%d %d %u %d", &id, &lines, &timeT, &fileFormatVersion) < 4 )
-        fileFormatVersion = 0;          // KNode <= 0.4 had no version number
-      art->setId(id);
-      art->lines()->setNumberOfLines(lines);
-      KDateTime dt;
-      dt.setTime_t( timeT );
-      art->date()->setDateTime( dt );
-
-      if ( fileFormatVersion > 0 ) {
-        buffer = f.readLine();
-        sscanf( buffer, "%d", &artNumber );
-        art->setArticleNumber(artNumber);
-      }
-
-      // optional headers
-      if ( fileFormatVersion > 1 ) {
-        // first line is the number of addiotion headers
-        buffer = f.readLine().trimmed();
-        // following lines contain one header per line
-        for ( uint i = buffer.toUInt(); i > 0; --i ) {
-          buffer = f.readLine().trimmed();
-          int pos = buffer.indexOf( ':' );
-          QByteArray hdrName = buffer.left( pos );
-          // skip headers we already set above and which we actually never should
-          // find here, but however it still happens... (eg. #101355)
-          if ( hdrName == "Subject" || hdrName == "From" || hdrName == "Date"
-              || hdrName == "Message-ID" || hdrName == "References"
-              || hdrName == "Bytes" || hdrName == "Lines" )
-            continue;
-          hdrValue = buffer.right( buffer.length() - (pos + 2) );
-          if ( hdrValue.length() > 0 )
-            art->setHeader( new KMime::Headers::Generic( hdrName, art, hdrValue ) );
-        }
-      }
+      setStaticData( art, entry );
 
       if(append(art)) cnt++;
       else {
@@ -295,14 +298,16 @@ bool KNGroup::loadHdrs()
         clear();
         return false;
       }
+
+      HdrCache::appendRecord( cacheRecords, entry );
     }
 
     setLastID();
     f.close();
-  }
-  else {
-    clear();
-    return false;
+
+    // unless the static file changed while it was read
+    if ( staticFile.size == staticEnd )
+      HdrCache::save( dir + g_roupname + ".hdrcache", staticFile, cacheRecords );
   }
 
 
@@ -384,6 +389,40 @@ bool KNGroup::loadHdrs()
 }
 
 
+bool KNGroup::loadHdrCache( const QString &dir )
+{
+  StaticFileState staticFile;
+  if ( !HdrCache::stat( dir + g_roupname + ".static", staticFile ) )
+    return false;
+  HdrCache cache( dir + g_roupname + ".hdrcache" );
+  if ( !cache.open( staticFile ) ) {
+    kDebug(5003) << "header cache of" << g_roupname << "is missing or out of date";
+    return false;
+  }
+
+  if ( !resize( c_ount ) )
+    return false;
+
+  StaticEntry entry;
+  while ( !cache.atEnd() ) {
+    if ( !cache.next( entry ) ) {
+      kWarning(5003) << "Corrupted header cache of" << g_roupname;
+      clear();
+      return false;
+    }
+    KNRemoteArticle *art = new KNRemoteArticle( this );
+    setStaticData( art, entry );
+    if ( !append( art ) ) {
+      clear();
+      return false;
+    }
+  }
+
+  setLastID();
+  return true;
+}
+
+
 bool KNGroup::unloadHdrs(bool force)
 {
   if(l_ockedArticles>0)
@@ -556,14 +595,21 @@ int KNGroup::saveStaticData(int cnt,bool ovr)
     return 0;
 
   QFile f(dir+g_roupname+".static");
+  // the static file the header cache was written for
+  StaticFileState oldStaticFile;
+  HdrCache::stat( f.fileName(), oldStaticFile );
 
   QIODevice::OpenMode mode;
   if(ovr) mode=QIODevice::WriteOnly;
   else mode=QIODevice::WriteOnly | QIODevice::Append;
 
   if(f.open(mode)) {
+    // where the new articles start in the static file
+    const qint64 oldStaticEnd = f.size();
 
-    QTextStream ts(&f);
+    // the articles are written in one go, and read back into the header cache
+    QByteArray data;
+    QTextStream ts( &data, QIODevice::WriteOnly );
     ts.setCodec( "ISO 8859-1" );
 
     for(idx=length()-cnt; idx<length(); ++idx) {
@@ -610,7 +656,34 @@ int KNGroup::saveStaticData(int cnt,bool ovr)
       savedCnt++;
     }
 
+    ts.flush();
+    if ( f.write( data ) != data.size() ) {
+      kWarning(5003) << "Cannot write the static data of" << g_roupname;
+      f.close();
+      return savedCnt;
+    }
     f.close();
+
+    QByteArray cacheRecords;
+    StaticEntry entry;
+    QBuffer written( &data );
+    written.open( QIODevice::ReadOnly );
+    while ( !written.atEnd() ) {
+      if ( HdrCache::readStaticEntry( written.readLine(), written, entry ) )
+        HdrCache::appendRecord( cacheRecords, entry );
+    }
+    // The cache is left out of date if someone else wrote to the static
+    // file as well
+    const QString cacheFile = dir + g_roupname + ".hdrcache";
+    StaticFileState staticFile;
+    HdrCache::stat( f.fileName(), staticFile );
+    if ( ovr ) {
+      if ( staticFile.size == data.size() )
+        HdrCache::save( cacheFile, staticFile, cacheRecords );
+    } else if ( oldStaticFile.size == oldStaticEnd &&
+                staticFile.size == oldStaticEnd + data.size() ) {
+      HdrCache::append( cacheFile, oldStaticFile, staticFile, cacheRecords );
+    }
   }
 
   return savedCnt;
@@ -182,6 +182,12 @@ class KNGroup : public KNArticleCollection , public KNJobItem  {
     void buildThreads(int cnt, KNJobData *parent=0);
     KNRemoteArticle* findReference(KNRemoteArticle *a);
 
+    /** Loads the headers from the header cache, a binary copy of the static
+     *  data which is mapped into memory instead of parsed.
+     *  Returns false if the cache is missing or out of date.
+     */
+    bool loadHdrCache( const QString &dir );
+
     int       n_ewCount,
               l_astFetchCount,
               r_eadCount,
@@ -483,6 +483,7 @@ bool KNGroupManager::unsubscribeGroup(KNGroup *g)
       Q_FOREACH( const QFileInfo &it, list ) {
         if ( it.fileName() == g->groupname()+".dynamic" ||
              it.fileName() == g->groupname()+".static" ||
+             it.fileName() == g->groupname()+".hdrcache" ||
              it.fileName() == g->groupname()+".grpinfo" )
           dir.remove( it.fileName() );
       }
@@ -0,0 +1,205 @@
+/*
+    KNode, the KDE newsreader
+    Copyright (c) 1999-2006 the KNode authors.
+    See file AUTHORS for details
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, US
+*/
+
+#include "hdrcachetest.h"
+
+#include <utils/hdrcache.h>
+using namespace KNode::Utilities;
+
+#include <qtest_kde.h>
+#include <KTempDir>
+
+#include <QBuffer>
+#include <QFile>
+#include <QTest>
+
+#include <stdio.h>
+#include <utime.h>
+
+
+/** The static data of article @p id, as KNGroup::saveStaticData() writes it. */
+static QByteArray staticArticle( int id )
+{
+  const QByteArray n = QByteArray::number( id );
+  QByteArray data = '<' + n + "@example.org>\tSubject " + n + "\tuser" + n + "@example.org\t";
+  // every other article has a name and references
+  if ( id % 2 )
+    data += "=?UTF-8?Q?J=C3=B6rg?=\n<" + QByteArray::number( id - 1 ) + "@example.org>\n";
+  else
+    data += "0\n0\n";
+  data += n + " 10 1234567890 2\n" + QByteArray::number( 100 + id ) + '\n';
+  data += "1\nX-Newsreader: test\n";
+  return data;
+}
+
+/** The header cache records of the articles in the static @p data. */
+static QByteArray cacheRecords( QByteArray data )
+{
+  QByteArray records;
+  StaticEntry entry;
+  QBuffer buffer( &data );
+  buffer.open( QIODevice::ReadOnly );
+  while ( !buffer.atEnd() ) {
+    if ( HdrCache::readStaticEntry( buffer.readLine(), buffer, entry ) )
+      HdrCache::appendRecord( records, entry );
+  }
+  return records;
+}
+
+static void writeFile( const QString &fileName, const QByteArray &data, QIODevice::OpenMode mode )
+{
+  QFile f( fileName );
+  QVERIFY( f.open( mode ) );
+  QCOMPARE( f.write( data ), (qint64)data.size() );
+  f.close();
+}
+
+/** Sets the modification time of @p fileName to @p time. */
+static void setModified( const QString &fileName, qint64 time )
+{
+  struct utimbuf times;
+  times.actime = time;
+  times.modtime = time;
+  QCOMPARE( utime( QFile::encodeName( fileName ), &times ), 0 );
+}
+
+/** Checks that the cache holds articles 1 to @p count. */
+static void verifyCache( const QString &cacheFile, const StaticFileState &staticFile, int count )
+{
+  HdrCache cache( cacheFile );
+  QVERIFY( cache.open( staticFile ) );
+  StaticEntry entry;
+  for ( int id = 1; id <= count; ++id ) {
+    QVERIFY( !cache.atEnd() );
+    QVERIFY( cache.next( entry ) );
+    const QByteArray n = QByteArray::number( id );
+    QCOMPARE( entry.messageId, '<' + n + "@example.org>" );
+    QCOMPARE( entry.subject, "Subject " + n );
+    QCOMPARE( entry.fromAddress, "user" + n + "@example.org" );
+    if ( id % 2 ) {
+      QCOMPARE( entry.fromName, QByteArray( "=?UTF-8?Q?J=C3=B6rg?=" ) );
+      QCOMPARE( entry.references, '<' + QByteArray::number( id - 1 ) + "@example.org>" );
+    } else {
+      QVERIFY( entry.fromName.isEmpty() );
+      QVERIFY( entry.references.isEmpty() );
+    }
+    QCOMPARE( entry.id, id );
+    QCOMPARE( entry.lines, 10 );
+    QCOMPARE( entry.timeT, 1234567890u );
+    QCOMPARE( entry.articleNumber, 100 + id );
+    QCOMPARE( entry.optionalHeaders, QByteArray( "X-Newsreader: test\n" ) );
+  }
+  QVERIFY( cache.atEnd() );
+}
+
+
+void HdrCacheTest::init()
+{
+  mTempDir = new KTempDir();
+  mStaticFile = mTempDir->name() + "group.static";
+  mCacheFile = mTempDir->name() + "group.hdrcache";
+}
+
+void HdrCacheTest::cleanup()
+{
+  delete mTempDir;
+}
+
+void HdrCacheTest::testRoundTrip()
+{
+  const QByteArray data = staticArticle( 1 ) + staticArticle( 2 );
+  writeFile( mStaticFile, data, QIODevice::WriteOnly );
+  StaticFileState staticFile;
+  QVERIFY( HdrCache::stat( mStaticFile, staticFile ) );
+  QCOMPARE( staticFile.size, (qint64)data.size() );
+
+  QVERIFY( HdrCache::save( mCacheFile, staticFile, cacheRecords( data ) ) );
+  verifyCache( mCacheFile, staticFile, 2 );
+}
+
+void HdrCacheTest::testAppend()
+{
+  // a new group has neither a static file nor a cache
+  StaticFileState oldStaticFile;
+  QVERIFY( !HdrCache::stat( mStaticFile, oldStaticFile ) );
+  QByteArray data = staticArticle( 1 ) + staticArticle( 2 );
+  writeFile( mStaticFile, data, QIODevice::WriteOnly );
+  StaticFileState staticFile;
+  QVERIFY( HdrCache::stat( mStaticFile, staticFile ) );
+  QVERIFY( HdrCache::append( mCacheFile, oldStaticFile, staticFile, cacheRecords( data ) ) );
+  verifyCache( mCacheFile, staticFile, 2 );
+
+  // the records of articles appended to the static file are appended too
+  oldStaticFile = staticFile;
+  data = staticArticle( 3 ) + staticArticle( 4 ) + staticArticle( 5 );
+  writeFile( mStaticFile, data, QIODevice::WriteOnly | QIODevice::Append );
+  setModified( mStaticFile, oldStaticFile.modified + 1 );
+  QVERIFY( HdrCache::stat( mStaticFile, staticFile ) );
+  QVERIFY( HdrCache::append( mCacheFile, oldStaticFile, staticFile, cacheRecords( data ) ) );
+  verifyCache( mCacheFile, staticFile, 5 );
+
+  // but not to a cache written for another static file
+  data = staticArticle( 6 );
+  writeFile( mStaticFile, data, QIODevice::WriteOnly | QIODevice::Append );
+  StaticFileState newStaticFile;
+  QVERIFY( HdrCache::stat( mStaticFile, newStaticFile ) );
+  QVERIFY( !HdrCache::append( mCacheFile, oldStaticFile, newStaticFile, cacheRecords( data ) ) );
+  HdrCache cache( mCacheFile );
+  QVERIFY( !cache.open( newStaticFile ) );
+}
+
+void HdrCacheTest::testStaticFileChanged()
+{
+  const QByteArray data = staticArticle( 1 ) + staticArticle( 2 );
+  writeFile( mStaticFile, data, QIODevice::WriteOnly );
+  StaticFileState staticFile;
+  QVERIFY( HdrCache::stat( mStaticFile, staticFile ) );
+  QVERIFY( HdrCache::save( mCacheFile, staticFile, cacheRecords( data ) ) );
+
+  // rewritten in place with the same size: only the time tells
+  writeFile( mStaticFile, staticArticle( 3 ) + staticArticle( 4 ), QIODevice::WriteOnly );
+  setModified( mStaticFile, staticFile.modified + 10 );
+  StaticFileState newStaticFile;
+  QVERIFY( HdrCache::stat( mStaticFile, newStaticFile ) );
+  QCOMPARE( newStaticFile.size, staticFile.size );
+  QCOMPARE( newStaticFile.inode, staticFile.inode );
+  HdrCache cache( mCacheFile );
+  QVERIFY( !cache.open( newStaticFile ) );
+}
+
+void HdrCacheTest::testStaticFileReplaced()
+{
+  const QByteArray data = staticArticle( 1 ) + staticArticle( 2 );
+  writeFile( mStaticFile, data, QIODevice::WriteOnly );
+  StaticFileState staticFile;
+  QVERIFY( HdrCache::stat( mStaticFile, staticFile ) );
+  QVERIFY( HdrCache::save( mCacheFile, staticFile, cacheRecords( data ) ) );
+
+  // replaced by another file of the same size and time: only the inode tells
+  const QString newFile = mTempDir->name() + "group.static.new";
+  writeFile( newFile, staticArticle( 3 ) + staticArticle( 4 ), QIODevice::WriteOnly );
+  setModified( newFile, staticFile.modified );
+  QCOMPARE( ::rename( QFile::encodeName( newFile ), QFile::encodeName( mStaticFile ) ), 0 );
+  StaticFileState newStaticFile;
+  QVERIFY( HdrCache::stat( mStaticFile, newStaticFile ) );
+  QCOMPARE( newStaticFile.size, staticFile.size );
+  QCOMPARE( newStaticFile.modified, staticFile.modified );
+  HdrCache cache( mCacheFile );
+  QVERIFY( !cache.open( newStaticFile ) );
+}
+
+
+QTEST_KDEMAIN( HdrCacheTest, NoGUI )
+
+#include "hdrcachetest.moc"
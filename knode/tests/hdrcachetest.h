@@ -0,0 +1,40 @@
+/*
+    KNode, the KDE newsreader
+    Copyright (c) 1999-2006 the KNode authors.
+    See file AUTHORS for details
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, US
+*/
+
+#ifndef HDRCACHETEST_H
+#define HDRCACHETEST_H
+
+#include <QtCore/QObject>
+
+class KTempDir;
+
+class HdrCacheTest : public QObject
+{
+  Q_OBJECT
+
+  private slots:
+    void init();
+    void cleanup();
+    void testRoundTrip();
+    void testAppend();
+    void testStaticFileChanged();
+    void testStaticFileReplaced();
+
+  private:
+    KTempDir *mTempDir;
+    QString mStaticFile;
+    QString mCacheFile;
+};
+
+#endif // HDRCACHETEST_H
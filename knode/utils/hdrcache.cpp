@@ -0,0 +1,302 @@
+/*
+    KNode, the KDE newsreader
+    Copyright (c) 1999-2006 the KNode authors.
+    See file AUTHORS for details
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, US
+*/
+
+#include "hdrcache.h"
+using namespace KNode::Utilities;
+
+#include <kdebug.h>
+#include <kde_file.h>
+#include <ksavefile.h>
+
+#include <QIODevice>
+#include <QList>
+
+#include <stdio.h>
+#include <string.h>
+
+
+static const char hdrCacheMagic[4] = { 'K', 'N', 'H', 'C' };
+static const quint32 hdrCacheVersion = 3;
+
+struct HdrCacheHeader {
+  char magic[4];
+  quint32 version;
+  quint32 recordSize;
+  quint32 reserved;
+  // the static file the records mirror
+  qint64 staticSize;
+  quint64 staticInode;
+  qint64 staticModified;
+};
+
+struct HdrCacheRecord {
+  qint32 id;
+  qint32 lines;
+  qint32 articleNumber;
+  quint32 date;
+  // lengths of the strings following the record, in this order
+  quint32 messageIdLength;
+  quint32 subjectLength;
+  quint32 fromAddressLength;
+  quint32 fromNameLength;         // encoded, empty if none
+  quint32 referencesLength;       // empty if none
+  quint32 optionalHeadersLength;  // "Name: value" lines
+};
+
+
+static void initHeader( HdrCacheHeader &header, const StaticFileState &staticFile )
+{
+  memcpy( header.magic, hdrCacheMagic, sizeof( hdrCacheMagic ) );
+  header.version = hdrCacheVersion;
+  header.recordSize = sizeof( HdrCacheRecord );
+  header.reserved = 0;
+  header.staticSize = staticFile.size;
+  header.staticInode = staticFile.inode;
+  header.staticModified = staticFile.modified;
+}
+
+
+/** Returns true if @p header is that of a cache written for @p staticFile. */
+static bool headerMatches( const HdrCacheHeader &header, const StaticFileState &staticFile )
+{
+  return memcmp( header.magic, hdrCacheMagic, sizeof( hdrCacheMagic ) ) == 0 &&
+         header.version == hdrCacheVersion &&
+         header.recordSize == sizeof( HdrCacheRecord ) &&
+         header.staticSize == staticFile.size &&
+         header.staticInode == staticFile.inode &&
+         header.staticModified == staticFile.modified;
+}
+
+
+HdrCache::HdrCache( const QString &fileName )
+  : mFile( fileName ), mData( 0 ), mSize( 0 ), mPos( 0 )
+{
+}
+
+
+HdrCache::~HdrCache()
+{
+  close();
+}
+
+
+bool HdrCache::open( const StaticFileState &staticFile )
+{
+  close();
+  if ( !mFile.open( QIODevice::ReadOnly ) )
+    return false;
+
+  const qint64 size = mFile.size();
+  if ( size >= (qint64)sizeof( HdrCacheHeader ) )
+    mData = mFile.map( 0, size );
+  if ( !mData ) {
+    close();
+    return false;
+  }
+
+  HdrCacheHeader header;
+  memcpy( &header, mData, sizeof( header ) );
+  if ( !headerMatches( header, staticFile ) ) {
+    close();
+    return false;
+  }
+
+  mSize = size;
+  mPos = sizeof( header );
+  return true;
+}
+
+
+void HdrCache::close()
+{
+  if ( mData )
+    mFile.unmap( mData );
+  mFile.close();
+  mData = 0;
+  mSize = 0;
+  mPos = 0;
+}
+
+
+bool HdrCache::next( StaticEntry &entry )
+{
+  HdrCacheRecord record;
+  if ( mPos + (qint64)sizeof( record ) > mSize )
+    return false;
+  memcpy( &record, mData + mPos, sizeof( record ) );
+  const qint64 pos = mPos + sizeof( record );
+  const quint64 stringsLength = (quint64)record.messageIdLength + record.subjectLength +
+      record.fromAddressLength + record.fromNameLength + record.referencesLength +
+      record.optionalHeadersLength;
+  if ( (quint64)pos + stringsLength > (quint64)mSize )
+    return false;
+
+  const char *str = reinterpret_cast<const char*>( mData + pos );
+  entry.messageId = QByteArray( str, record.messageIdLength );
+  str += record.messageIdLength;
+  entry.subject = QByteArray( str, record.subjectLength );
+  str += record.subjectLength;
+  entry.fromAddress = QByteArray( str, record.fromAddressLength );
+  str += record.fromAddressLength;
+  entry.fromName = QByteArray( str, record.fromNameLength );
+  str += record.fromNameLength;
+  entry.references = QByteArray( str, record.referencesLength );
+  str += record.referencesLength;
+  entry.optionalHeaders = QByteArray( str, record.optionalHeadersLength );
+  entry.id = record.id;
+  entry.lines = record.lines;
+  entry.articleNumber = record.articleNumber;
+  entry.timeT = record.date;
+
+  mPos = pos + stringsLength;
+  return true;
+}
+
+
+bool HdrCache::stat( const QString &fileName, StaticFileState &state )
+{
+  KDE_struct_stat st;
+  if ( KDE_stat( QFile::encodeName( fileName ), &st ) != 0 ) {
+    state.size = 0;
+    state.inode = 0;
+    state.modified = 0;
+    return false;
+  }
+  state.size = st.st_size;
+  state.inode = st.st_ino;
+  state.modified = st.st_mtime;
+  return true;
+}
+
+
+bool HdrCache::readStaticEntry( const QByteArray &line, QIODevice &f, StaticEntry &entry )
+{
+  QList<QByteArray> splits = line.split( '\t' );
+  if ( splits.size() < 4 )
+    return false;
+
+  entry.messageId = splits[0];
+  entry.subject = splits[1];
+  entry.fromAddress = splits[2];
+  entry.fromName.clear();
+  if ( splits[3] != "0\n" ) // last item has the line ending
+    entry.fromName = splits[3].trimmed();
+
+  entry.references = f.readLine().trimmed();
+  if ( entry.references == "0" )
+    entry.references.clear();
+
+  int fileFormatVersion;
+  QByteArray buffer = f.readLine();
+  if ( sscanf( buffer, "%d %d %u %d", &entry.id, &entry.lines, &entry.timeT, &fileFormatVersion) < 4 )
+    fileFormatVersion = 0;          // KNode <= 0.4 had no version number
+
+  entry.articleNumber = -1;
+  if ( fileFormatVersion > 0 ) {
+    buffer = f.readLine();
+    sscanf( buffer, "%d", &entry.articleNumber );
+  }
+
+  // optional headers
+  entry.optionalHeaders.clear();
+  if ( fileFormatVersion > 1 ) {
+    // first line is the number of addiotion headers
+    buffer = f.readLine().trimmed();
+    // following lines contain one header per line
+    for ( uint i = buffer.toUInt(); i > 0; --i ) {
+      entry.optionalHeaders += f.readLine().trimmed();
+      entry.optionalHeaders += '\n';
+    }
+  }
+  return true;
+}
+
+
+void HdrCache::appendRecord( QByteArray &records, const StaticEntry &entry )
+{
+  HdrCacheRecord record;
+  record.id = entry.id;
+  record.lines = entry.lines;
+  record.articleNumber = entry.articleNumber;
+  record.date = entry.timeT;
+  record.messageIdLength = entry.messageId.size();
+  record.subjectLength = entry.subject.size();
+  record.fromAddressLength = entry.fromAddress.size();
+  record.fromNameLength = entry.fromName.size();
+  record.referencesLength = entry.references.size();
+  record.optionalHeadersLength = entry.optionalHeaders.size();
+  records.append( reinterpret_cast<const char*>( &record ), sizeof( record ) );
+  records += entry.messageId;
+  records += entry.subject;
+  records += entry.fromAddress;
+  records += entry.fromName;
+  records += entry.references;
+  records += entry.optionalHeaders;
+}
+
+
+bool HdrCache::save( const QString &fileName, const StaticFileState &staticFile,
+                     const QByteArray &records )
+{
+  HdrCacheHeader header;
+  initHeader( header, staticFile );
+
+  KSaveFile f( fileName );
+  if ( !f.open() ||
+       f.write( reinterpret_cast<const char*>( &header ), sizeof( header ) ) != sizeof( header ) ||
+       f.write( records ) != records.size() ) {
+    f.abort();
+    kWarning(5003) << "Cannot write the header cache" << fileName;
+    return false;
+  }
+  if ( !f.finalize() ) {
+    kWarning(5003) << "Cannot write the header cache" << fileName;
+    return false;
+  }
+  return true;
+}
+
+
+bool HdrCache::append( const QString &fileName, const StaticFileState &oldStaticFile,
+                       const StaticFileState &staticFile, const QByteArray &records )
+{
+  QFile f( fileName );
+  if ( !f.exists() ) {
+    // a new group, or one whose cache was never written
+    return oldStaticFile.size == 0 && save( fileName, staticFile, records );
+  }
+  if ( !f.open( QIODevice::ReadWrite ) )
+    return false;
+
+  HdrCacheHeader header;
+  if ( f.read( reinterpret_cast<char*>( &header ), sizeof( header ) ) != sizeof( header ) ||
+       !headerMatches( header, oldStaticFile ) ||
+       staticFile.inode != oldStaticFile.inode || staticFile.size < oldStaticFile.size ) {
+    // out of date already, it is rebuilt on the next load
+    return false;
+  }
+
+  // The records go first: if writing them fails, the header still has the
+  // old state of the static file and the cache is out of date
+  initHeader( header, staticFile );
+  if ( !f.seek( f.size() ) || f.write( records ) != records.size() || !f.flush() ||
+       !f.seek( 0 ) ||
+       f.write( reinterpret_cast<const char*>( &header ), sizeof( header ) ) != sizeof( header ) ) {
+    kWarning(5003) << "Cannot write the header cache" << fileName;
+    f.close();
+    f.remove();
+    return false;
+  }
+  return true;
+}
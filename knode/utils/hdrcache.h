@@ -0,0 +1,117 @@
+/*
+    KNode, the KDE newsreader
+    Copyright (c) 1999-2006 the KNode authors.
+    See file AUTHORS for details
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, US
+*/
+
+#ifndef KNODE_UTILITIES_HDRCACHE_H
+#define KNODE_UTILITIES_HDRCACHE_H
+
+#include "knode_export.h"
+
+#include <QByteArray>
+#include <QFile>
+
+class QIODevice;
+
+namespace KNode {
+
+namespace Utilities {
+
+/** The data of one article in the static file of a group. */
+struct StaticEntry {
+  QByteArray messageId, subject, fromAddress, fromName, references, optionalHeaders;
+  int id, lines, articleNumber;
+  uint timeT;
+};
+
+/** What identifies a version of the static file: the header cache is only
+ *  valid for the one it was written for. */
+struct StaticFileState {
+  qint64 size;
+  quint64 inode;
+  qint64 modified;  // time_t
+
+  bool operator==( const StaticFileState &other ) const
+  {
+    return size == other.size && inode == other.inode && modified == other.modified;
+  }
+};
+
+/**
+  @brief The header cache of a group (<group>.hdrcache).
+
+  It holds the same data as the static file in fixed-width records, each
+  followed by the strings it refers to, and is mapped into memory instead
+  of being parsed. Records are appended to it whenever articles are appended
+  to the static file. Its header records the size, inode and modification
+  time of the static file after each write, and it is only read while the
+  static file still has them.
+  Like the dynamic file, it is written in the native byte order.
+*/
+class KNODE_EXPORT HdrCache
+{
+  public:
+    explicit HdrCache( const QString &fileName );
+    ~HdrCache();
+
+    /**
+      Maps the cache into memory. Returns false if it is missing or was not
+      written for the static file in @p staticFile.
+    */
+    bool open( const StaticFileState &staticFile );
+    void close();
+
+    /** Returns true if all articles have been read. */
+    bool atEnd() const { return mPos >= mSize; }
+    /** Reads the next article. Returns false if the cache is corrupted. */
+    bool next( StaticEntry &entry );
+
+    /**
+      Sets @p state to that of the file @p fileName. Returns false and
+      clears @p state if the file can't be found.
+    */
+    static bool stat( const QString &fileName, StaticFileState &state );
+
+    /**
+      Reads the article starting with @p line from the static file @p f.
+      Returns false if the line is broken.
+    */
+    static bool readStaticEntry( const QByteArray &line, QIODevice &f, StaticEntry &entry );
+    /** Appends the record of @p entry to @p records. */
+    static void appendRecord( QByteArray &records, const StaticEntry &entry );
+
+    /**
+      Writes the cache @p fileName with @p records, which hold all articles
+      of the static file in @p staticFile.
+    */
+    static bool save( const QString &fileName, const StaticFileState &staticFile,
+                      const QByteArray &records );
+    /**
+      Appends @p records to the cache @p fileName, for the articles that
+      turned the static file in @p oldStaticFile into @p staticFile.
+      Returns false, and leaves a cache that is out of date, if the cache
+      was not written for @p oldStaticFile or can't be written.
+    */
+    static bool append( const QString &fileName, const StaticFileState &oldStaticFile,
+                        const StaticFileState &staticFile, const QByteArray &records );
+
+  private:
+    QFile mFile;
+    uchar *mData;
+    qint64 mSize;
+    qint64 mPos;
+};
+
+} // namespace Utilities
+} // namespace KNode
+
+#endif // KNODE_UTILITIES_HDRCACHE_H
@@ -0,0 +1,225 @@
+/*
+  This file is part of KOrganizer.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+  As a special exception, permission is given to link this program
+  with any edition of Qt, and distribute the resulting executable,
+  without including the source code for Qt in the source distribution.
+*/
+
+#include "koincidenceindex.h"
+
+#include <KCal/CalFilter>
+#include <KCal/Event>
+#include <KCal/Journal>
+#include <KCal/Recurrence>
+#include <KCal/Todo>
+
+#include <climits>
+
+using namespace KCal;
+
+KOIncidenceIndex::KOIncidenceIndex( Calendar *calendar, QObject *parent )
+  : QObject( parent ), mCalendar( calendar ), mDirty( true )
+{
+  mCalendar->registerObserver( this );
+  connect( mCalendar, SIGNAL(calendarChanged()), SLOT(calendarChanged()) );
+}
+
+KOIncidenceIndex::~KOIncidenceIndex()
+{
+  mCalendar->unregisterObserver( this );
+}
+
+Incidence::List KOIncidenceIndex::incidences( const QDate &start, const QDate &end,
+                                              const KDateTime::Spec &spec )
+{
+  if ( mDirty || spec != mSpec ) {
+    rebuild( spec );
+  }
+
+  QVector<QPair<int, Incidence *> > found = mAlwaysShown;
+  findIntervals( 0, mIntervals.count(), start.toJulianDay(), end.toJulianDay(), found );
+
+  const KDateTime first( start, QTime( 0, 0 ), spec );
+  const KDateTime last( end, QTime( 23, 59, 59, 999 ), spec );
+  foreach ( const Recurring &recurring, mRecurring ) {
+    if ( mayRecur( recurring, first, last ) ) {
+      found.append( qMakePair( recurring.ordinal, recurring.incidence ) );
+    }
+  }
+
+  qSort( found );
+
+  Incidence::List incidences;
+  CalFilter *filter = mCalendar->filter();
+  for ( int i = 0; i < found.count(); ++i ) {
+    Incidence *incidence = found[i].second;
+    if ( !filter || filter->filterIncidence( incidence ) ) {
+      incidences.append( incidence );
+    }
+  }
+  return incidences;
+}
+
+void KOIncidenceIndex::rebuild( const KDateTime::Spec &spec )
+{
+  mSpec = spec;
+  mDirty = false;
+  mIntervals.clear();
+  mRecurring.clear();
+  mAlwaysShown.clear();
+
+  const Incidence::List incidences = mCalendar->rawIncidences();
+  int ordinal = 0;
+  foreach ( Incidence *incidence, incidences ) {
+    if ( !incidence->recurs() ) {
+      addInterval( incidence, ordinal );
+    } else if ( Event *event = dynamic_cast<Event *>( incidence ) ) {
+      // Occurrences starting up to that many days before the range reach into it
+      Recurring recurring;
+      recurring.durationDays =
+        event->dtStart().toTimeSpec( spec ).daysTo( event->dtEnd().toTimeSpec( spec ) );
+      recurring.ordinal = ordinal;
+      recurring.incidence = incidence;
+      mRecurring.append( recurring );
+    } else {
+      // Overdue to-dos show up today, whatever their recurrence
+      mAlwaysShown.append( qMakePair( ordinal, incidence ) );
+    }
+    ++ordinal;
+  }
+
+  qSort( mIntervals );
+  buildMaxEnd( 0, mIntervals.count() );
+}
+
+void KOIncidenceIndex::addInterval( Incidence *incidence, int ordinal )
+{
+  Interval interval;
+  interval.ordinal = ordinal;
+  interval.incidence = incidence;
+
+  if ( Todo *todo = dynamic_cast<Todo *>( incidence ) ) {
+    if ( !todo->hasDueDate() ) {
+      return;
+    }
+    const int due = todo->dtDue().toTimeSpec( mSpec ).date().toJulianDay();
+    // A to-do due at midnight is drawn on the day before; one which isn't
+    // completed shows up today once it is overdue
+    interval.start = due - 1;
+    interval.end = todo->isCompleted() ? due : INT_MAX;
+  } else {
+    const KDateTime start = incidence->dtStart().toTimeSpec( mSpec );
+    if ( !start.isValid() ) {
+      return;
+    }
+    interval.start = start.date().toJulianDay();
+    interval.end = interval.start;
+    if ( Event *event = dynamic_cast<Event *>( incidence ) ) {
+      const KDateTime end = event->dtEnd().toTimeSpec( mSpec );
+      if ( end.isValid() ) {
+        interval.end = qMax( interval.start, end.date().toJulianDay() );
+      }
+    }
+  }
+
+  mIntervals.append( interval );
+}
+
+int KOIncidenceIndex::buildMaxEnd( int begin, int end )
+{
+  if ( begin >= end ) {
+    return INT_MIN;
+  }
+  const int middle = ( begin + end ) / 2;
+  Interval &interval = mIntervals[middle];
+  interval.maxEnd = qMax( interval.end,
+                          qMax( buildMaxEnd( begin, middle ), buildMaxEnd( middle + 1, end ) ) );
+  return interval.maxEnd;
+}
+
+void KOIncidenceIndex::findIntervals( int begin, int end, int first, int last,
+                                      QVector<QPair<int, Incidence *> > &found ) const
+{
+  if ( begin >= end ) {
+    return;
+  }
+  const int middle = ( begin + end ) / 2;
+  const Interval &interval = mIntervals[middle];
+  if ( interval.maxEnd < first ) {
+    return;
+  }
+
+  findIntervals( begin, middle, first, last, found );
+  // The intervals from here on start later
+  if ( interval.start > last ) {
+    return;
+  }
+  if ( interval.end >= first ) {
+    found.append( qMakePair( interval.ordinal, interval.incidence ) );
+  }
+  findIntervals( middle + 1, end, first, last, found );
+}
+
+bool KOIncidenceIndex::mayRecur( const Recurring &recurring, const KDateTime &first,
+                                 const KDateTime &last )
+{
+  const KDateTime start = first.addDays( -recurring.durationDays );
+
+  QHash<Incidence *, Gap>::const_iterator it = mGaps.constFind( recurring.incidence );
+  if ( it != mGaps.constEnd() && it->after < start ) {
+    if ( !it->next.isValid() || it->next > last ) {
+      return false;
+    }
+    if ( it->next >= start ) {
+      return true;
+    }
+  }
+
+  Gap gap;
+  gap.after = start.addSecs( -1 );
+  gap.next = recurring.incidence->recurrence()->getNextDateTime( gap.after );
+  mGaps.insert( recurring.incidence, gap );
+  return gap.next.isValid() && gap.next <= last;
+}
+
+void KOIncidenceIndex::calendarIncidenceAdded( Incidence *incidence )
+{
+  Q_UNUSED( incidence );
+  mDirty = true;
+}
+
+void KOIncidenceIndex::calendarIncidenceChanged( Incidence *incidence )
+{
+  mGaps.remove( incidence );
+  mDirty = true;
+}
+
+void KOIncidenceIndex::calendarIncidenceDeleted( Incidence *incidence )
+{
+  mGaps.remove( incidence );
+  mDirty = true;
+}
+
+void KOIncidenceIndex::calendarChanged()
+{
+  // The incidences may have been reloaded, at the same addresses
+  mGaps.clear();
+  mDirty = true;
+}
+
+#include "koincidenceindex.moc"
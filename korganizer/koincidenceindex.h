@@ -0,0 +1,115 @@
+/*
+  This file is part of KOrganizer.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+  As a special exception, permission is given to link this program
+  with any edition of Qt, and distribute the resulting executable,
+  without including the source code for Qt in the source distribution.
+*/
+#ifndef KOINCIDENCEINDEX_H
+#define KOINCIDENCEINDEX_H
+
+#include <KCal/Calendar>
+
+#include <KDateTime>
+
+#include <QHash>
+#include <QObject>
+#include <QPair>
+#include <QVector>
+
+/**
+  Finds the incidences of a calendar which may show up in a range of dates,
+  so that the agenda and month views do not have to expand the recurrences
+  of every incidence in the calendar each time they show other dates.
+
+  Non-recurring incidences are kept in an interval tree of the days they
+  cover. For each recurring incidence the index remembers a span of time
+  known to hold no occurrence, found with the last query, so that paging
+  forward through the dates it does not recur in costs nothing.
+
+  The index is rebuilt on the next query after incidences were added,
+  changed or deleted, and when the calendar reports a change of its own,
+  like a reload of its resources.
+*/
+class KOIncidenceIndex : public QObject, public KCal::Calendar::CalendarObserver
+{
+  Q_OBJECT
+  public:
+    explicit KOIncidenceIndex( KCal::Calendar *calendar, QObject *parent = 0 );
+    ~KOIncidenceIndex();
+
+    /**
+      Returns the incidences that pass the filter of the calendar and may
+      show up from @p start to @p end in the time zone @p spec, in the order
+      of KCal::Calendar::incidences(). This includes the to-dos that are
+      overdue, which are shown today, and all recurring to-dos and journals.
+      The views still have to check for the dates on which the incidences
+      show up.
+    */
+    KCal::Incidence::List incidences( const QDate &start, const QDate &end,
+                                      const KDateTime::Spec &spec );
+
+    void calendarIncidenceAdded( KCal::Incidence *incidence );
+    void calendarIncidenceChanged( KCal::Incidence *incidence );
+    void calendarIncidenceDeleted( KCal::Incidence *incidence );
+
+  private slots:
+    void calendarChanged();
+
+  private:
+    struct Interval {
+      int start;   // Julian days
+      int end;
+      int maxEnd;  // the latest end in the subtree of this node
+      int ordinal;
+      KCal::Incidence *incidence;
+
+      bool operator<( const Interval &other ) const { return start < other.start; }
+    };
+    struct Recurring {
+      int durationDays;
+      int ordinal;
+      KCal::Incidence *incidence;
+    };
+    // No occurrence of an incidence after "after" and before "next", or
+    // after "after" at all if next is invalid
+    struct Gap {
+      KDateTime after;
+      KDateTime next;
+    };
+
+    void rebuild( const KDateTime::Spec &spec );
+    void addInterval( KCal::Incidence *incidence, int ordinal );
+    int buildMaxEnd( int begin, int end );
+    void findIntervals( int begin, int end, int first, int last,
+                        QVector<QPair<int, KCal::Incidence *> > &found ) const;
+    bool mayRecur( const Recurring &recurring, const KDateTime &first,
+                   const KDateTime &last );
+
+    KCal::Calendar *mCalendar;
+    KDateTime::Spec mSpec;
+    bool mDirty;
+
+    // Sorted by start, an implicit balanced tree rooted in the middle
+    QVector<Interval> mIntervals;
+    QVector<Recurring> mRecurring;
+    // Recurring to-dos and journals, which are always returned
+    QVector<QPair<int, KCal::Incidence *> > mAlwaysShown;
+    QHash<KCal::Incidence *, Gap> mGaps;
+};
+
+#endif
@@ -33,6 +33,7 @@
 #include "kodialogmanager.h"
 #include "koeventpopupmenu.h"
 #include "koglobals.h"
+#include "koincidenceindex.h"
 #include "koprefs.h"
 #include "timelabelszone.h"
 using namespace KOrg;
@@ -115,6 +116,7 @@ KOAgendaView::KOAgendaView( Calendar *cal, QWidget *parent, bool isSideBySide )
   mResource( 0 ),
   mIsSideBySide( isSideBySide ),
   mPendingChanges( true ),
+  mIncidenceIndex( 0 ),
   mAreDatesInitialized( false )
 {
   mSelectedDates.append( QDate::currentDate() );
@@ -231,6 +233,7 @@ KOAgendaView::KOAgendaView( Calendar *cal, QWidget *parent, bool isSideBySide )
 
   if ( cal ) {
     cal->registerObserver( this );
+    mIncidenceIndex = new KOIncidenceIndex( cal, this );
   }
 }
 
@@ -1306,7 +1309,10 @@ void KOAgendaView::fillAgenda()
   mAgenda->setDateList( mSelectedDates );
 
   bool somethingReselected = false;
-  Incidence::List incidences = calendar()->incidences();
+  // Only what may show up in the selected dates, not the whole calendar
+  Incidence::List incidences =
+    mIncidenceIndex->incidences( mSelectedDates.first(), mSelectedDates.last(),
+                                 KOPrefs::instance()->timeSpec() );
 
   foreach ( Incidence *incidence, incidences ) {
     displayIncidence( incidence );
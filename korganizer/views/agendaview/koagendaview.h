@@ -42,6 +42,7 @@ class TimeLabelsZone;
 class KOAgenda;
 class KOAgendaItem;
 class KOAgendaView;
+class KOIncidenceIndex;
 
 class KConfig;
 class KHBox;
@@ -298,6 +299,8 @@ class KOAgendaView : public KOrg::AgendaView, public KCal::Calendar::CalendarObs
     bool mIsSideBySide;
     bool mPendingChanges;
 
+    KOIncidenceIndex *mIncidenceIndex;
+
     // the current date is inserted into mSelectedDates in the constructor
     // however whe should only show events when setDates is called, otherwise
     // we see day view with current date for a few milisecs, then we see something else
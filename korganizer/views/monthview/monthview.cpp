@@ -27,6 +27,7 @@
 #include "monthitem.h"
 #include "monthgraphicsitems.h"
 #include "koglobals.h"
+#include "koincidenceindex.h"
 #include "koprefs.h"
 #include "koeventpopupmenu.h"
 
@@ -44,7 +45,7 @@
 using namespace KOrg;
 
 MonthView::MonthView( Calendar *calendar, QWidget *parent )
-  : KOEventView( calendar, parent )
+  : KOEventView( calendar, parent ), mIncidenceIndex( 0 )
 {
   QHBoxLayout *topLayout = new QHBoxLayout( this );
 
@@ -98,6 +99,10 @@ MonthView::MonthView( Calendar *calendar, QWidget *parent )
 
   mViewPopup = eventPopup();
 
+  if ( calendar ) {
+    mIncidenceIndex = new KOIncidenceIndex( calendar, this );
+  }
+
   connect( mScene, SIGNAL(showIncidencePopupSignal(Calendar *,Incidence *,const QDate &)),
            mViewPopup, SLOT(showIncidencePopup(Calendar *,Incidence *,const QDate &)) );
 
@@ -345,7 +350,10 @@ void MonthView::reloadIncidences()
 
   // build global event list
   KDateTime::Spec timeSpec = KOPrefs::instance()->timeSpec();
-  Incidence::List incidences = calendar()->incidences();
+  Incidence::List incidences;
+  if ( mIncidenceIndex ) {
+    incidences = mIncidenceIndex->incidences( mStartDate, mEndDate, timeSpec );
+  }
 
   foreach ( Incidence *incidence, incidences ) {
     if ( incidence->type() == "Todo" && !KOPrefs::instance()->showTodosMonthView() ) {
@@ -28,6 +28,7 @@
 #include "koeventview.h"
 
 class KOEventPopupMenu;
+class KOIncidenceIndex;
 
 class QWheelEvent;
 class QKeyEvent;
@@ -118,6 +119,8 @@ class MonthView : public KOEventView
 
     KOEventPopupMenu *mViewPopup;
 
+    KOIncidenceIndex *mIncidenceIndex;
+
     friend class MonthScene;
     friend class MonthGraphicsView;
 };
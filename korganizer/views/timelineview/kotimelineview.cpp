@@ -25,6 +25,7 @@
 #include "kotimelineview.h"
 #include "koeventpopupmenu.h"
 #include "koglobals.h"
+#include "koincidenceindex.h"
 #include "koprefs.h"
 #include "timelineitem.h"
 
@@ -32,6 +33,7 @@
 #include <kdgantt1/KDGanttViewSubwidgets.h>
 
 #include <kcal/calendar.h>
+#include <kcal/calfilter.h>
 #include <kcal/calendarresources.h>
 
 #include <QLayout>
@@ -39,8 +41,29 @@
 using namespace KOrg;
 using namespace KCal;
 
+// Whether the event shows up on the day, like in Calendar::events( day )
+static bool occursOnDay( Event *event, const QDate &day, const KDateTime::Spec &timeSpec )
+{
+  const QDate startDate = event->dtStart().toTimeSpec( timeSpec ).date();
+  const QDate endDate = event->dtEnd().toTimeSpec( timeSpec ).date();
+  const bool multiDay = event->isMultiDay( timeSpec );
+  if ( event->recurs() ) {
+    const int extraDays = multiDay ? startDate.daysTo( endDate ) : 0;
+    for ( int i = 0; i <= extraDays; ++i ) {
+      if ( event->recursOn( day.addDays( -i ), timeSpec ) ) {
+        return true;
+      }
+    }
+    return false;
+  }
+  if ( multiDay ) {
+    return startDate <= day && day <= endDate;
+  }
+  return startDate == day;
+}
+
 KOTimelineView::KOTimelineView( Calendar *calendar, QWidget *parent )
-  : KOEventView( calendar, parent ), mEventPopup( 0 )
+  : KOEventView( calendar, parent ), mEventPopup( 0 ), mIncidenceIndex( 0 )
 {
     QVBoxLayout *vbox = new QVBoxLayout( this );
     mGantt = new KDGanttView( this );
@@ -70,6 +93,10 @@ KOTimelineView::KOTimelineView( Calendar *calendar, QWidget *parent )
              SLOT(overscale(KDGanttView::Scale)) );
     connect( mGantt, SIGNAL(dateTimeDoubleClicked(const QDateTime &)),
              SLOT(newEventWithHint(const QDateTime &)) );
+
+    if ( calendar ) {
+      mIncidenceIndex = new KOIncidenceIndex( calendar, this );
+    }
 }
 
 KOTimelineView::~KOTimelineView()
@@ -153,13 +180,25 @@ void KOTimelineView::showDates( const QDate &start, const QDate &end )
     }
   }
 
-  // add incidences
+  // add incidences, looking only at the events which may show up in the
+  // shown dates instead of asking the calendar for the events of each day
   Event::List events;
   KDateTime::Spec timeSpec = KOPrefs::instance()->timeSpec();
+  if ( mIncidenceIndex ) {
+    const Incidence::List incidences = mIncidenceIndex->incidences( start, end, timeSpec );
+    foreach ( Incidence *incidence, incidences ) {
+      Event *event = dynamic_cast<Event *>( incidence );
+      if ( event ) {
+        events.append( event );
+      }
+    }
+    events = Calendar::sortEvents( &events, EventSortStartDate, SortDirectionAscending );
+  }
   for ( QDate day = start; day <= end; day = day.addDays( 1 ) ) {
-    events = calendar()->events( day, timeSpec, EventSortStartDate, SortDirectionAscending );
     for ( Event::List::ConstIterator it = events.constBegin(); it != events.constEnd(); ++it ) {
-      insertIncidence( *it, day );
+      if ( occursOnDay( *it, day, timeSpec ) ) {
+        insertIncidence( *it, day );
+      }
     }
   }
 
@@ -307,14 +346,15 @@ void KOTimelineView::insertIncidence( KCal::Incidence *incidence )
     insertIncidence( incidence, QDate() );
   }
 
+  CalFilter *filter = calendar()->filter();
+  if ( filter && !filter->filterIncidence( event ) ) {
+    return;
+  }
+
   KDateTime::Spec timeSpec = KOPrefs::instance()->timeSpec();
   for ( QDate day = mStartDate; day <= mEndDate; day = day.addDays( 1 ) ) {
-    Event::List events = calendar()->events(
-      day, timeSpec, EventSortStartDate, SortDirectionAscending );
-    for ( Event::List::ConstIterator it = events.constBegin(); it != events.constEnd(); ++it ) {
-      if ( events.contains( event ) ) {
-        insertIncidence( *it, day );
-      }
+    if ( occursOnDay( event, day, timeSpec ) ) {
+      insertIncidence( event, day );
     }
   }
 }
@@ -31,6 +31,7 @@
 #include <QMap>
 
 class KDGanttViewItem;
+class KOIncidenceIndex;
 
 namespace KCal {
   class ResourceCalendar;
@@ -83,6 +84,7 @@ class KOTimelineView : public KOEventView
     KOEventPopupMenu *mEventPopup;
     QDate mStartDate, mEndDate;
     QDateTime mHintDate;
+    KOIncidenceIndex *mIncidenceIndex;
 
 };
 
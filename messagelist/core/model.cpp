@@ -52,6 +52,8 @@
 #include "core/delegate.h"
 #include "core/manager.h"
 #include "core/messageitemsetmanager.h"
+#include "core/threadingprepass_p.h"
+#include "core/threadingcache_p.h"
 
 #include <messagecore/messagestatus.h>
 
@@ -149,6 +151,11 @@ K_GLOBAL_STATIC( QTimer, _k_heartBeatTimer )
  *
  * That's why we in fact have Pass1Fill, Pass1Cleanup, Pass1Update, Pass2, Pass3, Pass4 and Pass5 below.
  * Pass1Fill, Pass1Cleanup and Pass1Update are exclusive and all of them proceed with Pass2 when finished.
+ *
+ * A large "View Fill" job does the threading cache work of Pass1Fill and Pass2 in a worker
+ * thread (see ThreadingPrepass). Its Pass1Fill first reads all the rows and creates the
+ * MessageItem objects, then waits for the worker and finally attaches the messages
+ * to the tree with the parents found by the worker.
  */
 class ViewItemJob
 {
@@ -170,6 +177,8 @@ private:
   int mCurrentIndex;      ///< The current index (in the underlying storage) of this job
   int mEndIndex;          ///< The last index (in the underlying storage) of this job
 
+  ThreadingPrepass * mThreadingPrepass; ///< Owned, 0 if the threading caches are handled directly by Pass1Fill and Pass2
+
   // Data for "View Cleanup" jobs
   QList< ModelInvariantIndex * > * mInvariantIndexList; ///< Owned list of shallow pointers
 
@@ -206,7 +215,7 @@ public:
    */
   ViewItemJob( int startIndex, int endIndex, int chunkTimeout, int idleInterval, int messageCheckCount, bool disconnectUI = false )
     : mStartIndex( startIndex ), mCurrentIndex( startIndex ), mEndIndex( endIndex ),
-      mInvariantIndexList( 0 ),
+      mThreadingPrepass( 0 ), mInvariantIndexList( 0 ),
       mChunkTimeout( chunkTimeout ), mIdleInterval( idleInterval ),
       mMessageCheckCount( messageCheckCount ), mCurrentPass( Pass1Fill ),
       mDisconnectUI( disconnectUI ) {};
@@ -216,13 +225,14 @@ public:
    */
   ViewItemJob( Pass pass, QList< ModelInvariantIndex * > * invariantIndexList, int chunkTimeout, int idleInterval, int messageCheckCount )
     : mStartIndex( 0 ), mCurrentIndex( 0 ), mEndIndex( invariantIndexList->count() - 1 ),
-      mInvariantIndexList( invariantIndexList ),
+      mThreadingPrepass( 0 ), mInvariantIndexList( invariantIndexList ),
       mChunkTimeout( chunkTimeout ), mIdleInterval( idleInterval ),
       mMessageCheckCount( messageCheckCount ), mCurrentPass( pass ),
       mDisconnectUI( false ) {};
 
   ~ViewItemJob()
   {
+    delete mThreadingPrepass;
     delete mInvariantIndexList;
   }
 public:
@@ -248,6 +258,10 @@ public:
     { return mChunkTimeout; };
   int messageCheckCount() const
     { return mMessageCheckCount; };
+  ThreadingPrepass * threadingPrepass() const
+    { return mThreadingPrepass; };
+  void setThreadingPrepass( ThreadingPrepass * prepass )
+    { mThreadingPrepass = prepass; };
   QList< ModelInvariantIndex * > * invariantIndexList() const
     { return mInvariantIndexList; };
   bool disconnectUI() const
@@ -275,6 +289,9 @@ Model::Model( View *pParent )
   d->mUniqueIdOfLastSelectedMessageInFolder = 0;
   d->mLastSelectedMessageInFolder = 0;
   d->mLoading = false;
+  d->mThreadingCache = 0;
+  d->mThreadingCacheThreading = Aggregation::NoThreading;
+  d->mThreadingCacheDirty = false;
 
   d->mRootItem = new Item( Item::InvisibleRoot );
   d->mRootItem->setViewable( 0, true );
@@ -610,6 +627,9 @@ void Model::setStorageModel( StorageModel *storageModel, PreSelectionMode preSel
   if( d->mFillStepTimer.isActive() )
     d->mFillStepTimer.stop();
 
+  // Save the threading of the previous folder while we still have it
+  d->saveThreadingCache();
+
   // Kill pre-selection at this stage
   d->mPreSelectionMode = PreSelectNone;
   d->mUniqueIdOfLastSelectedMessageInFolder = 0;
@@ -627,6 +647,9 @@ void Model::setStorageModel( StorageModel *storageModel, PreSelectionMode preSel
   d->mThreadingCacheMessageIdMD5ToMessageItem.clear();
   d->mThreadingCacheMessageInReplyToIdMD5ToMessageItem.clear();
   d->clearThreadingCacheMessageSubjectMD5ToMessageItem();
+  delete d->mThreadingCache;
+  d->mThreadingCache = 0;
+  d->mThreadingCacheDirty = false;
   d->mViewItemJobStepChunkTimeout = 100;
   d->mViewItemJobStepIdleInterval = 10;
   d->mViewItemJobStepMessageCheckCount = 10;
@@ -692,9 +715,23 @@ void Model::setStorageModel( StorageModel *storageModel, PreSelectionMode preSel
   connect( d->mStorageModel, SIGNAL( headerDataChanged( Qt::Orientation, int, int ) ),
            this, SLOT( slotStorageModelHeaderDataChanged( Qt::Orientation, int, int ) ) );
 
+  d->mThreadingCacheThreading = d->mAggregation->threading();
+
   if ( d->mStorageModel->rowCount() == 0 )
     return; // folder empty: nothing to fill
 
+  // Reuse the threading data computed the last time this folder was shown
+  if ( d->mThreadingCacheThreading != Aggregation::NoThreading )
+  {
+    QString threadingCacheFileName = d->mStorageModel->threadingCacheFileName();
+    if ( !threadingCacheFileName.isEmpty() )
+    {
+      d->mThreadingCache = ThreadingCache::load( threadingCacheFileName, d->mThreadingCacheThreading );
+      if ( !d->mThreadingCache )
+        d->mThreadingCacheDirty = true; // never saved (or saved for another threading mode)
+    }
+  }
+
   // Here we use different strategies based on user preference and the folder size.
   // The knobs we can tune are:
   //
@@ -1424,8 +1461,25 @@ MessageItem * ModelPrivate::findMessageParent( MessageItem * mi )
 {
   Q_ASSERT( mAggregation->threading() != Aggregation::NoThreading ); // caller must take care of this
 
+  MessageItem * perfectParent = 0;
+  if ( !mi->inReplyToIdMD5().isEmpty() )
+    perfectParent = mThreadingCacheMessageIdMD5ToMessageItem.value( mi->inReplyToIdMD5(), 0 );
+
+  MessageItem * referencesParent = 0;
+  if ( !perfectParent && ( mAggregation->threading() != Aggregation::PerfectOnly ) && !mi->referencesIdMD5().isEmpty() )
+    referencesParent = mThreadingCacheMessageIdMD5ToMessageItem.value( mi->referencesIdMD5(), 0 );
+
+  return findMessageParent( mi, perfectParent, referencesParent );
+}
+
+MessageItem * ModelPrivate::findMessageParent( MessageItem * mi, MessageItem * perfectParent, MessageItem * referencesParent )
+{
+  Q_ASSERT( mAggregation->threading() != Aggregation::NoThreading ); // caller must take care of this
+
   // This function attempts to find a thread parent for the item "mi"
   // which actually may already have a children subtree.
+  // The candidate parents are the results of the lookups of the In-Reply-To
+  // and References MD5 in mThreadingCacheMessageIdMD5ToMessageItem.
 
   // Forged or plain broken message trees are dangerous here.
   // For example, a message tree with circular references like
@@ -1445,11 +1499,10 @@ MessageItem * ModelPrivate::findMessageParent( MessageItem * mi )
   // we have the ID in the "In-Reply-To" field. This is actually done by using
   // MD5 caches of the message ids because of speed. Collisions are very unlikely.
 
-  QString md5 = mi->inReplyToIdMD5();
-  if ( !md5.isEmpty() )
+  if ( !mi->inReplyToIdMD5().isEmpty() )
   {
     // have an In-Reply-To field MD5
-    pParent = mThreadingCacheMessageIdMD5ToMessageItem.value( md5, 0 );
+    pParent = perfectParent;
     if(pParent)
     {
       // Take care of circular references
@@ -1491,10 +1544,9 @@ MessageItem * ModelPrivate::findMessageParent( MessageItem * mi )
   // to last will likely be in this folder. replyToAuxIdMD5
   // contains the second to last one.
 
-  md5 = mi->referencesIdMD5();
-  if ( !md5.isEmpty() )
+  if ( !mi->referencesIdMD5().isEmpty() )
   {
-    pParent = mThreadingCacheMessageIdMD5ToMessageItem.value( md5, 0 );
+    pParent = referencesParent;
     if(pParent)
     {
       // Take care of circular references
@@ -1647,6 +1699,91 @@ void ModelPrivate::removeMessageFromSubjectBasedThreadingCache( MessageItem * mi
   }
 }
 
+void ModelPrivate::mergeIntoSubjectBasedThreadingCache( const QHash< QString, QList< MessageItem * > > &subjects )
+{
+  // The lists in subjects are sorted like the ones in the cache (see addMessageToSubjectBasedThreadingCache())
+  // so we can merge them in linear time instead of inserting the messages one by one.
+
+  MessageLessThanByDate lessThan;
+
+  for ( QHash< QString, QList< MessageItem * > >::ConstIterator it = subjects.constBegin(); it != subjects.constEnd(); ++it )
+  {
+    QList< MessageItem * > * messagesWithTheSameStrippedSubject =
+        mThreadingCacheMessageSubjectMD5ToMessageItem.value( it.key(), 0 );
+
+    if ( !messagesWithTheSameStrippedSubject )
+    {
+      // Not there yet: just take the new list.
+      mThreadingCacheMessageSubjectMD5ToMessageItem.insert( it.key(), new QList< MessageItem * >( *it ) );
+      continue;
+    }
+
+    QList< MessageItem * > merged;
+
+    QList< MessageItem * >::ConstIterator oldIt = messagesWithTheSameStrippedSubject->constBegin();
+    QList< MessageItem * >::ConstIterator oldEnd = messagesWithTheSameStrippedSubject->constEnd();
+    QList< MessageItem * >::ConstIterator newIt = it->constBegin();
+    QList< MessageItem * >::ConstIterator newEnd = it->constEnd();
+
+    while ( ( oldIt != oldEnd ) && ( newIt != newEnd ) )
+    {
+      if ( lessThan( *newIt, *oldIt ) )
+        merged.append( *newIt++ );
+      else
+        merged.append( *oldIt++ );
+    }
+    while ( oldIt != oldEnd )
+      merged.append( *oldIt++ );
+    while ( newIt != newEnd )
+      merged.append( *newIt++ );
+
+    *messagesWithTheSameStrippedSubject = merged;
+  }
+}
+
+MessageItem * ModelPrivate::findMessageParentInThreadingCache( MessageItem * mi )
+{
+  Q_ASSERT( mThreadingCache ); // caller must take care of this
+
+  MessageItem * pParent = mThreadingCache->parentOf( mi );
+  if ( !pParent )
+    return 0;
+
+  // The saved parent was valid in the tree we saved, but the messages
+  // added since then may have changed it: take care of circular references.
+  if (
+       ( mi == pParent ) ||
+       (
+         ( mi->childItemCount() > 0 ) &&
+         pParent->hasAncestor( mi )
+       )
+     )
+    return 0;
+
+  // Like a parent found by guessMessageParent(): a perfect parent that
+  // shows up later fixes it.
+  mi->setThreadingStatus( MessageItem::ImperfectParentFound );
+  return pParent;
+}
+
+void ModelPrivate::saveThreadingCache()
+{
+  if ( !mStorageModel || !mThreadingCacheDirty )
+    return;
+
+  mThreadingCacheDirty = false;
+
+  // A partially filled tree would make us forget the threading of the missing messages
+  if ( !mViewItemJobs.isEmpty() || ( mThreadingCacheThreading == Aggregation::NoThreading ) )
+    return;
+
+  QString fileName = mStorageModel->threadingCacheFileName();
+  if ( fileName.isEmpty() )
+    return;
+
+  ThreadingCache::save( fileName, mThreadingCacheThreading, mRootItem );
+}
+
 MessageItem * ModelPrivate::guessMessageParent( MessageItem * mi )
 {
   // This function implements subject based threading
@@ -2509,8 +2646,13 @@ ModelPrivate::ViewItemJobResult ModelPrivate::viewItemJobStepInternalForJobPass3
       // with the item being attacched to a group or directly to the root.
       if ( mi->subjectIsPrefixed() )
       {
+        // The parent guessed the last time the folder was shown, if any,
+        // saves guessing it again
+        MessageItem * mparent = mThreadingCache ? findMessageParentInThreadingCache( mi ) : 0;
+
         // We can try to guess it
-        MessageItem * mparent = guessMessageParent( mi );
+        if ( !mparent )
+          mparent = guessMessageParent( mi );
 
         if ( mparent )
         {
@@ -2594,6 +2736,10 @@ ModelPrivate::ViewItemJobResult ModelPrivate::viewItemJobStepInternalForJobPass2
   int curIndex = job->currentIndex();
   int endIndex = job->endIndex();
 
+  // Set if the messages appended to mUnassignedMessageListForPass2 by
+  // this job have been looked up in the caches by a worker thread
+  ThreadingPrepass * prepass = job->threadingPrepass();
+
   while ( curIndex <= endIndex )
   {
     // If we're here, then threading is requested for sure.
@@ -2603,7 +2749,17 @@ ModelPrivate::ViewItemJobResult ModelPrivate::viewItemJobStepInternalForJobPass2
     // then we attempt to (re-)thread it. Otherwise we just do nothing (the job has already been done by the previous steps).
     if ( ( !mi->parent() ) || ( mi->threadingStatus() == MessageItem::ParentMissing ) )
     {
-      MessageItem * mparent = findMessageParent( mi );
+      MessageItem * mparent;
+
+      if ( prepass && ( curIndex >= prepass->pass2Base() ) )
+      {
+        // The worker thread has already looked up the candidate parents
+        const ThreadingPrepass::Entry &entry = prepass->pass2Entry( curIndex );
+        Q_ASSERT( entry.mItem == mi );
+        mparent = findMessageParent( mi, entry.mPerfectParent, entry.mReferencesParent );
+      } else {
+        mparent = findMessageParent( mi );
+      }
 
       if ( mparent )
       {
@@ -2684,6 +2840,150 @@ ModelPrivate::ViewItemJobResult ModelPrivate::viewItemJobStepInternalForJobPass2
   return ViewItemJobCompleted;
 }
 
+void ModelPrivate::threadMessageInPass1Fill( MessageItem * mi, MessageItem * perfectParent )
+{
+  // The message has been just added to mThreadingCacheMessageIdMD5ToMessageItem
+  // and perfectParent is the result of the lookup of its In-Reply-To MD5 there.
+
+  // Check if this item is a perfect parent for some imperfectly threaded
+  // message (that is actually attacched to it, but not necessairly to the
+  // viewable root). If it is, then remove the imperfect child from its
+  // current parent rebuild the hierarchy on the fly.
+
+  bool needsImmediateReAttach = false;
+
+  if ( mThreadingCacheMessageInReplyToIdMD5ToMessageItem.count() > 0 ) // unlikely
+  {
+    QList< MessageItem * > lImperfectlyThreaded = mThreadingCacheMessageInReplyToIdMD5ToMessageItem.values( mi->messageIdMD5() );
+    if ( !lImperfectlyThreaded.isEmpty() )
+    {
+      // must move all of the items in the perfect parent
+      for ( QList< MessageItem * >::Iterator it = lImperfectlyThreaded.begin(); it != lImperfectlyThreaded.end(); ++it )
+      {
+        Q_ASSERT( ( *it )->parent() );
+        Q_ASSERT( ( *it )->parent() != mi );
+#if 1
+        Q_ASSERT( ( ( *it )->threadingStatus() == MessageItem::ImperfectParentFound ) || ( ( *it )->threadingStatus() == MessageItem::ParentMissing ) );
+#else
+        if(!(( ( *it )->threadingStatus() == MessageItem::ImperfectParentFound ) || ( ( *it )->threadingStatus() == MessageItem::ParentMissing )))
+        {
+          kDebug() << "GOT A MESSAGE " << ( *it ) << " WITH THREADING STATUS " << ( *it )->threadingStatus();
+          Q_ASSERT( false );
+        }
+#endif
+        // If the item was already attached to the view then
+        // re-attach it immediately. This will avoid a message
+        // being displayed for a short while in the view and then
+        // disappear until a perfect parent isn't found.
+        if ( ( *it )->isViewable() )
+          needsImmediateReAttach = true;
+
+        ( *it )->setThreadingStatus( MessageItem::PerfectParentFound );
+        attachMessageToParent( mi, *it );
+      }
+    }
+  }
+
+  // FIXME: Might look by "References" too, here... (?)
+
+  // Attempt to do threading with anything we already have in caches until now
+  // Note that this is likely to work since thread-parent messages tend
+  // to come before thread-children messages in the folders (simply because of
+  // date of arrival).
+
+  Item * pParent;
+
+  // First of all try to find a "perfect parent", that is the message for that
+  // we have the ID in the "In-Reply-To" field. This is actually done by using
+  // MD5 caches of the message ids because of speed. Collisions are very unlikely.
+
+  if ( !mi->inReplyToIdMD5().isEmpty() )
+  {
+    // Have an In-Reply-To field MD5.
+    // In well behaved mailing lists 70% of the threadable messages get a parent here :)
+    pParent = perfectParent;
+
+    if( pParent ) // very likely
+    {
+      if ( pParent == mi )
+      {
+        // Bad, bad message.. it has In-Reply-To equal to MessageId...
+        // Will wait for Pass2 with References-Id only
+        mUnassignedMessageListForPass2.append( mi );
+      } else {
+        // wow, got a perfect parent for this message!
+        mi->setThreadingStatus( MessageItem::PerfectParentFound );
+        attachMessageToParent( pParent, mi );
+        // we're done with this message (also for Pass2)
+      }
+    } else {
+      // got no parent
+      // will have to wait Pass2
+      mUnassignedMessageListForPass2.append( mi );
+    }
+  } else {
+    // No In-Reply-To header.
+
+    bool mightHaveOtherMeansForThreading;
+
+    switch( mAggregation->threading() )
+    {
+      case Aggregation::PerfectReferencesAndSubject:
+        mightHaveOtherMeansForThreading = mi->subjectIsPrefixed() || !mi->referencesIdMD5().isEmpty();
+      break;
+      case Aggregation::PerfectAndReferences:
+        mightHaveOtherMeansForThreading = !mi->referencesIdMD5().isEmpty();
+      break;
+      case Aggregation::PerfectOnly:
+        mightHaveOtherMeansForThreading = false;
+      break;
+      default:
+        // BUG: there shouldn't be other values (NoThreading is excluded in an upper branch)
+        Q_ASSERT( false );
+        mightHaveOtherMeansForThreading = false; // make gcc happy
+      break;
+    }
+
+    if ( mightHaveOtherMeansForThreading )
+    {
+      // We might have other means for threading this message, wait until Pass2
+      mUnassignedMessageListForPass2.append( mi );
+    } else {
+      // No other means for threading this message. This is either
+      // a standalone message or a thread leader.
+      // If there is no grouping in effect or thread leaders are just the "topmost"
+      // messages then we might be done with this one.
+      if (
+           ( mAggregation->grouping() == Aggregation::NoGrouping ) ||
+           ( mAggregation->threadLeader() == Aggregation::TopmostMessage )
+        )
+      {
+        // We're done with this message: it will be surely either toplevel (no grouping in effect)
+        // or a thread leader with a well defined group. Do it :)
+        //kDebug() << "Setting message status from " << mi->threadingStatus() << " to non threadable (1) " << mi;
+        mi->setThreadingStatus( MessageItem::NonThreadable );
+        // Locate the parent group for this item
+        attachMessageToGroupHeader( mi );
+        // we're done with this message (also for Pass2)
+      } else {
+        // Threads belong to the most recent message in the thread. This means
+        // that we have to wait until Pass2 or Pass3 to assign a group.
+        mUnassignedMessageListForPass2.append( mi );
+      }
+    }
+  }
+
+  if ( needsImmediateReAttach && !mi->isViewable() )
+  {
+    // The item gathered previously viewable children. They must be immediately
+    // re-shown. So this item must currently be attached to the view.
+    // This is a temporary measure: it will be probably still moved.
+    MessageItem * topmost = mi->topmostMessage();
+    Q_ASSERT( topmost->threadingStatus() == MessageItem::ParentMissing );
+    attachMessageToGroupHeader( topmost );
+  }
+}
+
 ModelPrivate::ViewItemJobResult ModelPrivate::viewItemJobStepInternalForJobPass1Fill( ViewItemJob *job, const QTime &tStart )
 {
   // In this pass we scan the a contiguous region of the underlying storage (that is
@@ -2695,6 +2995,23 @@ ModelPrivate::ViewItemJobResult ModelPrivate::viewItemJobStepInternalForJobPass1
 
   // We call this pass "Processing"
 
+  ThreadingPrepass * prepass = job->threadingPrepass();
+
+  if ( prepass && prepass->isStarted() )
+    return viewItemJobStepInternalForJobPass1FillThreading( job, tStart );
+
+  if (
+       ( !prepass ) &&
+       ( mAggregation->threading() != Aggregation::NoThreading ) &&
+       ( ( job->endIndex() - job->currentIndex() + 1 ) >= ThreadingPrepass::MinimumMessageCount )
+     )
+  {
+    // A large job: leave the threading cache work to a worker thread.
+    // We'll just create the message items here.
+    prepass = new ThreadingPrepass( mAggregation->threading() == Aggregation::PerfectReferencesAndSubject );
+    job->setThreadingPrepass( prepass );
+  }
+
   int elapsed;
 
   // Should we use the receiver or the sender field for sorting ?
@@ -2751,166 +3068,47 @@ ModelPrivate::ViewItemJobResult ModelPrivate::viewItemJobStepInternalForJobPass1
     {
       // Threading is requested
 
-      // Fetch the data needed for proper threading
+      // Fetch the data needed for proper threading: the messages that were
+      // already there the last time the folder was shown have it in mThreadingCache
       // Add the item to the threading caches
 
-      switch( mAggregation->threading() )
-      {
-        case Aggregation::PerfectReferencesAndSubject:
-          mStorageModel->fillMessageItemThreadingData( mi, curIndex, StorageModel::PerfectThreadingReferencesAndSubject );
-
-          // We also need to build the subject-based threading cache
-          addMessageToSubjectBasedThreadingCache( mi );
-        break;
-        case Aggregation::PerfectAndReferences:
-          mStorageModel->fillMessageItemThreadingData( mi, curIndex, StorageModel::PerfectThreadingPlusReferences );
-        break;
-        default:
-          mStorageModel->fillMessageItemThreadingData( mi, curIndex, StorageModel::PerfectThreadingOnly );
-        break;
-      }
-
-      // Perfect/References threading cache
-      mThreadingCacheMessageIdMD5ToMessageItem.insert( mi->messageIdMD5(), mi );
-
-      // Check if this item is a perfect parent for some imperfectly threaded
-      // message (that is actually attacched to it, but not necessairly to the
-      // viewable root). If it is, then remove the imperfect child from its
-      // current parent rebuild the hierarchy on the fly.
-
-      bool needsImmediateReAttach = false;
-
-      if ( mThreadingCacheMessageInReplyToIdMD5ToMessageItem.count() > 0 ) // unlikely
+      if ( !mThreadingCache || !mThreadingCache->fillMessageItemThreadingData( mi ) )
       {
-        QList< MessageItem * > lImperfectlyThreaded = mThreadingCacheMessageInReplyToIdMD5ToMessageItem.values( mi->messageIdMD5() );
-        if ( !lImperfectlyThreaded.isEmpty() )
-        {
-          // must move all of the items in the perfect parent
-          for ( QList< MessageItem * >::Iterator it = lImperfectlyThreaded.begin(); it != lImperfectlyThreaded.end(); ++it )
-          {
-            Q_ASSERT( ( *it )->parent() );
-            Q_ASSERT( ( *it )->parent() != mi );
-#if 1
-            Q_ASSERT( ( ( *it )->threadingStatus() == MessageItem::ImperfectParentFound ) || ( ( *it )->threadingStatus() == MessageItem::ParentMissing ) );
-#else
-            if(!(( ( *it )->threadingStatus() == MessageItem::ImperfectParentFound ) || ( ( *it )->threadingStatus() == MessageItem::ParentMissing )))
-            {
-              kDebug() << "GOT A MESSAGE " << ( *it ) << " WITH THREADING STATUS " << ( *it )->threadingStatus();
-              Q_ASSERT( false );
-            }
-#endif
-            // If the item was already attached to the view then
-            // re-attach it immediately. This will avoid a message
-            // being displayed for a short while in the view and then
-            // disappear until a perfect parent isn't found.
-            if ( ( *it )->isViewable() )
-              needsImmediateReAttach = true;
-
-            ( *it )->setThreadingStatus( MessageItem::PerfectParentFound );
-            attachMessageToParent( mi, *it );
-          }
-        }
-      }
-
-      // FIXME: Might look by "References" too, here... (?)
-
-      // Attempt to do threading with anything we already have in caches until now
-      // Note that this is likely to work since thread-parent messages tend
-      // to come before thread-children messages in the folders (simply because of
-      // date of arrival).
-
-      Item * pParent;
-
-      // First of all try to find a "perfect parent", that is the message for that
-      // we have the ID in the "In-Reply-To" field. This is actually done by using
-      // MD5 caches of the message ids because of speed. Collisions are very unlikely.
-
-      QString md5 = mi->inReplyToIdMD5();
-
-      if ( !md5.isEmpty() )
-      {
-        // Have an In-Reply-To field MD5.
-        // In well behaved mailing lists 70% of the threadable messages get a parent here :)
-        pParent = mThreadingCacheMessageIdMD5ToMessageItem.value( md5, 0 );
-
-        if( pParent ) // very likely
-        {
-          if ( pParent == mi )
-          {
-            // Bad, bad message.. it has In-Reply-To equal to MessageId...
-            // Will wait for Pass2 with References-Id only
-            mUnassignedMessageListForPass2.append( mi );
-          } else {
-            // wow, got a perfect parent for this message!
-            mi->setThreadingStatus( MessageItem::PerfectParentFound );
-            attachMessageToParent( pParent, mi );
-            // we're done with this message (also for Pass2)
-          }
-        } else {
-          // got no parent
-          // will have to wait Pass2
-          mUnassignedMessageListForPass2.append( mi );
-        }
-      } else {
-        // No In-Reply-To header.
-
-        bool mightHaveOtherMeansForThreading;
-
         switch( mAggregation->threading() )
         {
           case Aggregation::PerfectReferencesAndSubject:
-            mightHaveOtherMeansForThreading = mi->subjectIsPrefixed() || !mi->referencesIdMD5().isEmpty();
+            mStorageModel->fillMessageItemThreadingData( mi, curIndex, StorageModel::PerfectThreadingReferencesAndSubject );
           break;
           case Aggregation::PerfectAndReferences:
-            mightHaveOtherMeansForThreading = !mi->referencesIdMD5().isEmpty();
-          break;
-          case Aggregation::PerfectOnly:
-            mightHaveOtherMeansForThreading = false;
+            mStorageModel->fillMessageItemThreadingData( mi, curIndex, StorageModel::PerfectThreadingPlusReferences );
           break;
           default:
-            // BUG: there shouldn't be other values (NoThreading is excluded in an upper branch)
-            Q_ASSERT( false );
-            mightHaveOtherMeansForThreading = false; // make gcc happy
+            mStorageModel->fillMessageItemThreadingData( mi, curIndex, StorageModel::PerfectThreadingOnly );
           break;
         }
-
-        if ( mightHaveOtherMeansForThreading )
-        {
-          // We might have other means for threading this message, wait until Pass2
-          mUnassignedMessageListForPass2.append( mi );
-        } else {
-          // No other means for threading this message. This is either
-          // a standalone message or a thread leader.
-          // If there is no grouping in effect or thread leaders are just the "topmost"
-          // messages then we might be done with this one.
-          if (
-               ( mAggregation->grouping() == Aggregation::NoGrouping ) ||
-               ( mAggregation->threadLeader() == Aggregation::TopmostMessage )
-            )
-          {
-            // We're done with this message: it will be surely either toplevel (no grouping in effect)
-            // or a thread leader with a well defined group. Do it :)
-            //kDebug() << "Setting message status from " << mi->threadingStatus() << " to non threadable (1) " << mi;
-            mi->setThreadingStatus( MessageItem::NonThreadable );
-            // Locate the parent group for this item
-            attachMessageToGroupHeader( mi );
-            // we're done with this message (also for Pass2)
-          } else {
-            // Threads belong to the most recent message in the thread. This means
-            // that we have to wait until Pass2 or Pass3 to assign a group.
-            mUnassignedMessageListForPass2.append( mi );
-          }
-        }
       }
 
-      if ( needsImmediateReAttach && !mi->isViewable() )
+      // We also need to build the subject-based threading cache
+      if ( ( mAggregation->threading() == Aggregation::PerfectReferencesAndSubject ) && !prepass )
+        addMessageToSubjectBasedThreadingCache( mi );
+
+      // Make it available as a saved parent for Pass2
+      if ( mThreadingCache )
+        mThreadingCache->addMessageItem( mi );
+
+      if ( prepass )
       {
-        // The item gathered previously viewable children. They must be immediately
-        // re-shown. So this item must currently be attached to the view.
-        // This is a temporary measure: it will be probably still moved.
-        MessageItem * topmost = mi->topmostMessage();
-        Q_ASSERT( topmost->threadingStatus() == MessageItem::ParentMissing );
-        attachMessageToGroupHeader( topmost );
+        // The worker thread will add it to the caches and find its parent
+        prepass->addMessage( mi );
+      } else {
+        // Perfect/References threading cache
+        mThreadingCacheMessageIdMD5ToMessageItem.insert( mi->messageIdMD5(), mi );
+
+        MessageItem * perfectParent = 0;
+        if ( !mi->inReplyToIdMD5().isEmpty() )
+          perfectParent = mThreadingCacheMessageIdMD5ToMessageItem.value( mi->inReplyToIdMD5(), 0 );
+
+        threadMessageInPass1Fill( mi, perfectParent );
       }
 
     } else {
@@ -2947,6 +3145,76 @@ ModelPrivate::ViewItemJobResult ModelPrivate::viewItemJobStepInternalForJobPass1
 
   if ( mi )
     delete mi;
+
+  if ( prepass )
+  {
+    // All the rows have been read: start the worker thread and
+    // come back to attach the messages when it has finished.
+    job->setCurrentIndex( curIndex );
+    prepass->start( mThreadingCacheMessageIdMD5ToMessageItem );
+    return ViewItemJobInterrupted;
+  }
+
+  return ViewItemJobCompleted;
+}
+
+ModelPrivate::ViewItemJobResult ModelPrivate::viewItemJobStepInternalForJobPass1FillThreading( ViewItemJob *job, const QTime &tStart )
+{
+  // This is the second half of Pass1Fill for jobs with a ThreadingPrepass.
+  // All the rows of the job have been read and the worker thread is filling
+  // the threading caches. When it has finished we attach the messages exactly
+  // like Pass1Fill does for smaller jobs, but with the parents found by the worker.
+
+  ThreadingPrepass * prepass = job->threadingPrepass();
+
+  if ( !prepass->isFinished() )
+    return ViewItemJobInterrupted; // still working, try again at the next step
+
+  int elapsed;
+
+  int curIndex = prepass->attachIndex();
+  int endIndex = prepass->count() - 1;
+
+  if ( curIndex == 0 )
+  {
+    // First chunk (we never interrupt before attaching at least one message).
+    // Take over the caches built by the worker. Only the first job runs steps
+    // so nobody can have changed the Message-Id cache in the meantime.
+    Q_ASSERT( prepass->isSnapshotOf( mThreadingCacheMessageIdMD5ToMessageItem ) );
+    mThreadingCacheMessageIdMD5ToMessageItem = prepass->takeMessageIdCache();
+    mergeIntoSubjectBasedThreadingCache( prepass->subjectCache() );
+    prepass->clearSubjectCache();
+    prepass->setPass2Base( mUnassignedMessageListForPass2.count() );
+  }
+
+  while ( curIndex <= endIndex )
+  {
+    const ThreadingPrepass::Entry &entry = prepass->entry( curIndex );
+
+    int pass2Count = mUnassignedMessageListForPass2.count();
+
+    threadMessageInPass1Fill( entry.mItem, entry.mFillParent );
+
+    if ( mUnassignedMessageListForPass2.count() > pass2Count )
+      prepass->appendPass2Entry( curIndex ); // Pass2 will need the parents found by the worker
+
+    curIndex++;
+
+    if ( ( curIndex % mViewItemJobStepMessageCheckCount ) == 0 )
+    {
+      elapsed = tStart.msecsTo( QTime::currentTime() );
+      if ( ( elapsed > mViewItemJobStepChunkTimeout ) || ( elapsed < 0 ) )
+      {
+        if ( curIndex <= endIndex )
+        {
+          prepass->setAttachIndex( curIndex );
+          return ViewItemJobInterrupted;
+        }
+      }
+    }
+  }
+
+  prepass->setAttachIndex( curIndex );
   return ViewItemJobCompleted;
 }
 
@@ -3063,6 +3331,8 @@ ModelPrivate::ViewItemJobResult ModelPrivate::viewItemJobStepInternalForJobPass1
 
       // Remove from the cache of potential parent items
       mThreadingCacheMessageIdMD5ToMessageItem.remove( dyingMessage->messageIdMD5() );
+      if ( mThreadingCache )
+        mThreadingCache->removeMessageItem( dyingMessage );
 
       // If we also have a cache for subject-based threading then remove the message from there too
       if( mAggregation->threading() == Aggregation::PerfectReferencesAndSubject )
@@ -3992,6 +4262,15 @@ void ModelPrivate::viewItemJobStep()
         mView->modelFinishedLoading();
       }
 
+      // The saved threading data is needed only by the initial fill
+      if ( mThreadingCache )
+      {
+        if ( mThreadingCache->isStale() )
+          mThreadingCacheDirty = true;
+        delete mThreadingCache;
+        mThreadingCache = 0;
+      }
+
       // Apply pre-selection, if any
       if ( mPreSelectionMode != PreSelectNone )
       {
@@ -4186,6 +4465,8 @@ void ModelPrivate::slotStorageModelRowsInserted( const QModelIndex &parent, int
 
   int count = ( to - from ) + 1;
 
+  mThreadingCacheDirty = true;
+
   mInvariantRowMapper->modelRowsInserted( from, count );
 
   // look if no current job is in the middle
@@ -4195,7 +4476,11 @@ void ModelPrivate::slotStorageModelRowsInserted( const QModelIndex &parent, int
   for ( int idx = 0; idx < jobCount; idx++ )
   {
     ViewItemJob * job = mViewItemJobs.at( idx );
-    if ( job->currentPass() == ViewItemJob::Pass1Fill )
+    if (
+         ( job->currentPass() == ViewItemJob::Pass1Fill ) &&
+         // a job waiting for its ThreadingPrepass has already read all of its rows
+         ( job->currentIndex() <= job->endIndex() )
+       )
     {
       //
       // The following cases are possible:
@@ -4308,12 +4593,18 @@ void ModelPrivate::slotStorageModelRowsRemoved( const QModelIndex &parent, int f
 
   int count = ( to - from ) + 1;
 
+  mThreadingCacheDirty = true;
+
   int jobCount = mViewItemJobs.count();
 
   for ( int idx = 0; idx < jobCount; idx++ )
   {
     ViewItemJob * job = mViewItemJobs.at( idx );
-    if ( job->currentPass() == ViewItemJob::Pass1Fill )
+    if (
+         ( job->currentPass() == ViewItemJob::Pass1Fill ) &&
+         // a job waiting for its ThreadingPrepass has already read all of its rows
+         ( job->currentIndex() <= job->endIndex() )
+       )
     {
       //
       // The following cases are possible:
@@ -4371,11 +4662,18 @@ void ModelPrivate::slotStorageModelRowsRemoved( const QModelIndex &parent, int f
         // The change starts below (or exactly on the beginning of) the job. ( from <= job->currentIndex() )
         if ( to >= job->endIndex() )
         {
-          // The change completely covers the job: kill it
-          delete job;
-          mViewItemJobs.removeAt( idx );
-          idx--;
-          jobCount--;
+          if ( job->threadingPrepass() )
+          {
+            // The change completely covers the rest of the job. The messages read
+            // so far are waiting in the ThreadingPrepass: just stop reading rows.
+            job->setEndIndex( job->currentIndex() - 1 );
+          } else {
+            // The change completely covers the job: kill it
+            delete job;
+            mViewItemJobs.removeAt( idx );
+            idx--;
+            jobCount--;
+          }
         } else if ( to >= job->currentIndex() )
         {
           // The change partially covers the job. Only a part of it can be completed
@@ -29,6 +29,9 @@ namespace MessageList
 namespace Core
 {
 
+class ThreadingCache;
+class ThreadingPrepass;
+
 class ModelPrivate
 {
 public:
@@ -52,6 +55,12 @@ public:
    * This function performs In-Reply-To and References threading.
    */
   MessageItem * findMessageParent( MessageItem *mi );
+  /**
+   * Like the function above but with the lookups of the In-Reply-To and References MD5
+   * of the message in the Message-Id cache already done (by the caller or a worker thread).
+   * The candidate parents are 0 if the lookup failed (or wasn't needed).
+   */
+  MessageItem * findMessageParent( MessageItem *mi, MessageItem *perfectParent, MessageItem *referencesParent );
   /**
    * Attempt to find the threading parent for the specified message item.
    * Sets the message threading status to the appropriate value.
@@ -59,6 +68,19 @@ public:
    * This function performs Subject based threading.
    */
   MessageItem * guessMessageParent( MessageItem *mi );
+  /**
+   * Returns the parent the specified message was threaded to the last time
+   * the folder was shown, as saved in mThreadingCache, and sets the message
+   * threading status like guessMessageParent() does. Pass3 calls it before
+   * guessing. Returns 0 if there is no such parent (or it would create a loop
+   * in the tree).
+   */
+  MessageItem * findMessageParentInThreadingCache( MessageItem *mi );
+  /**
+   * Saves the threading data of the messages of the current storage model
+   * to its threading cache file, if it has changed since it was loaded.
+   */
+  void saveThreadingCache();
 
   void attachMessageToParent( Item *pParent, MessageItem *mi );
   void messageDetachedUpdateParentProperties( Item *oldParent, MessageItem *mi );
@@ -75,6 +97,7 @@ public:
 
   // FIXME: Those look like they should be made virtual in some job class! -> Refactor
   ViewItemJobResult viewItemJobStepInternalForJobPass1Fill( ViewItemJob *job, const QTime &tStart );
+  ViewItemJobResult viewItemJobStepInternalForJobPass1FillThreading( ViewItemJob *job, const QTime &tStart );
   ViewItemJobResult viewItemJobStepInternalForJobPass1Cleanup( ViewItemJob *job, const QTime &tStart );
   ViewItemJobResult viewItemJobStepInternalForJobPass1Update( ViewItemJob *job, const QTime &tStart );
   ViewItemJobResult viewItemJobStepInternalForJobPass2( ViewItemJob *job, const QTime &tStart );
@@ -87,6 +110,17 @@ public:
   void clearThreadingCacheMessageSubjectMD5ToMessageItem();
   void addMessageToSubjectBasedThreadingCache( MessageItem * mi );
   void removeMessageFromSubjectBasedThreadingCache( MessageItem * mi );
+  /**
+   * Merges lists of messages, sorted like the ones of the subject based threading cache,
+   * into the cache.
+   */
+  void mergeIntoSubjectBasedThreadingCache( const QHash< QString, QList< MessageItem * > > &subjects );
+  /**
+   * Does the Pass1Fill threading for the specified message, that has been just added to
+   * the Message-Id cache. perfectParent is the result of the lookup of its In-Reply-To MD5
+   * in the cache. The message is either attached or appended to mUnassignedMessageListForPass2.
+   */
+  void threadMessageInPass1Fill( MessageItem *mi, MessageItem *perfectParent );
   /**
    * Sync the expanded state of the subtree with the specified root.
    * This will cause the items that are marked with Item::ExpandNeeded to be
@@ -220,6 +254,23 @@ public:
    */
   QHash< QString, QList< MessageItem * > * > mThreadingCacheMessageSubjectMD5ToMessageItem;
 
+  /**
+   * The threading data saved the last time the storage model was shown,
+   * used by the initial fill jobs. Owned, 0 if there is none or the fill is over.
+   */
+  ThreadingCache * mThreadingCache;
+
+  /**
+   * The threading mode the current storage model was filled with.
+   */
+  Aggregation::Threading mThreadingCacheThreading;
+
+  /**
+   * True if the threading cache file of the current storage model doesn't
+   * match the messages shown and must be written again.
+   */
+  bool mThreadingCacheDirty;
+
   /**
    * List of group headers that either need to be re-sorted or must be removed because empty
    */
@@ -36,3 +36,8 @@ int StorageModel::initialUnreadRowCountGuess() const
   return rowCount( QModelIndex() );
 }
 
+QString StorageModel::threadingCacheFileName() const
+{
+  return QString();
+}
+
@@ -69,6 +69,15 @@ public:
    */
   virtual int initialUnreadRowCountGuess() const;
 
+  /**
+   * Returns the path of the file where the Model can save the threading data of
+   * this folder between sessions, or an empty string if the threading data shouldn't
+   * be saved (which is also what the default implementation does).
+   * The file is keyed by the unique ids of the messages: the StorageModel
+   * must remove it if they may have changed for the messages in the folder.
+   */
+  virtual QString threadingCacheFileName() const;
+
   /**
    * This method should use the inner model implementation to fill in the
    * base data for the specified MessageItem from the underlying storage slot at
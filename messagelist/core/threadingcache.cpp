@@ -0,0 +1,198 @@
+/******************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *******************************************************************************/
+
+#include "core/threadingcache_p.h"
+#include "core/messageitem.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QList>
+
+#include <KDebug>
+#include <KSaveFile>
+
+namespace MessageList
+{
+
+namespace Core
+{
+
+static const quint32 gThreadingCacheMarker = 0x4d4c5443; // "MLTC"
+static const qint32 gThreadingCacheCurrentVersion = 1;
+
+ThreadingCache::ThreadingCache()
+  : mHitCount( 0 ), mMissCount( 0 )
+{
+}
+
+ThreadingCache::~ThreadingCache()
+{
+}
+
+ThreadingCache * ThreadingCache::load( const QString &fileName, Aggregation::Threading threading )
+{
+  QFile f( fileName );
+  if ( !f.open( QIODevice::ReadOnly ) )
+    return 0; // not saved yet (or removed by the storage)
+
+  QDataStream s( &f );
+
+  quint32 marker;
+  qint32 version;
+  qint32 savedThreading;
+  qint32 count;
+
+  s >> marker >> version;
+  if ( ( marker != gThreadingCacheMarker ) || ( version != gThreadingCacheCurrentVersion ) )
+    return 0; // not ours (or an old format)
+
+  s >> savedThreading >> count;
+  if ( ( s.status() != QDataStream::Ok ) || ( savedThreading != (qint32)threading ) || ( count < 0 ) )
+    return 0; // the MD5 strings and the parents depend on the threading mode
+
+  ThreadingCache * cache = new ThreadingCache();
+  cache->mEntries.reserve( count );
+
+  for ( qint32 i = 0; i < count; i++ )
+  {
+    quint32 uniqueId;
+    quint32 parentUniqueId;
+    Entry e;
+
+    s >> uniqueId >> parentUniqueId;
+    s >> e.mMessageIdMD5 >> e.mInReplyToIdMD5 >> e.mReferencesIdMD5 >> e.mStrippedSubjectMD5;
+    s >> e.mSubjectIsPrefixed;
+
+    if ( s.status() != QDataStream::Ok )
+    {
+      kWarning() << "Threading cache" << fileName << "is truncated, ignoring it";
+      delete cache;
+      return 0;
+    }
+
+    e.mParentUniqueId = parentUniqueId;
+    cache->mEntries.insert( uniqueId, e );
+  }
+
+  return cache;
+}
+
+bool ThreadingCache::save( const QString &fileName, Aggregation::Threading threading, Item *root )
+{
+  // Collect the messages first: the count goes before them.
+  // The threads may be very deep: walk the tree without recursion.
+  QList< MessageItem * > messages;
+  QList< Item * > pending;
+  pending.append( root );
+
+  while ( !pending.isEmpty() )
+  {
+    Item * it = pending.takeLast();
+    if ( ( it->type() == Item::Message ) && ( static_cast< MessageItem * >( it )->uniqueId() != 0 ) )
+      messages.append( static_cast< MessageItem * >( it ) ); // 0 means "no unique id": can't be matched later
+
+    QList< Item * > * children = it->childItems();
+    if ( children )
+      pending += *children;
+  }
+
+  KSaveFile f( fileName );
+  if ( !f.open() )
+  {
+    kWarning() << "Can't write the threading cache" << fileName << ":" << f.errorString();
+    return false;
+  }
+
+  QDataStream s( &f );
+
+  s << gThreadingCacheMarker << gThreadingCacheCurrentVersion;
+  s << (qint32)threading << (qint32)messages.count();
+
+  for ( QList< MessageItem * >::ConstIterator it = messages.constBegin(); it != messages.constEnd(); ++it )
+  {
+    MessageItem * mi = *it;
+
+    quint32 parentUniqueId = 0;
+    if (
+         mi->parent() && ( mi->parent()->type() == Item::Message ) &&
+         (
+           ( mi->threadingStatus() == MessageItem::PerfectParentFound ) ||
+           ( mi->threadingStatus() == MessageItem::ImperfectParentFound )
+         )
+       )
+      parentUniqueId = static_cast< MessageItem * >( mi->parent() )->uniqueId();
+
+    s << (quint32)mi->uniqueId() << parentUniqueId;
+    s << mi->messageIdMD5() << mi->inReplyToIdMD5() << mi->referencesIdMD5() << mi->strippedSubjectMD5();
+    s << mi->subjectIsPrefixed();
+  }
+
+  if ( s.status() != QDataStream::Ok )
+  {
+    kWarning() << "Can't write the threading cache" << fileName;
+    f.abort();
+    return false;
+  }
+
+  return f.finalize();
+}
+
+bool ThreadingCache::fillMessageItemThreadingData( MessageItem *mi )
+{
+  QHash< unsigned long, Entry >::ConstIterator it = mEntries.constFind( mi->uniqueId() );
+  if ( it == mEntries.constEnd() )
+  {
+    // added since the cache was written
+    mMissCount++;
+    return false;
+  }
+
+  mHitCount++;
+
+  mi->setMessageIdMD5( it->mMessageIdMD5 );
+  mi->setInReplyToIdMD5( it->mInReplyToIdMD5 );
+  mi->setReferencesIdMD5( it->mReferencesIdMD5 );
+  mi->setStrippedSubjectMD5( it->mStrippedSubjectMD5 );
+  mi->setSubjectIsPrefixed( it->mSubjectIsPrefixed );
+  return true;
+}
+
+void ThreadingCache::addMessageItem( MessageItem *mi )
+{
+  mMessageItems.insert( mi->uniqueId(), mi );
+}
+
+void ThreadingCache::removeMessageItem( MessageItem *mi )
+{
+  QHash< unsigned long, MessageItem * >::Iterator it = mMessageItems.find( mi->uniqueId() );
+  if ( ( it != mMessageItems.end() ) && ( *it == mi ) )
+    mMessageItems.erase( it );
+}
+
+MessageItem * ThreadingCache::parentOf( MessageItem *mi ) const
+{
+  QHash< unsigned long, Entry >::ConstIterator it = mEntries.constFind( mi->uniqueId() );
+  if ( ( it == mEntries.constEnd() ) || ( it->mParentUniqueId == 0 ) )
+    return 0;
+
+  return mMessageItems.value( it->mParentUniqueId, 0 );
+}
+
+} // namespace Core
+
+} // namespace MessageList
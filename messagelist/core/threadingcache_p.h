@@ -0,0 +1,123 @@
+/******************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *******************************************************************************/
+
+#ifndef __MESSAGELIST_CORE_THREADINGCACHE_P_H__
+#define __MESSAGELIST_CORE_THREADINGCACHE_P_H__
+
+#include <QHash>
+#include <QString>
+
+#include "core/aggregation.h"
+
+namespace MessageList
+{
+
+namespace Core
+{
+
+class Item;
+class MessageItem;
+
+/**
+ * The threading data of a folder as it was computed the last time
+ * the folder was shown, loaded from the file returned by
+ * StorageModel::threadingCacheFileName().
+ *
+ * The messages are identified by their unique id. For each message the file
+ * holds the MD5 strings that StorageModel::fillMessageItemThreadingData()
+ * would return and the unique id of the parent the message was threaded to.
+ * A folder fill takes the MD5 strings from here instead of asking the
+ * storage for them. For the messages that In-Reply-To and References can't
+ * thread, Pass3 uses the saved parent instead of guessing one from the
+ * subject. The messages that are not in the file (added since it was
+ * written) are threaded by the usual passes.
+ */
+class ThreadingCache
+{
+public:
+  ~ThreadingCache();
+
+  /**
+   * Loads the cache from the specified file with a single sequential read.
+   * Returns 0 if the file doesn't exist, is broken or has been written
+   * for a different threading mode.
+   */
+  static ThreadingCache * load( const QString &fileName, Aggregation::Threading threading );
+
+  /**
+   * Saves the threading data of all the messages in the tree rooted at root
+   * to the specified file. Returns false if the file can't be written.
+   */
+  static bool save( const QString &fileName, Aggregation::Threading threading, Item *root );
+
+  /**
+   * Fills the threading data of the specified message from the cache.
+   * Returns false if the message is not in the cache: the caller must
+   * then ask the storage for the data.
+   */
+  bool fillMessageItemThreadingData( MessageItem *mi );
+
+  /**
+   * Makes the specified message available as a parent for the others.
+   */
+  void addMessageItem( MessageItem *mi );
+
+  /**
+   * Forgets the specified message, which is about to be deleted.
+   */
+  void removeMessageItem( MessageItem *mi );
+
+  /**
+   * Returns the parent the specified message was threaded to the last time,
+   * if the parent has been already added with addMessageItem(), and 0 otherwise.
+   */
+  MessageItem * parentOf( MessageItem *mi ) const;
+
+  /**
+   * Returns true if the cache no longer matches the folder: some of
+   * the messages shown weren't in the cache or some of the messages
+   * in the cache are no longer in the folder.
+   */
+  bool isStale() const
+    { return ( mMissCount > 0 ) || ( mHitCount < mEntries.count() ); };
+
+private:
+  ThreadingCache();
+
+  class Entry
+  {
+  public:
+    unsigned long mParentUniqueId;     ///< 0 if the message had no parent message
+    QString mMessageIdMD5;
+    QString mInReplyToIdMD5;
+    QString mReferencesIdMD5;
+    QString mStrippedSubjectMD5;
+    bool mSubjectIsPrefixed;
+  };
+
+  QHash< unsigned long, Entry > mEntries;                  ///< The loaded data, by message unique id
+  QHash< unsigned long, MessageItem * > mMessageItems;     ///< The messages added so far, by unique id
+  int mHitCount;
+  int mMissCount;
+};
+
+} // namespace Core
+
+} // namespace MessageList
+
+#endif //!__MESSAGELIST_CORE_THREADINGCACHE_P_H__
@@ -0,0 +1,169 @@
+/******************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *******************************************************************************/
+
+#include "core/threadingprepass_p.h"
+#include "core/messageitem.h"
+
+#include <QtAlgorithms>
+#include <QtConcurrentRun>
+
+namespace MessageList
+{
+
+namespace Core
+{
+
+// Orders entry indexes like MessageLessThanByDate orders the messages
+// in the subject cache of the Model: by date, then by pointer value.
+class EntryLessThanByDate
+{
+public:
+  EntryLessThanByDate( const QVector< ThreadingPrepass::Entry > &entries )
+    : mEntries( entries ) {};
+
+  inline bool operator()( int idx1, int idx2 ) const
+  {
+    const ThreadingPrepass::Entry &e1 = mEntries.at( idx1 );
+    const ThreadingPrepass::Entry &e2 = mEntries.at( idx2 );
+    if ( e1.mDate < e2.mDate ) // likely
+      return true;
+    if ( e1.mDate > e2.mDate ) // likely
+      return false;
+    // dates are equal, compare by pointer
+    return e1.mItem < e2.mItem;
+  }
+
+private:
+  const QVector< ThreadingPrepass::Entry > &mEntries;
+};
+
+ThreadingPrepass::ThreadingPrepass( bool buildSubjectCache )
+  : mBuildSubjectCache( buildSubjectCache ), mStarted( false ),
+    mPass2Base( 0 ), mAttachIndex( 0 )
+{
+}
+
+ThreadingPrepass::~ThreadingPrepass()
+{
+  // The worker uses our data: it can't be abandoned
+  if ( mStarted )
+    mFuture.waitForFinished();
+
+  // The messages that haven't been attached yet have neither a parent
+  // nor children: nobody else would delete them.
+  for ( int idx = mAttachIndex; idx < mEntries.count(); ++idx )
+  {
+    Q_ASSERT( !mEntries.at( idx ).mItem->parent() );
+    delete mEntries.at( idx ).mItem;
+  }
+}
+
+void ThreadingPrepass::addMessage( MessageItem *mi )
+{
+  Q_ASSERT( !mStarted );
+
+  Entry e;
+  e.mItem = mi;
+  e.mMessageIdMD5 = mi->messageIdMD5();
+  e.mInReplyToIdMD5 = mi->inReplyToIdMD5();
+  e.mReferencesIdMD5 = mi->referencesIdMD5();
+  if ( mBuildSubjectCache )
+    e.mStrippedSubjectMD5 = mi->strippedSubjectMD5();
+  e.mDate = mi->date();
+  e.mFillParent = 0;
+  e.mPerfectParent = 0;
+  e.mReferencesParent = 0;
+  mEntries.append( e );
+}
+
+void ThreadingPrepass::start( const QHash< QString, MessageItem * > &messageIdCache )
+{
+  Q_ASSERT( !mStarted );
+
+  mMessageIdCacheSnapshot = messageIdCache;
+  mStarted = true;
+  mFuture = QtConcurrent::run( this, &ThreadingPrepass::run );
+}
+
+QHash< QString, MessageItem * > ThreadingPrepass::takeMessageIdCache()
+{
+  Q_ASSERT( isFinished() );
+
+  // Drop our references so that the Model can change its cache without copying it
+  QHash< QString, MessageItem * > cache = mMessageIdCache;
+  mMessageIdCache.clear();
+  mMessageIdCacheSnapshot.clear();
+  return cache;
+}
+
+void ThreadingPrepass::run()
+{
+  // Runs in the worker thread
+
+  QHash< QString, MessageItem * > cache = mMessageIdCacheSnapshot;
+  cache.reserve( cache.count() + mEntries.count() );
+
+  QVector< Entry >::Iterator it;
+  QVector< Entry >::Iterator end = mEntries.end();
+
+  // Fill the cache in storage order, like Pass1Fill would have done,
+  // and look up the parents that Pass1Fill would have found
+  for ( it = mEntries.begin(); it != end; ++it )
+  {
+    cache.insert( it->mMessageIdMD5, it->mItem );
+    if ( !it->mInReplyToIdMD5.isEmpty() )
+      it->mFillParent = cache.value( it->mInReplyToIdMD5, 0 );
+  }
+
+  // The messages that didn't get a parent (or got themselves) are threaded
+  // by Pass2 on the complete cache
+  for ( it = mEntries.begin(); it != end; ++it )
+  {
+    if ( it->mFillParent && ( it->mFillParent != it->mItem ) )
+      continue; // attached in Pass1Fill
+
+    if ( !it->mInReplyToIdMD5.isEmpty() )
+      it->mPerfectParent = cache.value( it->mInReplyToIdMD5, 0 );
+    if ( !it->mReferencesIdMD5.isEmpty() )
+      it->mReferencesParent = cache.value( it->mReferencesIdMD5, 0 );
+  }
+
+  mMessageIdCache = cache;
+
+  if ( !mBuildSubjectCache )
+    return;
+
+  QHash< QString, QVector< int > > subjects;
+  for ( int idx = 0; idx < mEntries.count(); ++idx )
+    subjects[ mEntries.at( idx ).mStrippedSubjectMD5 ].append( idx );
+
+  EntryLessThanByDate lessThan( mEntries );
+  for ( QHash< QString, QVector< int > >::Iterator sit = subjects.begin(); sit != subjects.end(); ++sit )
+  {
+    QVector< int > &indexes = *sit;
+    qSort( indexes.begin(), indexes.end(), lessThan );
+
+    QList< MessageItem * > &messages = mSubjectCache[ sit.key() ];
+    for ( QVector< int >::ConstIterator iit = indexes.constBegin(); iit != indexes.constEnd(); ++iit )
+      messages.append( mEntries.at( *iit ).mItem );
+  }
+}
+
+} // namespace Core
+
+} // namespace MessageList
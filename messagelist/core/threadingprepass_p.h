@@ -0,0 +1,195 @@
+/******************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *******************************************************************************/
+
+#ifndef __MESSAGELIST_CORE_THREADINGPREPASS_P_H__
+#define __MESSAGELIST_CORE_THREADINGPREPASS_P_H__
+
+#include <QFuture>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+#include <time.h> // for time_t
+
+namespace MessageList
+{
+
+namespace Core
+{
+
+class MessageItem;
+
+/**
+ * The threading cache work of a large "View Fill" job, done in a worker thread.
+ *
+ * Pass1Fill of such a job only creates the MessageItem objects and queues
+ * them here with addMessage(). Once all the rows of the job have been read
+ * start() runs the worker on a snapshot of the Message-Id cache of the Model.
+ * The worker fills the cache with the new messages in storage order, looks up
+ * the In-Reply-To parent that Pass1Fill would have found for each of them and
+ * the In-Reply-To and References parents that Pass2 will need. It also builds
+ * the date sorted subject lists of the new messages for subject based threading.
+ *
+ * The worker only hashes and compares the MD5 strings: the MessageItem pointers
+ * are opaque values to it and are never dereferenced. The tree is only touched
+ * by the GUI thread, which attaches the messages once the worker has finished.
+ */
+class ThreadingPrepass
+{
+public:
+  enum
+  {
+    /**
+     * Smaller jobs are threaded directly by Pass1Fill:
+     * they take less time than the worker thread round trip saves.
+     */
+    MinimumMessageCount = 2000
+  };
+
+  /**
+   * The threading data of a queued message
+   */
+  class Entry
+  {
+  public:
+    MessageItem * mItem;               ///< The queued message, never dereferenced by the worker
+    QString mMessageIdMD5;
+    QString mInReplyToIdMD5;
+    QString mReferencesIdMD5;
+    QString mStrippedSubjectMD5;
+    time_t mDate;
+
+    // Set by the worker
+
+    MessageItem * mFillParent;         ///< The In-Reply-To parent among the messages read before this one
+    MessageItem * mPerfectParent;      ///< The In-Reply-To parent among all the messages (for Pass2)
+    MessageItem * mReferencesParent;   ///< The References parent among all the messages (for Pass2)
+  };
+
+  /**
+   * If buildSubjectCache is true then the worker also sorts
+   * the new messages by stripped subject.
+   */
+  explicit ThreadingPrepass( bool buildSubjectCache );
+
+  /**
+   * Waits for the worker, if it is running, and deletes the queued
+   * messages that haven't been attached yet (see attachIndex()).
+   */
+  ~ThreadingPrepass();
+
+  /**
+   * Queues a message whose threading data has been already filled.
+   * Must be called before start().
+   */
+  void addMessage( MessageItem *mi );
+
+  /**
+   * Starts the worker on the specified Message-Id cache. The cache is
+   * implicitly shared: the caller must not change it until the worker
+   * has finished and takeMessageIdCache() has been called.
+   */
+  void start( const QHash< QString, MessageItem * > &messageIdCache );
+
+  bool isStarted() const
+    { return mStarted; };
+  bool isFinished() const
+    { return mStarted && mFuture.isFinished(); };
+
+  /**
+   * Returns true if cache is still the one that was passed to start().
+   */
+  bool isSnapshotOf( const QHash< QString, MessageItem * > &cache ) const
+    { return mMessageIdCacheSnapshot.isSharedWith( cache ); };
+
+  /**
+   * Returns the Message-Id cache filled by the worker and releases
+   * all the references to it and to the snapshot.
+   */
+  QHash< QString, MessageItem * > takeMessageIdCache();
+
+  /**
+   * Returns the subject lists built by the worker: for each stripped subject MD5
+   * the new messages sorted by date and then by pointer value.
+   */
+  const QHash< QString, QList< MessageItem * > > & subjectCache() const
+    { return mSubjectCache; };
+  void clearSubjectCache()
+    { mSubjectCache.clear(); };
+
+  int count() const
+    { return mEntries.count(); };
+  const Entry & entry( int idx ) const
+    { return mEntries.at( idx ); };
+
+  // State of the GUI side
+
+  /**
+   * The queued messages before this index have been attached to the tree
+   * or appended to the Pass2 list. The ones after it are still owned by us.
+   */
+  int attachIndex() const
+    { return mAttachIndex; };
+  void setAttachIndex( int attachIndex )
+    { mAttachIndex = attachIndex; };
+
+  /**
+   * The number of messages that were already in the Pass2 list
+   * when the attaching started.
+   */
+  int pass2Base() const
+    { return mPass2Base; };
+  void setPass2Base( int pass2Base )
+    { mPass2Base = pass2Base; };
+
+  /**
+   * Records that the message of the specified entry will be
+   * threaded in Pass2 at index pass2Base() + pass2Count().
+   */
+  void appendPass2Entry( int idx )
+    { mPass2Entries.append( idx ); };
+  int pass2Count() const
+    { return mPass2Entries.count(); };
+  /**
+   * Returns the entry of the message at the specified Pass2 index.
+   */
+  const Entry & pass2Entry( int pass2Index ) const
+    { return mEntries.at( mPass2Entries.at( pass2Index - mPass2Base ) ); };
+
+private:
+  void run();
+
+  QVector< Entry > mEntries;
+  QHash< QString, MessageItem * > mMessageIdCacheSnapshot;
+  QHash< QString, MessageItem * > mMessageIdCache;
+  QHash< QString, QList< MessageItem * > > mSubjectCache;
+  QFuture< void > mFuture;
+  bool mBuildSubjectCache;
+  bool mStarted;
+
+  int mPass2Base;
+  int mAttachIndex;
+  QVector< int > mPass2Entries;
+};
+
+} // namespace Core
+
+} // namespace MessageList
+
+#endif //!__MESSAGELIST_CORE_THREADINGPREPASS_P_H__
@@ -0,0 +1,189 @@
+/******************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *******************************************************************************/
+
+#include "threadingcachetest.h"
+
+#include "core/messageitem.h"
+#include "core/threadingcache_p.h"
+
+#include <QFile>
+
+#include <KTempDir>
+#include <qtest_kde.h>
+
+using namespace MessageList::Core;
+
+QTEST_KDEMAIN_CORE( ThreadingCacheTester )
+
+static const Aggregation::Threading threading = Aggregation::PerfectReferencesAndSubject;
+
+static MessageItem * newMessage( unsigned long uniqueId, const QString &id )
+{
+  MessageItem * mi = new MessageItem();
+  mi->setUniqueId( uniqueId );
+  mi->setMessageIdMD5( id );
+  mi->setInReplyToIdMD5( id + QLatin1String( "-inreplyto" ) );
+  mi->setReferencesIdMD5( id + QLatin1String( "-references" ) );
+  mi->setStrippedSubjectMD5( id + QLatin1String( "-subject" ) );
+  mi->setSubjectIsPrefixed( uniqueId % 2 == 0 );
+  return mi;
+}
+
+static void attach( MessageItem * parent, MessageItem * child, MessageItem::ThreadingStatus status )
+{
+  parent->rawAppendChildItem( child );
+  child->setParent( parent );
+  child->setThreadingStatus( status );
+}
+
+/**
+ * Builds the tree
+ *   root (no unique id, not saved)
+ *     1
+ *       2 (perfect parent)
+ *         3 (parent guessed by subject)
+ *     4 (parent missing)
+ */
+static MessageItem * buildTree()
+{
+  MessageItem * root = new MessageItem();
+  MessageItem * m1 = newMessage( 1, QLatin1String( "one" ) );
+  MessageItem * m2 = newMessage( 2, QLatin1String( "two" ) );
+  MessageItem * m3 = newMessage( 3, QLatin1String( "three" ) );
+  MessageItem * m4 = newMessage( 4, QLatin1String( "four" ) );
+  attach( root, m1, MessageItem::NonThreadable );
+  attach( m1, m2, MessageItem::PerfectParentFound );
+  attach( m2, m3, MessageItem::ImperfectParentFound );
+  attach( root, m4, MessageItem::ParentMissing );
+  return root;
+}
+
+void ThreadingCacheTester::init()
+{
+  mTempDir = new KTempDir();
+  mFileName = mTempDir->name() + QLatin1String( "folder.index.threading" );
+  MessageItem * root = buildTree();
+  QVERIFY( ThreadingCache::save( mFileName, threading, root ) );
+  delete root;
+}
+
+void ThreadingCacheTester::cleanup()
+{
+  delete mTempDir;
+  mTempDir = 0;
+}
+
+void ThreadingCacheTester::test_roundTrip()
+{
+  ThreadingCache * cache = ThreadingCache::load( mFileName, threading );
+  QVERIFY( cache );
+
+  // A fresh fill of the same folder: the MD5 strings come from the cache
+  QList< MessageItem * > messages;
+  for ( unsigned long uniqueId = 1; uniqueId <= 4; ++uniqueId )
+  {
+    MessageItem * mi = new MessageItem();
+    mi->setUniqueId( uniqueId );
+    QVERIFY( cache->fillMessageItemThreadingData( mi ) );
+    cache->addMessageItem( mi );
+    messages.append( mi );
+  }
+
+  QCOMPARE( messages[ 0 ]->messageIdMD5(), QString::fromLatin1( "one" ) );
+  QCOMPARE( messages[ 2 ]->inReplyToIdMD5(), QString::fromLatin1( "three-inreplyto" ) );
+  QCOMPARE( messages[ 2 ]->referencesIdMD5(), QString::fromLatin1( "three-references" ) );
+  QCOMPARE( messages[ 2 ]->strippedSubjectMD5(), QString::fromLatin1( "three-subject" ) );
+  QVERIFY( !messages[ 0 ]->subjectIsPrefixed() );
+  QVERIFY( messages[ 1 ]->subjectIsPrefixed() );
+
+  // The parents found, both perfect and guessed, are restored
+  QCOMPARE( cache->parentOf( messages[ 0 ] ), (MessageItem *)0 );
+  QCOMPARE( cache->parentOf( messages[ 1 ] ), messages[ 0 ] );
+  QCOMPARE( cache->parentOf( messages[ 2 ] ), messages[ 1 ] );
+  QCOMPARE( cache->parentOf( messages[ 3 ] ), (MessageItem *)0 );
+  QVERIFY( !cache->isStale() );
+
+  // A parent that is gone can't be restored
+  cache->removeMessageItem( messages[ 1 ] );
+  QCOMPARE( cache->parentOf( messages[ 2 ] ), (MessageItem *)0 );
+
+  qDeleteAll( messages );
+  delete cache;
+}
+
+void ThreadingCacheTester::test_staleCache()
+{
+  // A message arrived since the cache was written
+  ThreadingCache * cache = ThreadingCache::load( mFileName, threading );
+  QVERIFY( cache );
+  MessageItem * mi = new MessageItem();
+  for ( unsigned long uniqueId = 1; uniqueId <= 4; ++uniqueId )
+  {
+    mi->setUniqueId( uniqueId );
+    QVERIFY( cache->fillMessageItemThreadingData( mi ) );
+  }
+  QVERIFY( !cache->isStale() );
+  mi->setUniqueId( 5 );
+  QVERIFY( !cache->fillMessageItemThreadingData( mi ) );
+  QVERIFY( cache->isStale() );
+  delete cache;
+
+  // A message was removed since the cache was written
+  cache = ThreadingCache::load( mFileName, threading );
+  QVERIFY( cache );
+  for ( unsigned long uniqueId = 1; uniqueId <= 3; ++uniqueId )
+  {
+    mi->setUniqueId( uniqueId );
+    QVERIFY( cache->fillMessageItemThreadingData( mi ) );
+  }
+  QVERIFY( cache->isStale() );
+  delete cache;
+  delete mi;
+}
+
+void ThreadingCacheTester::test_otherThreading()
+{
+  // The parents depend on the threading mode
+  QVERIFY( !ThreadingCache::load( mFileName, Aggregation::PerfectOnly ) );
+}
+
+void ThreadingCacheTester::test_truncatedCache()
+{
+  QFile f( mFileName );
+  QVERIFY( f.open( QIODevice::ReadWrite ) );
+  QVERIFY( f.resize( f.size() - 5 ) );
+  f.close();
+  QVERIFY( !ThreadingCache::load( mFileName, threading ) );
+}
+
+void ThreadingCacheTester::test_corruptCache()
+{
+  QFile f( mFileName );
+  QVERIFY( f.open( QIODevice::WriteOnly | QIODevice::Truncate ) );
+  f.write( "This is not a threading cache" );
+  f.close();
+  QVERIFY( !ThreadingCache::load( mFileName, threading ) );
+}
+
+void ThreadingCacheTester::test_missingCache()
+{
+  QVERIFY( QFile::remove( mFileName ) );
+  QVERIFY( !ThreadingCache::load( mFileName, threading ) );
+}
+
+#include "threadingcachetest.moc"
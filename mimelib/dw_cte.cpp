@@ -46,6 +46,8 @@ static int encode_qp(const char* aIn, size_t aInLen, char* aOut,
 static int decode_qp(const char* aIn, size_t aInLen, char* aOut,
     size_t aOutSize, size_t* aOutLen);
 static size_t calc_qp_buff_size(const char* aIn, size_t aInLen);
+static int set_cte_kernel(int aKernel);
+static int cte_kernel();
 
 
 int DwToCrLfEol(const DwString& aSrcStr, DwString& aDestStr)
@@ -198,6 +200,18 @@ int DwDecodeQuotedPrintable(const DwString& aSrcStr, DwString& aDestStr)
 }
 
 
+int DwSetCteKernel(int aKernel)
+{
+    return set_cte_kernel(aKernel);
+}
+
+
+int DwCteKernel()
+{
+    return cte_kernel();
+}
+
+
 //============================================================================
 // Everything below this line is private to this file (static)
 //============================================================================
@@ -392,6 +406,434 @@ inline int isbase64(int a) {
 #endif
 
 
+//============================================================================
+// Vector kernels
+//
+// The kernels below only handle the common case: whole lines when encoding
+// base64, runs of base64 characters without white space when decoding, and
+// runs of characters that are passed through unchanged by quoted-printable.
+// Everything else is left to the scalar code, so the output is identical
+// for all kernels.
+//============================================================================
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) \
+    || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#   define DW_CTE_SIMD
+#   include <immintrin.h>
+#   define DW_TARGET(x) __attribute__((target(x)))
+#endif
+
+static int cteKernel = kCteKernelAuto;
+
+static int cpu_kernel()
+{
+#if defined(DW_CTE_SIMD)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return kCteKernelAvx2;
+    if (__builtin_cpu_supports("ssse3"))
+        return kCteKernelSsse3;
+    if (__builtin_cpu_supports("sse2"))
+        return kCteKernelSse2;
+#endif
+    return kCteKernelScalar;
+}
+
+static int set_cte_kernel(int aKernel)
+{
+    int supported = cpu_kernel();
+    cteKernel = (aKernel == kCteKernelAuto || aKernel > supported)
+        ? supported : aKernel;
+    return cteKernel;
+}
+
+static int cte_kernel()
+{
+    if (cteKernel == kCteKernelAuto) {
+        cteKernel = cpu_kernel();
+    }
+    return cteKernel;
+}
+
+#define B64_LINE_GROUPS  ((MAXLINE - 3 + 3) / 4)  /* groups of a full line */
+#define B64_LINE_IN      (B64_LINE_GROUPS * 3)
+#define B64_LINE_OUT     (B64_LINE_GROUPS * 4)
+
+static inline void encode_base64_group(const char* aIn, char* aOut)
+{
+    int c1 = aIn[0] & 0xFF;
+    int c2 = aIn[1] & 0xFF;
+    int c3 = aIn[2] & 0xFF;
+    aOut[0] = base64tab[(c1 & 0xFC) >> 2];
+    aOut[1] = base64tab[((c1 & 0x03) << 4) | ((c2 & 0xF0) >> 4)];
+    aOut[2] = base64tab[((c2 & 0x0F) << 2) | ((c3 & 0xC0) >> 6)];
+    aOut[3] = base64tab[c3 & 0x3F];
+}
+
+/* Returns the number of leading chars of aIn that encode_qp() copies as
+ * they are, i.e. that are printable and not '='. */
+static inline size_t qp_plain_run_scalar(const char* aIn, size_t aLen)
+{
+    size_t i = 0;
+    while (i < aLen) {
+        int ch = aIn[i] & 0xFF;
+        if (!((62 <= ch && ch <= 126) || (33 <= ch && ch <= 60)))
+            break;
+        ++i;
+    }
+    return i;
+}
+
+/* Copies the chars of aIn up to the first one that decode_qp() treats as
+ * '=' to aOut, stripping the eighth bit. Returns the number of chars
+ * copied. */
+static inline size_t qp_copy_run_scalar(const char* aIn, size_t aLen,
+    char* aOut)
+{
+    size_t i = 0;
+    while (i < aLen) {
+        int ch = aIn[i] & 0x7F;
+        if (ch == '=')
+            break;
+        aOut[i++] = (char) ch;
+    }
+    return i;
+}
+
+#if defined(DW_CTE_SIMD)
+
+static inline int count_trailing_zeros(unsigned int aMask)
+{
+    return __builtin_ctz(aMask);
+}
+
+DW_TARGET("sse2")
+static size_t qp_plain_run_sse2(const char* aIn, size_t aLen)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i del = _mm_set1_epi8(0x7F);
+    const __m128i equals = _mm_set1_epi8('=');
+    size_t i = 0;
+    for (; i + 16 <= aLen; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (aIn + i));
+        /* signed compares: chars >= 0x80 are negative */
+        __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, space),
+            _mm_cmpgt_epi8(del, v));
+        ok = _mm_andnot_si128(_mm_cmpeq_epi8(v, equals), ok);
+        unsigned int mask = _mm_movemask_epi8(ok);
+        if (mask != 0xFFFF)
+            return i + count_trailing_zeros(~mask);
+    }
+    return i + qp_plain_run_scalar(aIn + i, aLen - i);
+}
+
+/* The AVX2 kernels only handle whole blocks and leave the rest to the SSE
+ * ones. They must not call those themselves: running SSE code before
+ * the upper halves of the AVX registers are cleared on return is slow. */
+DW_TARGET("avx2")
+static size_t qp_plain_run_avx2(const char* aIn, size_t aLen)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i del = _mm256_set1_epi8(0x7F);
+    const __m256i equals = _mm256_set1_epi8('=');
+    size_t i = 0;
+    for (; i + 32 <= aLen; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (aIn + i));
+        __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, space),
+            _mm256_cmpgt_epi8(del, v));
+        ok = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, equals), ok);
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(ok);
+        if (mask != 0xFFFFFFFFu)
+            return i + count_trailing_zeros(~mask);
+    }
+    return i;
+}
+
+/* aOut must have room for 16 chars more than are copied */
+DW_TARGET("sse2")
+static size_t qp_copy_run_sse2(const char* aIn, size_t aLen, char* aOut)
+{
+    const __m128i low7 = _mm_set1_epi8(0x7F);
+    const __m128i equals = _mm_set1_epi8('=');
+    size_t i = 0;
+    for (; i + 16 <= aLen; i += 16) {
+        __m128i v = _mm_and_si128(
+            _mm_loadu_si128((const __m128i*) (aIn + i)), low7);
+        _mm_storeu_si128((__m128i*) (aOut + i), v);
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, equals));
+        if (mask)
+            return i + count_trailing_zeros(mask);
+    }
+    return i + qp_copy_run_scalar(aIn + i, aLen - i, aOut + i);
+}
+
+/* aOut must have room for 32 chars more than are copied */
+DW_TARGET("avx2")
+static size_t qp_copy_run_avx2(const char* aIn, size_t aLen, char* aOut)
+{
+    const __m256i low7 = _mm256_set1_epi8(0x7F);
+    const __m256i equals = _mm256_set1_epi8('=');
+    size_t i = 0;
+    for (; i + 32 <= aLen; i += 32) {
+        __m256i v = _mm256_and_si256(
+            _mm256_loadu_si256((const __m256i*) (aIn + i)), low7);
+        _mm256_storeu_si256((__m256i*) (aOut + i), v);
+        unsigned int mask = (unsigned int)
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, equals));
+        if (mask)
+            return i + count_trailing_zeros(mask);
+    }
+    return i;
+}
+
+/* Spreads the 24 bits of each group of three bytes over four bytes of six
+ * bits and maps them to the base64 alphabet. The input bytes of each group
+ * must have been shuffled to (b1 b0 b2 b1) before. */
+DW_TARGET("ssse3")
+static inline __m128i base64_encode_ssse3(__m128i aIn)
+{
+    const __m128i t0 = _mm_and_si128(aIn, _mm_set1_epi32(0x0FC0FC00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(aIn, _mm_set1_epi32(0x003F03F0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    const __m128i idx = _mm_or_si128(t1, t3);
+
+    /* 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+    __m128i sel = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+    sel = _mm_or_si128(sel, _mm_and_si128(less, _mm_set1_epi8(13)));
+    const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(shift, sel), idx);
+}
+
+DW_TARGET("avx2")
+static inline __m256i base64_encode_avx2(__m256i aIn)
+{
+    const __m256i t0 = _mm256_and_si256(aIn, _mm256_set1_epi32(0x0FC0FC00));
+    const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    const __m256i t2 = _mm256_and_si256(aIn, _mm256_set1_epi32(0x003F03F0));
+    const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    const __m256i idx = _mm256_or_si256(t1, t3);
+
+    __m256i sel = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+    const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+    sel = _mm256_or_si256(sel, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    const __m256i shift = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm256_add_epi8(_mm256_shuffle_epi8(shift, sel), idx);
+}
+
+/* Encodes the B64_LINE_IN bytes at aIn to the B64_LINE_OUT chars of one
+ * line at aOut */
+DW_TARGET("ssse3")
+static void encode_base64_line_ssse3(const char* aIn, char* aOut)
+{
+    const __m128i spread = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+        7, 6, 8, 7, 10, 9, 11, 10);
+    int i = 0;
+    /* each step reads 16 bytes, but only uses 12 of them */
+    for (; i + 16 <= B64_LINE_IN; i += 12, aOut += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (aIn + i));
+        v = base64_encode_ssse3(_mm_shuffle_epi8(v, spread));
+        _mm_storeu_si128((__m128i*) aOut, v);
+    }
+    for (; i < B64_LINE_IN; i += 3, aOut += 4) {
+        encode_base64_group(aIn + i, aOut);
+    }
+}
+
+DW_TARGET("avx2")
+static void encode_base64_line_avx2(const char* aIn, char* aOut)
+{
+    const __m256i spread = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+        7, 6, 8, 7, 10, 9, 11, 10,
+        1, 0, 2, 1, 4, 3, 5, 4,
+        7, 6, 8, 7, 10, 9, 11, 10);
+    int i = 0;
+    /* each step reads 28 bytes, but only uses 24 of them */
+    for (; i + 28 <= B64_LINE_IN; i += 24, aOut += 32) {
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+            _mm_loadu_si128((const __m128i*) (aIn + i))),
+            _mm_loadu_si128((const __m128i*) (aIn + i + 12)), 1);
+        v = base64_encode_avx2(_mm256_shuffle_epi8(v, spread));
+        _mm256_storeu_si256((__m256i*) aOut, v);
+    }
+    for (; i < B64_LINE_IN; i += 3, aOut += 4) {
+        encode_base64_group(aIn + i, aOut);
+    }
+}
+
+/* Maps base64 chars to their six bit values. Sets aValid to false if
+ * any of the chars is not a base64 char. The lookup tables are indexed
+ * by the high nibble (shift, bit) and the low nibble (mask) of the chars;
+ * mask has bit h set if (h << 4 | low nibble) is a base64 char. */
+DW_TARGET("ssse3")
+static inline __m128i base64_decode_ssse3(__m128i aIn, bool& aValid)
+{
+    const __m128i shiftLut = _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i maskLut = _mm_setr_epi8((char) 0xA8,
+        (char) 0xF8, (char) 0xF8, (char) 0xF8, (char) 0xF8, (char) 0xF8,
+        (char) 0xF8, (char) 0xF8, (char) 0xF8, (char) 0xF8,
+        (char) 0xF0, 0x54, 0x50, 0x50, 0x50, 0x54);
+    const __m128i bitLut = _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20,
+        0x40, (char) 0x80, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+
+    const __m128i hi = _mm_and_si128(_mm_srli_epi32(aIn, 4), nibble);
+    const __m128i lo = _mm_and_si128(aIn, nibble);
+    const __m128i mask = _mm_shuffle_epi8(maskLut, lo);
+    const __m128i bit = _mm_shuffle_epi8(bitLut, hi);
+    const __m128i invalid = _mm_cmpeq_epi8(_mm_and_si128(mask, bit),
+        _mm_setzero_si128());
+    aValid = _mm_movemask_epi8(invalid) == 0;
+
+    /* '+' and '/' share the high nibble, but need different shifts */
+    const __m128i isSlash = _mm_cmpeq_epi8(aIn, _mm_set1_epi8('/'));
+    __m128i shift = _mm_shuffle_epi8(shiftLut, hi);
+    shift = _mm_or_si128(_mm_andnot_si128(isSlash, shift),
+        _mm_and_si128(isSlash, _mm_set1_epi8(16)));
+    const __m128i values = _mm_add_epi8(aIn, shift);
+
+    /* pack four six bit values into three bytes */
+    const __m128i ab = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i abc = _mm_madd_epi16(ab, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(abc, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+        14, 13, 12, -1, -1, -1, -1));
+}
+
+DW_TARGET("avx2")
+static inline __m256i base64_decode_avx2(__m256i aIn, bool& aValid)
+{
+    const __m256i shiftLut = _mm256_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i maskLut = _mm256_setr_epi8((char) 0xA8,
+        (char) 0xF8, (char) 0xF8, (char) 0xF8, (char) 0xF8, (char) 0xF8,
+        (char) 0xF8, (char) 0xF8, (char) 0xF8, (char) 0xF8,
+        (char) 0xF0, 0x54, 0x50, 0x50, 0x50, 0x54,
+        (char) 0xA8,
+        (char) 0xF8, (char) 0xF8, (char) 0xF8, (char) 0xF8, (char) 0xF8,
+        (char) 0xF8, (char) 0xF8, (char) 0xF8, (char) 0xF8,
+        (char) 0xF0, 0x54, 0x50, 0x50, 0x50, 0x54);
+    const __m256i bitLut = _mm256_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10,
+        0x20, 0x40, (char) 0x80, 0, 0, 0, 0, 0, 0, 0, 0,
+        0x01, 0x02, 0x04, 0x08, 0x10,
+        0x20, 0x40, (char) 0x80, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi32(aIn, 4), nibble);
+    const __m256i lo = _mm256_and_si256(aIn, nibble);
+    const __m256i mask = _mm256_shuffle_epi8(maskLut, lo);
+    const __m256i bit = _mm256_shuffle_epi8(bitLut, hi);
+    const __m256i invalid = _mm256_cmpeq_epi8(_mm256_and_si256(mask, bit),
+        _mm256_setzero_si256());
+    aValid = _mm256_movemask_epi8(invalid) == 0;
+
+    const __m256i isSlash = _mm256_cmpeq_epi8(aIn, _mm256_set1_epi8('/'));
+    __m256i shift = _mm256_shuffle_epi8(shiftLut, hi);
+    shift = _mm256_blendv_epi8(shift, _mm256_set1_epi8(16), isSlash);
+    const __m256i values = _mm256_add_epi8(aIn, shift);
+
+    const __m256i ab = _mm256_maddubs_epi16(values,
+        _mm256_set1_epi32(0x01400140));
+    const __m256i abc = _mm256_madd_epi16(ab, _mm256_set1_epi32(0x00011000));
+    const __m256i packed = _mm256_shuffle_epi8(abc, _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    /* move the 12 bytes of the high lane next to those of the low lane */
+    return _mm256_permutevar8x32_epi32(packed,
+        _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+}
+
+/* Decodes blocks of 16 base64 chars that contain nothing else. Each block
+ * writes 16 bytes to aOut, of which 12 are used. Returns the number of
+ * chars consumed. */
+DW_TARGET("ssse3")
+static size_t decode_base64_ssse3(const char* aIn, size_t aInLen,
+    char* aOut, size_t aOutSize, size_t* aOutLen)
+{
+    size_t inPos = 0;
+    size_t outPos = 0;
+    while (inPos + 16 <= aInLen && outPos + 16 <= aOutSize) {
+        bool valid;
+        __m128i v = base64_decode_ssse3(
+            _mm_loadu_si128((const __m128i*) (aIn + inPos)), valid);
+        if (!valid)
+            break;
+        _mm_storeu_si128((__m128i*) (aOut + outPos), v);
+        inPos += 16;
+        outPos += 12;
+    }
+    *aOutLen = outPos;
+    return inPos;
+}
+
+DW_TARGET("avx2")
+static size_t decode_base64_avx2(const char* aIn, size_t aInLen,
+    char* aOut, size_t aOutSize, size_t* aOutLen)
+{
+    size_t inPos = 0;
+    size_t outPos = 0;
+    while (inPos + 32 <= aInLen && outPos + 32 <= aOutSize) {
+        bool valid;
+        __m256i v = base64_decode_avx2(
+            _mm256_loadu_si256((const __m256i*) (aIn + inPos)), valid);
+        if (!valid)
+            break;
+        _mm256_storeu_si256((__m256i*) (aOut + outPos), v);
+        inPos += 32;
+        outPos += 24;
+    }
+    *aOutLen = outPos;
+    return inPos;
+}
+
+#endif // DW_CTE_SIMD
+
+
+static size_t qp_plain_run(int aKernel, const char* aIn, size_t aLen)
+{
+#if defined(DW_CTE_SIMD)
+    if (aKernel >= kCteKernelAvx2) {
+        size_t n = qp_plain_run_avx2(aIn, aLen);
+        if (aLen - n >= 32)
+            return n;
+        return n + qp_plain_run_sse2(aIn + n, aLen - n);
+    }
+    if (aKernel >= kCteKernelSse2)
+        return qp_plain_run_sse2(aIn, aLen);
+#endif
+    (void) aKernel;
+    return qp_plain_run_scalar(aIn, aLen);
+}
+
+
+static size_t qp_copy_run(int aKernel, const char* aIn, size_t aLen,
+    char* aOut)
+{
+#if defined(DW_CTE_SIMD)
+    if (aKernel >= kCteKernelAvx2) {
+        size_t n = qp_copy_run_avx2(aIn, aLen, aOut);
+        if (aLen - n >= 32)
+            return n;
+        return n + qp_copy_run_sse2(aIn + n, aLen - n, aOut + n);
+    }
+    if (aKernel >= kCteKernelSse2)
+        return qp_copy_run_sse2(aIn, aLen, aOut);
+#endif
+    (void) aKernel;
+    return qp_copy_run_scalar(aIn, aLen, aOut);
+}
+
+
 static int encode_base64(const char* aIn, size_t aInLen, char* aOut,
     size_t aOutSize, size_t* aOutLen)
 {
@@ -407,8 +849,30 @@ static int encode_base64(const char* aIn, size_t aInLen, char* aOut,
     size_t outPos = 0;
     int c1, c2, c3;
     int lineLen = 0;
+    size_t i = 0;
+#if defined(DW_CTE_SIMD)
+    /* Encode whole lines with the vector kernels. */
+    int kernel = cte_kernel();
+    if (kernel >= kCteKernelSsse3) {
+        for (; i + B64_LINE_GROUPS <= inLen/3; i += B64_LINE_GROUPS) {
+            if (kernel >= kCteKernelAvx2) {
+                encode_base64_line_avx2(aIn+inPos, out+outPos);
+            }
+            else {
+                encode_base64_line_ssse3(aIn+inPos, out+outPos);
+            }
+            inPos  += B64_LINE_IN;
+            outPos += B64_LINE_OUT;
+            const char* cp = DW_EOL;
+            out[outPos++] = *cp++;
+            if (*cp) {
+                out[outPos++] = *cp;
+            }
+        }
+    }
+#endif
     /* Get three characters at a time and encode them. */
-    for (size_t i=0; i < inLen/3; ++i) {
+    for (; i < inLen/3; ++i) {
         c1 = aIn[inPos++] & 0xFF;
         c2 = aIn[inPos++] & 0xFF;
         c3 = aIn[inPos++] & 0xFF;
@@ -489,7 +953,28 @@ static int decode_base64(const char* aIn, size_t aInLen, char* aOut,
     int a1, a2, a3, a4;
     size_t inPos = 0;
     size_t outPos = 0;
+#if defined(DW_CTE_SIMD)
+    int kernel = cte_kernel();
+#endif
     while (inPos < inLen) {
+#if defined(DW_CTE_SIMD)
+        /* Decode runs of base64 chars with the vector kernels, the loop
+         * below takes over at white space, '=' and invalid chars. */
+        size_t n;
+        if (kernel >= kCteKernelAvx2 && inLen - inPos >= 32) {
+            inPos += decode_base64_avx2(aIn+inPos, inLen-inPos,
+                out+outPos, aOutSize-outPos, &n);
+            outPos += n;
+        }
+        if (kernel >= kCteKernelSsse3 && inLen - inPos >= 16) {
+            inPos += decode_base64_ssse3(aIn+inPos, inLen-inPos,
+                out+outPos, aOutSize-outPos, &n);
+            outPos += n;
+        }
+        if (inPos >= inLen) {
+            break;
+        }
+#endif
         a1 = a2 = a3 = a4 = 0;
         while (inPos < inLen) {
             a1 = aIn[inPos++] & 0xFF;
@@ -595,10 +1080,26 @@ static int encode_qp(const char* aIn, size_t aInLen, char* aOut,
     if (!aIn || !aOut || !aOutLen) {
         return -1;
     }
+    int kernel = cte_kernel();
     inPos  = 0;
     outPos = 0;
     lineLen = 0;
     while (inPos < aInLen) {
+        /* Copy runs of normal printable chars that cannot end a line */
+        if (kernel >= kCteKernelSse2 && lineLen > 0 && lineLen < MAXLINE-4) {
+            size_t n = aInLen-inPos;
+            if (n > MAXLINE-4-lineLen) {
+                n = MAXLINE-4-lineLen;
+            }
+            n = qp_plain_run(kernel, aIn+inPos, n);
+            if (n > 0) {
+                memcpy(aOut+outPos, aIn+inPos, n);
+                inPos += n;
+                outPos += n;
+                lineLen += n;
+                continue;
+            }
+        }
         ch = aIn[inPos++] & 0xFF;
         /* '.' at beginning of line (confuses some SMTPs) */
         if (lineLen == 0 && ch == '.') {
@@ -701,22 +1202,21 @@ static int encode_qp(const char* aIn, size_t aInLen, char* aOut,
 
 
 static int decode_qp(const char* aIn, size_t aInLen, char* aOut,
-    size_t /* aOutSize */, size_t* aOutLen)
+    size_t aOutSize, size_t* aOutLen)
 {
-    size_t i, inPos, outPos, lineLen, nextLineStart, numChars, charsEnd;
+    size_t inPos, outPos, lineLen, nextLineStart, numChars, charsEnd;
     int isEolFound, softLineBrk, isError;
     int ch, c1, c2;
 
     if (!aIn || !aOut || !aOutLen)
         return -1;
+    int kernel = cte_kernel();
     isError = 0;
     inPos = 0;
     outPos = 0;
-    for (i=0; i < aInLen; ++i) {
-        if (aIn[i] == 0) {
-            aInLen = i;
-            break;
-        }
+    const char* nul = (const char*) memchr(aIn, 0, aInLen);
+    if (nul) {
+        aInLen = nul - aIn;
     }
     if (aInLen == 0) {
         aOut[0] = 0;
@@ -725,15 +1225,9 @@ static int decode_qp(const char* aIn, size_t aInLen, char* aOut,
     }
     while (inPos < aInLen) {
         /* Get line */
-        lineLen = 0;
-        isEolFound = 0;
-        while (!isEolFound && lineLen < aInLen - inPos) {
-            ch = aIn[inPos+lineLen];
-            ++lineLen;
-            if (ch == '\n') {
-                isEolFound = 1;
-            }
-        }
+        const char* eol = (const char*) memchr(aIn+inPos, '\n', aInLen-inPos);
+        isEolFound = (eol != 0);
+        lineLen = isEolFound ? (size_t) (eol - (aIn+inPos)) + 1 : aInLen - inPos;
         nextLineStart = inPos + lineLen;
         numChars = lineLen;
         /* Remove white space from end of line */
@@ -748,6 +1242,17 @@ static int decode_qp(const char* aIn, size_t aInLen, char* aOut,
         /* Decode line */
         softLineBrk = 0;
         while (inPos < charsEnd) {
+            /* Copy runs of chars up to the next '=' */
+            if (kernel >= kCteKernelSse2
+                && outPos + (charsEnd-inPos) + 32 <= aOutSize) {
+                size_t n = qp_copy_run(kernel, aIn+inPos, charsEnd-inPos,
+                    aOut+outPos);
+                inPos += n;
+                outPos += n;
+                if (inPos >= charsEnd) {
+                    break;
+                }
+            }
             ch = aIn[inPos++] & 0x7F;
             if (ch != '=') {
                 /* Normal printable char */
@@ -811,10 +1316,24 @@ static size_t calc_qp_buff_size(const char* aIn, size_t aInLen)
     if (!aIn || aInLen == 0) {
         return 0;
     }
+    int kernel = cte_kernel();
     inPos  = 0;
     outLen = 0;
     lineLen = 0;
     while (inPos < aInLen) {
+        if (kernel >= kCteKernelSse2 && lineLen > 0 && lineLen < MAXLINE-4) {
+            size_t n = aInLen-inPos;
+            if (n > MAXLINE-4-lineLen) {
+                n = MAXLINE-4-lineLen;
+            }
+            n = qp_plain_run(kernel, aIn+inPos, n);
+            if (n > 0) {
+                inPos += n;
+                outLen += n;
+                lineLen += n;
+                continue;
+            }
+        }
         ch = aIn[inPos++] & 0xFF;
         /* '.' at beginning of line (confuses some SMTPs) */
         if (lineLen == 0 && ch == '.') {
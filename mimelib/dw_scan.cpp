@@ -0,0 +1,145 @@
+//=============================================================================
+// File:       dw_scan.cpp
+// Contents:   Function definitions for scanning raw messages and mbox files
+//=============================================================================
+
+#define DW_IMPLEMENTATION
+
+#include <mimelib/config.h>
+#include <mimelib/debug.h>
+#include <string.h>
+#include <mimelib/utility.h>
+
+static size_t find_lf_followed_by(const char* aBuf, size_t aLen, size_t aPos,
+    char aNext1, char aNext2);
+
+
+size_t DwFindFromLine(const char* aBuf, size_t aLen, size_t aPos)
+{
+    assert(aBuf != 0);
+    if (aPos >= aLen) {
+        return (size_t) -1;
+    }
+    if ((aPos == 0 || aBuf[aPos-1] == '\n')
+        && aLen - aPos >= 5 && memcmp(aBuf + aPos, "From ", 5) == 0) {
+        return aPos;
+    }
+    size_t i = aPos;
+    while ((i = find_lf_followed_by(aBuf, aLen, i, 'F', 'F')) < aLen) {
+        if (aLen - i > 5 && memcmp(aBuf + i + 1, "From ", 5) == 0) {
+            return i + 1;
+        }
+        ++i;
+    }
+    return (size_t) -1;
+}
+
+
+size_t DwFindHeaderEnd(const char* aBuf, size_t aLen)
+{
+    assert(aBuf != 0);
+    size_t i = 0;
+    while ((i = find_lf_followed_by(aBuf, aLen, i, '\n', '\r')) < aLen) {
+        if (aBuf[i+1] == '\n' || (i + 2 < aLen && aBuf[i+2] == '\n')) {
+            return i;
+        }
+        ++i;
+    }
+    return (size_t) -1;
+}
+
+
+//============================================================================
+// Everything below this line is private to this file (static)
+//============================================================================
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) \
+    || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#   define DW_SCAN_SIMD
+#   include <immintrin.h>
+#   define DW_TARGET(x) __attribute__((target(x)))
+#endif
+
+/* Returns the position of the first '\n' at or after aPos that is followed
+ * by aNext1 or aNext2, or aLen if there is none. */
+static size_t find_lf_scalar(const char* aBuf, size_t aLen, size_t aPos,
+    char aNext1, char aNext2)
+{
+    const char* end = aBuf + aLen;
+    const char* p = aBuf + aPos;
+    while (p < end && (p = (const char*) memchr(p, '\n', end - p)) != 0) {
+        if (p + 1 < end && (p[1] == aNext1 || p[1] == aNext2)) {
+            return p - aBuf;
+        }
+        ++p;
+    }
+    return aLen;
+}
+
+#if defined(DW_SCAN_SIMD)
+
+/* Compares each char and the one following it at once, so every block
+ * loads 16 (32) chars plus one. */
+DW_TARGET("sse2")
+static size_t find_lf_sse2(const char* aBuf, size_t aLen, size_t aPos,
+    char aNext1, char aNext2)
+{
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i next1 = _mm_set1_epi8(aNext1);
+    const __m128i next2 = _mm_set1_epi8(aNext2);
+    size_t i = aPos;
+    for (; i + 17 <= aLen; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (aBuf + i));
+        __m128i w = _mm_loadu_si128((const __m128i*) (aBuf + i + 1));
+        __m128i hit = _mm_and_si128(_mm_cmpeq_epi8(v, lf),
+            _mm_or_si128(_mm_cmpeq_epi8(w, next1), _mm_cmpeq_epi8(w, next2)));
+        unsigned int mask = _mm_movemask_epi8(hit);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return find_lf_scalar(aBuf, aLen, i, aNext1, aNext2);
+}
+
+/* Only handles whole blocks; returns the position of the first match or
+ * the position up to which there is none. The caller continues with the
+ * SSE2 kernel, see the comment on the AVX2 kernels in dw_cte.cpp. */
+DW_TARGET("avx2")
+static size_t find_lf_avx2(const char* aBuf, size_t aLen, size_t aPos,
+    char aNext1, char aNext2)
+{
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i next1 = _mm256_set1_epi8(aNext1);
+    const __m256i next2 = _mm256_set1_epi8(aNext2);
+    size_t i = aPos;
+    for (; i + 33 <= aLen; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (aBuf + i));
+        __m256i w = _mm256_loadu_si256((const __m256i*) (aBuf + i + 1));
+        __m256i hit = _mm256_and_si256(_mm256_cmpeq_epi8(v, lf),
+            _mm256_or_si256(_mm256_cmpeq_epi8(w, next1),
+                _mm256_cmpeq_epi8(w, next2)));
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(hit);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return i;
+}
+
+#endif // defined(DW_SCAN_SIMD)
+
+/* The scanners use the kernel selected for the content transfer encodings,
+ * see DwSetCteKernel(). */
+static size_t find_lf_followed_by(const char* aBuf, size_t aLen, size_t aPos,
+    char aNext1, char aNext2)
+{
+#if defined(DW_SCAN_SIMD)
+    switch (DwCteKernel()) {
+    case kCteKernelAvx2:
+        aPos = find_lf_avx2(aBuf, aLen, aPos, aNext1, aNext2);
+        return find_lf_sse2(aBuf, aLen, aPos, aNext1, aNext2);
+    case kCteKernelSsse3:
+    case kCteKernelSse2:
+        return find_lf_sse2(aBuf, aLen, aPos, aNext1, aNext2);
+    }
+#endif
+    return find_lf_scalar(aBuf, aLen, aPos, aNext1, aNext2);
+}
@@ -195,7 +195,8 @@ inline void delete_rep_safely(DwStringRep* rep)
     }
 #endif //  defined(DW_DEBUG_VERSION) || defined(DW_DEVELOPMENT_VERSION)
     --rep->mRefCount;
-    if (rep->mRefCount == 0) {
+    // A rep of a DwStringRegion is also referenced by the region
+    if (rep->mRefCount == 0 || (rep->mRefCount == 1 && rep->mRegion != 0)) {
         delete rep;
     }
 }
@@ -217,6 +218,9 @@ DwStringRep::DwStringRep(char* aBuf, size_t aSize)
     mBuffer = aBuf;
     mRefCount = 1;
     mPageMod = 0;
+    mRegion = 0;
+    mRegionPrev = 0;
+    mRegionNext = 0;
 }
 
 DwStringRep::DwStringRep(FILE* aFile, size_t aSize)
@@ -230,6 +234,9 @@ DwStringRep::DwStringRep(FILE* aFile, size_t aSize)
     mPageMod = tell % pagesize;
     mSize = aSize;
     mRefCount = 1;
+    mRegion = 0;
+    mRegionPrev = 0;
+    mRegionNext = 0;
 
     mBuffer = (char *)mmap(0, aSize + mPageMod, PROT_READ, MAP_SHARED, fileno(aFile), tell - mPageMod) + mPageMod;
     ++mPageMod;
@@ -241,6 +248,22 @@ DwStringRep::DwStringRep(FILE* aFile, size_t aSize)
 }
 
 
+// The rep points into the region and is never written to. It starts with
+// one reference held by the region, which DwStringRegion::Detach() drops.
+
+DwStringRep::DwStringRep(DwStringRegion* aRegion, size_t aStart, size_t aLen)
+{
+    assert(aRegion != 0);
+    assert(aStart + aLen <= aRegion->Size());
+    mSize = aLen;
+    mBuffer = aRegion->mData + aStart;
+    mRefCount = 2;
+    mPageMod = 0;
+    mRegion = 0;
+    aRegion->Add(this);
+}
+
+
 DwStringRep::~DwStringRep()
 {
 #if defined (DW_DEBUG_VERSION) || defined (DW_DEVELOPMENT_VERSION)
@@ -252,7 +275,9 @@ DwStringRep::~DwStringRep()
         abort();
     }
 #endif //  defined (DW_DEBUG_VERSION) || defined (DW_DEVELOPMENT_VERSION)
-    if (mPageMod) {
+    if (mRegion) {
+        mRegion->Remove(this);
+    } else if (mPageMod) {
 	--mPageMod;
 	munmap(mBuffer - mPageMod, mSize + mPageMod);
     } else {
@@ -305,6 +330,103 @@ void DwStringRep::operator delete(void* aRep, size_t)
 #endif
 
 
+//--------------------------------------------------------------------------
+
+
+DwStringRegion* DwStringRegion::Map(int aFd, size_t aSize)
+{
+    if (aFd < 0 || aSize == 0) {
+        return 0;
+    }
+    void* data = mmap(0, aSize, PROT_READ, MAP_SHARED, aFd, 0);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+    return new DwStringRegion((char*) data, aSize);
+}
+
+
+DwStringRegion::DwStringRegion(char* aData, size_t aSize)
+{
+    mData = aData;
+    mSize = aSize;
+    mReps = 0;
+    mIsReleased = DwFalse;
+}
+
+
+DwStringRegion::~DwStringRegion()
+{
+    assert(mReps == 0);
+    munmap(mData, mSize);
+}
+
+
+void DwStringRegion::Add(DwStringRep* aRep)
+{
+    aRep->mRegion = this;
+    aRep->mRegionPrev = 0;
+    aRep->mRegionNext = mReps;
+    if (mReps) {
+        mReps->mRegionPrev = aRep;
+    }
+    mReps = aRep;
+}
+
+
+void DwStringRegion::Remove(DwStringRep* aRep)
+{
+    assert(aRep->mRegion == this);
+    if (aRep->mRegionPrev) {
+        aRep->mRegionPrev->mRegionNext = aRep->mRegionNext;
+    }
+    else {
+        mReps = aRep->mRegionNext;
+    }
+    if (aRep->mRegionNext) {
+        aRep->mRegionNext->mRegionPrev = aRep->mRegionPrev;
+    }
+    aRep->mRegion = 0;
+    aRep->mRegionPrev = 0;
+    aRep->mRegionNext = 0;
+    if (mIsReleased && mReps == 0) {
+        delete this;
+    }
+}
+
+
+void DwStringRegion::Detach()
+{
+    while (mReps) {
+        DwStringRep* rep = mReps;
+        size_t size = rep->mSize + 1;
+        char* buf = mem_alloc(&size);
+        assert(buf != 0);
+        mem_copy(rep->mBuffer, rep->mSize, buf);
+        buf[rep->mSize] = 0;
+        mReps = rep->mRegionNext;
+        if (mReps) {
+            mReps->mRegionPrev = 0;
+        }
+        rep->mRegion = 0;
+        rep->mRegionNext = 0;
+        rep->mBuffer = buf;
+        rep->mSize = size;
+        --rep->mRefCount;
+    }
+}
+
+
+void DwStringRegion::Release()
+{
+    assert(!mIsReleased);
+    mIsReleased = DwTrue;
+    if (mReps == 0) {
+        delete this;
+    }
+}
+
+
 //--------------------------------------------------------------------------
 
 const size_t DwString::kEmptyBufferSize = 4;
@@ -451,6 +573,35 @@ DwString::DwString(char* aBuf, size_t aSize, size_t aStart, size_t aLen)
 }
 
 
+DwString::DwString(DwStringRegion* aRegion, size_t aStart, size_t aLen)
+{
+    assert(aRegion != 0);
+    assert(aStart <= aRegion->Size());
+    assert(aLen <= aRegion->Size() - aStart);
+    if (sEmptyRep == 0) {
+        sEmptyBuffer[0] = 0;
+        sEmptyRep = new DwStringRep(sEmptyBuffer, kEmptyBufferSize);
+        assert(sEmptyRep != 0);
+    }
+    DBG_STMT(sEmptyRep->CheckInvariants())
+    // Set valid values, in case an exception is thrown
+    mRep = new_rep_reference(sEmptyRep);
+    mStart = 0;
+    mLength = 0;
+    if (aRegion == 0 || aLen == 0
+        || aStart > aRegion->Size() || aLen > aRegion->Size() - aStart) {
+        return;
+    }
+    DwStringRep* rep = new DwStringRep(aRegion, aStart, aLen);
+    assert(rep != 0);
+    if (rep != 0) {
+        delete_rep_safely(mRep);
+        mRep = rep;
+        mLength = aLen;
+    }
+}
+
+
 DwString::~DwString()
 {
     assert(mRep != 0);
@@ -43,15 +43,23 @@ typedef std::string DwString;
 // DwStringRep is an implementation class that should not be used externally.
 //=============================================================================
 
+class DwStringRegion;
+
 struct DW_EXPORT DwStringRep {
     DwStringRep(char* aBuf, size_t aSize);
     DwStringRep(FILE* aFile, size_t aSize);
+    DwStringRep(DwStringRegion* aRegion, size_t aStart, size_t aLen);
     ~DwStringRep();
     // void* operator new(size_t);
     // void operator delete(void*, size_t);
     size_t mSize;
     char* mBuffer;
     int mRefCount, mPageMod;
+    // Reps pointing into a DwStringRegion hold an extra reference, so that
+    // they are never modified in place.
+    DwStringRegion* mRegion;
+    DwStringRep* mRegionPrev;
+    DwStringRep* mRegionNext;
 //private:
     // memory management
     // DwStringRep* mNext;
@@ -62,6 +70,54 @@ public:
 };
 
 
+//=============================================================================
+//+ Name DwStringRegion -- Shared read-only memory mapping of a file
+//+ Description
+//. {\tt DwStringRegion} maps a file, typically an mbox folder, into memory.
+//. {\tt DwString} objects created from the region point into the mapping
+//. instead of holding a copy of the bytes; they are copied only when they
+//. are modified.
+//.
+//. The owner of the region must call {\tt Detach()} before the mapped part
+//. of the file is changed or truncated, and {\tt Release()} when it no
+//. longer needs the region. A released region is unmapped as soon as no
+//. {\tt DwString} points into it anymore.
+//=============================================================================
+
+class DW_EXPORT DwStringRegion {
+
+public:
+
+    static DwStringRegion* Map(int aFd, size_t aSize);
+    //. Maps the first {\tt aSize} bytes of the file {\tt aFd} read-only.
+    //. Returns NULL if the file cannot be mapped.
+
+    const char* Data() const { return mData; }
+    size_t Size() const { return mSize; }
+
+    void Detach();
+    //. Gives every {\tt DwString} that points into the region a private copy
+    //. of its contents.
+
+    void Release();
+    //. Gives up the owner's reference to the region.
+
+private:
+
+    DwStringRegion(char* aData, size_t aSize);
+    ~DwStringRegion();
+    void Add(DwStringRep* aRep);
+    void Remove(DwStringRep* aRep);
+
+    char* mData;
+    size_t mSize;
+    DwStringRep* mReps;
+    DwBool mIsReleased;
+
+    friend struct DwStringRep;
+};
+
+
 //=============================================================================
 //+ Name DwString -- String class
 //+ Description
@@ -107,6 +163,7 @@ public:
     DwString(const char* aCstr);
     DwString(size_t aLen, char aChar);
     DwString(char* aBuf, size_t aSize, size_t aStart, size_t aLen);
+    DwString(DwStringRegion* aRegion, size_t aStart, size_t aLen);
     //. The first constructor is the default constructor, which sets the
     //. {\tt DwString} object's contents to be empty.
     //.
@@ -138,6 +195,11 @@ public:
     //. Because {\tt DwString} will free the buffer using {\tt delete []},
     //. the buffer should have been allocated using {\tt new}.
     //. See also: TakeBuffer(), and ReleaseBuffer().
+    //.
+    //. The seventh constructor is an {\it advanced} constructor that sets
+    //. the contents of the new {\tt DwString} object to the {\tt aLen}
+    //. characters starting at offset {\tt aStart} of the memory mapped
+    //. {\tt aRegion}, without copying them.
 
     virtual ~DwString();
 
@@ -23,6 +23,8 @@
 #ifndef DW_UTILITY_H
 #define DW_UTILITY_H
 
+#include <stddef.h>
+
 #ifndef DW_CONFIG_H
 #include <mimelib/config.h>
 #endif
@@ -47,4 +49,29 @@ int  DW_EXPORT DwDecodeBase64(const DwString& aSrcStr, DwString& aDestStr);
 int  DW_EXPORT DwEncodeQuotedPrintable(const DwString& aSrcStr, DwString& aDestStr);
 int  DW_EXPORT DwDecodeQuotedPrintable(const DwString& aSrcStr, DwString& aDestStr);
 
+// Implementations of the base64 and quoted-printable functions above. By
+// default the fastest one the CPU supports is used; DwSetCteKernel() selects
+// another one, e.g. for comparing them. It returns the kernel actually in
+// effect, which is the fastest supported one not faster than aKernel.
+enum {
+    kCteKernelAuto = -1,
+    kCteKernelScalar,
+    kCteKernelSse2,
+    kCteKernelSsse3,
+    kCteKernelAvx2
+};
+int  DW_EXPORT DwSetCteKernel(int aKernel);
+int  DW_EXPORT DwCteKernel();
+
+// Scanning of raw messages and mbox files. Both functions return
+// (size_t) -1 if nothing is found and use the kernel selected with
+// DwSetCteKernel().
+//
+// DwFindFromLine() returns the position of the first line starting with
+// "From " that starts at or after aPos. DwFindHeaderEnd() returns the
+// position of the line break ending the last header line, i.e. of the
+// first "\n" followed by an empty line.
+size_t DW_EXPORT DwFindFromLine(const char* aBuf, size_t aLen, size_t aPos);
+size_t DW_EXPORT DwFindHeaderEnd(const char* aBuf, size_t aLen);
+
 #endif
@@ -0,0 +1,158 @@
+// Checks that all kernels of the base64 and quoted-printable codecs produce
+// the same output as the scalar one and reports their throughput.
+//
+// usage: bench_cte [ <megabytes> ]
+
+#include <mimelib/string.h>
+#include <mimelib/utility.h>
+
+#include <iostream>
+#include <cassert>
+#include <cstdlib>
+#include <ctime>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+
+static const char * kernelNames[] = { "scalar", "sse2", "ssse3", "avx2" };
+
+typedef int (*Codec)( const DwString &, DwString & );
+
+static DwString randomBinary( size_t len ) {
+  DwString s( len, '\0' );
+  char * p = (char*)s.data();
+  for ( size_t i = 0 ; i < len ; ++i )
+    p[i] = (char)( rand() & 0xFF );
+  return s;
+}
+
+// Mostly printable text with some spaces at line ends, '=', 8-bit chars,
+// lines starting with '.' or "From " and overlong lines
+static DwString randomText( size_t len ) {
+  static const char * snippets[] = {
+    "\n", " \n", "\nFrom ", "\n.", "=", "\xe4\xf6\xfc", "\t", " ",
+    "\r\n", "From ", "........................................................................"
+  };
+  DwString s;
+  while ( s.length() < len ) {
+    int r = rand() % 16;
+    if ( r < 11 )
+      s.append( snippets[r] );
+    else {
+      for ( int n = rand() % 120 ; n > 0 ; --n )
+        s.append( 1, (char)( 33 + rand() % 94 ) );
+    }
+  }
+  return s.substr( 0, len );
+}
+
+// base64 with line breaks, stray white space, invalid chars and padding
+static DwString mangledBase64( const DwString & encoded ) {
+  DwString s;
+  for ( size_t i = 0 ; i < encoded.length() ; ++i ) {
+    int r = rand() % 1000;
+    if ( r == 0 )
+      s.append( 1, ' ' );
+    else if ( r == 1 )
+      s.append( "\r\n" );
+    else if ( r == 2 )
+      s.append( 1, '*' );
+    s.append( 1, encoded[i] );
+  }
+  return s;
+}
+
+static DwString run( int kernel, Codec codec, const DwString & in, int * result = 0 ) {
+  DwSetCteKernel( kernel );
+  DwString out;
+  int r = codec( in, out );
+  if ( result )
+    *result = r;
+  return out;
+}
+
+// Runs codec on in with every kernel and checks the output against the
+// scalar kernel
+static void check( Codec codec, const DwString & in, const char * what ) {
+  int scalarResult;
+  const DwString expected = run( kCteKernelScalar, codec, in, &scalarResult );
+  for ( int kernel = kCteKernelScalar + 1 ; kernel <= kCteKernelAvx2 ; ++kernel ) {
+    if ( DwSetCteKernel( kernel ) != kernel )
+      break;
+    int result;
+    const DwString out = run( kernel, codec, in, &result );
+    if ( out != expected || result != scalarResult ) {
+      cerr << what << ": " << kernelNames[kernel] << " differs from scalar for input of "
+           << in.length() << " bytes" << endl;
+      exit( 1 );
+    }
+  }
+}
+
+static void bench( Codec codec, const DwString & in, const char * what ) {
+  for ( int kernel = kCteKernelScalar ; kernel <= kCteKernelAvx2 ; ++kernel ) {
+    if ( DwSetCteKernel( kernel ) != kernel )
+      break;
+    DwString out;
+    int rounds = 0;
+    const clock_t start = clock();
+    clock_t elapsed;
+    do {
+      codec( in, out );
+      ++rounds;
+      elapsed = clock() - start;
+    } while ( elapsed < CLOCKS_PER_SEC / 2 );
+    const double mb = double( in.length() ) * rounds / ( 1024 * 1024 );
+    cout << what << " " << kernelNames[kernel] << ": "
+         << mb / ( double( elapsed ) / CLOCKS_PER_SEC ) << " MB/s" << endl;
+  }
+}
+
+int main( int argc, char * argv[] ) {
+
+  if ( argc > 2 ) {
+    cerr << "usage: bench_cte [ <megabytes> ]" << endl;
+    exit( 1 );
+  }
+  const size_t size = ( argc == 2 ? atoi( argv[1] ) : 4 ) * 1024 * 1024;
+
+  srand( 42 );
+  cout << "Kernel in use: " << kernelNames[DwSetCteKernel( kCteKernelAuto )] << endl;
+
+  // Every length around the block and line sizes of the kernels
+  for ( size_t len = 0 ; len < 400 ; ++len ) {
+    const DwString binary = randomBinary( len );
+    check( DwEncodeBase64, binary, "encode base64" );
+    const DwString encoded = run( kCteKernelScalar, DwEncodeBase64, binary );
+    check( DwDecodeBase64, encoded, "decode base64" );
+    check( DwDecodeBase64, mangledBase64( encoded ), "decode mangled base64" );
+    check( DwDecodeBase64, encoded.substr( 0, len ), "decode truncated base64" );
+
+    const DwString text = randomText( len );
+    check( DwEncodeQuotedPrintable, text, "encode qp" );
+    check( DwEncodeQuotedPrintable, binary, "encode binary qp" );
+    const DwString qp = run( kCteKernelScalar, DwEncodeQuotedPrintable, text );
+    check( DwDecodeQuotedPrintable, qp, "decode qp" );
+    check( DwDecodeQuotedPrintable, text, "decode unencoded qp" );
+    check( DwDecodeQuotedPrintable, binary, "decode binary qp" );
+  }
+
+  const DwString binary = randomBinary( size );
+  const DwString base64 = run( kCteKernelScalar, DwEncodeBase64, binary );
+  const DwString text = randomText( size );
+  const DwString qp = run( kCteKernelScalar, DwEncodeQuotedPrintable, text );
+  check( DwEncodeBase64, binary, "encode base64" );
+  check( DwDecodeBase64, base64, "decode base64" );
+  check( DwDecodeBase64, mangledBase64( base64 ), "decode mangled base64" );
+  check( DwEncodeQuotedPrintable, text, "encode qp" );
+  check( DwDecodeQuotedPrintable, qp, "decode qp" );
+  assert( run( kCteKernelAuto, DwDecodeBase64, base64 ) == binary );
+
+  bench( DwEncodeBase64, binary, "encode base64" );
+  bench( DwDecodeBase64, base64, "decode base64" );
+  bench( DwEncodeQuotedPrintable, text, "encode qp" );
+  bench( DwDecodeQuotedPrintable, qp, "decode qp" );
+
+  return 0;
+}
@@ -0,0 +1,202 @@
+// Checks that all kernels of DwFindFromLine() and DwFindHeaderEnd() find
+// the same positions as a plain byte by byte scan and reports their
+// throughput on a synthetic mbox file.
+//
+// usage: bench_mboxscan [ <megabytes> ]
+
+#include <mimelib/string.h>
+#include <mimelib/utility.h>
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+
+static const char * kernelNames[] = { "scalar", "sse2", "ssse3", "avx2" };
+
+static const size_t npos = (size_t) -1;
+
+static size_t bytewiseFindFromLine( const char * buf, size_t len, size_t pos ) {
+  for ( size_t i = pos ; i + 5 <= len ; ++i )
+    if ( ( i == 0 || buf[i - 1] == '\n' ) && memcmp( buf + i, "From ", 5 ) == 0 )
+      return i;
+  return npos;
+}
+
+static size_t bytewiseFindHeaderEnd( const char * buf, size_t len ) {
+  for ( size_t i = 0 ; i + 1 < len ; ++i ) {
+    if ( buf[i] != '\n' )
+      continue;
+    if ( buf[i + 1] == '\n' || ( buf[i + 1] == '\r' && i + 2 < len && buf[i + 2] == '\n' ) )
+      return i;
+  }
+  return npos;
+}
+
+// Messages with lines that almost look like separators or empty lines
+static DwString randomMbox( size_t len ) {
+  static const char * snippets[] = {
+    "\n", "\r\n", "\nFrom ", "\n>From ", "\nFrom", "\nFro", "\nF", "From ",
+    "\n\r", "\r\n\r\n", "\n\n", "\nSubject: From here\n", "Fromage\n"
+  };
+  DwString s;
+  while ( s.length() < len ) {
+    int r = rand() % 20;
+    if ( r < 13 )
+      s.append( snippets[r] );
+    else {
+      for ( int n = rand() % 80 ; n > 0 ; --n )
+        s.append( 1, (char)( 32 + rand() % 95 ) );
+    }
+  }
+  return s.substr( 0, len );
+}
+
+// A realistic message: separator, header, empty line and body lines of
+// typical length, some of them quoted or starting with 'F'
+static void appendMessage( DwString & mbox ) {
+  mbox.append( "From someone@example.com Mon Jan  1 12:34:56 2007\n" );
+  for ( int n = 8 + rand() % 16 ; n > 0 ; --n ) {
+    mbox.append( "X-Header-Field: " );
+    for ( int m = 20 + rand() % 50 ; m > 0 ; --m )
+      mbox.append( 1, (char)( 'a' + rand() % 26 ) );
+    mbox.append( "\n" );
+  }
+  mbox.append( "\n" );
+  for ( int n = 20 + rand() % 200 ; n > 0 ; --n ) {
+    int r = rand() % 10;
+    if ( r == 0 )
+      mbox.append( "> " );
+    else if ( r == 1 )
+      mbox.append( ">From " );
+    else if ( r == 2 )
+      mbox.append( "Further " );
+    for ( int m = rand() % 76 ; m > 0 ; --m )
+      mbox.append( 1, (char)( 'a' + rand() % 26 ) );
+    mbox.append( "\n" );
+  }
+  mbox.append( "\n" );
+}
+
+static void check( const DwString & mbox, const char * what ) {
+  const char * buf = mbox.data();
+  const size_t len = mbox.length();
+  for ( int kernel = kCteKernelScalar ; kernel <= kCteKernelAvx2 ; ++kernel ) {
+    if ( DwSetCteKernel( kernel ) != kernel )
+      break;
+    size_t expected = npos;
+    size_t pos = 0;
+    do {
+      expected = bytewiseFindFromLine( buf, len, pos );
+      if ( DwFindFromLine( buf, len, pos ) != expected ) {
+        cerr << what << ": " << kernelNames[kernel] << " finds a different From_ line after "
+             << pos << " in " << len << " bytes" << endl;
+        exit( 1 );
+      }
+      pos = expected + 1;
+    } while ( expected != npos );
+    for ( pos = 0 ; pos < len ; pos += 1 + rand() % 64 ) {
+      if ( DwFindHeaderEnd( buf + pos, len - pos ) != bytewiseFindHeaderEnd( buf + pos, len - pos ) ) {
+        cerr << what << ": " << kernelNames[kernel] << " finds a different header end after "
+             << pos << " in " << len << " bytes" << endl;
+        exit( 1 );
+      }
+    }
+  }
+}
+
+static size_t countFromLines( const char * buf, size_t len, bool bytewise ) {
+  size_t count = 0;
+  size_t pos = 0;
+  while ( ( pos = bytewise ? bytewiseFindFromLine( buf, len, pos )
+                           : DwFindFromLine( buf, len, pos ) ) != npos ) {
+    ++count;
+    ++pos;
+  }
+  return count;
+}
+
+static std::vector<size_t> messageStarts;
+
+// Scans the header of each message of the block, so the throughput refers
+// to the header bytes only
+static size_t sumHeaderEnds( const char * buf, size_t len, bool bytewise ) {
+  size_t sum = 0;
+  for ( size_t i = 0 ; i < messageStarts.size() ; ++i ) {
+    const size_t pos = messageStarts[i];
+    const size_t end = bytewise ? bytewiseFindHeaderEnd( buf + pos, len - pos )
+                                : DwFindHeaderEnd( buf + pos, len - pos );
+    if ( end != npos )
+      sum += end;
+  }
+  return sum;
+}
+
+typedef size_t (*Scan)( const char *, size_t, bool );
+
+// Runs scan on buf until it has processed at least total bytes
+static void bench( Scan scan, const DwString & buf, size_t total, const char * what ) {
+  size_t expected = 0;
+  for ( int kernel = kCteKernelScalar - 1 ; kernel <= kCteKernelAvx2 ; ++kernel ) {
+    const bool bytewise = kernel < kCteKernelScalar;
+    if ( !bytewise && DwSetCteKernel( kernel ) != kernel )
+      break;
+    size_t scanned = 0;
+    size_t result = 0;
+    const clock_t start = clock();
+    while ( scanned < total ) {
+      result = scan( buf.data(), buf.length(), bytewise );
+      scanned += scan == sumHeaderEnds ? result : buf.length();
+    }
+    const clock_t elapsed = clock() - start;
+    if ( bytewise )
+      expected = result;
+    else if ( result != expected ) {
+      cerr << what << ": " << kernelNames[kernel] << " differs from the bytewise scan" << endl;
+      exit( 1 );
+    }
+    const double gb = double( scanned ) / ( 1024 * 1024 * 1024 );
+    cout << what << " " << ( bytewise ? "bytewise" : kernelNames[kernel] ) << ": "
+         << gb / ( double( elapsed ) / CLOCKS_PER_SEC ) << " GB/s" << endl;
+  }
+}
+
+int main( int argc, char * argv[] ) {
+
+  if ( argc > 2 ) {
+    cerr << "usage: bench_mboxscan [ <megabytes> ]" << endl;
+    exit( 1 );
+  }
+  const size_t size = size_t( argc == 2 ? atoi( argv[1] ) : 2048 ) * 1024 * 1024;
+
+  srand( 42 );
+  cout << "Kernel in use: " << kernelNames[DwSetCteKernel( kCteKernelAuto )] << endl;
+
+  // Every length around the block sizes of the kernels
+  for ( size_t len = 0 ; len < 200 ; ++len )
+    check( randomMbox( len ), "random" );
+  check( randomMbox( 1024 * 1024 ), "random" );
+
+  // Repeat a few megabytes of messages up to the requested size
+  DwString block;
+  while ( block.length() < 4 * 1024 * 1024 )
+    appendMessage( block );
+  check( block, "mbox" );
+  for ( size_t pos = 0 ; ( pos = DwFindFromLine( block.data(), block.length(), pos ) ) != npos ; ++pos )
+    messageStarts.push_back( pos );
+  DwString mbox;
+  mbox.reserve( size + block.length() );
+  while ( mbox.length() < size )
+    mbox.append( block );
+  cout << "Scanning " << mbox.length() / ( 1024 * 1024 ) << " MB of messages" << endl;
+
+  bench( countFromLines, mbox, mbox.length(), "From_ lines" );
+  bench( sumHeaderEnds, block, mbox.length() / 8, "header ends" );
+
+  return 0;
+}